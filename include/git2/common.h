@@ -143,6 +143,16 @@ typedef enum {
 	GIT_OPT_GET_TEMPLATE_PATH,
 	GIT_OPT_SET_TEMPLATE_PATH,
 	GIT_OPT_SET_SSL_CERT_LOCATIONS,
+	GIT_OPT_ENABLE_PIPELINED_FETCH,
+	GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE,
+	GIT_OPT_SET_DELTA_BASE_CACHE_OBJECT_LIMIT,
+	GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_GET_MWINDOW_FILE_LIMIT,
+	GIT_OPT_SET_MWINDOW_FILE_LIMIT,
+	GIT_OPT_ENABLE_ODB_EXISTS_FILTER,
+	GIT_OPT_SET_GRAPH_CACHE_SIZE,
+	GIT_OPT_GET_GRAPH_CACHE_STATS,
 } git_libgit2_opt_t;
 
 /**
@@ -167,6 +177,17 @@ typedef enum {
  *		>Set the maximum amount of memory that can be mapped at any time
  *		by the library
  *
+ *	* opts(GIT_OPT_GET_MWINDOW_FILE_LIMIT, size_t *):
+ *
+ *		> Get the maximum number of packfiles the library keeps open
+ *
+ *	* opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, size_t):
+ *
+ *		> Set the maximum number of packfiles the library keeps open at
+ *		> any time. When the limit is reached, the least recently used
+ *		> packfile which is not being read is closed, and reopened when
+ *		> it is needed again. The default of 0 means no limit.
+ *
  *	* opts(GIT_OPT_GET_SEARCH_PATH, int level, git_buf *buf)
  *
  *		> Get the search path for a given level of config data.  "level" must
@@ -202,6 +223,8 @@ typedef enum {
  *		> from the cache.  This is a soft limit, in that the library might
  *		> briefly exceed it, but will start aggressively evicting objects
  *		> from cache when that happens.  The default cache size is 256MB.
+ *		> Objects which have only been used once are evicted before
+ *		> those which keep being looked up.
  *
  *	* opts(GIT_OPT_ENABLE_CACHING, int enabled)
  *
@@ -238,6 +261,64 @@ typedef enum {
  *		>
  * 		> Either parameter may be `NULL`, but not both.
  *
+ *	* opts(GIT_OPT_ENABLE_PIPELINED_FETCH, int enabled)
+ *
+ *		> Receive the packfile of a fetch on a thread of its own, so
+ *		> that indexing it does not hold up the network. The progress
+ *		> callbacks are still called from the fetching thread. This
+ *		> has no effect if libgit2 was built without threads.
+ *
+ *	* opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, size_t max_storage_bytes)
+ *
+ *		> Set the maximum size of the delta base cache, which keeps the
+ *		> objects that deltas in packfiles are applied on. The cache is
+ *		> shared by every packfile of the process and has a default size
+ *		> of 96MB. Set it to 0 to disable the cache.
+ *
+ *	* opts(GIT_OPT_SET_DELTA_BASE_CACHE_OBJECT_LIMIT, git_otype type, size_t size)
+ *
+ *		> Set the largest delta base of the given type that will be
+ *		> kept in the delta base cache. The default is 1MB for every
+ *		> type.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, size_t *hits, size_t *misses, size_t *used)
+ *
+ *		> Get the number of lookups in the delta base cache which found
+ *		> a base and which did not, and the bytes currently in the
+ *		> cache.
+ *
+ *	* opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of object cache lookups which found an object
+ *		> and which did not, and the number of objects which have been
+ *		> evicted to keep the cache within its maximum size, summed
+ *		> over all repositories.
+ *
+ *	* opts(GIT_OPT_ENABLE_ODB_EXISTS_FILTER, int enabled)
+ *
+ *		> Let `git_odb_exists` answer lookups of objects which are not
+ *		> in the database from an in-memory filter of the objects it
+ *		> holds, instead of looking for them in every backend. Objects
+ *		> written by other processes are noticed through the stat data
+ *		> of the `pack` directory and of the loose object directory of
+ *		> the object looked up. The filter is only used for object
+ *		> databases whose backends are all on-disk ones. Disabled by
+ *		> default.
+ *
+ *	* opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, size_t entries)
+ *
+ *		> Let each repository remember the merge bases and the
+ *		> ahead/behind counts of up to `entries` pairs of commits, so
+ *		> that `git_merge_base`, `git_graph_descendant_of` and
+ *		> `git_graph_ahead_behind` only walk the history once for each
+ *		> pair. Repositories which already have a cache keep its size.
+ *		> 0, the default, disables the cache.
+ *
+ *	* opts(GIT_OPT_GET_GRAPH_CACHE_STATS, size_t *hits, size_t *misses)
+ *
+ *		> Get the number of lookups in the graph cache which found an
+ *		> answer and which did not, summed over all repositories.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
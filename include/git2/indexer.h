@@ -35,6 +35,22 @@ GIT_EXTERN(int) git_indexer_new(
 		git_transfer_progress_cb progress_cb,
 		void *progress_cb_payload);
 
+/**
+ * Set number of threads to spawn when resolving deltas
+ *
+ * By default, libgit2 won't spawn any threads at all;
+ * when set to 0, libgit2 will autodetect the number of
+ * CPUs.
+ *
+ * The progress callback is still only called on the thread
+ * which calls `git_indexer_commit()`.
+ *
+ * @param idx the indexer
+ * @param n Number of threads to spawn
+ * @return number of actual threads to be used
+ */
+GIT_EXTERN(unsigned int) git_indexer_set_threads(git_indexer *idx, unsigned int n);
+
 /**
  * Add data to the indexer
  *
@@ -158,6 +158,62 @@ GIT_EXTERN(int) git_odb_read_header(size_t *len_out, git_otype *type_out, git_od
  */
 GIT_EXTERN(int) git_odb_exists(git_odb *db, const git_oid *id);
 
+/**
+ * Read several objects from the database at once.
+ *
+ * This is faster than reading the objects one by one, as the lookups
+ * are done in id order and the objects are then read in the order in
+ * which they are stored.
+ *
+ * Each object that is found is stored in `out` at the position of its
+ * id and must be freed with `git_odb_object_free`. The position of each
+ * missing object is set to NULL.
+ *
+ * @param out array of `count` pointers where to store the objects
+ * @param db database to search for the objects in.
+ * @param ids the identities of the objects to read.
+ * @param count the number of objects to read.
+ * @return
+ * - 0 if every object was read;
+ * - GIT_ENOTFOUND if some of them are not in the database;
+ * - an error code otherwise, in which case no object is returned.
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb_object **out, git_odb *db, const git_oid *ids, size_t count);
+
+/**
+ * Read the headers of several objects from the database at once.
+ *
+ * The type of each missing object is set to GIT_OBJ_BAD and its
+ * length to 0.
+ *
+ * @param len_out array of `count` lengths
+ * @param type_out array of `count` types
+ * @param db database to search for the objects in.
+ * @param ids the identities of the objects to read.
+ * @param count the number of objects to read.
+ * @return
+ * - 0 if every header was read;
+ * - GIT_ENOTFOUND if some objects are not in the database;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_read_header_many(
+	size_t *len_out, git_otype *type_out,
+	git_odb *db, const git_oid *ids, size_t count);
+
+/**
+ * Determine which of several objects can be found in the database.
+ *
+ * @param out array of `count` ints, each set to 1 if the object at the
+ * same position was found and to 0 otherwise
+ * @param db database to be searched for the objects.
+ * @param ids the objects to search for.
+ * @param count the number of objects to search for.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_exists_many(
+	int *out, git_odb *db, const git_oid *ids, size_t count);
+
 /**
  * Determine if objects can be found in the object database from a short OID.
  *
@@ -171,6 +227,47 @@ GIT_EXTERN(int) git_odb_exists(git_odb *db, const git_oid *id);
 GIT_EXTERN(int) git_odb_exists_prefix(
 	git_oid *out, git_odb *db, const git_oid *short_id, size_t len);
 
+/**
+ * Find the length of the shortest abbreviation of an object id which
+ * does not match any other object in the database.
+ *
+ * This compares the id with its closest neighbours in every index and
+ * loose object directory at once, rather than looking up longer and
+ * longer prefixes of it.
+ *
+ * @param out the number of hex digits needed
+ * @param db the database to search for the object in.
+ * @param id the id of the object.
+ * @param min_len the shortest abbreviation to return; it is raised to
+ * `GIT_OID_MINPREFIXLEN` if it is smaller.
+ * @return 0, GIT_ENOTFOUND if the object is not in the database, or
+ * an error code.
+ */
+GIT_EXTERN(int) git_odb_unique_prefix_len(
+	size_t *out, git_odb *db, const git_oid *id, size_t min_len);
+
+/**
+ * Find the length of the shortest unique abbreviation of several object
+ * ids at once. See `git_odb_unique_prefix_len`.
+ *
+ * @param out array of `count` lengths; the length of an object which
+ * is not in the database is set to 0
+ * @param db the database to search for the objects in.
+ * @param ids the ids of the objects.
+ * @param count the number of objects.
+ * @param min_len the shortest abbreviation to return.
+ * @return
+ * - 0 if every object was found;
+ * - GIT_ENOTFOUND if some objects are not in the database;
+ * - an error code otherwise.
+ */
+GIT_EXTERN(int) git_odb_unique_prefix_len_many(
+	size_t *out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	size_t min_len);
+
 /**
  * Refresh the object database to load newly added files.
  *
@@ -281,6 +378,12 @@ GIT_EXTERN(int) git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stre
  * Read from an odb stream
  *
  * Most backends don't implement streaming reads
+ *
+ * @param stream the stream
+ * @param buffer the buffer to read into
+ * @param len the buffer's length
+ * @return the number of bytes read, 0 at the end of the object, or an
+ *         error code
  */
 GIT_EXTERN(int) git_odb_stream_read(git_odb_stream *stream, char *buffer, size_t len);
 
@@ -296,6 +399,9 @@ GIT_EXTERN(void) git_odb_stream_free(git_odb_stream *stream);
  *
  * Note that most backends do *not* support streaming reads
  * because they store their objects as compressed/delta'ed blobs.
+ * The packfile backend does, and only keeps a bounded part of the
+ * object in memory while it is read, even for deltified objects.
+ * The size of the object is in the stream's `declared_size`.
  *
  * It's recommended to use `git_odb_read` instead, which is
  * assured to work on all backends.
@@ -341,6 +447,66 @@ GIT_EXTERN(int) git_odb_write_pack(
 	git_transfer_progress_cb progress_cb,
 	void *progress_payload);
 
+/**
+ * Write a `multi-pack-index` file from all the `.pack` files in the ODB.
+ *
+ * If the ODB layer understands pack files, then this will create a file
+ * called `multi-pack-index` next to the `.pack` and `.idx` files, which
+ * will contain an index of all objects stored in `.pack` files. This will
+ * allow for O(log n) lookup for n objects (regardless of how many packfiles
+ * there exist), instead of having to search through every pack.
+ *
+ * @param db object database where the `multi-pack-index` file will be written.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_write_multi_pack_index(
+	git_odb *db);
+
+/**
+ * Start a bulk write into the ODB.
+ *
+ * Until the bulk write is committed or freed, every object written to
+ * the ODB with `git_odb_write` or `git_odb_open_wstream` is appended to a
+ * single new packfile, instead of being stored as a loose object. The
+ * objects can be read back as soon as they have been written. An object
+ * written while a write stream is open is stored as a loose object.
+ *
+ * The index of the packfile is only written by `git_odb_bulk_commit`;
+ * freeing the bulk write without committing it removes the objects
+ * written since it started.
+ *
+ * Only one bulk write may be in progress on an ODB at a time, and the
+ * ODB must not be used from other threads while the bulk write is
+ * started, committed or freed.
+ *
+ * @param out pointer where to store the bulk write
+ * @param db object database to write to; it must have a pack directory
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_bulk_begin(git_odb_bulk **out, git_odb *db);
+
+/**
+ * Commit a bulk write.
+ *
+ * Writes the index of the packfile holding the objects written during
+ * the bulk write, and moves both into the pack directory of the ODB. If
+ * no objects were written, no packfile is created. On failure, the bulk
+ * write is aborted.
+ *
+ * The bulk write must still be freed with `git_odb_bulk_free`.
+ *
+ * @param bulk the bulk write to commit
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_bulk_commit(git_odb_bulk *bulk);
+
+/**
+ * Free a bulk write, aborting it if it hasn't been committed.
+ *
+ * @param bulk the bulk write to free
+ */
+GIT_EXTERN(void) git_odb_bulk_free(git_odb_bulk *bulk);
+
 /**
  * Determine the object-ID (sha1 hash) of a data buffer
  *
@@ -153,6 +153,9 @@ GIT_EXTERN(int) git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 /**
  * Write the new pack and corresponding index file to path.
  *
+ * If bitmaps have been enabled with `git_packbuilder_set_bitmap_options`
+ * the `.bitmap` file is written as well.
+ *
  * @param pb The packbuilder
  * @param path to the directory where the packfile and index should be stored
  * @param mode permissions to use creating a packfile or 0 for defaults
@@ -168,6 +171,66 @@ GIT_EXTERN(int) git_packbuilder_write(
 	git_transfer_progress_cb progress_cb,
 	void *progress_cb_payload);
 
+/**
+ * Options for choosing the commits which get a reachability bitmap
+ *
+ * Bitmaps are written for the most recent reference tips in the pack
+ * and for a sample of the rest of history. That sample gets sparser the
+ * older the commits are: going from the newest commit to the oldest, the
+ * first two bitmapped commits are `history_span` commits apart, and each
+ * following gap is twice as large as the previous one, up to
+ * `max_history_span`.
+ *
+ * Initialize with `GIT_PACKBUILDER_BITMAP_OPTIONS_INIT`. Alternatively,
+ * you can use `git_packbuilder_init_bitmap_options`.
+ */
+typedef struct {
+	unsigned int version;
+
+	/** The number of most recent reference tips to bitmap (default: 100) */
+	unsigned int ref_tips;
+
+	/** The first gap between bitmapped commits, or 0 to only bitmap reference tips (default: 100) */
+	unsigned int history_span;
+
+	/** The largest gap between bitmapped commits (default: 5000) */
+	unsigned int max_history_span;
+} git_packbuilder_bitmap_options;
+
+#define GIT_PACKBUILDER_BITMAP_OPTIONS_VERSION 1
+#define GIT_PACKBUILDER_BITMAP_OPTIONS_INIT { \
+	GIT_PACKBUILDER_BITMAP_OPTIONS_VERSION, 100, 100, 5000 }
+
+/**
+ * Initializes a `git_packbuilder_bitmap_options` with default values.
+ * Equivalent to creating an instance with
+ * `GIT_PACKBUILDER_BITMAP_OPTIONS_INIT`.
+ *
+ * @param opts the `git_packbuilder_bitmap_options` instance to initialize.
+ * @param version the version of the struct; you should pass
+ *        `GIT_PACKBUILDER_BITMAP_OPTIONS_VERSION` here.
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_packbuilder_init_bitmap_options(
+	git_packbuilder_bitmap_options *opts,
+	unsigned int version);
+
+/**
+ * Write a reachability bitmap index along with the pack
+ *
+ * When enabled, `git_packbuilder_write` also writes a `.bitmap` file
+ * next to the pack and its index. This lets the pack be used to count
+ * the objects to send without walking all of their trees.
+ *
+ * @param pb The packbuilder
+ * @param opts the options for choosing the bitmapped commits, or NULL
+ *        to stop writing a bitmap index (the default)
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_bitmap_options(
+	git_packbuilder *pb,
+	const git_packbuilder_bitmap_options *opts);
+
 /**
 * Get the packfile's hash
 *
@@ -165,6 +165,117 @@ GIT_EXTERN(const char *) git_reflog_entry_message(const git_reflog_entry *entry)
  */
 GIT_EXTERN(void) git_reflog_free(git_reflog *reflog);
 
+/**
+ * Create an iterator over the reflog of the given reference
+ *
+ * Unlike `git_reflog_read()`, the entries are only parsed as they are
+ * asked for, starting from the most recent one, so looking at the last
+ * few entries of a long reflog does not need to read all of it.
+ *
+ * There are no entries if the reference has no reflog.
+ *
+ * @param out pointer in which to store the iterator
+ * @param repo the repository
+ * @param name reference whose reflog to iterate over
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_reflog_iterator_new(
+	git_reflog_iterator **out,
+	git_repository *repo,
+	const char *name);
+
+/**
+ * Get the next entry of the reflog, going from the most recent one to
+ * the oldest
+ *
+ * The entry belongs to the iterator and is valid until the iterator is
+ * used again or freed.
+ *
+ * @param out pointer in which to store the entry
+ * @param iter the iterator
+ * @return 0, GIT_ITEROVER if there are no more entries or an error code
+ */
+GIT_EXTERN(int) git_reflog_iterator_next(
+	const git_reflog_entry **out,
+	git_reflog_iterator *iter);
+
+/**
+ * Get an entry of the reflog by its index
+ *
+ * Only the requested entry is parsed; 0 is the most recent entry. The
+ * next call to `git_reflog_iterator_next()` returns the entry after it.
+ *
+ * The entry belongs to the iterator and is valid until the iterator is
+ * used again or freed.
+ *
+ * @param out pointer in which to store the entry
+ * @param iter the iterator
+ * @param idx the position of the entry to lookup
+ * @return 0, GIT_ENOTFOUND if there is no such entry or an error code
+ */
+GIT_EXTERN(int) git_reflog_iterator_entry_byindex(
+	const git_reflog_entry **out,
+	git_reflog_iterator *iter,
+	size_t idx);
+
+/**
+ * Free the reflog iterator
+ *
+ * @param iter the iterator to free
+ */
+GIT_EXTERN(void) git_reflog_iterator_free(git_reflog_iterator *iter);
+
+/**
+ * Which entries `git_reflog_expire()` removes
+ *
+ * Entries are removed if they are past `max_entries` or older than
+ * `expire_time`; leaving either at zero disables it.
+ */
+typedef struct {
+	unsigned int version;
+
+	/** The number of most recent entries to keep */
+	size_t max_entries;
+
+	/** Entries with an earlier time are removed */
+	git_time_t expire_time;
+} git_reflog_expire_options;
+
+#define GIT_REFLOG_EXPIRE_OPTIONS_VERSION 1
+#define GIT_REFLOG_EXPIRE_OPTIONS_INIT {GIT_REFLOG_EXPIRE_OPTIONS_VERSION}
+
+/**
+ * Initializes a `git_reflog_expire_options` with default values. Equivalent
+ * to creating an instance with GIT_REFLOG_EXPIRE_OPTIONS_INIT.
+ *
+ * @param opts the `git_reflog_expire_options` struct to initialize
+ * @param version Version of struct; pass `GIT_REFLOG_EXPIRE_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_reflog_expire_init_options(
+	git_reflog_expire_options *opts,
+	unsigned int version);
+
+/**
+ * Remove old entries from the reflog of a reference
+ *
+ * The entries which are kept are left as they are; the filesystem
+ * backend copies their lines over without parsing them, and once
+ * `max_entries` entries are kept, it only counts the older lines.
+ *
+ * @param removed pointer in which to store the number of removed
+ *        entries, or NULL
+ * @param repo the repository
+ * @param name reference whose reflog to expire
+ * @param opts which entries to remove
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_reflog_expire(
+	size_t *removed,
+	git_repository *repo,
+	const char *name,
+	const git_reflog_expire_options *opts);
+
 /** @} */
 GIT_END_DECL
 #endif
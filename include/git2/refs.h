@@ -504,6 +504,25 @@ GIT_EXTERN(int) git_reference_iterator_glob_new(
 	git_repository *repo,
 	const char *glob);
 
+/**
+ * Create an iterator for the repo's references whose names start
+ * with the given prefix
+ *
+ * Unlike a glob, the prefix does not have to be matched against every
+ * reference: only the references with the prefix are looked at, which
+ * makes listing e.g. `refs/heads/` cheap in a repository with many
+ * other references.
+ *
+ * @param out pointer in which to store the iterator
+ * @param repo the repository
+ * @param prefix the start of the names of the references to list
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_reference_iterator_prefix_new(
+	git_reference_iterator **out,
+	git_repository *repo,
+	const char *prefix);
+
 /**
  * Get the next reference
  *
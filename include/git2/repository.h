@@ -749,6 +749,76 @@ GIT_EXTERN(int) git_repository_ident(const char **name, const char **email, cons
  */
 GIT_EXTERN(int) git_repository_set_ident(git_repository *repo, const char *name, const char *email);
 
+/**
+ * Option flags for `git_repository_repack`
+ *
+ * * SKIP_LOOSE - Leave the loose objects alone, only merge packs.
+ */
+typedef enum {
+	GIT_REPOSITORY_REPACK_SKIP_LOOSE = (1u << 0),
+} git_repository_repack_flag_t;
+
+/**
+ * Options for `git_repository_repack`
+ *
+ * Initialize with `GIT_REPOSITORY_REPACK_OPTIONS_INIT`. Alternatively,
+ * you can use `git_repository_repack_init_options`.
+ */
+typedef struct {
+	unsigned int version;
+
+	/**
+	 * Packs are merged until each of them holds at least this many
+	 * times as many objects as the next smaller one (default: 2)
+	 */
+	unsigned int geometric_factor;
+
+	/** Combination of `git_repository_repack_flag_t` values */
+	unsigned int flags;
+
+	/** Called with the progress of writing the new pack (optional) */
+	git_transfer_progress_cb progress_cb;
+	void *progress_payload;
+} git_repository_repack_options;
+
+#define GIT_REPOSITORY_REPACK_OPTIONS_VERSION 1
+#define GIT_REPOSITORY_REPACK_OPTIONS_INIT {GIT_REPOSITORY_REPACK_OPTIONS_VERSION, 2}
+
+/**
+ * Initializes a `git_repository_repack_options` with default values.
+ * Equivalent to creating an instance with GIT_REPOSITORY_REPACK_OPTIONS_INIT.
+ *
+ * @param opts the `git_repository_repack_options` struct to initialize
+ * @param version Version of struct; pass `GIT_REPOSITORY_REPACK_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_repository_repack_init_options(
+	git_repository_repack_options *opts,
+	unsigned int version);
+
+/**
+ * Consolidate the packfiles and loose objects of a repository
+ *
+ * The packs are sorted by the number of objects they hold, and the
+ * smallest ones are written into a single new pack together with the
+ * loose objects, so that the sizes of the remaining packs form a
+ * geometric progression. This keeps the number of packs logarithmic in
+ * the number of objects, while each repack only rewrites about as much
+ * data as was added since the previous one: large packs are left alone
+ * until enough small ones have accumulated to match them.
+ *
+ * Packs with a `.keep` file are never rewritten. The packs and loose
+ * objects which were merged are removed once the new pack and its index
+ * are in place, and an existing `multi-pack-index` is rewritten.
+ *
+ * @param repo the repository to repack
+ * @param opts the options, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_repack(
+	git_repository *repo,
+	const git_repository_repack_options *opts);
+
 /** @} */
 GIT_END_DECL
 #endif
@@ -21,6 +21,37 @@
  */
 GIT_BEGIN_DECL
 
+/**
+ * What a batched lookup through `read_many` has to find out about
+ * each object
+ */
+typedef enum {
+	GIT_ODB_BATCH_EXISTS = 0, /**< only whether it exists */
+	GIT_ODB_BATCH_HEADER = 1, /**< its type and size */
+	GIT_ODB_BATCH_READ = 2,   /**< its type, size and contents */
+} git_odb_batch_t;
+
+/**
+ * An object in a batched lookup
+ */
+typedef struct {
+	/** The id of the object, set by the caller */
+	git_oid id;
+
+	/** Set to 1 by the backend which finds the object */
+	int found;
+
+	/** The type and size of the object, unless looking up existence */
+	git_otype type;
+	size_t len;
+
+	/**
+	 * The contents of the object, when reading. This has to be
+	 * allocated with `git_odb_backend_malloc`.
+	 */
+	void *data;
+} git_odb_batch_entry;
+
 /**
  * An instance for a custom backend
  */
@@ -83,6 +114,38 @@ struct git_odb_backend {
 		git_odb_writepack **, git_odb_backend *, git_odb *odb,
 		git_transfer_progress_cb progress_cb, void *progress_payload);
 
+	/**
+	 * If the backend supports pack files, this will create a
+	 * `multi-pack-index` file which will contain an index of all objects
+	 * across all the `.pack` files.
+	 */
+	int (* writemidx)(git_odb_backend *);
+
+	/**
+	 * Look up a batch of objects at once. The entries are sorted by
+	 * id; those which are already marked as found have been found
+	 * by another backend and must be left alone. Objects which the
+	 * backend does not have are left unmarked rather than being an
+	 * error.
+	 *
+	 * Backends which don't implement this are asked about each
+	 * object in turn through `read`, `read_header` or `exists`.
+	 */
+	int (* read_many)(
+		git_odb_backend *, git_odb_batch_entry *, size_t, git_odb_batch_t);
+
+	/**
+	 * Find how many hex digits of each of a batch of ids are needed
+	 * to tell it apart from every other object in the backend, and
+	 * raise the matching entry of the lengths to that if it is
+	 * larger. The ids need not be in the backend themselves.
+	 *
+	 * Backends which don't implement this are asked about longer and
+	 * longer prefixes of each id through `exists_prefix`.
+	 */
+	int (* unique_prefix_len)(
+		size_t *, git_odb_backend *, const git_oid *, size_t);
+
 	void (* free)(git_odb_backend *);
 };
 
@@ -10,6 +10,7 @@
 #include "git2/common.h"
 #include "git2/types.h"
 #include "git2/oid.h"
+#include "git2/reflog.h"
 
 /**
  * @file git2/refdb_backend.h
@@ -56,6 +57,34 @@ struct git_reference_iterator {
 		git_reference_iterator *iter);
 };
 
+/**
+ * Every backend's reflog iterator must have a `git_reflog_iterator` as
+ * its first element, like reference iterators do.
+ */
+struct git_reflog_iterator {
+	/**
+	 * Return the next entry, going back from the most recent one.
+	 */
+	int (*next)(
+		const git_reflog_entry **entry,
+		git_reflog_iterator *iter);
+
+	/**
+	 * Return the entry at the given position, 0 being the most recent
+	 * one, and continue after it.
+	 */
+	int (*entry_byindex)(
+		const git_reflog_entry **entry,
+		git_reflog_iterator *iter,
+		size_t idx);
+
+	/**
+	 * Free the iterator
+	 */
+	void (*free)(
+		git_reflog_iterator *iter);
+};
+
 /** An instance for a custom backend */
 struct git_refdb_backend {
 	unsigned int version;
@@ -155,17 +184,71 @@ struct git_refdb_backend {
 	int (*reflog_delete)(git_refdb_backend *backend, const char *name);
 
 	/**
-	 * Lock a reference. The opaque parameter will be passed to the unlock function
+	 * Lock a reference. The opaque parameter will be passed to the unlock function.
+	 * If the backend provides `transaction_begin`, `*payload_out` holds the
+	 * batch of the transaction which locks the reference on entry.
 	 */
 	int (*lock)(void **payload_out, git_refdb_backend *backend, const char *refname);
 
 	/**
 	 * Unlock a reference. Only one of target or symbolic_target
 	 * will be set. success indicates whether to update the
-	 * reference or discard the lock (if it's false)
+	 * reference or discard the lock (if it's false). It is 2 to
+	 * delete the reference, and 3 to write a direct reference into
+	 * the backend's packed storage, which backends without one
+	 * treat like an update.
 	 */
 	int (*unlock)(git_refdb_backend *backend, void *payload, int success, int update_reflog,
 		      const git_reference *ref, const git_signature *sig, const char *message);
+
+	/**
+	 * Allocate an iterator over a reflog, newest entry first. A refdb
+	 * implementation may provide this function; if it is not provided,
+	 * the whole reflog is read with `reflog_read`.
+	 */
+	int (*reflog_iterator)(
+		git_reflog_iterator **iter,
+		git_refdb_backend *backend,
+		const char *name);
+
+	/**
+	 * Remove old entries from a reflog. A refdb implementation may
+	 * provide this function; if it is not provided, the reflog is read
+	 * and written back with `reflog_read` and `reflog_write`.
+	 */
+	int (*reflog_expire)(
+		size_t *removed,
+		git_refdb_backend *backend,
+		const char *name,
+		const git_reflog_expire_options *opts);
+
+	/**
+	 * Start a batch for the updates of a transaction. A refdb
+	 * implementation may provide this function, along with
+	 * `transaction_commit` and `transaction_free`; the transaction then
+	 * passes the batch to `lock`, and its updates are applied by
+	 * `transaction_commit` rather than when the references are unlocked.
+	 */
+	int (*transaction_begin)(void **batch_out, git_refdb_backend *backend);
+
+	/**
+	 * Write a reflog as part of a transaction's batch. A refdb
+	 * implementation may provide this function; if it is not provided,
+	 * the reflog is written with `reflog_write`.
+	 */
+	int (*transaction_reflog_write)(git_refdb_backend *backend, void *batch, git_reflog *reflog);
+
+	/**
+	 * Apply the updates of a batch once all of its references are
+	 * unlocked.
+	 */
+	int (*transaction_commit)(git_refdb_backend *backend, void *batch);
+
+	/**
+	 * Free a batch, dropping the updates which were not applied and
+	 * releasing their locks.
+	 */
+	void (*transaction_free)(git_refdb_backend *backend, void *batch);
 };
 
 #define GIT_REFDB_BACKEND_VERSION 1
@@ -198,6 +281,27 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructor for a refdb backend which stores the references and
+ * their logs in a stack of reftables in `$GIT_DIR/reftable`
+ *
+ * Every update adds a small table to the stack, and the stack is
+ * compacted so that it holds a logarithmic number of tables. All the
+ * updates of a `git_transaction` are written as a single table, so
+ * they are applied atomically. A transaction locks the whole stack from
+ * its first reference until it is committed or freed; the updates made
+ * outside of it meanwhile fail with `GIT_ELOCKED`.
+ *
+ * The backend is not used unless it is set with `git_refdb_set_backend`.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
@@ -86,11 +86,29 @@ GIT_EXTERN(int) git_transaction_set_reflog(git_transaction *tx, const char *refn
  */
 GIT_EXTERN(int) git_transaction_remove(git_transaction *tx, const char *refname);
 
+/**
+ * Write the references directly into packed storage
+ *
+ * When enabled, the direct references which the transaction updates are
+ * written into the backend's packed storage (`packed-refs` for the
+ * filesystem backend) instead of as loose references, along with the
+ * deletions, when the transaction is committed. Symbolic references and
+ * backends without packed storage are not affected.
+ *
+ * @param tx the transaction
+ * @param packed whether to write the references packed
+ * @return 0
+ */
+GIT_EXTERN(int) git_transaction_set_packed(git_transaction *tx, int packed);
+
 /**
  * Commit the changes from the transaction
  *
  * Perform the changes that have been queued. The updates will be made
- * one by one, and the first failure will stop the processing.
+ * one by one, and the first failure will stop the processing. A backend
+ * may hold the updates back until the last reference is unlocked and
+ * apply them together; the filesystem backend rewrites `packed-refs`
+ * once for all of them and appends to each reflog once.
  *
  * @param tx the transaction
  * @return 0 or an error code
@@ -92,6 +92,15 @@ typedef struct git_odb_stream git_odb_stream;
 /** A stream to write a packfile to the ODB */
 typedef struct git_odb_writepack git_odb_writepack;
 
+/** A bulk write of objects into a single packfile of the ODB */
+typedef struct git_odb_bulk git_odb_bulk;
+
+/** a writer for multi-pack-index files. */
+typedef struct git_midx_writer git_midx_writer;
+
+/** a writer for commit-graph files. */
+typedef struct git_commit_graph_writer git_commit_graph_writer;
+
 /** An open refs database handle. */
 typedef struct git_refdb git_refdb;
 
@@ -146,6 +155,9 @@ typedef struct git_reflog_entry git_reflog_entry;
 /** Representation of a reference log */
 typedef struct git_reflog git_reflog;
 
+/** Iterator over the entries of a reference log, newest first */
+typedef struct git_reflog_iterator git_reflog_iterator;
+
 /** Representation of a git note */
 typedef struct git_note git_note;
 
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bloom.h"
+
+#define BLOOM_BITS_PER_OBJECT 10
+#define BLOOM_HASHES 7
+#define BLOOM_MIN_BITS 1024
+
+int git_bloom_init(git_bloom *bloom, size_t capacity)
+{
+	size_t nbits = BLOOM_MIN_BITS;
+
+	memset(bloom, 0, sizeof(git_bloom));
+
+	while (nbits / BLOOM_BITS_PER_OBJECT < capacity) {
+		if (nbits > SIZE_MAX / 2) {
+			giterr_set_oom();
+			return -1;
+		}
+
+		nbits *= 2;
+	}
+
+	bloom->bits = git__calloc(nbits / 32, sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(bloom->bits);
+
+	bloom->mask = nbits - 1;
+	bloom->capacity = nbits / BLOOM_BITS_PER_OBJECT;
+	return 0;
+}
+
+GIT_INLINE(uint32_t) oid_word(const git_oid *id, size_t n)
+{
+	const unsigned char *p = &id->id[n * 4];
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/*
+ * The bits of an id are h1 + i * h2 for each of the hashes (the double
+ * hashing of Kirsch and Mitzenmacher); h2 is odd so that the positions
+ * differ from each other.
+ */
+#define BLOOM_FOREACH_BIT(bloom, id, pos, i) \
+	for (i = 0, pos = oid_word(id, 1); \
+		i < BLOOM_HASHES; \
+		i++, pos += (oid_word(id, 2) | 1))
+
+void git_bloom_add(git_bloom *bloom, const git_oid *id)
+{
+	size_t i, bit;
+	uint32_t pos;
+
+	assert(bloom->bits);
+
+	BLOOM_FOREACH_BIT(bloom, id, pos, i) {
+		bit = pos & bloom->mask;
+		bloom->bits[bit / 32] |= (1u << (bit % 32));
+	}
+
+	bloom->count++;
+}
+
+bool git_bloom_may_contain(const git_bloom *bloom, const git_oid *id)
+{
+	size_t i, bit;
+	uint32_t pos;
+
+	if (!bloom->bits)
+		return true;
+
+	BLOOM_FOREACH_BIT(bloom, id, pos, i) {
+		bit = pos & bloom->mask;
+		if ((bloom->bits[bit / 32] & (1u << (bit % 32))) == 0)
+			return false;
+	}
+
+	return true;
+}
+
+void git_bloom_free(git_bloom *bloom)
+{
+	git__free(bloom->bits);
+	memset(bloom, 0, sizeof(git_bloom));
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bloom_h__
+#define INCLUDE_bloom_h__
+
+#include "common.h"
+#include "git2/oid.h"
+
+/*
+ * A Bloom filter over object ids. Object ids are already uniformly
+ * distributed, so the bits to set are taken straight from the id rather
+ * than from a separate hash. With ten bits per object the filter claims
+ * to contain an object it doesn't contain about 1% of the time, and it
+ * never misses an object which was added to it.
+ */
+typedef struct {
+	uint32_t *bits;
+	size_t mask; /* number of bits - 1; the number of bits is a power of two */
+	size_t count;
+	size_t capacity;
+} git_bloom;
+
+int git_bloom_init(git_bloom *bloom, size_t capacity);
+
+void git_bloom_add(git_bloom *bloom, const git_oid *id);
+
+/* Whether `id` may have been added; false means it definitely wasn't */
+bool git_bloom_may_contain(const git_bloom *bloom, const git_oid *id);
+
+void git_bloom_free(git_bloom *bloom);
+
+#endif
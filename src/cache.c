@@ -20,6 +20,11 @@ GIT__USE_OIDMAP
 bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
+git_atomic_ssize git_cache__hits = {0};
+git_atomic_ssize git_cache__misses = {0};
+git_atomic_ssize git_cache__evictions = {0};
+
+static git_atomic_ssize cache_shard_storage[GIT_CACHE_SHARDS];
 
 static size_t git_cache__max_object_size[8] = {
 	0,     /* GIT_OBJ__EXT1 */
@@ -46,99 +51,221 @@ int git_cache_set_max_object_size(git_otype type, size_t size)
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
+	size_t i;
 
-	if (kh_size(cache->map) == 0)
+	if (git_cache_size(cache) == 0)
 		return;
 
-	printf("Cache %p: %d items cached, %d bytes\n",
-		cache, kh_size(cache->map), (int)cache->used_memory);
-
-	kh_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%d)\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			(int)object->size
-		);
-	});
+	printf("Cache %p: %d items cached\n", cache, (int)git_cache_size(cache));
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		printf("Shard %d: %d bytes\n", (int)i, (int)shard->used_memory);
+
+		kh_foreach_value(shard->map, object, {
+			char oid_str[9];
+			printf(" %s%c%c %s (%d)\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				object->lru_segment == GIT_CACHE_LRU_PROTECTED ? '+' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				(int)object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
-	cache->map = git_oidmap_alloc();
-	if (git_rwlock_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize cache rwlock");
-		return -1;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		if ((shard->map = git_oidmap_alloc()) == NULL) {
+			giterr_set_oom();
+			goto on_error;
+		}
+
+		shard->storage = &cache_shard_storage[i];
+
+		if (git_mutex_init(&shard->lock)) {
+			giterr_set(GITERR_OS, "Failed to initialize cache mutex");
+			git_oidmap_free(shard->map);
+			goto on_error;
+		}
 	}
+
 	return 0;
+
+on_error:
+	/* the shards before this one are empty, and only need freeing */
+	while (i-- > 0) {
+		git_oidmap_free(cache->shards[i].map);
+		git_mutex_free(&cache->shards[i].lock);
+	}
+
+	git__memzero(cache, sizeof(*cache));
+	return -1;
+}
+
+GIT_INLINE(git_cache_shard *) cache_shard(git_cache *cache, const git_oid *oid)
+{
+	return &cache->shards[oid->id[0] % GIT_CACHE_SHARDS];
+}
+
+/* called with lock */
+static void lru_unlink(git_cache_shard *shard, git_cached_obj *entry)
+{
+	git_cache_lru *lru = &shard->segments[entry->lru_segment];
+
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		lru->head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		lru->tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+	lru->memory -= entry->size;
+}
+
+/* called with lock */
+static void lru_push(git_cache_shard *shard, git_cached_obj *entry, int segment)
+{
+	git_cache_lru *lru = &shard->segments[segment];
+
+	entry->lru_segment = segment;
+	entry->lru_prev = NULL;
+	entry->lru_next = lru->head;
+
+	if (lru->head)
+		lru->head->lru_prev = entry;
+	else
+		lru->tail = entry;
+
+	lru->head = entry;
+	lru->memory += entry->size;
+}
+
+/*
+ * Called with lock. The entry has been used again, so it moves to the
+ * front of the protected segment. When that segment grows past its
+ * share of the shard, its least recently used entries go back on
+ * probation, where they get another chance before being evicted.
+ */
+static void lru_promote(git_cache_shard *shard, git_cached_obj *entry)
+{
+	git_cache_lru *protected = &shard->segments[GIT_CACHE_LRU_PROTECTED];
+
+	lru_unlink(shard, entry);
+	lru_push(shard, entry, GIT_CACHE_LRU_PROTECTED);
+
+	while (protected->tail != entry &&
+		protected->memory > shard->used_memory / 4 * 3) {
+		git_cached_obj *demote = protected->tail;
+
+		lru_unlink(shard, demote);
+		lru_push(shard, demote, GIT_CACHE_LRU_PROBATION);
+	}
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
 
-	if (kh_size(cache->map) == 0)
+	if (kh_size(shard->map) == 0)
 		return;
 
-	kh_foreach_value(cache->map, evict, {
+	kh_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	kh_clear(oid, cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	kh_clear(oid, shard->map);
+	memset(shard->segments, 0, sizeof(shard->segments));
+
+	git_atomic_ssize_add(shard->storage, -shard->used_memory);
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	clear_cache(cache);
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
 
-	git_rwlock_wrunlock(&cache->lock);
+		clear_shard(shard);
+
+		git_mutex_unlock(&shard->lock);
+	}
 }
 
 void git_cache_free(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_free(cache->shards[i].map);
+		git_mutex_free(&cache->shards[i].lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
-/* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+/* The memory the same shard of all the caches may use together */
+GIT_INLINE(ssize_t) cache_shard_budget(void)
 {
-	uint32_t seed = rand();
-	size_t evict_count = 8;
-	ssize_t evicted_memory = 0;
+	return git_cache__max_storage / GIT_CACHE_SHARDS;
+}
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > kh_size(cache->map)) {
-		clear_cache(cache);
-		return;
-	}
+/*
+ * Called with lock. Evict the least recently used entries of the shard,
+ * taking those on probation before any protected one, until the shard
+ * is back within its part of the limit or is empty.
+ */
+static void cache_evict_entries(git_cache_shard *shard)
+{
+	ssize_t evicted_memory = 0, evicted_count = 0;
+	ssize_t budget = cache_shard_budget();
 
-	while (evict_count > 0) {
-		khiter_t pos = seed++ % kh_end(cache->map);
+	while (shard->storage->val - evicted_memory > budget) {
+		git_cached_obj *evict = shard->segments[GIT_CACHE_LRU_PROBATION].tail;
+		khiter_t pos;
 
-		if (kh_exist(cache->map, pos)) {
-			git_cached_obj *evict = kh_val(cache->map, pos);
+		if (!evict)
+			evict = shard->segments[GIT_CACHE_LRU_PROTECTED].tail;
+		if (!evict)
+			break;
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+		pos = kh_get(oid, shard->map, &evict->oid);
+		assert(pos != kh_end(shard->map));
+		kh_del(oid, shard->map, pos);
 
-			kh_del(oid, cache->map, pos);
-		}
+		lru_unlink(shard, evict);
+
+		evicted_count++;
+		evicted_memory += evict->size;
+		git_cached_obj_decref(evict);
 	}
 
-	cache->used_memory -= evicted_memory;
+	shard->used_memory -= evicted_memory;
+	git_atomic_ssize_add(shard->storage, -evicted_memory);
 	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+	git_atomic_ssize_add(&git_cache__evictions, evicted_count);
 }
 
 static bool cache_should_store(git_otype object_type, size_t object_size)
@@ -149,35 +276,39 @@ static bool cache_should_store(git_otype object_type, size_t object_size)
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
+	git_cache_shard *shard = cache_shard(cache, oid);
 	khiter_t pos;
 	git_cached_obj *entry = NULL;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_mutex_lock(&shard->lock) < 0)
 		return NULL;
 
-	pos = kh_get(oid, cache->map, oid);
-	if (pos != kh_end(cache->map)) {
-		entry = kh_val(cache->map, pos);
+	pos = kh_get(oid, shard->map, oid);
+	if (pos != kh_end(shard->map)) {
+		entry = kh_val(shard->map, pos);
 
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+			lru_promote(shard, entry);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_mutex_unlock(&shard->lock);
 
+	git_atomic_ssize_add(entry ? &git_cache__hits : &git_cache__misses, 1);
 	return entry;
 }
 
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
+	git_cache_shard *shard = cache_shard(cache, &entry->oid);
 	khiter_t pos;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && shard->used_memory > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -185,31 +316,33 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	if (git_mutex_lock(&shard->lock) < 0)
 		return entry;
 
 	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
+	if (shard->storage->val > cache_shard_budget())
+		cache_evict_entries(shard);
 
-	pos = kh_get(oid, cache->map, &entry->oid);
+	pos = kh_get(oid, shard->map, &entry->oid);
 
 	/* not found */
-	if (pos == kh_end(cache->map)) {
+	if (pos == kh_end(shard->map)) {
 		int rval;
 
-		pos = kh_put(oid, cache->map, &entry->oid, &rval);
+		pos = kh_put(oid, shard->map, &entry->oid, &rval);
 		if (rval >= 0) {
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
+			lru_push(shard, entry, GIT_CACHE_LRU_PROBATION);
+			shard->used_memory += entry->size;
+			git_atomic_ssize_add(shard->storage, (ssize_t)entry->size);
 			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
 		}
 	}
 	/* found */
 	else {
-		git_cached_obj *stored_entry = kh_val(cache->map, pos);
+		git_cached_obj *stored_entry = kh_val(shard->map, pos);
 
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
@@ -217,17 +350,22 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			entry->flags == GIT_CACHE_STORE_PARSED) {
+			int segment = stored_entry->lru_segment;
+
+			lru_unlink(shard, stored_entry);
+			lru_push(shard, entry, segment);
+
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+	git_mutex_unlock(&shard->lock);
 	return entry;
 }
 
@@ -20,23 +20,60 @@ enum {
 	GIT_CACHE_STORE_PARSED = 2
 };
 
-typedef struct {
+typedef struct git_cached_obj {
 	git_oid    oid;
 	int16_t    type;  /* git_otype value */
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+
+	/* position in the LRU lists of the shard, guarded by its lock */
+	struct git_cached_obj *lru_prev, *lru_next;
+	int        lru_segment;
 } git_cached_obj;
 
+/*
+ * The cache is split into shards by the first byte of the object id,
+ * each with its own lock. Every shard is a segmented LRU: new entries
+ * start out on probation and are promoted to the protected segment
+ * when they get looked up again, so a scan over objects which are only
+ * used once cannot flush out the ones which are used all the time.
+ *
+ * Each shard gets an equal part of the memory limit, counted over the
+ * same shard of all the caches, and only ever evicts to stay within
+ * its own part.
+ */
+#define GIT_CACHE_SHARDS 16
+
+enum {
+	GIT_CACHE_LRU_PROBATION = 0,
+	GIT_CACHE_LRU_PROTECTED = 1
+};
+
+typedef struct {
+	git_cached_obj *head, *tail;
+	ssize_t memory;
+} git_cache_lru;
+
 typedef struct {
-	git_oidmap *map;
-	git_rwlock  lock;
-	ssize_t     used_memory;
+	git_oidmap   *map;
+	git_mutex     lock;
+	git_cache_lru segments[2];
+	ssize_t       used_memory;
+	/* the memory used by this shard of every cache */
+	git_atomic_ssize *storage;
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
 extern bool git_cache__enabled;
 extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
+extern git_atomic_ssize git_cache__hits;
+extern git_atomic_ssize git_cache__misses;
+extern git_atomic_ssize git_cache__evictions;
 
 int git_cache_set_max_object_size(git_otype type, size_t size);
 
@@ -53,7 +90,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)kh_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += (size_t)kh_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
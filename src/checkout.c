@@ -76,6 +76,7 @@ typedef struct {
 	git_checkout_perfdata perfdata;
 	git_strmap *mkdir_map;
 	git_attr_session attr_session;
+	git_off_t big_file_threshold;
 } checkout_data;
 
 typedef struct {
@@ -1431,7 +1432,8 @@ static void checkout_stream_free(git_writestream *s)
 static int blob_content_to_file(
 	checkout_data *data,
 	struct stat *st,
-	git_blob *blob,
+	git_blob *blob, /* NULL to stream the blob `id` instead */
+	const git_oid *id,
 	const char *path,
 	const char *hint_path,
 	mode_t entry_filemode)
@@ -1480,9 +1482,16 @@ static int blob_content_to_file(
 	writer.fd = fd;
 	writer.open = 1;
 
-	error = git_filter_list_stream_blob(fl, blob, &writer.base);
+	if (blob)
+		error = git_filter_list_stream_blob(fl, blob, &writer.base);
+	else
+		error = git_filter_list__stream_object(fl, data->repo, id, &writer.base);
+
+	assert(error < 0 || writer.open == 0);
 
-	assert(writer.open == 0);
+	/* the stream is left open when streaming the blob failed */
+	if (writer.open)
+		p_close(fd);
 
 	git_filter_list_free(fl);
 
@@ -1667,6 +1676,26 @@ static int checkout_safe_for_update_only(
 	return 0;
 }
 
+/*
+ * Files at least `core.bigFileThreshold` large are streamed from the
+ * object database to the working directory rather than read whole.
+ */
+static bool checkout_is_big_file(checkout_data *data, const git_oid *oid)
+{
+	git_odb *odb;
+	size_t len;
+	git_otype type;
+
+	if (git_repository_odb__weakptr(&odb, data->repo) < 0 ||
+		git_odb_read_header(&len, &type, odb, oid) < 0) {
+		/* looking up the blob will tell what's wrong */
+		giterr_clear();
+		return false;
+	}
+
+	return (git_off_t)len >= data->big_file_threshold;
+}
+
 static int checkout_write_content(
 	checkout_data *data,
 	const git_oid *oid,
@@ -1676,15 +1705,16 @@ static int checkout_write_content(
 	struct stat *st)
 {
 	int error = 0;
-	git_blob *blob;
+	git_blob *blob = NULL;
 
-	if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
+	if (!S_ISLNK(mode) && checkout_is_big_file(data, oid))
+		error = blob_content_to_file(data, st, NULL, oid, full_path, hint_path, mode);
+	else if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
 		return error;
-
-	if (S_ISLNK(mode))
+	else if (S_ISLNK(mode))
 		error = blob_content_to_link(data, st, blob, full_path);
 	else
-		error = blob_content_to_file(data, st, blob, full_path, hint_path, mode);
+		error = blob_content_to_file(data, st, blob, oid, full_path, hint_path, mode);
 
 	git_blob_free(blob);
 
@@ -2298,6 +2328,27 @@ static void checkout_data_clear(checkout_data *data)
 	git_attr_session__free(&data->attr_session);
 }
 
+static int checkout_big_file_threshold(git_off_t *out, git_repository *repo)
+{
+	git_config *cfg;
+	int64_t threshold;
+	int error;
+
+	*out = GIT_CHECKOUT_BIG_FILE_THRESHOLD;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0)
+		return error;
+
+	if ((error = git_config_get_int64(&threshold, cfg, "core.bigfilethreshold")) == 0)
+		*out = (git_off_t)threshold;
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
 static int checkout_data_init(
 	checkout_data *data,
 	git_iterator *target,
@@ -2397,6 +2448,10 @@ static int checkout_data_init(
 			 &data->can_symlink, repo, GIT_CVAR_SYMLINKS)) < 0)
 		goto cleanup;
 
+	if ((error = checkout_big_file_threshold(
+			&data->big_file_threshold, repo)) < 0)
+		goto cleanup;
+
 	if (!data->opts.baseline && !data->opts.baseline_index) {
 		data->opts_free_baseline = true;
 
@@ -12,6 +12,9 @@
 
 #define GIT_CHECKOUT__NOTIFY_CONFLICT_TREE (1u << 12)
 
+/* The default of `core.bigFileThreshold`, as in git */
+#define GIT_CHECKOUT_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+
 /**
  * Update the working directory to match the target iterator.  The
  * expected baseline value can be passed in via the checkout options
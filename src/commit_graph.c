@@ -0,0 +1,972 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "git2/commit.h"
+#include "git2/revwalk.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "odb.h"
+#include "oid.h"
+#include "pack.h"
+#include "sha1_lookup.h"
+#include "vector.h"
+
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+
+#define COMMIT_GRAPH_CHUNK_ENTRY_SIZE 12
+#define COMMIT_GRAPH_COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 16)
+#define COMMIT_GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+typedef git_array_t(size_t) parent_index_array_t;
+typedef git_array_t(git_oid) parent_id_array_t;
+
+struct packed_commit {
+	git_oid sha1;
+	git_oid tree_oid;
+	git_time_t commit_time;
+	parent_id_array_t parents;
+	parent_index_array_t parent_indices;
+};
+
+struct git_commit_graph_writer {
+	/* The path of the objects/info directory. */
+	git_buf objects_info_dir;
+
+	/* The list of packed commits, sorted by id once written. */
+	git_vector commits;
+};
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid;
+
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0 && file->num_commits > 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (chunk_oid_lookup->length != file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = oid++;
+	for (i = 1; i < file->num_commits; ++i, ++oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length != file->num_commits * COMMIT_GRAPH_COMMIT_DATA_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = data + chunk_extra_edge_list->offset;
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+
+	return 0;
+}
+
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	const struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0},
+			chunk_oid_lookup = {0},
+			chunk_commit_data = {0},
+			chunk_extra_edge_list = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((const struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+		hdr->version != COMMIT_GRAPH_VERSION ||
+		hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION)
+		return commit_graph_error("unsupported commit-graph version");
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+	if (hdr->base_graph_files != 0)
+		return commit_graph_error("chained commit-graphs are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset =
+			sizeof(struct git_commit_graph_header) +
+			(1 + hdr->chunks) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+
+	/*
+	 * Unlike the multi-pack-index, the trailing checksum is not verified:
+	 * the file is read every time a repository is opened and can be
+	 * large, and the structure of every chunk is validated below.
+	 */
+	git_oid_fromraw(&file->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_ENTRY_SIZE) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32 |
+				((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		default:
+			/* unknown chunks (e.g. bloom filters) are ignored, as git does */
+			last_chunk = NULL;
+			break;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout)) < 0 ||
+		(error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup)) < 0 ||
+		(error = commit_graph_parse_commit_data(file, data, &chunk_commit_data)) < 0 ||
+		(error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_commit_graph_new(git_commit_graph **cgraph_out, const char *objects_dir, bool open_file)
+{
+	git_commit_graph *cgraph = NULL;
+	int error = 0;
+
+	assert(cgraph_out && objects_dir);
+
+	cgraph = git__calloc(1, sizeof(git_commit_graph));
+	GITERR_CHECK_ALLOC(cgraph);
+
+	if (git_mutex_init(&cgraph->lock)) {
+		giterr_set(GITERR_OS, "Failed to initialize commit-graph mutex");
+		git__free(cgraph);
+		return -1;
+	}
+
+	if ((error = git_buf_joinpath(&cgraph->filename, objects_dir, GIT_COMMIT_GRAPH_FILE)) < 0)
+		goto error;
+
+	if (open_file) {
+		git_futils_filestamp_check(&cgraph->stamp, git_buf_cstr(&cgraph->filename));
+
+		error = git_commit_graph_file_open(&cgraph->file, git_buf_cstr(&cgraph->filename));
+		if (error < 0)
+			goto error;
+		cgraph->checked = 1;
+	}
+
+	*cgraph_out = cgraph;
+	return 0;
+
+error:
+	git_commit_graph_free(cgraph);
+	return error;
+}
+
+int git_commit_graph_file_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid commit-graph file '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_file_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	git_atomic_set(&file->refcount, 1);
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_get_file(git_commit_graph_file **file_out, git_commit_graph *cgraph)
+{
+	git_commit_graph_file *file;
+	int error = 0;
+
+	if (git_mutex_lock(&cgraph->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock commit-graph");
+		return -1;
+	}
+
+	if (!cgraph->checked) {
+		/* We only check once, no matter the result. */
+		cgraph->checked = 1;
+
+		/* Take the stat data first, so a file replaced meanwhile shows up as changed */
+		git_futils_filestamp_check(&cgraph->stamp, git_buf_cstr(&cgraph->filename));
+
+		/* Best effort */
+		error = git_commit_graph_file_open(&cgraph->file, git_buf_cstr(&cgraph->filename));
+	}
+
+	if ((file = cgraph->file) != NULL)
+		git_atomic_inc(&file->refcount);
+	else if (!error)
+		error = GIT_ENOTFOUND;
+
+	git_mutex_unlock(&cgraph->lock);
+
+	if (error < 0)
+		return error;
+
+	*file_out = file;
+	return 0;
+}
+
+void git_commit_graph_refresh(git_commit_graph *cgraph)
+{
+	git_commit_graph_file *old = NULL;
+	int changed;
+
+	if (git_mutex_lock(&cgraph->lock) < 0)
+		return;
+
+	if (cgraph->checked) {
+		changed = git_futils_filestamp_check(
+			&cgraph->stamp, git_buf_cstr(&cgraph->filename));
+
+		/* a file which is still missing hasn't changed */
+		if (changed == GIT_ENOTFOUND)
+			changed = (cgraph->file != NULL);
+
+		if (changed) {
+			old = cgraph->file;
+			cgraph->file = NULL;
+			cgraph->checked = 0;
+		}
+	}
+
+	git_mutex_unlock(&cgraph->lock);
+
+	git_commit_graph_file_free(old);
+}
+
+static int commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	const unsigned char *commit_data;
+
+	assert(e && file);
+
+	if (pos >= file->num_commits) {
+		giterr_set(GITERR_INVALID, "commit index %" PRIuZ " does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	commit_data = file->commit_data + pos * COMMIT_GRAPH_COMMIT_DATA_SIZE;
+	git_oid_cpy(&e->tree_oid, (const git_oid *)commit_data);
+	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ)));
+	e->parent_indices[1] = ntohl(
+			*((uint32_t *)(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t))));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+	e->generation = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t))));
+	e->commit_time = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t))));
+
+	e->commit_time |= (e->generation & UINT64_C(0x3)) << UINT64_C(32);
+	e->generation >>= 2u;
+	if (e->parent_indices[1] & COMMIT_GRAPH_OCTOPUS_EDGES_NEEDED) {
+		const unsigned char *extra_edge_list = file->extra_edge_list;
+		size_t extra_edge_list_pos = e->parent_indices[1] & ~COMMIT_GRAPH_OCTOPUS_EDGES_NEEDED;
+
+		e->extra_parents_index = extra_edge_list_pos;
+		while (extra_edge_list_pos < file->num_extra_edge_list
+				&& (ntohl(*((uint32_t *)(extra_edge_list + extra_edge_list_pos * sizeof(uint32_t))))
+				& COMMIT_GRAPH_LAST_EDGE) == 0) {
+			extra_edge_list_pos++;
+			e->parent_count++;
+		}
+
+		if (extra_edge_list_pos >= file->num_extra_edge_list)
+			return commit_graph_error("unterminated octopus edge list");
+	}
+	git_oid_cpy(&e->sha1, &file->oid_lookup[pos]);
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	assert(e && file && short_oid);
+
+	hi = ntohl(file->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	if (lo < hi)
+		pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+	else
+		pos = -1 - (int)lo;
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = file->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)file->num_commits) {
+			current = file->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)file->num_commits) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len))
+			found = 2;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for commit-graph index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for commit-graph index entry");
+
+	return commit_graph_entry_get_byindex(e, file, pos);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "parent index %" PRIuZ " does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	return commit_graph_entry_get_byindex(
+			parent,
+			file,
+			ntohl(
+				*(uint32_t *)(file->extra_edge_list
+						+ (entry->extra_parents_index + n - 1) * sizeof(uint32_t)))
+			& ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	if (git_atomic_dec(&file->refcount) > 0)
+		return;
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+	git__free(file);
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	if (!cgraph)
+		return;
+
+	git_buf_free(&cgraph->filename);
+	git_commit_graph_file_free(cgraph->file);
+	git_mutex_free(&cgraph->lock);
+	git__free(cgraph);
+}
+
+/***********************************************************
+ *
+ * COMMIT-GRAPH WRITER
+ *
+ ***********************************************************/
+
+static void packed_commit_free(void *p)
+{
+	struct packed_commit *commit = p;
+
+	if (!commit)
+		return;
+
+	git_array_clear(commit->parents);
+	git_array_clear(commit->parent_indices);
+	git__free(commit);
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+
+	return git_oid__cmp(&a->sha1, &b->sha1);
+}
+
+static int packed_commit__oid_cmp(const void *key, const void *b_)
+{
+	const struct packed_commit *b = b_;
+
+	return git_oid__cmp(key, &b->sha1);
+}
+
+static struct packed_commit *packed_commit_new(git_commit *commit)
+{
+	unsigned int i, parentcount = git_commit_parentcount(commit);
+	struct packed_commit *p = git__calloc(1, sizeof(struct packed_commit));
+
+	if (!p)
+		return NULL;
+
+	git_array_init_to_size(p->parents, parentcount);
+	if (parentcount && !p->parents.ptr) {
+		git__free(p);
+		return NULL;
+	}
+
+	git_oid_cpy(&p->sha1, git_commit_id(commit));
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = git_commit_time(commit);
+
+	for (i = 0; i < parentcount; ++i) {
+		git_oid *parent_id = git_array_alloc(p->parents);
+		if (!parent_id) {
+			packed_commit_free(p);
+			return NULL;
+		}
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	return p;
+}
+
+int git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir)
+{
+	git_commit_graph_writer *w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_buf_free(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_free(&w->commits);
+	git_buf_free(&w->objects_info_dir);
+	git__free(w);
+}
+
+int git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk)
+{
+	int error;
+	git_oid id;
+	git_repository *repo = git_revwalk_repository(walk);
+	git_commit *commit;
+	struct packed_commit *packed_commit;
+
+	assert(w && walk);
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = git_commit_lookup(&commit, repo, &id)) < 0)
+			return error;
+
+		packed_commit = packed_commit_new(commit);
+		git_commit_free(commit);
+		GITERR_CHECK_ALLOC(packed_commit);
+
+		if ((error = git_vector_insert(&w->commits, packed_commit)) < 0) {
+			packed_commit_free(packed_commit);
+			return error;
+		}
+	}
+	if (error != GIT_ITEROVER)
+		return error;
+
+	return 0;
+}
+
+static int write_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int write_chunk_header(git_buf *buf, uint32_t chunk_id, git_off_t offset)
+{
+	if (write_be32(buf, chunk_id) < 0 ||
+		write_be32(buf, (uint32_t)((uint64_t)offset >> 32)) < 0)
+		return -1;
+	return write_be32(buf, (uint32_t)((uint64_t)offset & 0xffffffff));
+}
+
+/*
+ * Resolve the parents of every commit into indices of the (sorted) commit
+ * list, failing if any of them is not part of the graph.
+ */
+static int compute_parent_indices(git_vector *commits)
+{
+	struct packed_commit *packed_commit;
+	size_t i, j, pos;
+
+	git_vector_foreach(commits, i, packed_commit) {
+		for (j = 0; j < git_array_size(packed_commit->parents); ++j) {
+			git_oid *parent_id = git_array_get(packed_commit->parents, j);
+			size_t *parent_index;
+
+			if (git_vector_bsearch2(&pos, commits, packed_commit__oid_cmp, parent_id) < 0) {
+				char oid_str[GIT_OID_HEXSZ + 1];
+
+				git_oid_tostr(oid_str, sizeof(oid_str), parent_id);
+				giterr_set(GITERR_ODB,
+					"parent %s of commit is not part of the commit-graph", oid_str);
+				return -1;
+			}
+
+			parent_index = git_array_alloc(packed_commit->parent_indices);
+			GITERR_CHECK_ALLOC(parent_index);
+			*parent_index = pos;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The generation number of a commit is one more than the largest
+ * generation number of its parents, with root commits at generation one.
+ * Walk the graph iteratively so that long histories do not overflow the
+ * stack.
+ */
+static int compute_generations(uint32_t **out, git_vector *commits)
+{
+	git_array_t(size_t) stack = GIT_ARRAY_INIT;
+	uint32_t *generations;
+	size_t i, j, *top;
+	int error = 0;
+
+	generations = git__calloc(git_vector_length(commits) ? git_vector_length(commits) : 1,
+		sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(generations);
+
+	for (i = 0; i < git_vector_length(commits); ++i) {
+		if (generations[i])
+			continue;
+
+		top = git_array_alloc(stack);
+		GITERR_CHECK_ALLOC(top);
+		*top = i;
+
+		while ((top = git_array_last(stack)) != NULL) {
+			struct packed_commit *commit = git_vector_get(commits, *top);
+			uint32_t max_generation = 0;
+			bool parents_done = true;
+
+			for (j = 0; j < git_array_size(commit->parent_indices); ++j) {
+				size_t parent_index = *git_array_get(commit->parent_indices, j);
+
+				if (!generations[parent_index]) {
+					size_t *next = git_array_alloc(stack);
+					if (!next) {
+						error = -1;
+						goto done;
+					}
+					*next = parent_index;
+					parents_done = false;
+				} else if (generations[parent_index] > max_generation) {
+					max_generation = generations[parent_index];
+				}
+			}
+
+			if (!parents_done)
+				continue;
+
+			top = git_array_pop(stack);
+			if (max_generation < GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX)
+				max_generation++;
+			generations[*top] = max_generation;
+		}
+	}
+
+done:
+	git_array_clear(stack);
+	if (error < 0) {
+		git__free(generations);
+		return error;
+	}
+
+	*out = generations;
+	return 0;
+}
+
+static int commit_graph_write(git_buf *out, git_commit_graph_writer *w)
+{
+	int error = 0;
+	size_t i, j, num_commits, extra_edges = 0;
+	struct git_commit_graph_header hdr = {0};
+	uint32_t oid_fanout_count, *generations = NULL;
+	struct packed_commit *packed_commit;
+	git_oid checksum;
+	git_buf oid_lookup = GIT_BUF_INIT,
+		commit_data = GIT_BUF_INIT,
+		extra_edge_list = GIT_BUF_INIT;
+	git_off_t offset;
+
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.base_graph_files = 0;
+
+	git_vector_sort(&w->commits);
+	git_vector_uniq(&w->commits, packed_commit_free);
+	num_commits = git_vector_length(&w->commits);
+
+	if (num_commits >= GIT_COMMIT_GRAPH_MISSING_PARENT) {
+		giterr_set(GITERR_ODB, "too many commits for a commit-graph");
+		return -1;
+	}
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		git_array_clear(packed_commit->parent_indices);
+
+	if ((error = compute_parent_indices(&w->commits)) < 0 ||
+		(error = compute_generations(&generations, &w->commits)) < 0)
+		goto cleanup;
+
+	/* Fill the OID Lookup, Commit Data and Extra Edge List tables. */
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		size_t parentcount = git_array_size(packed_commit->parent_indices);
+		uint32_t word;
+
+		if ((error = git_buf_put(&oid_lookup,
+				(const char *)packed_commit->sha1.id, GIT_OID_RAWSZ)) < 0 ||
+			(error = git_buf_put(&commit_data,
+				(const char *)packed_commit->tree_oid.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+
+		if (parentcount == 0)
+			word = GIT_COMMIT_GRAPH_MISSING_PARENT;
+		else
+			word = (uint32_t)*git_array_get(packed_commit->parent_indices, 0);
+		if ((error = write_be32(&commit_data, word)) < 0)
+			goto cleanup;
+
+		if (parentcount < 2) {
+			word = GIT_COMMIT_GRAPH_MISSING_PARENT;
+		} else if (parentcount == 2) {
+			word = (uint32_t)*git_array_get(packed_commit->parent_indices, 1);
+		} else {
+			word = (uint32_t)extra_edges | COMMIT_GRAPH_OCTOPUS_EDGES_NEEDED;
+			for (j = 1; j < parentcount; ++j) {
+				uint32_t edge = (uint32_t)*git_array_get(packed_commit->parent_indices, j);
+
+				if (j + 1 == parentcount)
+					edge |= COMMIT_GRAPH_LAST_EDGE;
+				if ((error = write_be32(&extra_edge_list, edge)) < 0)
+					goto cleanup;
+				extra_edges++;
+			}
+		}
+		if ((error = write_be32(&commit_data, word)) < 0)
+			goto cleanup;
+
+		word = (generations[i] << 2) |
+			(uint32_t)(((uint64_t)packed_commit->commit_time >> 32) & 0x3);
+		if ((error = write_be32(&commit_data, word)) < 0)
+			goto cleanup;
+		word = (uint32_t)((uint64_t)packed_commit->commit_time & 0xffffffff);
+		if ((error = write_be32(&commit_data, word)) < 0)
+			goto cleanup;
+	}
+
+	/* Write the header. */
+	hdr.chunks = 3;
+	if (git_buf_len(&extra_edge_list) > 0)
+		hdr.chunks++;
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk headers. */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(out, COMMIT_GRAPH_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += 256 * sizeof(uint32_t);
+	if ((error = write_chunk_header(out, COMMIT_GRAPH_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = write_chunk_header(out, COMMIT_GRAPH_COMMIT_DATA_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&commit_data);
+	if (git_buf_len(&extra_edge_list) > 0) {
+		if ((error = write_chunk_header(out, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&extra_edge_list);
+	}
+	if ((error = write_chunk_header(out, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write all the chunks. */
+	oid_fanout_count = 0;
+	for (i = 0; i < 256; i++) {
+		while (oid_fanout_count < num_commits &&
+			((struct packed_commit *)git_vector_get(&w->commits, oid_fanout_count))->sha1.id[0] <= i)
+			oid_fanout_count++;
+
+		if ((error = write_be32(out, oid_fanout_count)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_buf_put(out, oid_lookup.ptr, git_buf_len(&oid_lookup))) < 0 ||
+		(error = git_buf_put(out, commit_data.ptr, git_buf_len(&commit_data))) < 0 ||
+		(error = git_buf_put(out, extra_edge_list.ptr, git_buf_len(&extra_edge_list))) < 0)
+		goto cleanup;
+
+	/* Finalize the checksum and write the trailer. */
+	if ((error = git_hash_buf(&checksum, out->ptr, git_buf_len(out))) < 0)
+		goto cleanup;
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git__free(generations);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&commit_data);
+	git_buf_free(&extra_edge_list);
+	return error;
+}
+
+int git_commit_graph_writer_commit(
+		git_commit_graph_writer *w)
+{
+	int error;
+	git_buf commit_graph = GIT_BUF_INIT, commit_graph_path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+
+	assert(w);
+
+	if ((error = commit_graph_write(&commit_graph, w)) < 0 ||
+		(error = git_buf_joinpath(&commit_graph_path,
+			git_buf_cstr(&w->objects_info_dir), "commit-graph")) < 0)
+		goto cleanup;
+
+	if ((error = git_futils_mkdir(git_buf_cstr(&w->objects_info_dir), NULL,
+			GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0 ||
+		(error = git_filebuf_open(&output, git_buf_cstr(&commit_graph_path),
+			GIT_FILEBUF_DO_NOT_BUFFER, GIT_PACK_FILE_MODE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_write(&output, commit_graph.ptr, git_buf_len(&commit_graph))) < 0) {
+		git_filebuf_cleanup(&output);
+		goto cleanup;
+	}
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_buf_free(&commit_graph);
+	git_buf_free(&commit_graph_path);
+	return error;
+}
+
+int git_commit_graph_writer_dump(
+		git_buf *buffer,
+		git_commit_graph_writer *w)
+{
+	assert(buffer && w);
+
+	git_buf_sanitize(buffer);
+	return commit_graph_write(buffer, w);
+}
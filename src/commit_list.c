@@ -174,14 +174,55 @@ static int commit_quick_parse(
 	return 0;
 }
 
+static int commit_graph_quick_parse(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *file,
+	git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, e->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e->parent_count; ++i) {
+		if (git_commit_graph_entry_parent(&parent, file, e, i) < 0)
+			return commit_error(commit, "commit-graph is corrupted");
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)e->parent_count;
+	commit->time = (uint32_t)e->commit_time;
+	commit->parsed = 1;
+	return 0;
+}
+
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	/* Use the commit-graph, if there is one, to avoid inflating the commit */
+	if (git_odb__get_commit_graph_file(&cgraph_file, walk->odb) == 0) {
+		if (git_commit_graph_entry_find(&e, cgraph_file, &commit->oid, GIT_OID_HEXSZ) == 0) {
+			error = commit_graph_quick_parse(walk, commit, cgraph_file, &e);
+			git_commit_graph_file_free(cgraph_file);
+			return error;
+		}
+
+		git_commit_graph_file_free(cgraph_file);
+		giterr_clear();
+	}
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
@@ -368,31 +368,18 @@ static int find_unique_abbrev_size(
 	const git_oid *oid_in,
 	int abbreviated_size)
 {
-	size_t size = abbreviated_size;
+	size_t size;
 	git_odb *odb;
-	git_oid dummy;
 	int error;
 
 	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0)
 		return error;
 
-	while (size < GIT_OID_HEXSZ) {
-		if ((error = git_odb_exists_prefix(&dummy, odb, oid_in, size)) == 0) {
-			*out = (int) size;
-			return 0;
-		}
-
-		/* If the error wasn't that it's not unique, then it's a proper error */
-		if (error != GIT_EAMBIGUOUS)
-			return error;
-
-		/* Try again with a larger size */
-		size++;
-	}
+	if ((error = git_odb_unique_prefix_len(
+			&size, odb, oid_in, (size_t)abbreviated_size)) < 0)
+		return error;
 
-	/* If we didn't find any shorter prefix, we have to do the whole thing */
-	*out = GIT_OID_HEXSZ;
-	
+	*out = (int) size;
 	return 0;
 }
 
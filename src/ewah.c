@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * A run-length word (RLW) of an EWAH bitmap is laid out as
+ *
+ *	bit  0      : the value of the bits in the run
+ *	bits 1..32  : the number of "clean" words in the run
+ *	bits 33..63 : the number of literal words following the RLW
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_RUNNING_LEN_MASK (((uint64_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LITERAL_BITS 31
+#define RLW_LITERAL_MAX (((uint64_t)1 << RLW_LITERAL_BITS) - 1)
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words)
+{
+	uint64_t *new_words;
+	size_t new_alloc;
+
+	if (words <= bitmap->word_alloc)
+		return 0;
+
+	new_alloc = bitmap->word_alloc ? bitmap->word_alloc : 32;
+	while (new_alloc < words) {
+		if (GIT_MULTIPLY_SIZET_OVERFLOW(&new_alloc, new_alloc, 2)) {
+			giterr_set_oom();
+			return -1;
+		}
+	}
+
+	new_words = git__reallocarray(bitmap->words, new_alloc, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(new_words);
+
+	memset(new_words + bitmap->word_alloc, 0x0,
+		(new_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = new_words;
+	bitmap->word_alloc = new_alloc;
+	return 0;
+}
+
+void git_bitmap_free(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	if (bitmap_grow(bitmap, block + 1) < 0)
+		return -1;
+
+	bitmap->words[block] |= (uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS);
+	return 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, count = min(dst->word_alloc, src->word_alloc);
+
+	for (i = 0; i < count; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] ^= src->words[i];
+
+	return 0;
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		uint64_t word = bitmap->words[i];
+
+		while (word) {
+			word &= word - 1;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int git_bitmap_foreach(
+	const git_bitmap *bitmap,
+	int (*cb)(size_t pos, void *payload),
+	void *payload)
+{
+	size_t i, offset;
+	int error;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		uint64_t word = bitmap->words[i];
+
+		for (offset = 0; word; offset++, word >>= 1) {
+			if ((word & 1) == 0)
+				continue;
+
+			if ((error = cb(i * GIT_BITMAP_WORD_BITS + offset, payload)) != 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+GIT_INLINE(uint32_t) read_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint64_t) read_be64(const unsigned char *p)
+{
+	return ((uint64_t)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+static int ewah_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid EWAH bitmap - %s", message);
+	return -1;
+}
+
+int git_ewah_read(
+	git_bitmap *out, size_t *consumed, const unsigned char *data, size_t len)
+{
+	const unsigned char *words;
+	uint32_t bit_size, word_count, i;
+	size_t pos = 0, needed, total_words;
+
+	assert(out && consumed && data);
+
+	if (len < 12)
+		return ewah_error("truncated header");
+
+	bit_size = read_be32(data);
+	word_count = read_be32(data + 4);
+
+	/* header, the compressed words and the position of the last RLW */
+	if (word_count > (len - 12) / 8)
+		return ewah_error("truncated data");
+	needed = 8 + (size_t)word_count * 8 + 4;
+
+	total_words = ((size_t)bit_size + GIT_BITMAP_WORD_BITS - 1) / GIT_BITMAP_WORD_BITS;
+	if (bitmap_grow(out, total_words) < 0)
+		return -1;
+
+	words = data + 8;
+	for (i = 0; i < word_count; ) {
+		uint64_t rlw = read_be64(words + (size_t)i * 8);
+		uint64_t running_len = (rlw >> 1) & RLW_RUNNING_LEN_MASK;
+		uint32_t literals = (uint32_t)(rlw >> (1 + RLW_RUNNING_BITS));
+		size_t j;
+
+		i++;
+
+		if (running_len > total_words - pos ||
+			literals > total_words - pos - running_len)
+			return ewah_error("words extend beyond the bit size");
+
+		if (rlw & 1) {
+			for (j = 0; j < running_len; j++)
+				out->words[pos + j] = ~(uint64_t)0;
+		}
+		pos += running_len;
+
+		if (literals > word_count - i)
+			return ewah_error("literal words extend beyond the bitmap");
+
+		for (j = 0; j < literals; j++, i++)
+			out->words[pos + j] = read_be64(words + (size_t)i * 8);
+		pos += literals;
+	}
+
+	*consumed = needed;
+	return 0;
+}
+
+GIT_INLINE(int) put_be32(git_buf *out, uint32_t value)
+{
+	unsigned char buf[4];
+
+	buf[0] = (unsigned char)(value >> 24);
+	buf[1] = (unsigned char)(value >> 16);
+	buf[2] = (unsigned char)(value >> 8);
+	buf[3] = (unsigned char)value;
+	return git_buf_put(out, (const char *)buf, 4);
+}
+
+GIT_INLINE(int) put_be64(git_buf *out, uint64_t value)
+{
+	if (put_be32(out, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return put_be32(out, (uint32_t)value);
+}
+
+GIT_INLINE(uint64_t) word_at(const git_bitmap *bitmap, size_t pos)
+{
+	return pos < bitmap->word_alloc ? bitmap->words[pos] : 0;
+}
+
+GIT_INLINE(bool) is_clean(uint64_t word)
+{
+	return word == 0 || word == ~(uint64_t)0;
+}
+
+int git_ewah_write(git_buf *out, const git_bitmap *bitmap, size_t bit_size)
+{
+	size_t total_words, pos = 0, header, last_rlw = 0;
+	uint32_t word_count = 0;
+
+	assert(out && bitmap);
+
+	if (!git__is_uint32(bit_size)) {
+		giterr_set(GITERR_INVALID, "bitmap is too large to be compressed");
+		return -1;
+	}
+
+	total_words = (bit_size + GIT_BITMAP_WORD_BITS - 1) / GIT_BITMAP_WORD_BITS;
+
+	/* the word count is filled in once it is known */
+	header = git_buf_len(out);
+	if (put_be32(out, (uint32_t)bit_size) < 0 || put_be32(out, 0) < 0)
+		return -1;
+
+	do {
+		uint64_t clean = 0, running_len = 0, literals = 0, i;
+
+		if (pos < total_words && is_clean(word_at(bitmap, pos))) {
+			clean = word_at(bitmap, pos);
+
+			while (pos + running_len < total_words &&
+				running_len < RLW_RUNNING_LEN_MASK &&
+				word_at(bitmap, pos + running_len) == clean)
+				running_len++;
+		}
+
+		while (pos + running_len + literals < total_words &&
+			literals < RLW_LITERAL_MAX &&
+			!is_clean(word_at(bitmap, pos + running_len + literals)))
+			literals++;
+
+		last_rlw = word_count;
+		if (put_be64(out, (clean & 1) |
+				(running_len << 1) |
+				(literals << (1 + RLW_RUNNING_BITS))) < 0)
+			return -1;
+
+		pos += running_len;
+		for (i = 0; i < literals; i++, pos++) {
+			if (put_be64(out, word_at(bitmap, pos)) < 0)
+				return -1;
+		}
+
+		word_count += (uint32_t)(1 + literals);
+	} while (pos < total_words);
+
+	if (put_be32(out, (uint32_t)last_rlw) < 0)
+		return -1;
+
+	out->ptr[header + 4] = (char)(word_count >> 24);
+	out->ptr[header + 5] = (char)(word_count >> 16);
+	out->ptr[header + 6] = (char)(word_count >> 8);
+	out->ptr[header + 7] = (char)word_count;
+
+	return 0;
+}
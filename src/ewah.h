@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+
+#include "buffer.h"
+
+/*
+ * An uncompressed, growable bitmap. This is what EWAH-compressed bitmaps
+ * from `.bitmap` files get expanded into so that they can be combined
+ * with plain word-wise operations.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT { NULL, 0 }
+
+#define GIT_BITMAP_WORD_BITS 64
+
+void git_bitmap_free(git_bitmap *bitmap);
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+
+GIT_INLINE(bool) git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	return block < bitmap->word_alloc &&
+		(bitmap->words[block] & ((uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS))) != 0;
+}
+
+/* `dst |= src` */
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+
+/* `dst &= ~src` */
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+/* `dst ^= src` */
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src);
+
+/* Number of bits set in the bitmap. */
+size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+/*
+ * Call `cb` for every set bit of the bitmap, in increasing order. A
+ * non-zero return value from the callback stops the iteration and is
+ * returned.
+ */
+int git_bitmap_foreach(
+	const git_bitmap *bitmap,
+	int (*cb)(size_t pos, void *payload),
+	void *payload);
+
+/*
+ * Decode an EWAH-compressed bitmap as stored in `.bitmap` files into
+ * `out`, which must be empty. On success, `consumed` holds the number of
+ * bytes read from `data`.
+ */
+int git_ewah_read(
+	git_bitmap *out, size_t *consumed, const unsigned char *data, size_t len);
+
+/*
+ * Append the first `bit_size` bits of the bitmap to `out`, compressed in
+ * the EWAH format used by `.bitmap` files.
+ */
+int git_ewah_write(git_buf *out, const git_bitmap *bitmap, size_t bit_size);
+
+#endif
@@ -12,6 +12,7 @@
 #include "repository.h"
 #include "global.h"
 #include "git2/sys/filter.h"
+#include "git2/odb_backend.h"
 #include "git2/config.h"
 #include "blob.h"
 #include "attr_file.h"
@@ -953,3 +954,67 @@ int git_filter_list_stream_blob(
 
 	return git_filter_list_stream_data(filters, &in, target);
 }
+
+int git_filter_list__stream_object(
+	git_filter_list *filters,
+	git_repository *repo,
+	const git_oid *id,
+	git_writestream *target)
+{
+	git_vector filter_streams = GIT_VECTOR_INIT;
+	git_writestream *stream_start;
+	git_odb_stream *stream = NULL;
+	git_blob *blob;
+	git_odb *odb;
+	char *buf = NULL;
+	git_off_t total = 0;
+	int readlen = 0, error;
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0)
+		return error;
+
+	/* fall back to reading the whole blob if it can't be streamed */
+	if (git_odb_open_rstream(&stream, odb, id) < 0) {
+		giterr_clear();
+
+		if ((error = git_blob_lookup(&blob, repo, id)) < 0)
+			return error;
+
+		error = git_filter_list_stream_blob(filters, blob, target);
+		git_blob_free(blob);
+		return error;
+	}
+
+	if (filters)
+		git_oid_cpy(&filters->source.oid, id);
+
+	if ((error = stream_list_init(
+			&stream_start, &filter_streams, filters, target)) < 0)
+		goto done;
+
+	if ((buf = git__malloc(FILTERIO_BUFSIZE)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	while ((readlen = git_odb_stream_read(stream, buf, FILTERIO_BUFSIZE)) > 0) {
+		total += readlen;
+
+		if ((error = stream_start->write(stream_start, buf, readlen)) < 0)
+			goto done;
+	}
+
+	if (readlen < 0)
+		error = readlen;
+	else if (total != stream->declared_size) {
+		giterr_set(GITERR_ODB, "object stream ended early");
+		error = -1;
+	} else
+		error = stream_start->close(stream_start);
+
+done:
+	stream_list_free(&filter_streams);
+	git_odb_stream_free(stream);
+	git__free(buf);
+	return error;
+}
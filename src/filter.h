@@ -42,6 +42,17 @@ extern int git_filter_list__load_ext(
 	git_filter_mode_t mode,
 	git_filter_options *filter_opts);
 
+/*
+ * Apply the filters to the blob `id` and write the result to `target`,
+ * streaming the blob from the object database rather than reading all
+ * of it into memory when the database can.
+ */
+extern int git_filter_list__stream_object(
+	git_filter_list *filters,
+	git_repository *repo,
+	const git_oid *id,
+	git_writestream *target);
+
 /*
  * Available filters
  */
@@ -8,6 +8,7 @@
 #include "global.h"
 #include "hash.h"
 #include "sysdir.h"
+#include "pack-cache.h"
 #include "git2/global.h"
 #include "git2/sys/openssl.h"
 #include "thread-utils.h"
@@ -194,8 +195,9 @@ static int synchronized_threads_init(void)
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
-		error = git_sysdir_global_init();
+	if ((error = git_hash_global_init()) >= 0 &&
+		(error = git_sysdir_global_init()) >= 0)
+		error = git_pack_cache_global_init();
 
 	win32_pthread_initialize();
 
@@ -303,8 +305,9 @@ static void init_once(void)
 
 
 	/* Initialize any other subsystems that have global state */
-	if ((init_error = git_hash_global_init()) >= 0)
-		init_error = git_sysdir_global_init();
+	if ((init_error = git_hash_global_init()) >= 0 &&
+		(init_error = git_sysdir_global_init()) >= 0)
+		init_error = git_pack_cache_global_init();
 
 	/* OpenSSL needs to be initialized from the main thread */
 	init_ssl();
@@ -378,6 +381,10 @@ int git_libgit2_init(void)
 		ssl_inited = 1;
 	}
 
+	if (git_atomic_get(&git__n_inits) == 0 &&
+		git_pack_cache_global_init() < 0)
+		return -1;
+
 	return git_atomic_inc(&git__n_inits);
 }
 
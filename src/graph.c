@@ -7,6 +7,7 @@
 
 #include "revwalk.h"
 #include "merge.h"
+#include "graph_cache.h"
 #include "git2/graph.h"
 
 static int interesting(git_pqueue *list, git_commit_list *roots)
@@ -147,6 +148,9 @@ int git_graph_ahead_behind(size_t *ahead, size_t *behind, git_repository *repo,
 	git_revwalk *walk;
 	git_commit_list_node *commit_u, *commit_l;
 
+	if (git_graph_cache_get_counts(ahead, behind, repo, local, upstream) == 0)
+		return 0;
+
 	if (git_revwalk_new(&walk, repo) < 0)
 		return -1;
 
@@ -164,6 +168,7 @@ int git_graph_ahead_behind(size_t *ahead, size_t *behind, git_repository *repo,
 		goto on_error;
 
 	git_revwalk_free(walk);
+	git_graph_cache_set_counts(repo, local, upstream, *ahead, *behind);
 
 	return 0;
 
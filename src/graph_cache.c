@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "graph_cache.h"
+#include "repository.h"
+#include "thread-utils.h"
+
+/*
+ * The table is split into sets of a few entries. A pair of commits can
+ * only be stored in the set its ids hash to, and when that set is full,
+ * its entries are replaced in turn.
+ */
+#define GRAPH_CACHE_WAYS 4
+
+enum {
+	GRAPH_CACHE_BASE = (1 << 0),
+	/* the merge base was found with the commits in the other order */
+	GRAPH_CACHE_BASE_SWAPPED = (1 << 1),
+	/* ... which doesn't matter if there is only the one */
+	GRAPH_CACHE_BASE_UNIQUE = (1 << 2),
+	GRAPH_CACHE_COUNTS = (1 << 3),
+};
+
+typedef struct {
+	git_oid one, two; /* `one` sorts before `two` */
+	git_oid base; /* zero if there is no merge base */
+	size_t ahead, behind; /* of `one` against `two` */
+	unsigned int flags; /* 0 for an empty entry */
+} graph_cache_entry;
+
+struct git_graph_cache {
+	git_mutex lock;
+	size_t set_mask;
+	graph_cache_entry *entries;
+	unsigned char *next_way;
+};
+
+size_t git_graph_cache__max_entries = 0;
+
+static git_atomic_ssize cache_hits, cache_misses;
+
+static git_graph_cache *graph_cache_new(size_t max_entries)
+{
+	git_graph_cache *cache;
+	size_t sets = 1;
+
+	while (sets * 2 * GRAPH_CACHE_WAYS <= max_entries)
+		sets *= 2;
+
+	if ((cache = git__calloc(1, sizeof(git_graph_cache))) == NULL)
+		return NULL;
+
+	cache->set_mask = sets - 1;
+	cache->entries = git__calloc(sets * GRAPH_CACHE_WAYS, sizeof(graph_cache_entry));
+	cache->next_way = git__calloc(sets, sizeof(unsigned char));
+
+	if (!cache->entries || !cache->next_way || git_mutex_init(&cache->lock)) {
+		git__free(cache->entries);
+		git__free(cache->next_way);
+		git__free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void git_graph_cache_free(git_graph_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	git_mutex_free(&cache->lock);
+	git__free(cache->entries);
+	git__free(cache->next_way);
+	git__free(cache);
+}
+
+/* The cache of the repository, created on first use; NULL if disabled */
+static git_graph_cache *graph_cache_for(git_repository *repo)
+{
+	git_graph_cache *cache, *existing;
+
+	if (!git_graph_cache__max_entries)
+		return NULL;
+
+	if ((cache = repo->graph_cache) != NULL)
+		return cache;
+
+	/* not being able to cache is not an error for the caller */
+	if ((cache = graph_cache_new(git_graph_cache__max_entries)) == NULL) {
+		giterr_clear();
+		return NULL;
+	}
+
+	existing = git__compare_and_swap(&repo->graph_cache, NULL, cache);
+	if (existing != NULL) {
+		git_graph_cache_free(cache);
+		cache = existing;
+	}
+
+	return cache;
+}
+
+/* Put the ids in sorted order; returns whether they were swapped */
+static int sort_pair(
+	const git_oid **one, const git_oid **two, const git_oid *a, const git_oid *b)
+{
+	int swapped = (git_oid_cmp(a, b) > 0);
+
+	*one = swapped ? b : a;
+	*two = swapped ? a : b;
+	return swapped;
+}
+
+static graph_cache_entry *graph_cache_set(
+	git_graph_cache *cache, const git_oid *one, const git_oid *two)
+{
+	uint32_t a, b;
+
+	/* the ids are hashes already; take bits from both of them */
+	memcpy(&a, one->id, sizeof(a));
+	memcpy(&b, two->id + sizeof(b), sizeof(b));
+
+	return &cache->entries[((a ^ b) & cache->set_mask) * GRAPH_CACHE_WAYS];
+}
+
+/* Run with the lock held */
+static graph_cache_entry *graph_cache_lookup(
+	git_graph_cache *cache, const git_oid *one, const git_oid *two)
+{
+	graph_cache_entry *set = graph_cache_set(cache, one, two);
+	size_t i;
+
+	for (i = 0; i < GRAPH_CACHE_WAYS; i++) {
+		if (set[i].flags &&
+			git_oid_equal(&set[i].one, one) &&
+			git_oid_equal(&set[i].two, two))
+			return &set[i];
+	}
+
+	return NULL;
+}
+
+/* Run with the lock held */
+static graph_cache_entry *graph_cache_insert(
+	git_graph_cache *cache, const git_oid *one, const git_oid *two)
+{
+	graph_cache_entry *set, *entry;
+	size_t i, set_idx;
+
+	if ((entry = graph_cache_lookup(cache, one, two)) != NULL)
+		return entry;
+
+	set = graph_cache_set(cache, one, two);
+	set_idx = (set - cache->entries) / GRAPH_CACHE_WAYS;
+
+	for (i = 0; i < GRAPH_CACHE_WAYS; i++) {
+		if (!set[i].flags)
+			break;
+	}
+
+	if (i == GRAPH_CACHE_WAYS) {
+		i = cache->next_way[set_idx];
+		cache->next_way[set_idx] = (i + 1) % GRAPH_CACHE_WAYS;
+	}
+
+	entry = &set[i];
+	memset(entry, 0, sizeof(graph_cache_entry));
+	git_oid_cpy(&entry->one, one);
+	git_oid_cpy(&entry->two, two);
+
+	return entry;
+}
+
+int git_graph_cache_get_base(
+	git_oid *out, git_repository *repo, const git_oid *a, const git_oid *b)
+{
+	git_graph_cache *cache;
+	graph_cache_entry *entry;
+	const git_oid *one, *two;
+	int swapped, error = GIT_ENOTFOUND;
+
+	if ((cache = graph_cache_for(repo)) == NULL)
+		return GIT_ENOTFOUND;
+
+	swapped = sort_pair(&one, &two, a, b);
+
+	if (git_mutex_lock(&cache->lock) < 0)
+		return GIT_ENOTFOUND;
+
+	if ((entry = graph_cache_lookup(cache, one, two)) != NULL &&
+		(entry->flags & GRAPH_CACHE_BASE) != 0 &&
+		((entry->flags & GRAPH_CACHE_BASE_UNIQUE) != 0 ||
+		 !(entry->flags & GRAPH_CACHE_BASE_SWAPPED) == !swapped)) {
+		git_oid_cpy(out, &entry->base);
+		error = 0;
+	}
+
+	git_mutex_unlock(&cache->lock);
+
+	git_atomic_ssize_add(error ? &cache_misses : &cache_hits, 1);
+	return error;
+}
+
+void git_graph_cache_set_base(
+	git_repository *repo, const git_oid *a, const git_oid *b,
+	const git_oid *base, int unique)
+{
+	git_graph_cache *cache;
+	graph_cache_entry *entry;
+	const git_oid *one, *two;
+	int swapped;
+
+	if ((cache = graph_cache_for(repo)) == NULL)
+		return;
+
+	swapped = sort_pair(&one, &two, a, b);
+
+	if (git_mutex_lock(&cache->lock) < 0)
+		return;
+
+	entry = graph_cache_insert(cache, one, two);
+
+	if (base)
+		git_oid_cpy(&entry->base, base);
+	else
+		memset(&entry->base, 0, sizeof(git_oid));
+
+	entry->flags &= ~(GRAPH_CACHE_BASE_SWAPPED | GRAPH_CACHE_BASE_UNIQUE);
+	entry->flags |= GRAPH_CACHE_BASE;
+
+	if (swapped)
+		entry->flags |= GRAPH_CACHE_BASE_SWAPPED;
+	if (unique || !base)
+		entry->flags |= GRAPH_CACHE_BASE_UNIQUE;
+
+	git_mutex_unlock(&cache->lock);
+}
+
+int git_graph_cache_get_counts(
+	size_t *ahead, size_t *behind, git_repository *repo,
+	const git_oid *local, const git_oid *upstream)
+{
+	git_graph_cache *cache;
+	graph_cache_entry *entry;
+	const git_oid *one, *two;
+	int swapped, error = GIT_ENOTFOUND;
+
+	if ((cache = graph_cache_for(repo)) == NULL)
+		return GIT_ENOTFOUND;
+
+	swapped = sort_pair(&one, &two, local, upstream);
+
+	if (git_mutex_lock(&cache->lock) < 0)
+		return GIT_ENOTFOUND;
+
+	if ((entry = graph_cache_lookup(cache, one, two)) != NULL &&
+		(entry->flags & GRAPH_CACHE_COUNTS) != 0) {
+		*ahead = swapped ? entry->behind : entry->ahead;
+		*behind = swapped ? entry->ahead : entry->behind;
+		error = 0;
+	}
+
+	git_mutex_unlock(&cache->lock);
+
+	git_atomic_ssize_add(error ? &cache_misses : &cache_hits, 1);
+	return error;
+}
+
+void git_graph_cache_set_counts(
+	git_repository *repo, const git_oid *local, const git_oid *upstream,
+	size_t ahead, size_t behind)
+{
+	git_graph_cache *cache;
+	graph_cache_entry *entry;
+	const git_oid *one, *two;
+	int swapped;
+
+	if ((cache = graph_cache_for(repo)) == NULL)
+		return;
+
+	swapped = sort_pair(&one, &two, local, upstream);
+
+	if (git_mutex_lock(&cache->lock) < 0)
+		return;
+
+	entry = graph_cache_insert(cache, one, two);
+	entry->ahead = swapped ? behind : ahead;
+	entry->behind = swapped ? ahead : behind;
+	entry->flags |= GRAPH_CACHE_COUNTS;
+
+	git_mutex_unlock(&cache->lock);
+}
+
+void git_graph_cache_stats(size_t *hits, size_t *misses)
+{
+	if (hits)
+		*hits = (size_t)cache_hits.val;
+	if (misses)
+		*misses = (size_t)cache_misses.val;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_graph_cache_h__
+#define INCLUDE_graph_cache_h__
+
+#include "common.h"
+#include "git2/oid.h"
+
+/*
+ * The graph cache remembers the merge bases and the ahead/behind counts
+ * of pairs of commits. A commit never changes, so neither do these, and
+ * entries are only ever evicted to make room for others, never
+ * invalidated. Each repository has a table of a fixed number of entries,
+ * keyed by the pair of ids in sorted order.
+ */
+typedef struct git_graph_cache git_graph_cache;
+
+/* The number of entries of the tables; 0 disables the cache */
+extern size_t git_graph_cache__max_entries;
+
+void git_graph_cache_free(git_graph_cache *cache);
+
+/*
+ * Look up the merge base of two commits. Returns 0 if it is known, with
+ * a zero id in `out` if the commits have no merge base, or GIT_ENOTFOUND
+ * if it is not cached.
+ */
+int git_graph_cache_get_base(
+	git_oid *out, git_repository *repo, const git_oid *one, const git_oid *two);
+
+/*
+ * Remember the merge base of two commits, or that they have none if
+ * `base` is NULL. `unique` tells whether it is their only merge base;
+ * other ones are only handed out for the same order of the commits.
+ */
+void git_graph_cache_set_base(
+	git_repository *repo, const git_oid *one, const git_oid *two,
+	const git_oid *base, int unique);
+
+/*
+ * Look up the number of commits in `local` and not in `upstream`, and
+ * the other way around. Returns GIT_ENOTFOUND if they are not cached.
+ */
+int git_graph_cache_get_counts(
+	size_t *ahead, size_t *behind, git_repository *repo,
+	const git_oid *local, const git_oid *upstream);
+
+void git_graph_cache_set_counts(
+	git_repository *repo, const git_oid *local, const git_oid *upstream,
+	size_t ahead, size_t behind);
+
+void git_graph_cache_stats(size_t *hits, size_t *misses);
+
+#endif
@@ -17,6 +17,9 @@
 #include "oid.h"
 #include "oidmap.h"
 #include "zstream.h"
+#include "delta-apply.h"
+#include "thread-utils.h"
+#include "array.h"
 
 GIT__USE_OIDMAP;
 
@@ -24,6 +27,9 @@ extern git_mutex git__mwindow_mutex;
 
 #define UINT31_MAX (0x7FFFFFFF)
 
+/* like git's core.deltaBaseCacheLimit, for each thread resolving deltas */
+#define GIT_INDEXER_MAX_RESOLVE_MEMORY (96 * 1024 * 1024)
+
 struct entry {
 	git_oid oid;
 	uint32_t crc;
@@ -52,6 +58,9 @@ struct git_indexer {
 	void *progress_payload;
 	char objbuf[8*1024];
 
+	/* The number of threads resolving deltas in git_indexer_commit */
+	unsigned int nr_threads;
+
 	/* Needed to look up objects which we want to inject to fix a thin pack */
 	git_odb *odb;
 
@@ -63,6 +72,14 @@ struct git_indexer {
 
 struct delta_info {
 	git_off_t delta_off;
+
+	/* Filled in once the whole pack has been received */
+	git_otype type;
+	size_t size;
+	git_off_t data_off;
+	git_off_t base_off;
+	git_oid base_id;
+	unsigned int resolved :1;
 };
 
 const git_oid *git_indexer_hash(const git_indexer *idx)
@@ -122,6 +139,7 @@ int git_indexer_new(
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
+	idx->nr_threads = 1; /* do not spawn any thread by default */
 	git_hash_ctx_init(&idx->hash_ctx);
 	git_hash_ctx_init(&idx->trailer);
 
@@ -157,6 +175,20 @@ cleanup:
 	return -1;
 }
 
+unsigned int git_indexer_set_threads(git_indexer *idx, unsigned int n)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	idx->nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	assert(1 == idx->nr_threads);
+#endif
+
+	return idx->nr_threads;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -355,41 +387,6 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 	return 0;
 }
 
-static int hash_and_save(git_indexer *idx, git_rawobj *obj, git_off_t entry_start)
-{
-	git_oid oid;
-	size_t entry_size;
-	struct entry *entry;
-	struct git_pack_entry *pentry = NULL;
-
-	entry = git__calloc(1, sizeof(*entry));
-	GITERR_CHECK_ALLOC(entry);
-
-	if (git_odb__hashobj(&oid, obj) < 0) {
-		giterr_set(GITERR_INDEXER, "Failed to hash object");
-		goto on_error;
-	}
-
-	pentry = git__calloc(1, sizeof(struct git_pack_entry));
-	GITERR_CHECK_ALLOC(pentry);
-
-	git_oid_cpy(&pentry->sha1, &oid);
-	git_oid_cpy(&entry->oid, &oid);
-	entry->crc = crc32(0L, Z_NULL, 0);
-
-	entry_size = (size_t)(idx->off - entry_start);
-	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
-		goto on_error;
-
-	return save_entry(idx, entry, pentry, entry_start);
-
-on_error:
-	git__free(pentry);
-	git__free(entry);
-	git__free(obj->data);
-	return -1;
-}
-
 static int do_progress_callback(git_indexer *idx, git_transfer_progress *stats)
 {
 	if (idx->progress_cb)
@@ -761,7 +758,7 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 
 	/* Loop until we find the first REF delta */
 	git_vector_foreach(&idx->deltas, i, delta) {
-		if (!delta)
+		if (delta->resolved)
 			continue;
 
 		curpos = delta->delta_off;
@@ -799,53 +796,692 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 	return 0;
 }
 
-static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
+/*
+ * Deltas are resolved by walking the tree of objects from each object
+ * stored whole in the pack down to the deltas against it: each base is
+ * inflated once, and its deltas are applied while it is at hand. Every
+ * such tree is independent of the others, so they are shared out among
+ * the threads.
+ */
+struct resolve_ctx {
+	git_indexer *idx;
+	git_transfer_progress *stats;
+
+	/* the unresolved deltas, by base offset and by base name */
+	git_vector ofs_deltas;
+	git_vector ref_deltas;
+	size_t unresolved;
+
+	/* the objects whose delta trees remain to be resolved */
+	struct entry **roots;
+	size_t roots_len;
+	size_t next_root;
+
+	git_mutex lock;
+	int error;
+	int error_class;
+	char *error_msg;
+
+	/*
+	 * With threads, the progress callback is called by the thread
+	 * which waits for them, once it is told there is progress.
+	 */
+	bool threaded;
+	git_cond progress_cond;
+	size_t running;
+};
+
+static int ofs_delta_cmp(const void *a, const void *b)
 {
-	unsigned int i;
+	const struct delta_info *deltaa = a, *deltab = b;
+
+	if (deltaa->base_off < deltab->base_off)
+		return -1;
+	return deltaa->base_off > deltab->base_off;
+}
+
+static int ref_delta_cmp(const void *a, const void *b)
+{
+	const struct delta_info *deltaa = a, *deltab = b;
+
+	return git_oid__cmp(&deltaa->base_id, &deltab->base_id);
+}
+
+GIT_INLINE(git_off_t) entry_offset(const struct entry *entry)
+{
+	return entry->offset == UINT32_MAX ?
+		(git_off_t)entry->offset_long : (git_off_t)entry->offset;
+}
+
+/* Find where the deltas against the given base start in a sorted list */
+static size_t find_deltas(
+	git_vector *deltas, const struct delta_info *base,
+	int (*cmp)(const void *, const void *))
+{
+	size_t lo = 0, hi = deltas->length;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (cmp(deltas->contents[mid], base) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Read the type, size and base of every delta of the pack */
+static int parse_deltas(struct resolve_ctx *ctx)
+{
+	git_indexer *idx = ctx->idx;
 	struct delta_info *delta;
-	int progressed = 0, non_null = 0, progress_cb_result;
+	git_mwindow *w = NULL;
+	unsigned char *base_info;
+	unsigned int left;
+	size_t i;
+	int error;
 
-	while (idx->deltas.length > 0) {
-		progressed = 0;
-		non_null = 0;
-		git_vector_foreach(&idx->deltas, i, delta) {
-			git_rawobj obj;
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (delta->resolved)
+			continue;
+
+		delta->data_off = delta->delta_off;
+		if ((error = git_packfile_unpack_header(&delta->size, &delta->type,
+				&idx->pack->mwf, &w, &delta->data_off)) < 0)
+			return error;
+		git_mwindow_close(&w);
 
-			if (!delta)
-				continue;
+		if (delta->type == GIT_OBJ_OFS_DELTA) {
+			delta->base_off = get_delta_base(idx->pack, &w,
+				&delta->data_off, delta->type, delta->delta_off);
+			git_mwindow_close(&w);
 
-			non_null = 1;
-			idx->off = delta->delta_off;
-			if (git_packfile_unpack(&obj, idx->pack, &idx->off) < 0)
-				continue;
+			if (delta->base_off <= 0) {
+				giterr_set(GITERR_INDEXER, "invalid delta base offset");
+				return -1;
+			}
 
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
-				continue;
+			if (git_vector_insert(&ctx->ofs_deltas, delta) < 0)
+				return -1;
+		} else {
+			base_info = git_mwindow_open(&idx->pack->mwf, &w,
+				delta->data_off, GIT_OID_RAWSZ, &left);
+			if (base_info == NULL) {
+				giterr_set(GITERR_INDEXER, "failed to map delta information");
+				return -1;
+			}
 
+			git_oid_fromraw(&delta->base_id, base_info);
+			git_mwindow_close(&w);
+			delta->data_off += GIT_OID_RAWSZ;
+
+			if (git_vector_insert(&ctx->ref_deltas, delta) < 0)
+				return -1;
+		}
+
+		ctx->unresolved++;
+	}
+
+	git_vector_sort(&ctx->ofs_deltas);
+	git_vector_sort(&ctx->ref_deltas);
+	return 0;
+}
+
+/* Record an object which has been resolved from a delta */
+static int save_resolved(
+	struct resolve_ctx *ctx,
+	struct delta_info *delta,
+	const git_oid *id,
+	git_off_t delta_end)
+{
+	git_indexer *idx = ctx->idx;
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+	int error;
+
+	entry = git__calloc(1, sizeof(*entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid, id);
+	if (crc_object(&entry->crc, &idx->pack->mwf,
+			delta->delta_off, delta_end - delta->delta_off) < 0) {
+		git__free(entry);
+		return -1;
+	}
+
+	pentry = git__calloc(1, sizeof(struct git_pack_entry));
+	if (!pentry) {
+		git__free(entry);
+		giterr_set_oom();
+		return -1;
+	}
+	git_oid_cpy(&pentry->sha1, id);
+
+	if (git_mutex_lock(&ctx->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock indexer mutex");
+		git__free(entry);
+		git__free(pentry);
+		return -1;
+	}
+
+	if ((error = save_entry(idx, entry, pentry, delta->delta_off)) < 0) {
+		git__free(pentry);
+		git__free(entry);
+	} else {
+		delta->resolved = 1;
+		ctx->unresolved--;
+		ctx->stats->indexed_objects++;
+		ctx->stats->indexed_deltas++;
+
+		if (!ctx->threaded)
+			error = do_progress_callback(idx, ctx->stats);
+		else if (ctx->error)
+			error = ctx->error; /* somebody else failed; stop too */
+		else
+			git_cond_signal(&ctx->progress_cond);
+	}
+
+	git_mutex_unlock(&ctx->lock);
+	return error;
+}
+
+/*
+ * A base of the chain being resolved. Its data is freed when the chain
+ * takes up more than `git_indexer__max_resolve_memory`, and inflated
+ * again if it has more deltas.
+ */
+struct resolve_frame {
+	struct delta_info *delta; /* the delta it comes from; NULL for the root */
+	git_off_t offset;
+	git_oid id;
+	git_rawobj obj;
+
+	/* the next of its deltas to look at */
+	size_t ofs_pos;
+	size_t ref_pos;
+};
+
+typedef git_array_t(struct resolve_frame) resolve_stack;
+
+size_t git_indexer__max_resolve_memory = GIT_INDEXER_MAX_RESOLVE_MEMORY;
+
+/* Inflate a delta and apply it to its base */
+static int apply_delta(
+	git_rawobj *out,
+	git_off_t *delta_end,
+	struct resolve_ctx *ctx,
+	struct delta_info *delta,
+	const git_rawobj *base)
+{
+	git_rawobj data;
+	git_mwindow *w = NULL;
+	git_off_t curpos = delta->data_off;
+	int error;
+
+	if ((error = packfile_unpack_compressed(&data, ctx->idx->pack,
+			&w, &curpos, delta->size, delta->type)) < 0)
+		return error;
+
+	error = git__delta_apply(out, base->data, base->len, data.data, data.len);
+	git__free(data.data);
+
+	if (error < 0)
+		return error;
+
+	out->type = base->type;
+
+	if (delta_end)
+		*delta_end = curpos;
+
+	return 0;
+}
+
+static bool has_children(struct resolve_ctx *ctx, git_off_t offset, const git_oid *id)
+{
+	struct delta_info key, *delta;
+	size_t pos;
+
+	key.base_off = offset;
+	git_oid_cpy(&key.base_id, id);
+
+	pos = find_deltas(&ctx->ofs_deltas, &key, ofs_delta_cmp);
+	if (pos < ctx->ofs_deltas.length) {
+		delta = ctx->ofs_deltas.contents[pos];
+		if (delta->base_off == key.base_off)
+			return true;
+	}
+
+	pos = find_deltas(&ctx->ref_deltas, &key, ref_delta_cmp);
+	if (pos < ctx->ref_deltas.length) {
+		delta = ctx->ref_deltas.contents[pos];
+		if (git_oid_equal(&delta->base_id, &key.base_id))
+			return true;
+	}
+
+	return false;
+}
+
+static int push_frame(
+	resolve_stack *stack,
+	size_t *held,
+	struct resolve_ctx *ctx,
+	struct delta_info *delta,
+	git_off_t offset,
+	const git_oid *id,
+	git_rawobj *obj)
+{
+	struct resolve_frame *frame;
+	struct delta_info key;
+
+	frame = git_array_alloc(*stack);
+	GITERR_CHECK_ALLOC(frame);
+
+	memset(frame, 0, sizeof(*frame));
+	frame->delta = delta;
+	frame->offset = offset;
+	git_oid_cpy(&frame->id, id);
+	frame->obj = *obj;
+	*held += obj->len;
+
+	key.base_off = offset;
+	git_oid_cpy(&key.base_id, id);
+	frame->ofs_pos = find_deltas(&ctx->ofs_deltas, &key, ofs_delta_cmp);
+	frame->ref_pos = find_deltas(&ctx->ref_deltas, &key, ref_delta_cmp);
+
+	return 0;
+}
+
+static void free_frame(struct resolve_frame *frame, size_t *held)
+{
+	if (!frame->obj.data)
+		return;
+
+	*held -= frame->obj.len;
+	git__free(frame->obj.data);
+	frame->obj.data = NULL;
+}
+
+/* The next delta against the base of `frame`, or NULL if there is none */
+static struct delta_info *next_child(struct resolve_ctx *ctx, struct resolve_frame *frame)
+{
+	struct delta_info *delta;
+
+	if (frame->ofs_pos < ctx->ofs_deltas.length) {
+		delta = ctx->ofs_deltas.contents[frame->ofs_pos];
+
+		if (delta->base_off == frame->offset) {
+			frame->ofs_pos++;
+			return delta;
+		}
+
+		frame->ofs_pos = ctx->ofs_deltas.length;
+	}
+
+	while (frame->ref_pos < ctx->ref_deltas.length) {
+		delta = ctx->ref_deltas.contents[frame->ref_pos++];
+
+		if (!git_oid_equal(&delta->base_id, &frame->id)) {
+			frame->ref_pos = ctx->ref_deltas.length;
+			break;
+		}
+
+		/* a delta may be resolved already if its base is in the pack twice */
+		if (!delta->resolved)
+			return delta;
+	}
+
+	return NULL;
+}
+
+/* Free the bases furthest up the chain until it fits the limit */
+static void trim_stack(resolve_stack *stack, size_t *held)
+{
+	size_t i;
+
+	/* the last one is the base in use */
+	for (i = 0; *held > git_indexer__max_resolve_memory &&
+		i + 1 < git_array_size(*stack); i++)
+		free_frame(git_array_get(*stack, i), held);
+}
+
+/*
+ * Inflate the base at the top of the stack again, from the closest one
+ * up the chain which is still at hand, or from the root.
+ */
+static int inflate_top(resolve_stack *stack, size_t *held, struct resolve_ctx *ctx)
+{
+	struct resolve_frame *frame, *base;
+	git_off_t offset;
+	size_t top = git_array_size(*stack) - 1, i = top;
+	int error;
+
+	while (i > 0 && !git_array_get(*stack, i)->obj.data)
+		i--;
+
+	base = git_array_get(*stack, i);
+
+	if (!base->obj.data) {
+		offset = base->offset;
+		if ((error = git_packfile_unpack(&base->obj, ctx->idx->pack, &offset)) < 0)
+			return error;
+		*held += base->obj.len;
+	}
+
+	for (i++; i <= top; i++) {
+		frame = git_array_get(*stack, i);
+
+		if ((error = apply_delta(&frame->obj, NULL, ctx, frame->delta, &base->obj)) < 0)
+			return error;
+		*held += frame->obj.len;
+
+		base = frame;
+	}
+
+	trim_stack(stack, held);
+	return 0;
+}
+
+/*
+ * Resolve the tree of deltas under an object which is stored whole. It
+ * is walked depth first, with the chain down to the current delta on an
+ * explicit stack, as the chains may be thousands of objects long.
+ */
+static int resolve_root(struct resolve_ctx *ctx, const struct entry *root)
+{
+	resolve_stack stack = GIT_ARRAY_INIT;
+	struct resolve_frame *frame;
+	struct delta_info *delta;
+	git_rawobj obj;
+	git_off_t offset = entry_offset(root), delta_end;
+	git_oid id;
+	size_t held = 0, i;
+	int error;
+
+	if (!has_children(ctx, offset, &root->oid))
+		return 0;
+
+	if ((error = git_packfile_unpack(&obj, ctx->idx->pack, &offset)) < 0)
+		return error;
+
+	if ((error = push_frame(&stack, &held, ctx, NULL,
+			entry_offset(root), &root->oid, &obj)) < 0) {
+		git__free(obj.data);
+		return error;
+	}
+
+	while ((frame = git_array_last(stack)) != NULL) {
+		if ((delta = next_child(ctx, frame)) == NULL) {
+			free_frame(frame, &held);
+			git_array_pop(stack);
+			continue;
+		}
+
+		if (!frame->obj.data && (error = inflate_top(&stack, &held, ctx)) < 0)
+			break;
+
+		if ((error = apply_delta(&obj, &delta_end, ctx, delta, &frame->obj)) < 0)
+			break;
+
+		if ((error = git_odb__hashobj(&id, &obj)) < 0 ||
+			(error = save_resolved(ctx, delta, &id, delta_end)) < 0) {
 			git__free(obj.data);
-			stats->indexed_objects++;
-			stats->indexed_deltas++;
-			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
-				return progress_cb_result;
-
-			/* remove from the list */
-			git_vector_set(NULL, &idx->deltas, i, NULL);
-			git__free(delta);
+			break;
+		}
+
+		if (!has_children(ctx, delta->delta_off, &id)) {
+			git__free(obj.data);
+			continue;
+		}
+
+		if ((error = push_frame(&stack, &held, ctx, delta,
+				delta->delta_off, &id, &obj)) < 0) {
+			git__free(obj.data);
+			break;
+		}
+
+		trim_stack(&stack, &held);
+	}
+
+	for (i = 0; i < git_array_size(stack); i++)
+		free_frame(git_array_get(stack, i), &held);
+
+	git_array_clear(stack);
+	return error;
+}
+
+static void *resolve_thread(void *arg)
+{
+	struct resolve_ctx *ctx = arg;
+	struct entry *root;
+	const git_error *err;
+	int error = 0;
+
+	while (1) {
+		if (git_mutex_lock(&ctx->lock)) {
+			giterr_set(GITERR_THREAD, "unable to lock indexer mutex");
+			error = -1;
+			break;
+		}
+
+		if (ctx->error || ctx->next_root == ctx->roots_len) {
+			git_mutex_unlock(&ctx->lock);
+			break;
 		}
 
-		/* if none were actually set, we're done */
-		if (!non_null)
+		root = ctx->roots[ctx->next_root++];
+		git_mutex_unlock(&ctx->lock);
+
+		if ((error = resolve_root(ctx, root)) < 0)
 			break;
+	}
+
+	if (git_mutex_lock(&ctx->lock))
+		return NULL;
+
+	/* pass the error on to the thread which waits for us */
+	if (error < 0 && !ctx->error) {
+		ctx->error = error;
+		if ((err = giterr_last()) != NULL) {
+			ctx->error_class = err->klass;
+			ctx->error_msg = git__strdup(err->message);
+		}
+	}
+
+	ctx->running--;
+	git_cond_signal(&ctx->progress_cond);
+	git_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Call the progress callback on the calling thread, with a copy of the
+ * counts, until the threads are done.
+ */
+static int report_progress(struct resolve_ctx *ctx)
+{
+	git_transfer_progress stats;
+	unsigned int reported;
+	int error = 0;
+
+	if (git_mutex_lock(&ctx->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock indexer mutex");
+		return -1;
+	}
+
+	reported = ctx->stats->indexed_objects;
+
+	while (ctx->running > 0 || reported != ctx->stats->indexed_objects) {
+		if (reported == ctx->stats->indexed_objects) {
+			git_cond_wait(&ctx->progress_cond, &ctx->lock);
+			continue;
+		}
 
-		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
+		memcpy(&stats, ctx->stats, sizeof(stats));
+		reported = stats.indexed_objects;
+
+		if (error < 0)
+			continue;
+
+		git_mutex_unlock(&ctx->lock);
+		error = do_progress_callback(ctx->idx, &stats);
+		git_mutex_lock(&ctx->lock);
+
+		/* the threads stop once they see it */
+		if (error < 0 && !ctx->error)
+			ctx->error = error;
+	}
+
+	git_mutex_unlock(&ctx->lock);
+	return error;
+}
+
+#endif
+
+static int resolve_roots(struct resolve_ctx *ctx)
+{
+	size_t i;
+
+	ctx->next_root = 0;
+
+#ifdef GIT_THREADS
+	if (ctx->idx->nr_threads > 1 && ctx->roots_len > 1) {
+		git_thread *threads;
+		size_t nr_threads = min(ctx->idx->nr_threads, ctx->roots_len);
+		size_t started = 0;
+
+		int error;
+
+		threads = git__mallocarray(nr_threads, sizeof(git_thread));
+		GITERR_CHECK_ALLOC(threads);
+
+		if (git_cond_init(&ctx->progress_cond)) {
+			git__free(threads);
+			giterr_set(GITERR_THREAD, "unable to initialize indexer condition");
 			return -1;
 		}
+
+		ctx->threaded = true;
+		ctx->running = nr_threads;
+
+		for (i = 0; i < nr_threads; i++) {
+			if (git_thread_create(&threads[i], NULL, resolve_thread, ctx))
+				break;
+			started++;
+		}
+
+		if (!git_mutex_lock(&ctx->lock)) {
+			ctx->running -= nr_threads - started;
+			git_mutex_unlock(&ctx->lock);
+		}
+
+		/* the ones we could start will do the work if some failed */
+		if (!started) {
+			ctx->threaded = false;
+			git_cond_free(&ctx->progress_cond);
+			git__free(threads);
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			return -1;
+		}
+
+		error = report_progress(ctx);
+
+		for (i = 0; i < started; i++)
+			git_thread_join(&threads[i], NULL);
+
+		ctx->threaded = false;
+		git_cond_free(&ctx->progress_cond);
+		git__free(threads);
+
+		/* the callback's error is already set on this thread */
+		if (error < 0)
+			return error;
+
+		if (ctx->error) {
+			if (ctx->error_msg)
+				giterr_set_str(ctx->error_class, ctx->error_msg);
+			return ctx->error;
+		}
+
+		return 0;
+	}
+#endif
+
+	for (i = 0; i < ctx->roots_len; i++) {
+		int error;
+
+		if ((error = resolve_root(ctx, ctx->roots[i])) < 0)
+			return error;
 	}
 
 	return 0;
 }
 
+static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
+{
+	struct resolve_ctx ctx;
+	struct entry *injected;
+	int error;
+
+	if (!idx->deltas.length)
+		return 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.idx = idx;
+	ctx.stats = stats;
+
+	if (!idx->nr_threads)
+		idx->nr_threads = git_online_cpus();
+
+	if (git_mutex_init(&ctx.lock) < 0) {
+		giterr_set(GITERR_THREAD, "unable to initialize indexer mutex");
+		return -1;
+	}
+
+	if ((error = git_vector_init(&ctx.ofs_deltas, idx->deltas.length, ofs_delta_cmp)) < 0 ||
+		(error = git_vector_init(&ctx.ref_deltas, 0, ref_delta_cmp)) < 0 ||
+		(error = parse_deltas(&ctx)) < 0)
+		goto done;
+
+	/* the trees start at the objects which are not deltas */
+	ctx.roots_len = idx->objects.length;
+	ctx.roots = git__mallocarray(max(ctx.roots_len, 1), sizeof(struct entry *));
+	if (!ctx.roots) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+	memcpy(ctx.roots, idx->objects.contents, ctx.roots_len * sizeof(struct entry *));
+
+	if ((error = resolve_roots(&ctx)) < 0)
+		goto done;
+
+	/* whatever is left is based on objects we do not have */
+	while (ctx.unresolved > 0) {
+		if ((error = fix_thin_pack(idx, stats)) < 0)
+			goto done;
+
+		injected = git_vector_last(&idx->objects);
+		ctx.roots[0] = injected;
+		ctx.roots_len = 1;
+
+		if ((error = resolve_roots(&ctx)) < 0)
+			goto done;
+	}
+
+done:
+	git__free(ctx.roots);
+	git__free(ctx.error_msg);
+	git_vector_free(&ctx.ofs_deltas);
+	git_vector_free(&ctx.ref_deltas);
+	git_mutex_free(&ctx.lock);
+	return error;
+}
+
 static int update_header_and_rehash(git_indexer *idx, git_transfer_progress *stats)
 {
 	void *ptr;
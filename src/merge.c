@@ -28,6 +28,7 @@
 #include "config.h"
 #include "oidarray.h"
 #include "annotated_commit.h"
+#include "graph_cache.h"
 
 #include "git2/types.h"
 #include "git2/repository.h"
@@ -231,6 +232,7 @@ static int merge_bases(git_commit_list **out, git_revwalk **walk_out, git_reposi
 
 	if (!result) {
 		git_revwalk_free(walk);
+		git_graph_cache_set_base(repo, one, two, NULL, true);
 		giterr_set(GITERR_MERGE, "No merge base found");
 		return GIT_ENOTFOUND;
 	}
@@ -252,10 +254,19 @@ int git_merge_base(git_oid *out, git_repository *repo, const git_oid *one, const
 	git_revwalk *walk;
 	git_commit_list *result;
 
+	if (git_graph_cache_get_base(out, repo, one, two) == 0) {
+		if (!git_oid_iszero(out))
+			return 0;
+
+		giterr_set(GITERR_MERGE, "No merge base found");
+		return GIT_ENOTFOUND;
+	}
+
 	if ((error = merge_bases(&result, &walk, repo, one, two)) < 0)
 		return error;
 
 	git_oid_cpy(out, &result->item->oid);
+	git_graph_cache_set_base(repo, one, two, out, result->next == NULL);
 	git_commit_list_free(&result);
 	git_revwalk_free(walk);
 
@@ -274,6 +285,8 @@ int git_merge_bases(git_oidarray *out, git_repository *repo, const git_oid *one,
 	if ((error = merge_bases(&result, &walk, repo, one, two)) < 0)
 		return error;
 
+	git_graph_cache_set_base(repo, one, two, &result->item->oid, result->next == NULL);
+
 	list = result;
 	while (list) {
 		git_oid *id = git_array_alloc(array);
@@ -0,0 +1,848 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "path.h"
+#include "sha1_lookup.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OBJECT_ID_VERSION 1
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d	   /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446		   /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c		   /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646	   /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_CHUNK_ENTRY_SIZE 12
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct git_midx_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+struct git_midx_writer {
+	/* The path of the directory where the .pack/.idx files are stored. */
+	git_buf pack_dir;
+
+	/* The list of packfiles that are going to be included in the index. */
+	git_vector packs;
+};
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint64_t) midx_get_be64(const unsigned char *p)
+{
+	return ((uint64_t)ntohl(*((uint32_t *)p)) << 32) |
+		ntohl(*((uint32_t *)(p + 4)));
+}
+
+static int midx_parse_packfile_names(
+		git_midx_file *idx,
+		const unsigned char *data,
+		uint32_t packfiles,
+		struct git_midx_chunk *chunk)
+{
+	int error;
+	uint32_t i;
+	char *packfile_name = (char *)(data + chunk->offset);
+	size_t chunk_size = chunk->length, len;
+
+	if (chunk->offset == 0)
+		return midx_error("missing Packfile Names chunk");
+	if (chunk->length == 0)
+		return midx_error("empty Packfile Names chunk");
+
+	for (i = 0; i < packfiles; ++i) {
+		len = p_strnlen(packfile_name, chunk_size);
+		if (len == 0)
+			return midx_error("empty packfile name");
+		if (len + 1 > chunk_size)
+			return midx_error("unterminated packfile name");
+		if (git__suffixcmp(packfile_name, ".idx") != 0 ||
+			strchr(packfile_name, '/') != NULL)
+			return midx_error("invalid packfile name");
+		if (i > 0 && strcmp(git_vector_get(&idx->packfile_names, i - 1), packfile_name) >= 0)
+			return midx_error("packfile names are not sorted");
+
+		if ((error = git_vector_insert(&idx->packfile_names, packfile_name)) < 0)
+			return error;
+
+		packfile_name += len + 1;
+		chunk_size -= len + 1;
+	}
+
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return midx_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+	idx->num_objects = nr;
+	return 0;
+}
+
+static int midx_parse_oid_lookup(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid;
+
+	if (chunk_oid_lookup->offset == 0)
+		return midx_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return midx_error("empty OID Lookup chunk");
+	if (chunk_oid_lookup->length != idx->num_objects * GIT_OID_RAWSZ)
+		return midx_error("OID Lookup chunk has wrong length");
+
+	idx->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = oid++;
+	for (i = 1; i < idx->num_objects; ++i, ++oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return midx_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int midx_parse_object_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_offsets)
+{
+	if (chunk_object_offsets->offset == 0)
+		return midx_error("missing Object Offsets chunk");
+	if (chunk_object_offsets->length == 0)
+		return midx_error("empty Object Offsets chunk");
+	if (chunk_object_offsets->length != idx->num_objects * 8)
+		return midx_error("Object Offsets chunk has wrong length");
+
+	idx->object_offsets = data + chunk_object_offsets->offset;
+
+	return 0;
+}
+
+static int midx_parse_object_large_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_large_offsets)
+{
+	if (chunk_object_large_offsets->length == 0)
+		return 0;
+	if (chunk_object_large_offsets->length % 8 != 0)
+		return midx_error("malformed Object Large Offsets chunk");
+
+	idx->object_large_offsets = (const uint64_t *)(data + chunk_object_large_offsets->offset);
+	idx->num_object_large_offsets = chunk_object_large_offsets->length / 8;
+
+	return 0;
+}
+
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size)
+{
+	const struct git_midx_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_midx_chunk *last_chunk;
+	uint32_t i, packfiles;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	git_oid idx_checksum = {{0}};
+	int error;
+	struct git_midx_chunk chunk_packfile_names = {0},
+			chunk_oid_fanout = {0},
+			chunk_oid_lookup = {0},
+			chunk_object_offsets = {0},
+			chunk_object_large_offsets = {0};
+
+	assert(idx);
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("multi-pack index is too short");
+
+	hdr = ((const struct git_midx_header *)data);
+
+	if (hdr->signature != htonl(MIDX_SIGNATURE) ||
+		hdr->version != MIDX_VERSION ||
+		hdr->object_id_version != MIDX_OBJECT_ID_VERSION)
+		return midx_error("unsupported multi-pack index version");
+	if (hdr->chunks == 0)
+		return midx_error("no chunks in multi-pack index");
+	if (hdr->base_midx_files != 0)
+		return midx_error("chained multi-pack indexes are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset =
+			sizeof(struct git_midx_header) +
+			(1 + hdr->chunks) * MIDX_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return midx_error("wrong index size");
+	git_oid_fromraw(&idx->checksum, data + trailer_offset);
+
+	if (git_hash_buf(&idx_checksum, data, (size_t)trailer_offset) < 0)
+		return midx_error("could not calculate signature");
+	if (!git_oid_equal(&idx_checksum, &idx->checksum))
+		return midx_error("index signature mismatch");
+
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += MIDX_CHUNK_ENTRY_SIZE) {
+		chunk_offset = (git_off_t)midx_get_be64(chunk_hdr + 4);
+		if (chunk_offset < last_chunk_offset)
+			return midx_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return midx_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case MIDX_PACKFILE_NAMES_ID:
+			chunk_packfile_names.offset = last_chunk_offset;
+			last_chunk = &chunk_packfile_names;
+			break;
+
+		case MIDX_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case MIDX_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case MIDX_OBJECT_OFFSETS_ID:
+			chunk_object_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_offsets;
+			break;
+
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			chunk_object_large_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_large_offsets;
+			break;
+
+		default:
+			/* unknown chunks are ignored, as git does */
+			last_chunk = NULL;
+			break;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	packfiles = ntohl(hdr->packfiles);
+	if ((error = git_vector_init(&idx->packfile_names, packfiles, NULL)) < 0)
+		return error;
+
+	if ((error = midx_parse_packfile_names(
+			idx, data, packfiles, &chunk_packfile_names)) < 0 ||
+		(error = midx_parse_oid_fanout(idx, data, &chunk_oid_fanout)) < 0 ||
+		(error = midx_parse_oid_lookup(idx, data, &chunk_oid_lookup)) < 0 ||
+		(error = midx_parse_object_offsets(idx, data, &chunk_object_offsets)) < 0 ||
+		(error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_midx_open(
+		git_midx_file **idx_out,
+		const char *path)
+{
+	git_midx_file *idx;
+	git_file fd = -1;
+	size_t idx_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "multi-pack-index file not found - '%s'", path);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid pack index '%s'", path);
+		return -1;
+	}
+	idx_size = (size_t)st.st_size;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	git_futils_filestamp_set_from_stat(&idx->stamp, &st);
+
+	error = git_futils_mmap_ro(&idx->index_map, fd, 0, idx_size);
+	p_close(fd);
+	if (error < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	if ((error = git_midx_parse(idx, idx->index_map.data, idx_size)) < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	*idx_out = idx;
+	return 0;
+}
+
+bool git_midx_needs_refresh(
+		const git_midx_file *idx,
+		const char *path)
+{
+	git_futils_filestamp stamp;
+
+	git_futils_filestamp_set(&stamp, &idx->stamp);
+
+	/* a missing or changed file both mean that our view is stale */
+	return git_futils_filestamp_check(&stamp, path) != 0;
+}
+
+static git_off_t nth_midxed_object_offset(git_midx_file *idx, size_t n)
+{
+	const unsigned char *object_offset;
+	uint32_t offset32;
+
+	object_offset = idx->object_offsets + n * 8;
+	offset32 = ntohl(*((uint32_t *)(object_offset + 4)));
+
+	if (idx->object_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		uint32_t large_pos = offset32 & ~MIDX_LARGE_OFFSET_NEEDED;
+
+		if (large_pos >= idx->num_object_large_offsets)
+			return midx_error("invalid index into the object large offsets table");
+
+		return (git_off_t)midx_get_be64(
+			(const unsigned char *)(idx->object_large_offsets + large_pos));
+	}
+
+	return (git_off_t)offset32;
+}
+
+static int midx_find_offset(
+		size_t *pos_out,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	unsigned hi, lo;
+	const git_oid *current = NULL;
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	if (lo < hi)
+		pos = sha1_position(idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+	else
+		pos = -1 - (int)lo;
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len))
+			found = 2;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for multi-pack index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
+
+	*pos_out = (size_t)pos;
+	return 0;
+}
+
+size_t git_midx_unique_prefix_len(
+		git_midx_file *idx,
+		const git_oid *id)
+{
+	unsigned hi, lo;
+
+	assert(idx && id);
+
+	hi = ntohl(idx->oid_fanout[(int)id->id[0]]);
+	lo = ((id->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)id->id[0] - 1]));
+
+	return sha1_unique_prefix_len(
+		idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, idx->num_objects, id->id);
+}
+
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len)
+{
+	git_off_t offset;
+	size_t pos, pack_index;
+	int error;
+
+	assert(e && idx && idx->oid_lookup);
+
+	if ((error = midx_find_offset(&pos, idx, short_oid, len)) < 0)
+		return error;
+
+	pack_index = ntohl(*((uint32_t *)(idx->object_offsets + pos * 8)));
+	if (pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+
+	offset = nth_midxed_object_offset(idx, pos);
+	if (offset < 0)
+		return -1;
+
+	e->pack_index = pack_index;
+	e->offset = offset;
+	git_oid_cpy(&e->sha1, idx->oid_lookup + pos);
+	return 0;
+}
+
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data)
+{
+	size_t i;
+	int error;
+
+	assert(idx);
+
+	for (i = 0; i < idx->num_objects; ++i) {
+		if ((error = cb(&idx->oid_lookup[i], data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return 0;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	git_vector_free(&idx->packfile_names);
+	git_futils_mmap_free(&idx->index_map);
+	git__free(idx);
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX WRITER
+ *
+ ***********************************************************/
+
+static int packfile__cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_file *a = a_;
+	const struct git_pack_file *b = b_;
+
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+int git_midx_writer_new(
+		git_midx_writer **out,
+		const char *pack_dir)
+{
+	git_midx_writer *w = git__calloc(1, sizeof(git_midx_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->pack_dir, pack_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->packs, 0, packfile__cmp) < 0) {
+		git_buf_free(&w->pack_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_midx_writer_free(git_midx_writer *w)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&w->packs);
+	git_buf_free(&w->pack_dir);
+	git__free(w);
+}
+
+int git_midx_writer_add(
+		git_midx_writer *w,
+		const char *idx_path)
+{
+	git_buf idx_path_buf = GIT_BUF_INIT;
+	int error;
+	struct git_pack_file *p;
+
+	assert(w && idx_path);
+
+	if ((error = git_path_join_unrooted(&idx_path_buf, idx_path, git_buf_cstr(&w->pack_dir), NULL)) < 0)
+		return error;
+
+	if (git__suffixcmp(git_buf_cstr(&idx_path_buf), ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not an index file", idx_path);
+		git_buf_free(&idx_path_buf);
+		return -1;
+	}
+
+	error = git_mwindow_get_pack(&p, git_buf_cstr(&idx_path_buf));
+	git_buf_free(&idx_path_buf);
+	if (error < 0)
+		return error;
+
+	if ((error = git_vector_insert(&w->packs, p)) < 0) {
+		git_mwindow_put_pack(p);
+		return error;
+	}
+
+	return 0;
+}
+
+typedef git_array_t(git_midx_entry) object_entry_array_t;
+
+struct object_entry_cb_state {
+	uint32_t pack_index;
+	object_entry_array_t *object_entries_array;
+};
+
+static int object_entry__cb(const git_oid *oid, git_off_t offset, void *data)
+{
+	struct object_entry_cb_state *state = (struct object_entry_cb_state *)data;
+
+	git_midx_entry *entry = git_array_alloc(*state->object_entries_array);
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->sha1, oid);
+	entry->offset = offset;
+	entry->pack_index = state->pack_index;
+
+	return 0;
+}
+
+static int object_entry__cmp(const void *a_, const void *b_, void *payload)
+{
+	const git_midx_entry *a = (const git_midx_entry *)a_;
+	const git_midx_entry *b = (const git_midx_entry *)b_;
+	git_vector *packs = payload;
+	const struct git_pack_file *pa, *pb;
+	int error;
+
+	if ((error = git_oid_cmp(&a->sha1, &b->sha1)) != 0)
+		return error;
+
+	/*
+	 * When an object is in more than one pack, prefer the most recent
+	 * pack, the same way the pack backend orders its search.
+	 */
+	pa = git_vector_get(packs, a->pack_index);
+	pb = git_vector_get(packs, b->pack_index);
+	if (pa->mtime != pb->mtime)
+		return pa->mtime > pb->mtime ? -1 : 1;
+
+	return (a->pack_index > b->pack_index) - (a->pack_index < b->pack_index);
+}
+
+static int write_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int write_be64(git_buf *buf, uint64_t value)
+{
+	if (write_be32(buf, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return write_be32(buf, (uint32_t)(value & 0xffffffff));
+}
+
+static int write_chunk_header(git_buf *buf, uint32_t chunk_id, git_off_t offset)
+{
+	if (write_be32(buf, chunk_id) < 0)
+		return -1;
+	return write_be64(buf, (uint64_t)offset);
+}
+
+static int midx_write(git_buf *out, git_midx_writer *w)
+{
+	int error = 0;
+	size_t i, num_objects = 0, large_offsets = 0;
+	struct git_midx_header hdr = {0};
+	uint32_t oid_fanout_count;
+	object_entry_array_t object_entries_array = GIT_ARRAY_INIT;
+	git_midx_entry *entry, *last_entry = NULL;
+	git_oid checksum;
+	git_buf packfile_names = GIT_BUF_INIT,
+		oid_lookup = GIT_BUF_INIT,
+		object_offsets = GIT_BUF_INIT,
+		object_large_offsets = GIT_BUF_INIT;
+	git_off_t offset;
+	struct git_pack_file *p;
+
+	hdr.signature = htonl(MIDX_SIGNATURE);
+	hdr.version = MIDX_VERSION;
+	hdr.object_id_version = MIDX_OBJECT_ID_VERSION;
+	hdr.base_midx_files = 0;
+	hdr.packfiles = htonl((uint32_t)w->packs.length);
+
+	git_vector_sort(&w->packs);
+	git_vector_foreach(&w->packs, i, p) {
+		git_buf idx_name = GIT_BUF_INIT;
+		struct object_entry_cb_state state = {0};
+
+		state.pack_index = (uint32_t)i;
+		state.object_entries_array = &object_entries_array;
+
+		/* store the name of the .idx relative to the pack directory */
+		if ((error = git_buf_sets(&idx_name, p->pack_name)) == 0) {
+			git_buf_shorten(&idx_name, strlen("pack"));
+			git_buf_puts(&idx_name, "idx");
+			error = git_buf_put(&packfile_names,
+				idx_name.ptr + git_path_basename_offset(&idx_name),
+				git_buf_len(&idx_name) - git_path_basename_offset(&idx_name) + 1);
+		}
+		git_buf_free(&idx_name);
+		if (error < 0)
+			goto cleanup;
+
+		if ((error = git_pack_foreach_entry_offset(p, object_entry__cb, &state)) < 0)
+			goto cleanup;
+	}
+
+	/* Pad the packfile names so it is a multiple of four. */
+	while (git_buf_len(&packfile_names) & 3) {
+		if ((error = git_buf_putc(&packfile_names, '\0')) < 0)
+			goto cleanup;
+	}
+
+	/* Fill the OID Lookup table. */
+	git__qsort_r(object_entries_array.ptr, object_entries_array.size,
+		sizeof(git_midx_entry), object_entry__cmp, &w->packs);
+	for (i = 0; i < git_array_size(object_entries_array); i++) {
+		entry = git_array_get(object_entries_array, i);
+
+		if (last_entry && git_oid_equal(&last_entry->sha1, &entry->sha1))
+			continue;
+		last_entry = entry;
+
+		if ((error = git_buf_put(&oid_lookup, (const char *)entry->sha1.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+		num_objects++;
+	}
+
+	/* Fill the Object Offsets and Object Large Offsets tables. */
+	last_entry = NULL;
+	for (i = 0; i < git_array_size(object_entries_array); i++) {
+		uint32_t word;
+		entry = git_array_get(object_entries_array, i);
+
+		if (last_entry && git_oid_equal(&last_entry->sha1, &entry->sha1))
+			continue;
+		last_entry = entry;
+
+		if ((error = write_be32(&object_offsets, (uint32_t)entry->pack_index)) < 0)
+			goto cleanup;
+
+		if (entry->offset >= 0x80000000l) {
+			word = (uint32_t)large_offsets++ | MIDX_LARGE_OFFSET_NEEDED;
+			if ((error = write_be64(&object_large_offsets, (uint64_t)entry->offset)) < 0)
+				goto cleanup;
+		} else {
+			word = (uint32_t)entry->offset;
+		}
+
+		if ((error = write_be32(&object_offsets, word)) < 0)
+			goto cleanup;
+	}
+
+	/* Write the header. */
+	hdr.chunks = 4;
+	if (git_buf_len(&object_large_offsets) > 0)
+		hdr.chunks++;
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk headers. */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * MIDX_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(out, MIDX_PACKFILE_NAMES_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&packfile_names);
+	if ((error = write_chunk_header(out, MIDX_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += 256 * sizeof(uint32_t);
+	if ((error = write_chunk_header(out, MIDX_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = write_chunk_header(out, MIDX_OBJECT_OFFSETS_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&object_offsets);
+	if (git_buf_len(&object_large_offsets) > 0) {
+		if ((error = write_chunk_header(out, MIDX_OBJECT_LARGE_OFFSETS_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&object_large_offsets);
+	}
+	if ((error = write_chunk_header(out, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write all the chunks. */
+	if ((error = git_buf_put(out, git_buf_cstr(&packfile_names), git_buf_len(&packfile_names))) < 0)
+		goto cleanup;
+
+	oid_fanout_count = 0;
+	for (i = 0; i < 256; i++) {
+		const unsigned char *oids = (const unsigned char *)oid_lookup.ptr;
+
+		while (oid_fanout_count < num_objects &&
+			oids[oid_fanout_count * GIT_OID_RAWSZ] <= i)
+			oid_fanout_count++;
+
+		if ((error = write_be32(out, oid_fanout_count)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_buf_put(out, oid_lookup.ptr, git_buf_len(&oid_lookup))) < 0 ||
+		(error = git_buf_put(out, object_offsets.ptr, git_buf_len(&object_offsets))) < 0 ||
+		(error = git_buf_put(out, object_large_offsets.ptr, git_buf_len(&object_large_offsets))) < 0)
+		goto cleanup;
+
+	/* Finalize the checksum and write the trailer. */
+	if ((error = git_hash_buf(&checksum, out->ptr, git_buf_len(out))) < 0)
+		goto cleanup;
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_array_clear(object_entries_array);
+	git_buf_free(&packfile_names);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&object_offsets);
+	git_buf_free(&object_large_offsets);
+	return error;
+}
+
+int git_midx_writer_commit(
+		git_midx_writer *w)
+{
+	int error;
+	git_buf midx = GIT_BUF_INIT, midx_path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+
+	assert(w);
+
+	if ((error = midx_write(&midx, w)) < 0 ||
+		(error = git_buf_joinpath(&midx_path, git_buf_cstr(&w->pack_dir), GIT_MIDX_FILE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, git_buf_cstr(&midx_path),
+			GIT_FILEBUF_DO_NOT_BUFFER, GIT_PACK_FILE_MODE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_write(&output, midx.ptr, git_buf_len(&midx))) < 0) {
+		git_filebuf_cleanup(&output);
+		goto cleanup;
+	}
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_buf_free(&midx);
+	git_buf_free(&midx_path);
+	return error;
+}
+
+int git_midx_writer_dump(
+		git_buf *midx,
+		git_midx_writer *w)
+{
+	assert(midx && w);
+
+	git_buf_sanitize(midx);
+	return midx_write(midx, w);
+}
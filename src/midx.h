@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "git2/sys/midx.h"
+
+#include "common.h"
+#include "map.h"
+#include "vector.h"
+#include "fileops.h"
+#include "odb.h"
+
+#define GIT_MIDX_FILE "multi-pack-index"
+
+/*
+ * A multi-pack-index file.
+ *
+ * This file contains a merged index for multiple independent .pack files.
+ * It can help reduce the number of binary search operations needed to find
+ * an object: instead of probing the `.idx` of every pack, a single fanout
+ * lookup and binary search over all the packed objects gives us the pack
+ * and the offset of the object inside of it.
+ */
+typedef struct git_midx_file {
+	git_map index_map;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of objects in the index. */
+	uint32_t num_objects;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/* The Object Offsets table. Each entry has two 4-byte fields with the pack index and the offset. */
+	const unsigned char *object_offsets;
+
+	/* The Object Large Offsets table. */
+	const uint64_t *object_large_offsets;
+	/* The number of entries in the Object Large Offsets table. Each entry has an 8-byte with an offset */
+	size_t num_object_large_offsets;
+
+	/* The names of all the packfiles, pointing into the mapped file. */
+	git_vector packfile_names;
+
+	/* The checksum of the multi-pack-index file. */
+	git_oid checksum;
+
+	/* The identity of the file when it was loaded. */
+	git_futils_filestamp stamp;
+} git_midx_file;
+
+/*
+ * An entry in the multi-pack-index file. Similar in purpose to git_pack_entry.
+ */
+typedef struct git_midx_entry {
+	/* The index within idx->packfile_names where the packfile name can be found. */
+	size_t pack_index;
+	/* The offset within the .pack file where the requested object is found. */
+	git_off_t offset;
+	/* The SHA-1 hash of the requested object. */
+	git_oid sha1;
+} git_midx_entry;
+
+int git_midx_open(
+		git_midx_file **idx_out,
+		const char *path);
+bool git_midx_needs_refresh(
+		const git_midx_file *idx,
+		const char *path);
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len);
+/*
+ * The number of hex digits of `id` needed to tell it apart from every
+ * other object in the multi-pack-index.
+ */
+size_t git_midx_unique_prefix_len(
+		git_midx_file *idx,
+		const git_oid *id);
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data);
+void git_midx_free(git_midx_file *idx);
+
+/* Parse an in-memory multi-pack-index; `data` must outlive `idx`. */
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size);
+
+#endif
@@ -24,11 +24,17 @@ GIT__USE_STRMAP
 #define DEFAULT_MAPPED_LIMIT \
 	((1024 * 1024) * (sizeof(void*) >= 8 ? 8192ULL : 256UL))
 
+#define DEFAULT_FILE_LIMIT 0
+
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
+size_t git_mwindow__file_limit = DEFAULT_FILE_LIMIT;
 
-/* Whenever you want to read or modify this, grab git__mwindow_mutex */
-static git_mwindow_ctl mem_ctl;
+/*
+ * Whenever you want to read or modify this, grab git__mwindow_mutex,
+ * except for `used_ctr` which is only ever bumped atomically.
+ */
+git_mwindow_ctl git_mwindow__mem_ctl;
 
 /* Global list of mwindow files, to open packs once across repos */
 git_strmap *git__pack_cache = NULL;
@@ -150,7 +156,7 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
  */
 void git_mwindow_free_all_locked(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t i;
 
 	/*
@@ -170,7 +176,7 @@ void git_mwindow_free_all_locked(git_mwindow_file *mwf)
 
 	while (mwf->windows) {
 		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
+		assert(w->inuse_cnt.val == 0);
 
 		ctl->mapped -= w->window_map.len;
 		ctl->open_windows--;
@@ -203,7 +209,7 @@ static void git_mwindow_scan_lru(
 	git_mwindow *w, *w_l;
 
 	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
+		if (!w->inuse_cnt.val) {
 			/*
 			 * If the current one is more recent than the last one,
 			 * store it in the output parameter. If lru_w is NULL,
@@ -220,14 +226,16 @@ static void git_mwindow_scan_lru(
 
 /*
  * Close the least recently used window. You should check to see if
- * the file descriptors need closing from time to time. Called under
- * lock from new_window.
+ * the file descriptors need closing from time to time. Called from
+ * new_window with the global lock and the lock of `mwf` held; the
+ * other files are locked while they are scanned.
  */
 static int git_mwindow_close_lru(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t i;
 	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
+	git_mwindow_file *lru_file = NULL;
 
 	/* FIXME: Does this give us any advantage? */
 	if(mwf->windows)
@@ -236,9 +244,24 @@ static int git_mwindow_close_lru(git_mwindow_file *mwf)
 	for (i = 0; i < ctl->windowfiles.length; ++i) {
 		git_mwindow *last = lru_w;
 		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
+
+		if (cur == mwf)
+			continue;
+
+		if (git_mutex_lock(&cur->lock))
+			continue;
+
 		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
+
+		if (lru_w != last) {
+			/* keep the file holding the LRU window locked */
+			if (lru_file)
+				git_mutex_unlock(&lru_file->lock);
+			lru_file = cur;
 			list = &cur->windows;
+		} else {
+			git_mutex_unlock(&cur->lock);
+		}
 	}
 
 	if (!lru_w) {
@@ -254,20 +277,23 @@ static int git_mwindow_close_lru(git_mwindow_file *mwf)
 	else
 		*list = lru_w->next;
 
+	if (lru_file)
+		git_mutex_unlock(&lru_file->lock);
+
 	git__free(lru_w);
 	ctl->open_windows--;
 
 	return 0;
 }
 
-/* This gets called under lock from git_mwindow_open */
+/* This gets called from git_mwindow_open with the global lock and the lock of `mwf` held */
 static git_mwindow *new_window(
 	git_mwindow_file *mwf,
 	git_file fd,
 	git_off_t size,
 	git_off_t offset)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	size_t walign = git_mwindow__window_size / 2;
 	git_off_t len;
 	git_mwindow *w;
@@ -312,6 +338,20 @@ static git_mwindow *new_window(
 	return w;
 }
 
+/* Called with the lock of `mwf` held */
+static git_mwindow *find_window(git_mwindow_file *mwf, git_off_t offset, size_t extra)
+{
+	git_mwindow *w;
+
+	for (w = mwf->windows; w; w = w->next) {
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			break;
+	}
+
+	return w;
+}
+
 /*
  * Open a new window, closing the least recenty used until we have
  * enough space. Don't forget to add it to your list
@@ -323,45 +363,89 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	git_mwindow *w = *cursor;
 
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-		return NULL;
-	}
-
 	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
-		if (w) {
-			w->inuse_cnt--;
+		if (git_mutex_lock(&mwf->lock)) {
+			giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+			return NULL;
 		}
 
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
-		}
+		if (w)
+			git_atomic_dec(&w->inuse_cnt);
+		*cursor = NULL;
 
 		/*
 		 * If there isn't a suitable window, we need to create a new
-		 * one.
+		 * one. The global lock comes first, so let go of the file
+		 * and look again once we have both, as another thread may
+		 * have mapped the window in the meantime.
 		 */
-		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
+		while ((w = find_window(mwf, offset, extra)) == NULL) {
+			/*
+			 * The file may have been closed to free up its
+			 * descriptor; open it again without holding its lock,
+			 * as that takes the global one.
+			 */
+			if (mwf->fd < 0) {
+				git_mutex_unlock(&mwf->lock);
+
+				if (!mwf->reopen) {
+					giterr_set(GITERR_OS, "the file has been closed");
+					return NULL;
+				}
+
+				if (mwf->reopen(mwf) < 0)
+					return NULL;
+
+				if (git_mutex_lock(&mwf->lock)) {
+					giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+					return NULL;
+				}
+
+				continue;
+			}
+
+			git_mutex_unlock(&mwf->lock);
+
+			if (git_mutex_lock(&git__mwindow_mutex)) {
+				giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+				return NULL;
+			}
+
+			if (git_mutex_lock(&mwf->lock)) {
 				git_mutex_unlock(&git__mwindow_mutex);
+				giterr_set(GITERR_THREAD, "unable to lock mwindow file mutex");
+				return NULL;
+			}
+
+			if (mwf->fd >= 0 &&
+				(w = find_window(mwf, offset, extra)) == NULL &&
+				(w = new_window(mwf, mwf->fd, mwf->size, offset)) != NULL) {
+				w->next = mwf->windows;
+				mwf->windows = w;
+			}
+
+			git_mutex_unlock(&git__mwindow_mutex);
+
+			if (w != NULL)
+				break;
+
+			/* unless it got closed in the meantime, mapping failed */
+			if (mwf->fd >= 0) {
+				git_mutex_unlock(&mwf->lock);
 				return NULL;
 			}
-			w->next = mwf->windows;
-			mwf->windows = w;
 		}
-	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
+		/* Store the window we changed to in the cursor */
+		w->last_used = (size_t)git_atomic_ssize_add(&ctl->used_ctr, 1);
+		mwf->last_used = w->last_used;
+		git_atomic_inc(&w->inuse_cnt);
 		*cursor = w;
+
+		git_mutex_unlock(&mwf->lock);
 	}
 
 	offset -= w->offset;
@@ -369,13 +453,83 @@ unsigned char *git_mwindow_open(
 	if (left)
 		*left = (unsigned int)(w->window_map.len - offset);
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
+/*
+ * Close the least recently used file which may be closed and has no
+ * window in use, so its descriptor can be reused. The file is taken
+ * off the list; it registers itself again when it gets reopened.
+ * Called under the global lock.
+ */
+static int git_mwindow_close_lru_file(void)
+{
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
+	git_mwindow_file *cur, *lru_file = NULL;
+	git_mwindow *w;
+	size_t i, lru_i = 0;
+
+	git_vector_foreach(&ctl->windowfiles, i, cur) {
+		if (!cur->closeable || cur->fd < 0)
+			continue;
+
+		if (lru_file && cur->last_used >= lru_file->last_used)
+			continue;
+
+		if (git_mutex_lock(&cur->lock))
+			continue;
+
+		for (w = cur->windows; w; w = w->next) {
+			if (w->inuse_cnt.val)
+				break;
+		}
+
+		git_mutex_unlock(&cur->lock);
+
+		if (!w) {
+			lru_file = cur;
+			lru_i = i;
+		}
+	}
+
+	if (!lru_file)
+		return -1;
+
+	if (git_mutex_lock(&lru_file->lock))
+		return -1;
+
+	for (w = lru_file->windows; w; w = w->next) {
+		if (w->inuse_cnt.val) {
+			/* somebody started reading from it in the meantime */
+			git_mutex_unlock(&lru_file->lock);
+			return -1;
+		}
+	}
+
+	while (lru_file->windows) {
+		w = lru_file->windows;
+
+		ctl->mapped -= w->window_map.len;
+		ctl->open_windows--;
+
+		git_futils_mmap_free(&w->window_map);
+
+		lru_file->windows = w->next;
+		git__free(w);
+	}
+
+	p_close(lru_file->fd);
+	lru_file->fd = -1;
+
+	git_vector_remove(&ctl->windowfiles, lru_i);
+
+	git_mutex_unlock(&lru_file->lock);
+	return 0;
+}
+
 int git_mwindow_file_register(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	int ret;
 
 	if (git_mutex_lock(&git__mwindow_mutex)) {
@@ -389,6 +543,16 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 		return -1;
 	}
 
+	/*
+	 * Like the mapped limit, this is a soft limit: if every open file
+	 * is in use, we go over it.
+	 */
+	while (git_mwindow__file_limit &&
+		ctl->windowfiles.length >= git_mwindow__file_limit &&
+		git_mwindow_close_lru_file() == 0) /* nop */;
+
+	mwf->last_used = (size_t)git_atomic_ssize_add(&ctl->used_ctr, 1);
+
 	ret = git_vector_insert(&ctl->windowfiles, mwf);
 	git_mutex_unlock(&git__mwindow_mutex);
 
@@ -397,7 +561,7 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 
 void git_mwindow_file_deregister(git_mwindow_file *mwf)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
+	git_mwindow_ctl *ctl = &git_mwindow__mem_ctl;
 	git_mwindow_file *cur;
 	size_t i;
 
@@ -418,13 +582,7 @@ void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		if (git_mutex_lock(&git__mwindow_mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
-			return;
-		}
-
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
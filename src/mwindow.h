@@ -10,19 +10,32 @@
 
 #include "map.h"
 #include "vector.h"
+#include "thread-utils.h"
 
 typedef struct git_mwindow {
 	struct git_mwindow *next;
 	git_map window_map;
 	git_off_t offset;
 	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
 } git_mwindow;
 
+/*
+ * The window list of a file is guarded by its own lock, so looking up a
+ * window which is already mapped never touches the global mwindow lock.
+ * That one is only needed to map or unmap a window, and must be taken
+ * before the lock of any file.
+ */
 typedef struct git_mwindow_file {
+	git_mutex lock;
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
+	size_t last_used;
+	/* the file can be closed to stay within the open file limit */
+	unsigned int closeable:1;
+	/* opens a closed file again when a window of it is needed */
+	int (*reopen)(struct git_mwindow_file *mwf);
 } git_mwindow_file;
 
 typedef struct git_mwindow_ctl {
@@ -31,10 +44,12 @@ typedef struct git_mwindow_ctl {
 	unsigned int mmap_calls;
 	unsigned int peak_open_windows;
 	size_t peak_mapped;
-	size_t used_ctr;
+	git_atomic_ssize used_ctr;
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
+extern git_mwindow_ctl git_mwindow__mem_ctl;
+
 int git_mwindow_contains(git_mwindow *win, git_off_t offset);
 void git_mwindow_free_all(git_mwindow_file *mwf); /* locks */
 void git_mwindow_free_all_locked(git_mwindow_file *mwf); /* run under lock */
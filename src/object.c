@@ -429,7 +429,7 @@ int git_object_short_id(git_buf *out, const git_object *obj)
 {
 	git_repository *repo;
 	int len = GIT_ABBREV_DEFAULT, error;
-	git_oid id = {{0}};
+	size_t size;
 	git_odb *odb;
 
 	assert(out && obj);
@@ -443,23 +443,12 @@ int git_object_short_id(git_buf *out, const git_object *obj)
 	if ((error = git_repository_odb(&odb, repo)) < 0)
 		return error;
 
-	while (len < GIT_OID_HEXSZ) {
-		/* set up short oid */
-		memcpy(&id.id, &obj->cached.oid.id, (len + 1) / 2);
-		if (len & 1)
-			id.id[len / 2] &= 0xf0;
+	error = git_odb_unique_prefix_len(
+		&size, odb, &obj->cached.oid, len < 0 ? 0 : (size_t)len);
 
-		error = git_odb_exists_prefix(NULL, odb, &id, len);
-		if (error != GIT_EAMBIGUOUS)
-			break;
-
-		giterr_clear();
-		len++;
-	}
-
-	if (!error && !(error = git_buf_grow(out, len + 1))) {
-		git_oid_tostr(out->ptr, len + 1, &id);
-		out->size = len;
+	if (!error && !(error = git_buf_grow(out, size + 1))) {
+		git_oid_tostr(out->ptr, size + 1, &obj->cached.oid);
+		out->size = size;
 	}
 
 	git_odb_free(odb);
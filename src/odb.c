@@ -27,6 +27,7 @@
  */
 #define GIT_LOOSE_PRIORITY 1
 #define GIT_PACKED_PRIORITY 2
+#define GIT_BULK_PRIORITY 3
 
 #define GIT_ALTERNATES_MAX_DEPTH 5
 
@@ -380,13 +381,286 @@ static int backend_sort_cmp(const void *a, const void *b)
 	return backend_a->is_alternate ? 1 : -1;
 }
 
+/*
+ * The negative lookup filter answers `git_odb_exists` for objects which
+ * aren't in the database without asking the backends, which would
+ * rescan the pack directory for every miss. It is a Bloom filter of
+ * every object in the objects directories of the database.
+ *
+ * To notice objects written by somebody else, we keep the stat data of
+ * the pack directory and of the loose object fanout directories of each
+ * objects directory, as they were when we last listed them. Before
+ * trusting the filter on a miss, we check the pack directories and the
+ * fanout directory of the object: a new pack means rebuilding the
+ * filter, and a new loose object means listing its fanout directory
+ * again. Directories which changed in the second we looked at them may
+ * change again without their stat data telling, so they are always
+ * considered changed.
+ */
+bool git_odb__exists_filter = false;
+
+typedef struct {
+	git_buf path; /* the objects directory, and the current subdirectory */
+	size_t path_len;
+	git_futils_filestamp pack_stamp;
+	git_futils_filestamp fanout_stamps[256];
+} filter_dir;
+
+static int filter_add_dir(git_odb *db, const char *objects_dir)
+{
+	filter_dir *dir = git__calloc(1, sizeof(filter_dir));
+	GITERR_CHECK_ALLOC(dir);
+
+	if (git_buf_sets(&dir->path, objects_dir) < 0 ||
+		git_path_to_dir(&dir->path) < 0 ||
+		git_vector_insert(&db->filter_dirs, dir) < 0) {
+		git_buf_free(&dir->path);
+		git__free(dir);
+		return -1;
+	}
+
+	dir->path_len = git_buf_len(&dir->path);
+	db->filter_valid = 0;
+	return 0;
+}
+
+static const char *filter_dir_path(filter_dir *dir, int fanout)
+{
+	git_buf_truncate(&dir->path, dir->path_len);
+
+	if (fanout < 0)
+		git_buf_puts(&dir->path, "pack");
+	else
+		git_buf_printf(&dir->path, "%02x", fanout);
+
+	return git_buf_oom(&dir->path) ? NULL : git_buf_cstr(&dir->path);
+}
+
+/* Returns 1 if the directory changed since the last time, 0 otherwise */
+static int filter_stamp(
+	git_futils_filestamp *stamp, filter_dir *dir, int fanout, time_t now)
+{
+	const char *path;
+	int changed;
+
+	if ((path = filter_dir_path(dir, fanout)) == NULL)
+		return -1;
+
+	changed = git_futils_filestamp_check(stamp, path);
+
+	/* a directory which doesn't exist holds no objects */
+	if (changed == GIT_ENOTFOUND) {
+		changed = (stamp->mtime || stamp->size || stamp->ino);
+		git_futils_filestamp_set(stamp, NULL);
+	} else if (stamp->mtime >= (git_time_t)now) {
+		/* it may change again within this second; never match it */
+		git_futils_filestamp_set(stamp, NULL);
+		stamp->mtime = -1;
+	}
+
+	return changed;
+}
+
+static int filter_count_cb(const git_oid *id, void *payload)
+{
+	GIT_UNUSED(id);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static int filter_add_cb(const git_oid *id, void *payload)
+{
+	git_bloom_add((git_bloom *)payload, id);
+	return 0;
+}
+
+/* Run with the filter lock held */
+static int filter_rebuild(git_odb *db)
+{
+	time_t now = time(NULL);
+	size_t i, count = 0;
+	filter_dir *dir;
+	int fanout;
+
+	db->filter_valid = 0;
+
+	/* look at the directories before listing them, so that anything
+	 * added while we list them shows up as a change later */
+	git_vector_foreach(&db->filter_dirs, i, dir) {
+		if (filter_stamp(&dir->pack_stamp, dir, -1, now) < 0)
+			return -1;
+
+		for (fanout = 0; fanout < 256; fanout++) {
+			if (filter_stamp(&dir->fanout_stamps[fanout], dir, fanout, now) < 0)
+				return -1;
+		}
+	}
+
+	if (git_odb_foreach(db, filter_count_cb, &count) < 0)
+		return -1;
+
+	git_bloom_free(&db->filter);
+
+	/* leave room for the loose objects written later on */
+	if (git_bloom_init(&db->filter, count + count / 4) < 0 ||
+		git_odb_foreach(db, filter_add_cb, &db->filter) < 0)
+		return -1;
+
+	db->filter_valid = 1;
+	return 0;
+}
+
+struct filter_fanout_state {
+	git_bloom *bloom;
+	size_t dir_len;
+};
+
+static int filter_fanout_cb(void *payload, git_buf *path)
+{
+	struct filter_fanout_state *state = payload;
+	const char *name = path->ptr + state->dir_len;
+	char hex[GIT_OID_HEXSZ];
+	git_oid id;
+
+	/* "xx/" followed by the rest of the id */
+	if (git_buf_len(path) - state->dir_len != GIT_OID_HEXSZ + 1 ||
+		name[2] != '/')
+		return 0;
+
+	memcpy(hex, name, 2);
+	memcpy(hex + 2, name + 3, GIT_OID_HEXSZ - 2);
+
+	if (git_oid_fromstrn(&id, hex, GIT_OID_HEXSZ) == 0)
+		git_bloom_add(state->bloom, &id);
+	else
+		giterr_clear();
+
+	return 0;
+}
+
+/* Run with the filter lock held */
+static int filter_rescan_fanout(git_odb *db, filter_dir *dir, int fanout)
+{
+	struct filter_fanout_state state;
+	int error;
+
+	if (filter_dir_path(dir, fanout) == NULL)
+		return -1;
+
+	state.bloom = &db->filter;
+	state.dir_len = dir->path_len;
+
+	error = git_path_direach(&dir->path, 0, filter_fanout_cb, &state);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+/*
+ * Bring the filter up to date with the directories where `id` would be.
+ * Run with the filter lock held.
+ */
+static int filter_refresh(git_odb *db, const git_oid *id)
+{
+	time_t now = time(NULL);
+	int fanout = id->id[0], changed;
+	filter_dir *dir;
+	size_t i;
+
+	git_vector_foreach(&db->filter_dirs, i, dir) {
+		if ((changed = filter_stamp(&dir->pack_stamp, dir, -1, now)) < 0)
+			return changed;
+
+		if (changed)
+			return filter_rebuild(db);
+	}
+
+	git_vector_foreach(&db->filter_dirs, i, dir) {
+		changed = filter_stamp(&dir->fanout_stamps[fanout], dir, fanout, now);
+
+		if (changed > 0)
+			changed = filter_rescan_fanout(db, dir, fanout);
+		if (changed < 0)
+			return changed;
+	}
+
+	/* too many objects were added for the filter to stay selective */
+	if (db->filter.count > db->filter.capacity)
+		return filter_rebuild(db);
+
+	return 0;
+}
+
+/* Whether the filter tells for sure that `id` is not in the database */
+static bool filter_rules_out(git_odb *db, const git_oid *id)
+{
+	bool missing = false;
+	int error = 0;
+
+	if (!git_odb__exists_filter || git_mutex_lock(&db->filter_lock) < 0)
+		return false;
+
+	if (db->filter_unusable || !db->filter_dirs.length)
+		goto done;
+
+	if (!db->filter_valid && (error = filter_rebuild(db)) < 0)
+		goto done;
+
+	if (git_bloom_may_contain(&db->filter, id))
+		goto done;
+
+	/* make sure it wasn't added since we last looked */
+	if ((error = filter_refresh(db, id)) < 0)
+		goto done;
+
+	missing = !git_bloom_may_contain(&db->filter, id);
+
+done:
+	if (error < 0) {
+		/* we'll just ask the backends instead */
+		db->filter_valid = 0;
+		giterr_clear();
+	}
+
+	git_mutex_unlock(&db->filter_lock);
+	return missing;
+}
+
+/* Make the filter aware of an object written through this database */
+static void filter_add(git_odb *db, const git_oid *id)
+{
+	if (!git_odb__exists_filter || git_mutex_lock(&db->filter_lock) < 0)
+		return;
+
+	if (db->filter_valid)
+		git_bloom_add(&db->filter, id);
+
+	git_mutex_unlock(&db->filter_lock);
+}
+
 int git_odb_new(git_odb **out)
 {
 	git_odb *db = git__calloc(1, sizeof(*db));
 	GITERR_CHECK_ALLOC(db);
 
 	if (git_cache_init(&db->own_cache) < 0 ||
-		git_vector_init(&db->backends, 4, backend_sort_cmp) < 0) {
+		git_vector_init(&db->backends, 4, backend_sort_cmp) < 0 ||
+		git_vector_init(&db->filter_dirs, 0, NULL) < 0) {
+		git_vector_free(&db->backends);
+		git_cache_free(&db->own_cache);
+		git__free(db);
+		return -1;
+	}
+
+	if (git_mutex_init(&db->filter_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize odb mutex");
+		git_vector_free(&db->filter_dirs);
+		git_vector_free(&db->backends);
+		git_cache_free(&db->own_cache);
 		git__free(db);
 		return -1;
 	}
@@ -429,14 +703,78 @@ static int add_backend_internal(
 
 int git_odb_add_backend(git_odb *odb, git_odb_backend *backend, int priority)
 {
+	/* we can't tell when a custom backend gains objects */
+	odb->filter_unusable = 1;
 	return add_backend_internal(odb, backend, priority, false, 0);
 }
 
 int git_odb_add_alternate(git_odb *odb, git_odb_backend *backend, int priority)
 {
+	odb->filter_unusable = 1;
 	return add_backend_internal(odb, backend, priority, true, 0);
 }
 
+int git_odb__add_bulk(git_odb *db, git_odb_backend *backend)
+{
+	int error;
+
+	if (db->bulk != NULL) {
+		giterr_set(GITERR_ODB,
+			"a bulk write is already in progress on this object database");
+		return -1;
+	}
+
+	if ((error = add_backend_internal(
+			db, backend, GIT_BULK_PRIORITY, false, 0)) < 0)
+		return error;
+
+	db->bulk = backend;
+	return 0;
+}
+
+void git_odb__remove_bulk(git_odb *db, git_odb_backend *backend, bool aborted)
+{
+	backend_internal *internal;
+	size_t i;
+
+	git_vector_foreach(&db->backends, i, internal) {
+		if (internal->backend != backend)
+			continue;
+
+		git_vector_remove(&db->backends, i);
+		git__free(internal);
+		break;
+	}
+
+	backend->odb = NULL;
+	db->bulk = NULL;
+
+	/* don't hand out objects which are no longer in the database */
+	if (aborted)
+		git_cache_clear(odb_cache(db));
+}
+
+int git_odb__pack_folder(const char **out, git_odb *db)
+{
+	backend_internal *internal;
+	size_t i;
+
+	git_vector_foreach(&db->backends, i, internal) {
+		const char *folder;
+
+		if (internal->is_alternate)
+			continue;
+
+		if ((folder = git_odb_backend__pack_folder(internal->backend)) != NULL) {
+			*out = folder;
+			return 0;
+		}
+	}
+
+	giterr_set(GITERR_ODB, "the object database has no pack directory");
+	return GIT_ENOTFOUND;
+}
+
 size_t git_odb_num_backends(git_odb *odb)
 {
 	assert(odb);
@@ -511,6 +849,9 @@ static int add_default_backends(
 		add_backend_internal(db, packed, GIT_PACKED_PRIORITY, as_alternates, inode) < 0)
 		return -1;
 
+	if (filter_add_dir(db, objects_dir) < 0)
+		return -1;
+
 	return load_alternates(db, objects_dir, alternate_depth);
 }
 
@@ -572,6 +913,25 @@ int git_odb_add_disk_alternate(git_odb *odb, const char *path)
 	return add_default_backends(odb, path, true, 0);
 }
 
+static int load_commit_graph(git_odb *db, const char *objects_dir)
+{
+	git_commit_graph_file *file;
+
+	if (git_commit_graph_new(&db->cgraph, objects_dir, false) < 0)
+		return -1;
+
+	/*
+	 * Load the file right away so that concurrent readers never race on
+	 * opening it; a missing or broken commit-graph simply goes unused.
+	 */
+	if (git_commit_graph_get_file(&file, db->cgraph) < 0)
+		giterr_clear();
+	else
+		git_commit_graph_file_free(file);
+
+	return 0;
+}
+
 int git_odb_open(git_odb **out, const char *objects_dir)
 {
 	git_odb *db;
@@ -583,7 +943,8 @@ int git_odb_open(git_odb **out, const char *objects_dir)
 	if (git_odb_new(&db) < 0)
 		return -1;
 
-	if (add_default_backends(db, objects_dir, 0, 0) < 0) {
+	if (add_default_backends(db, objects_dir, 0, 0) < 0 ||
+		load_commit_graph(db, objects_dir) < 0) {
 		git_odb_free(db);
 		return -1;
 	}
@@ -592,8 +953,17 @@ int git_odb_open(git_odb **out, const char *objects_dir)
 	return 0;
 }
 
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *db)
+{
+	if (!db->cgraph)
+		return GIT_ENOTFOUND;
+
+	return git_commit_graph_get_file(out, db->cgraph);
+}
+
 static void odb_free(git_odb *db)
 {
+	filter_dir *dir;
 	size_t i;
 
 	for (i = 0; i < db->backends.length; ++i) {
@@ -608,6 +978,16 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_free(&db->own_cache);
+	git_commit_graph_free(db->cgraph);
+
+	git_vector_foreach(&db->filter_dirs, i, dir) {
+		git_buf_free(&dir->path);
+		git__free(dir);
+	}
+
+	git_vector_free(&db->filter_dirs);
+	git_bloom_free(&db->filter);
+	git_mutex_free(&db->filter_lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -634,6 +1014,9 @@ int git_odb_exists(git_odb *db, const git_oid *id)
 		return (int)true;
 	}
 
+	if (filter_rules_out(db, id))
+		return (int)false;
+
 	for (i = 0; i < db->backends.length && !found; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
 		git_odb_backend *b = internal->backend;
@@ -705,6 +1088,26 @@ int git_odb_exists_prefix(
 	return 0;
 }
 
+int git_odb__find_pack_entry(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id)
+{
+	size_t i;
+	int error;
+
+	assert(e && db && id);
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		error = git_odb_backend__find_pack_entry(e, internal->backend, id);
+		if (error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	giterr_clear();
+	return GIT_ENOTFOUND;
+}
+
 int git_odb_read_header(size_t *len_p, git_otype *type_p, git_odb *db, const git_oid *id)
 {
 	int error;
@@ -888,6 +1291,417 @@ int git_odb_read_prefix(
 	return 0;
 }
 
+static int batch_position_cmp(const void *a, const void *b, void *payload)
+{
+	const git_oid *ids = payload;
+	return git_oid__cmp(&ids[*(const size_t *)a], &ids[*(const size_t *)b]);
+}
+
+/*
+ * Set up the entries of a batch in id order. `positions` maps each
+ * entry back to the position of its id in the caller's array.
+ */
+static int batch_init(
+	git_odb_batch_entry **entries_out,
+	size_t **positions_out,
+	const git_oid *ids,
+	size_t count)
+{
+	git_odb_batch_entry *entries;
+	size_t *positions, i;
+	bool sorted = true;
+
+	entries = git__calloc(count ? count : 1, sizeof(git_odb_batch_entry));
+	GITERR_CHECK_ALLOC(entries);
+
+	if ((positions = git__calloc(count ? count : 1, sizeof(size_t))) == NULL) {
+		git__free(entries);
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		positions[i] = i;
+
+		if (i > 0 && git_oid__cmp(&ids[i - 1], &ids[i]) > 0)
+			sorted = false;
+	}
+
+	if (!sorted)
+		git__qsort_r(positions, count, sizeof(size_t),
+			batch_position_cmp, (void *)ids);
+
+	for (i = 0; i < count; ++i)
+		git_oid_cpy(&entries[i].id, &ids[positions[i]]);
+
+	*entries_out = entries;
+	*positions_out = positions;
+	return 0;
+}
+
+static void batch_free(git_odb_batch_entry *entries, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		git__free(entries[i].data);
+
+	git__free(entries);
+}
+
+/* Ask a backend without `read_many` about a single object */
+static int batch_lookup_one(
+	git_odb_backend *b, git_odb_batch_entry *entry, git_odb_batch_t what)
+{
+	int error = GIT_ENOTFOUND;
+
+	switch (what) {
+	case GIT_ODB_BATCH_EXISTS:
+		if (b->exists != NULL && b->exists(b, &entry->id))
+			error = 0;
+		break;
+
+	case GIT_ODB_BATCH_HEADER:
+		if (b->read_header != NULL) {
+			error = b->read_header(&entry->len, &entry->type, b, &entry->id);
+			break;
+		}
+
+		/* we can still learn the header by reading the object */
+		if (b->read != NULL &&
+			!(error = b->read(&entry->data, &entry->len, &entry->type, b, &entry->id))) {
+			git__free(entry->data);
+			entry->data = NULL;
+		}
+		break;
+
+	case GIT_ODB_BATCH_READ:
+		if (b->read != NULL)
+			error = b->read(&entry->data, &entry->len, &entry->type, b, &entry->id);
+		break;
+	}
+
+	if (!error)
+		entry->found = 1;
+	else if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+/*
+ * Look up a batch of entries, sorted by id. Cached objects are returned
+ * in `objects` (which can be NULL when only looking for existence), as
+ * are the objects read when `what` is GIT_ODB_BATCH_READ.
+ */
+static int odb_batch(
+	git_odb_object **objects,
+	git_odb *db,
+	git_odb_batch_entry *entries,
+	size_t count,
+	git_odb_batch_t what)
+{
+	size_t i, j;
+	int error = 0;
+
+	for (i = 0; i < count; ++i) {
+		git_odb_batch_entry *entry = &entries[i];
+		git_odb_object *cached;
+		git_rawobj raw;
+
+		if ((cached = git_cache_get_raw(odb_cache(db), &entry->id)) != NULL) {
+			entry->found = 1;
+			entry->type = cached->cached.type;
+			entry->len = cached->cached.size;
+
+			if (objects)
+				objects[i] = cached;
+			else
+				git_odb_object_free(cached);
+		} else if (what != GIT_ODB_BATCH_EXISTS &&
+			!hardcoded_objects(&raw, &entry->id)) {
+			entry->found = 1;
+			entry->type = raw.type;
+			entry->len = raw.len;
+			entry->data = raw.data;
+		}
+	}
+
+	for (i = 0; i < db->backends.length && !error; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->read_many != NULL) {
+			error = b->read_many(b, entries, count, what);
+			continue;
+		}
+
+		for (j = 0; j < count && !error; ++j) {
+			if (!entries[j].found)
+				error = batch_lookup_one(b, &entries[j], what);
+		}
+	}
+
+	if (error < 0 || what != GIT_ODB_BATCH_READ)
+		return error;
+
+	for (i = 0; i < count; ++i) {
+		git_odb_batch_entry *entry = &entries[i];
+		git_rawobj raw;
+		git_odb_object *object;
+
+		if (!entry->found || objects[i] != NULL)
+			continue;
+
+		raw.data = entry->data;
+		raw.len = entry->len;
+		raw.type = entry->type;
+
+		if ((object = odb_object__alloc(&entry->id, &raw)) == NULL)
+			return -1;
+
+		entry->data = NULL;
+		objects[i] = git_cache_store_raw(odb_cache(db), object);
+	}
+
+	return 0;
+}
+
+static int batch_notfound(git_odb_batch_entry *entries, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (!entries[i].found)
+			return git_odb__error_notfound("no match for id", &entries[i].id);
+	}
+
+	return 0;
+}
+
+int git_odb_read_many(
+	git_odb_object **out, git_odb *db, const git_oid *ids, size_t count)
+{
+	git_odb_batch_entry *entries;
+	git_odb_object **objects;
+	size_t *positions, i;
+	int error;
+
+	assert(out && db && (ids || !count));
+
+	memset(out, 0, count * sizeof(git_odb_object *));
+
+	if (batch_init(&entries, &positions, ids, count) < 0)
+		return -1;
+
+	if ((objects = git__calloc(count ? count : 1, sizeof(git_odb_object *))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = odb_batch(objects, db, entries, count, GIT_ODB_BATCH_READ)) < 0) {
+		for (i = 0; i < count; ++i)
+			git_odb_object_free(objects[i]);
+		goto done;
+	}
+
+	for (i = 0; i < count; ++i)
+		out[positions[i]] = objects[i];
+
+	error = batch_notfound(entries, count);
+
+done:
+	git__free(objects);
+	git__free(positions);
+	batch_free(entries, count);
+	return error;
+}
+
+int git_odb_read_header_many(
+	size_t *len_out, git_otype *type_out,
+	git_odb *db, const git_oid *ids, size_t count)
+{
+	git_odb_batch_entry *entries;
+	git_odb_object **cached;
+	size_t *positions, i;
+	int error;
+
+	assert(len_out && type_out && db && (ids || !count));
+
+	if (batch_init(&entries, &positions, ids, count) < 0)
+		return -1;
+
+	if ((cached = git__calloc(count ? count : 1, sizeof(git_odb_object *))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	error = odb_batch(cached, db, entries, count, GIT_ODB_BATCH_HEADER);
+
+	for (i = 0; i < count; ++i) {
+		git_odb_object_free(cached[i]);
+
+		len_out[positions[i]] = entries[i].found ? entries[i].len : 0;
+		type_out[positions[i]] = entries[i].found ? entries[i].type : GIT_OBJ_BAD;
+	}
+
+	if (!error)
+		error = batch_notfound(entries, count);
+
+done:
+	git__free(cached);
+	git__free(positions);
+	batch_free(entries, count);
+	return error;
+}
+
+int git_odb_exists_many(
+	int *out, git_odb *db, const git_oid *ids, size_t count)
+{
+	git_odb_batch_entry *entries;
+	size_t *positions, i;
+	int error;
+
+	assert(out && db && (ids || !count));
+
+	if (batch_init(&entries, &positions, ids, count) < 0)
+		return -1;
+
+	error = odb_batch(NULL, db, entries, count, GIT_ODB_BATCH_EXISTS);
+
+	for (i = 0; i < count; ++i)
+		out[positions[i]] = entries[i].found;
+
+	git__free(positions);
+	batch_free(entries, count);
+	return error;
+}
+
+/*
+ * Ask a backend which can't tell the unique prefix length by itself about
+ * longer and longer prefixes of `id`, until the only object it has with
+ * that prefix is `id` itself, or it has none.
+ */
+static int backend_unique_prefix_len(
+	size_t *len, git_odb_backend *b, const git_oid *id)
+{
+	git_oid key, found;
+	int error;
+
+	if (!b->exists_prefix)
+		return 0;
+
+	for (; *len < GIT_OID_HEXSZ; (*len)++) {
+		memset(&key, 0, sizeof(key));
+		memcpy(&key.id, id->id, (*len + 1) / 2);
+		if (*len & 1)
+			key.id[*len / 2] &= 0xF0;
+
+		error = b->exists_prefix(&found, b, &key, *len);
+
+		if (error == GIT_EAMBIGUOUS) {
+			giterr_clear();
+			continue;
+		}
+		if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+			giterr_clear();
+			return 0;
+		}
+		if (error < 0)
+			return error;
+
+		if (!git_oid__cmp(&found, id))
+			return 0;
+	}
+
+	return 0;
+}
+
+static int odb_unique_prefix_len(
+	size_t *out,
+	git_odb *db,
+	const git_oid *ids,
+	const int *found,
+	size_t count,
+	size_t min_len)
+{
+	size_t i, j;
+	int error = 0;
+
+	if (min_len < GIT_OID_MINPREFIXLEN)
+		min_len = GIT_OID_MINPREFIXLEN;
+	if (min_len > GIT_OID_HEXSZ)
+		min_len = GIT_OID_HEXSZ;
+
+	for (i = 0; i < count; ++i)
+		out[i] = min_len;
+
+	for (i = 0; i < db->backends.length && !error; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (b->unique_prefix_len) {
+			error = b->unique_prefix_len(out, b, ids, count);
+			continue;
+		}
+
+		for (j = 0; j < count && !error; ++j) {
+			if (found[j])
+				error = backend_unique_prefix_len(&out[j], b, &ids[j]);
+		}
+	}
+
+	if (error < 0)
+		return error;
+
+	for (i = count; i > 0; --i) {
+		if (!found[i - 1]) {
+			out[i - 1] = 0;
+			error = git_odb__error_notfound("no match for id", &ids[i - 1]);
+		}
+	}
+
+	return error;
+}
+
+int git_odb_unique_prefix_len(
+	size_t *out, git_odb *db, const git_oid *id, size_t min_len)
+{
+	int found;
+
+	assert(out && db && id);
+
+	found = git_odb_exists(db, id);
+
+	return odb_unique_prefix_len(out, db, id, &found, 1, min_len);
+}
+
+int git_odb_unique_prefix_len_many(
+	size_t *out,
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	size_t min_len)
+{
+	int *found;
+	int error;
+
+	assert(out && db && (ids || !count));
+
+	if (!count)
+		return 0;
+
+	found = git__calloc(count, sizeof(int));
+	GITERR_CHECK_ALLOC(found);
+
+	if ((error = git_odb_exists_many(found, db, ids, count)) == 0)
+		error = odb_unique_prefix_len(out, db, ids, found, count, min_len);
+
+	git__free(found);
+	return error;
+}
+
 int git_odb_foreach(git_odb *db, git_odb_foreach_cb cb, void *payload)
 {
 	unsigned int i;
@@ -928,8 +1742,10 @@ int git_odb_write(
 			error = b->write(b, oid, data, len, type);
 	}
 
-	if (!error || error == GIT_PASSTHROUGH)
+	if (!error || error == GIT_PASSTHROUGH) {
+		filter_add(db, oid);
 		return 0;
+	}
 
 	/* if no backends were able to write the object directly, we try a
 	 * streaming write to the backends; just write the whole object into the
@@ -939,7 +1755,8 @@ int git_odb_write(
 		return error;
 
 	stream->write(stream, data, len);
-	error = stream->finalize_write(stream, oid);
+	if ((error = stream->finalize_write(stream, oid)) == 0)
+		filter_add(db, oid);
 	git_odb_stream_free(stream);
 
 	return error;
@@ -1033,6 +1850,8 @@ int git_odb_stream_write(git_odb_stream *stream, const char *buffer, size_t len)
 
 int git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stream)
 {
+	int error;
+
 	if (stream->received_bytes != stream->declared_size)
 		return git_odb_stream__invalid_length(stream,
 			"stream_finalize_write()");
@@ -1042,7 +1861,10 @@ int git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stream)
 	if (git_odb_exists(stream->backend->odb, out))
 		return 0;
 
-	return stream->finalize_write(stream, out);
+	if ((error = stream->finalize_write(stream, out)) == 0)
+		filter_add(stream->backend->odb, out);
+
+	return error;
 }
 
 int git_odb_stream_read(git_odb_stream *stream, char *buffer, size_t len)
@@ -1055,7 +1877,11 @@ void git_odb_stream_free(git_odb_stream *stream)
 	if (stream == NULL)
 		return;
 
-	git_hash_ctx_cleanup(stream->hash_ctx);
+	/* read streams don't hash anything */
+	if (stream->hash_ctx) {
+		git_hash_ctx_cleanup(stream->hash_ctx);
+	}
+
 	git__free(stream->hash_ctx);
 	stream->free(stream);
 }
@@ -1114,6 +1940,35 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer
 	return error;
 }
 
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	size_t i, writes = 0;
+	int error = GIT_ERROR;
+
+	assert(db);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate)
+			continue;
+
+		if (b->writemidx != NULL) {
+			++writes;
+			error = b->writemidx(b);
+		}
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = 0;
+	if (error < 0 && !writes)
+		error = git_odb__error_unsupported_in_backend("write multi-pack-index");
+
+	return error;
+}
+
 void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
@@ -1125,6 +1980,10 @@ int git_odb_refresh(struct git_odb *db)
 	size_t i;
 	assert(db);
 
+	/*
+	 * The exists filter is left alone: the stat data of the directories
+	 * it covers tells it about new packs and loose objects.
+	 */
 	for (i = 0; i < db->backends.length; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
 		git_odb_backend *b = internal->backend;
@@ -1136,6 +1995,9 @@ int git_odb_refresh(struct git_odb *db)
 		}
 	}
 
+	if (db->cgraph)
+		git_commit_graph_refresh(db->cgraph);
+
 	return 0;
 }
 
@@ -15,6 +15,9 @@
 #include "cache.h"
 #include "posix.h"
 #include "filter.h"
+#include "commit_graph.h"
+#include "bloom.h"
+#include "thread-utils.h"
 
 #define GIT_OBJECTS_DIR "objects/"
 #define GIT_OBJECT_DIR_MODE 0777
@@ -38,8 +41,75 @@ struct git_odb {
 	git_refcount rc;
 	git_vector backends;
 	git_cache own_cache;
+	git_commit_graph *cgraph;
+
+	/*
+	 * The negative lookup filter of `git_odb_exists`: the objects
+	 * directories it covers, and the ids found in them.
+	 */
+	git_mutex filter_lock;
+	git_vector filter_dirs;
+	git_bloom filter;
+	unsigned int filter_valid:1,
+		filter_unusable:1; /* a backend we don't know how to watch */
+
+	/* The backend of the bulk write in progress, if any */
+	git_odb_backend *bulk;
 };
 
+/* Whether `git_odb_exists` may answer misses from the filter */
+extern bool git_odb__exists_filter;
+
+/*
+ * Get the commit-graph file of the object database, if there is one.
+ * Returns GIT_ENOTFOUND when the database has no (usable) commit-graph.
+ * The file must be given back with `git_commit_graph_file_free`.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
+struct git_pack_entry;
+
+/*
+ * Find where an object is stored in one of the packs of the database.
+ * Returns GIT_ENOTFOUND if the object is not packed. The entry holds a
+ * reference on its pack, which a refresh of the database could drop
+ * otherwise; release it with `git_mwindow_put_pack`.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *e, git_odb *odb, const git_oid *id);
+
+/*
+ * Find an object in the packs of `backend`. Returns GIT_ENOTFOUND if it
+ * isn't there or if `backend` is not a pack backend. Like the above, the
+ * entry holds a reference on its pack.
+ */
+int git_odb_backend__find_pack_entry(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *id);
+
+/* The pack directory of `backend`, or NULL if it is not a pack backend. */
+const char *git_odb_backend__pack_folder(git_odb_backend *backend);
+
+/*
+ * Find the pack directory new packs of the database are written to.
+ * Returns GIT_ENOTFOUND if the database has no local pack backend.
+ */
+int git_odb__pack_folder(const char **out, git_odb *db);
+
+/*
+ * Register the backend of a bulk write, which gets every object written
+ * to the database until it is removed again. Unlike the backends added
+ * with `git_odb_add_backend`, it doesn't disable the `git_odb_exists`
+ * filter, as every object it holds has gone through `git_odb_write`.
+ * Only one bulk write may be in progress at a time.
+ */
+int git_odb__add_bulk(git_odb *db, git_odb_backend *backend);
+
+/*
+ * Unregister the backend of a bulk write. When the write was `aborted`,
+ * the objects cached from it are dropped as well.
+ */
+void git_odb__remove_bulk(git_odb *db, git_odb_backend *backend, bool aborted);
+
 /*
  * Hash a git_rawobj internally.
  * The `git_rawobj` is supposed to be previously initialized
@@ -0,0 +1,935 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include <zlib.h>
+
+#include "common.h"
+#include "git2/odb.h"
+#include "git2/odb_backend.h"
+#include "git2/sys/odb_backend.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "odb.h"
+#include "pack.h"
+#include "oid.h"
+#include "oidmap.h"
+#include "vector.h"
+
+GIT__USE_OIDMAP
+
+#define BULK_BUFSIZE (16 * 1024)
+
+/*
+ * A bulk write appends the objects written to the odb to a temporary
+ * packfile, one undeltified object after the other. It is registered as
+ * the first backend of the odb, so that it gets every write, and reads
+ * the objects back from the packfile until the index is written.
+ */
+
+struct bulk_entry {
+	git_oid oid;
+	git_otype type;
+	size_t size;
+	git_off_t offset;      /* where the object header starts */
+	git_off_t data_offset; /* where the compressed data starts */
+	git_off_t data_len;
+	uint32_t crc;
+};
+
+struct git_odb_bulk {
+	git_odb_backend parent;
+	git_odb *db;
+
+	/* protects everything below; the fd is shared by reads and writes */
+	git_mutex lock;
+	git_oidmap *objects;
+	git_vector entries;
+	git_buf path;
+	int fd;
+	git_off_t size; /* the end of the last object written */
+	unsigned int streaming:1, /* an object is being written by a stream */
+		registered:1;
+};
+
+struct bulk_stream {
+	git_odb_stream parent;
+	git_odb_bulk *bulk;
+	z_stream zs;
+	struct bulk_entry entry;
+	unsigned int done:1;
+};
+
+static int bulk_entry_cmp(const void *a, const void *b)
+{
+	const struct bulk_entry *entry_a = a, *entry_b = b;
+	return git_oid__cmp(&entry_a->oid, &entry_b->oid);
+}
+
+static int bulk_append(
+	git_odb_bulk *bulk, const void *data, size_t len, uint32_t *crc)
+{
+	if (!len)
+		return 0;
+
+	if (p_lseek(bulk->fd, bulk->size, SEEK_SET) < 0 ||
+		p_write(bulk->fd, data, len) < 0) {
+		giterr_set(GITERR_OS, "failed to write to packfile '%s'", bulk->path.ptr);
+		return -1;
+	}
+
+	bulk->size += len;
+	*crc = crc32(*crc, data, (uInt)len);
+	return 0;
+}
+
+static int bulk_deflate(
+	git_odb_bulk *bulk,
+	struct bulk_entry *entry,
+	z_stream *zs,
+	const void *data,
+	size_t len,
+	int flush)
+{
+	unsigned char out[BULK_BUFSIZE];
+	const unsigned char *in = data;
+	int zerr;
+
+	do {
+		uInt chunk = (len > UINT_MAX) ? UINT_MAX : (uInt)len;
+		int zflush = (chunk == len) ? flush : Z_NO_FLUSH;
+
+		zs->next_in = (Bytef *)in;
+		zs->avail_in = chunk;
+
+		do {
+			zs->next_out = out;
+			zs->avail_out = sizeof(out);
+
+			if ((zerr = deflate(zs, zflush)) == Z_STREAM_ERROR) {
+				giterr_set(GITERR_ZLIB, "failed to deflate object");
+				return -1;
+			}
+
+			if (bulk_append(bulk, out,
+					sizeof(out) - zs->avail_out, &entry->crc) < 0)
+				return -1;
+		} while (zs->avail_out == 0 ||
+			(zflush == Z_FINISH && zerr != Z_STREAM_END));
+
+		in += chunk;
+		len -= chunk;
+	} while (len > 0);
+
+	return 0;
+}
+
+/* Write the header of an object, and get ready to deflate its data */
+static int bulk_start_object(
+	git_odb_bulk *bulk,
+	struct bulk_entry *entry,
+	z_stream *zs,
+	size_t size,
+	git_otype type)
+{
+	unsigned char hdr[10];
+	size_t hdr_len;
+
+	entry->type = type;
+	entry->size = size;
+	entry->offset = bulk->size;
+	entry->crc = crc32(0L, Z_NULL, 0);
+
+	hdr_len = git_packfile__object_header(hdr, size, type);
+
+	if (bulk_append(bulk, hdr, hdr_len, &entry->crc) < 0)
+		return -1;
+
+	entry->data_offset = bulk->size;
+
+	memset(zs, 0, sizeof(*zs));
+	if (deflateInit(zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to initialize deflate");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bulk_finish_object(git_odb_bulk *bulk, struct bulk_entry *entry)
+{
+	struct bulk_entry *stored;
+	khiter_t pos;
+	int error;
+
+	entry->data_len = bulk->size - entry->data_offset;
+
+	stored = git__malloc(sizeof(struct bulk_entry));
+	GITERR_CHECK_ALLOC(stored);
+	memcpy(stored, entry, sizeof(struct bulk_entry));
+
+	if (git_vector_insert(&bulk->entries, stored) < 0) {
+		git__free(stored);
+		return -1;
+	}
+
+	pos = kh_put(oid, bulk->objects, &stored->oid, &error);
+	if (error < 0) {
+		git_vector_pop(&bulk->entries);
+		git__free(stored);
+		return -1;
+	}
+
+	kh_val(bulk->objects, pos) = stored;
+	return 0;
+}
+
+/* Forget an object which couldn't be written in whole */
+static void bulk_rollback(git_odb_bulk *bulk, git_off_t offset)
+{
+	bulk->size = offset;
+
+	/* the commit truncates the file anyway, so failing here is fine */
+	if (p_ftruncate(bulk->fd, offset) < 0)
+		giterr_clear();
+}
+
+static struct bulk_entry *bulk_lookup(git_odb_bulk *bulk, const git_oid *oid)
+{
+	khiter_t pos = kh_get(oid, bulk->objects, oid);
+
+	if (pos == kh_end(bulk->objects))
+		return NULL;
+
+	return kh_val(bulk->objects, pos);
+}
+
+static int bulk_find_prefix(
+	struct bulk_entry **out,
+	git_odb_bulk *bulk,
+	const git_oid *short_oid,
+	size_t len)
+{
+	struct bulk_entry *entry, *found = NULL;
+	size_t i;
+
+	git_vector_foreach(&bulk->entries, i, entry) {
+		if (git_oid_ncmp(&entry->oid, short_oid, len))
+			continue;
+
+		if (found)
+			return git_odb__error_ambiguous("found multiple offsets for pack entry");
+
+		found = entry;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find pack entry", short_oid);
+
+	*out = found;
+	return 0;
+}
+
+static int bulk_inflate(void **out, git_odb_bulk *bulk, struct bulk_entry *entry)
+{
+	unsigned char in[BULK_BUFSIZE];
+	git_off_t pos = entry->data_offset, left = entry->data_len;
+	unsigned char *buffer;
+	size_t alloc_len;
+	z_stream zs;
+	int zerr = Z_OK;
+
+	GITERR_CHECK_ALLOC_ADD(&alloc_len, entry->size, 1);
+	buffer = git__calloc(1, alloc_len);
+	GITERR_CHECK_ALLOC(buffer);
+
+	memset(&zs, 0, sizeof(zs));
+	zs.next_out = buffer;
+	zs.avail_out = (uInt)entry->size;
+
+	if (inflateInit(&zs) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to initialize inflate");
+		git__free(buffer);
+		return -1;
+	}
+
+	while (left > 0 && zerr == Z_OK) {
+		size_t chunk = (left > (git_off_t)sizeof(in)) ? sizeof(in) : (size_t)left;
+
+		if (p_lseek(bulk->fd, pos, SEEK_SET) < 0 ||
+			p_read(bulk->fd, in, chunk) != (ssize_t)chunk) {
+			giterr_set(GITERR_OS,
+				"failed to read from packfile '%s'", bulk->path.ptr);
+			goto on_error;
+		}
+
+		zs.next_in = in;
+		zs.avail_in = (uInt)chunk;
+		zerr = inflate(&zs, Z_NO_FLUSH);
+
+		pos += chunk;
+		left -= chunk;
+	}
+
+	if (zerr != Z_STREAM_END || zs.total_out != entry->size) {
+		giterr_set(GITERR_ZLIB, "failed to inflate object from packfile");
+		goto on_error;
+	}
+
+	inflateEnd(&zs);
+	*out = buffer;
+	return 0;
+
+on_error:
+	inflateEnd(&zs);
+	git__free(buffer);
+	return -1;
+}
+
+static int impl__read(
+	void **buffer_p,
+	size_t *len_p,
+	git_otype *type_p,
+	git_odb_backend *backend,
+	const git_oid *oid)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry *entry;
+	int error;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if ((entry = bulk_lookup(bulk, oid)) == NULL)
+		error = GIT_ENOTFOUND;
+	else if ((error = bulk_inflate(buffer_p, bulk, entry)) == 0) {
+		*len_p = entry->size;
+		*type_p = entry->type;
+	}
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int impl__read_prefix(
+	git_oid *out_oid,
+	void **buffer_p,
+	size_t *len_p,
+	git_otype *type_p,
+	git_odb_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry *entry = NULL;
+	int error;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if ((error = bulk_find_prefix(&entry, bulk, short_oid, len)) == 0 &&
+		(error = bulk_inflate(buffer_p, bulk, entry)) == 0) {
+		git_oid_cpy(out_oid, &entry->oid);
+		*len_p = entry->size;
+		*type_p = entry->type;
+	}
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int impl__read_header(
+	size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry *entry;
+	int error = 0;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if ((entry = bulk_lookup(bulk, oid)) == NULL)
+		error = GIT_ENOTFOUND;
+	else {
+		*len_p = entry->size;
+		*type_p = entry->type;
+	}
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int impl__exists(git_odb_backend *backend, const git_oid *oid)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	int found;
+
+	if (git_mutex_lock(&bulk->lock) < 0)
+		return 0;
+
+	found = (bulk_lookup(bulk, oid) != NULL);
+
+	git_mutex_unlock(&bulk->lock);
+	return found;
+}
+
+static int impl__exists_prefix(
+	git_oid *out, git_odb_backend *backend, const git_oid *short_oid, size_t len)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry *entry = NULL;
+	int error;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if ((error = bulk_find_prefix(&entry, bulk, short_oid, len)) == 0)
+		git_oid_cpy(out, &entry->oid);
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int impl__foreach(git_odb_backend *backend, git_odb_foreach_cb cb, void *data)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry *entry;
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	git_oid *id;
+	size_t i;
+	int error = 0;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	/* the callback may well write objects itself */
+	git_vector_foreach(&bulk->entries, i, entry) {
+		if ((id = git_array_alloc(ids)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		git_oid_cpy(id, &entry->oid);
+	}
+
+	git_mutex_unlock(&bulk->lock);
+
+	for (i = 0; !error && i < git_array_size(ids); i++) {
+		if ((error = cb(git_array_get(ids, i), data)) != 0)
+			giterr_set_after_callback(error);
+	}
+
+	git_array_clear(ids);
+	return error;
+}
+
+static int impl__write(
+	git_odb_backend *backend,
+	const git_oid *oid,
+	const void *data,
+	size_t len,
+	git_otype type)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_entry entry;
+	z_stream zs;
+	int error;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	/* a stream is appending to the packfile; let the next backend have it */
+	if (bulk->streaming) {
+		git_mutex_unlock(&bulk->lock);
+		return GIT_PASSTHROUGH;
+	}
+
+	if (bulk_lookup(bulk, oid) != NULL) {
+		git_mutex_unlock(&bulk->lock);
+		return 0;
+	}
+
+	git_oid_cpy(&entry.oid, oid);
+
+	if ((error = bulk_start_object(bulk, &entry, &zs, len, type)) < 0) {
+		bulk_rollback(bulk, entry.offset);
+		git_mutex_unlock(&bulk->lock);
+		return error;
+	}
+
+	if ((error = bulk_deflate(bulk, &entry, &zs, data, len, Z_FINISH)) < 0 ||
+		(error = bulk_finish_object(bulk, &entry)) < 0)
+		bulk_rollback(bulk, entry.offset);
+
+	deflateEnd(&zs);
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int bulk_stream__write(git_odb_stream *_stream, const char *data, size_t len)
+{
+	struct bulk_stream *stream = (struct bulk_stream *)_stream;
+	git_odb_bulk *bulk = stream->bulk;
+	int error;
+
+	if (stream->done) {
+		giterr_set(GITERR_ODB, "the stream has been closed");
+		return -1;
+	}
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if ((error = bulk_deflate(
+			bulk, &stream->entry, &stream->zs, data, len, Z_NO_FLUSH)) < 0) {
+		bulk_rollback(bulk, stream->entry.offset);
+		bulk->streaming = 0;
+		stream->done = 1;
+	}
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static int bulk_stream__finalize_write(git_odb_stream *_stream, const git_oid *oid)
+{
+	struct bulk_stream *stream = (struct bulk_stream *)_stream;
+	git_odb_bulk *bulk = stream->bulk;
+	int error = 0;
+
+	if (stream->done) {
+		giterr_set(GITERR_ODB, "the stream has been closed");
+		return -1;
+	}
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	git_oid_cpy(&stream->entry.oid, oid);
+
+	if (bulk_lookup(bulk, oid) != NULL)
+		bulk_rollback(bulk, stream->entry.offset);
+	else if ((error = bulk_deflate(bulk, &stream->entry,
+			&stream->zs, NULL, 0, Z_FINISH)) < 0 ||
+		(error = bulk_finish_object(bulk, &stream->entry)) < 0)
+		bulk_rollback(bulk, stream->entry.offset);
+
+	bulk->streaming = 0;
+	stream->done = 1;
+
+	git_mutex_unlock(&bulk->lock);
+	return error;
+}
+
+static void bulk_stream__free(git_odb_stream *_stream)
+{
+	struct bulk_stream *stream = (struct bulk_stream *)_stream;
+	git_odb_bulk *bulk = stream->bulk;
+
+	/* the object was never finished, so drop what was written of it */
+	if (!stream->done && git_mutex_lock(&bulk->lock) == 0) {
+		bulk_rollback(bulk, stream->entry.offset);
+		bulk->streaming = 0;
+		git_mutex_unlock(&bulk->lock);
+	}
+
+	deflateEnd(&stream->zs);
+	git__free(stream);
+}
+
+static int impl__writestream(
+	git_odb_stream **out, git_odb_backend *backend, git_off_t size, git_otype type)
+{
+	git_odb_bulk *bulk = (git_odb_bulk *)backend;
+	struct bulk_stream *stream;
+	int error;
+
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	/* only one object can be appended at a time */
+	if (bulk->streaming) {
+		git_mutex_unlock(&bulk->lock);
+		return GIT_PASSTHROUGH;
+	}
+
+	stream = git__calloc(1, sizeof(struct bulk_stream));
+	if (stream == NULL) {
+		git_mutex_unlock(&bulk->lock);
+		return -1;
+	}
+
+	if ((error = bulk_start_object(
+			bulk, &stream->entry, &stream->zs, (size_t)size, type)) < 0) {
+		bulk_rollback(bulk, stream->entry.offset);
+		git_mutex_unlock(&bulk->lock);
+		deflateEnd(&stream->zs);
+		git__free(stream);
+		return error;
+	}
+
+	bulk->streaming = 1;
+	git_mutex_unlock(&bulk->lock);
+
+	stream->bulk = bulk;
+	stream->parent.backend = backend;
+	stream->parent.mode = GIT_STREAM_WRONLY;
+	stream->parent.write = &bulk_stream__write;
+	stream->parent.finalize_write = &bulk_stream__finalize_write;
+	stream->parent.free = &bulk_stream__free;
+
+	*out = (git_odb_stream *)stream;
+	return 0;
+}
+
+static void impl__free(git_odb_backend *backend)
+{
+	/* the bulk write is always unregistered before the odb goes away */
+	GIT_UNUSED(backend);
+}
+
+static int bulk_write_header(git_odb_bulk *bulk)
+{
+	struct git_pack_header hdr;
+
+	hdr.hdr_signature = htonl(PACK_SIGNATURE);
+	hdr.hdr_version = htonl(PACK_VERSION);
+	hdr.hdr_entries = htonl((uint32_t)bulk->entries.length);
+
+	if (p_lseek(bulk->fd, 0, SEEK_SET) < 0 ||
+		p_write(bulk->fd, &hdr, sizeof(hdr)) < 0) {
+		giterr_set(GITERR_OS, "failed to write to packfile '%s'", bulk->path.ptr);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Hash the packfile and append the trailer */
+static int bulk_write_trailer(git_oid *out, git_odb_bulk *bulk)
+{
+	unsigned char buf[BULK_BUFSIZE];
+	git_hash_ctx ctx;
+	git_off_t left = bulk->size;
+	ssize_t read_len;
+	int error = -1;
+
+	if (git_hash_ctx_init(&ctx) < 0)
+		return -1;
+
+	if (p_ftruncate(bulk->fd, bulk->size) < 0 ||
+		p_lseek(bulk->fd, 0, SEEK_SET) < 0)
+		goto on_oserror;
+
+	while (left > 0) {
+		size_t chunk = (left > (git_off_t)sizeof(buf)) ? sizeof(buf) : (size_t)left;
+
+		if ((read_len = p_read(bulk->fd, buf, chunk)) != (ssize_t)chunk)
+			goto on_oserror;
+
+		git_hash_update(&ctx, buf, chunk);
+		left -= chunk;
+	}
+
+	git_hash_final(out, &ctx);
+
+	if (p_write(bulk->fd, out->id, GIT_OID_RAWSZ) < 0 || p_fsync(bulk->fd) < 0)
+		goto on_oserror;
+
+	error = 0;
+	goto done;
+
+on_oserror:
+	giterr_set(GITERR_OS, "failed to write the trailer of packfile '%s'",
+		bulk->path.ptr);
+done:
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+static int bulk_write_index(
+	git_filebuf *index_file, git_odb_bulk *bulk, const git_oid *pack_hash)
+{
+	struct git_pack_idx_header hdr;
+	struct bulk_entry *entry;
+	uint32_t fanout[256] = {0}, long_offsets = 0;
+	git_oid idx_hash;
+	size_t i;
+
+	git_vector_sort(&bulk->entries);
+
+	git_vector_foreach(&bulk->entries, i, entry)
+		fanout[entry->oid.id[0]]++;
+
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	hdr.idx_signature = htonl(PACK_IDX_SIGNATURE);
+	hdr.idx_version = htonl(2);
+	git_filebuf_write(index_file, &hdr, sizeof(hdr));
+
+	for (i = 0; i < 256; i++) {
+		uint32_t n = htonl(fanout[i]);
+		git_filebuf_write(index_file, &n, sizeof(n));
+	}
+
+	git_vector_foreach(&bulk->entries, i, entry)
+		git_filebuf_write(index_file, &entry->oid, GIT_OID_RAWSZ);
+
+	git_vector_foreach(&bulk->entries, i, entry) {
+		uint32_t n = htonl(entry->crc);
+		git_filebuf_write(index_file, &n, sizeof(n));
+	}
+
+	git_vector_foreach(&bulk->entries, i, entry) {
+		uint32_t n;
+
+		if (entry->offset > 0x7fffffff)
+			n = htonl(0x80000000 | long_offsets++);
+		else
+			n = htonl((uint32_t)entry->offset);
+
+		git_filebuf_write(index_file, &n, sizeof(n));
+	}
+
+	git_vector_foreach(&bulk->entries, i, entry) {
+		uint32_t split[2];
+
+		if (entry->offset <= 0x7fffffff)
+			continue;
+
+		split[0] = htonl((uint32_t)(entry->offset >> 32));
+		split[1] = htonl((uint32_t)(entry->offset & 0xffffffff));
+		git_filebuf_write(index_file, split, sizeof(split));
+	}
+
+	if (git_filebuf_write(index_file, pack_hash->id, GIT_OID_RAWSZ) < 0 ||
+		git_filebuf_hash(&idx_hash, index_file) < 0)
+		return -1;
+
+	return git_filebuf_write(index_file, idx_hash.id, GIT_OID_RAWSZ);
+}
+
+static void bulk_unregister(git_odb_bulk *bulk, bool aborted)
+{
+	if (!bulk->registered)
+		return;
+
+	git_odb__remove_bulk(bulk->db, &bulk->parent, aborted);
+	bulk->registered = 0;
+
+	if (bulk->fd >= 0) {
+		p_close(bulk->fd);
+		bulk->fd = -1;
+	}
+
+	if (aborted)
+		p_unlink(bulk->path.ptr);
+}
+
+int git_odb_bulk_begin(git_odb_bulk **out, git_odb *db)
+{
+	git_odb_bulk *bulk;
+	const char *pack_folder;
+	struct git_pack_header hdr = {0};
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	assert(out && db);
+
+	if ((error = git_odb__pack_folder(&pack_folder, db)) < 0)
+		return error;
+
+	bulk = git__calloc(1, sizeof(git_odb_bulk));
+	GITERR_CHECK_ALLOC(bulk);
+
+	bulk->fd = -1;
+
+	if (git_mutex_init(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize bulk write mutex");
+		git__free(bulk);
+		return -1;
+	}
+
+	if ((bulk->objects = git_oidmap_alloc()) == NULL ||
+		git_vector_init(&bulk->entries, 0, bulk_entry_cmp) < 0 ||
+		git_buf_joinpath(&path, pack_folder, "pack_bulk") < 0 ||
+		git_futils_mkdir(pack_folder, NULL, GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH) < 0 ||
+		(bulk->fd = git_futils_mktmp(&bulk->path, path.ptr, GIT_PACK_FILE_MODE)) < 0)
+		goto on_error;
+
+	/* the number of objects is only known at commit */
+	if (p_write(bulk->fd, &hdr, sizeof(hdr)) < 0) {
+		giterr_set(GITERR_OS, "failed to write to packfile '%s'", bulk->path.ptr);
+		goto on_error;
+	}
+
+	bulk->size = sizeof(hdr);
+
+	bulk->parent.version = GIT_ODB_BACKEND_VERSION;
+	bulk->parent.read = &impl__read;
+	bulk->parent.read_prefix = &impl__read_prefix;
+	bulk->parent.read_header = &impl__read_header;
+	bulk->parent.write = &impl__write;
+	bulk->parent.writestream = &impl__writestream;
+	bulk->parent.exists = &impl__exists;
+	bulk->parent.exists_prefix = &impl__exists_prefix;
+	bulk->parent.foreach = &impl__foreach;
+	bulk->parent.free = &impl__free;
+
+	if (git_odb__add_bulk(db, &bulk->parent) < 0)
+		goto on_error;
+
+	bulk->db = db;
+	bulk->registered = 1;
+	GIT_REFCOUNT_INC(db);
+
+	git_buf_free(&path);
+	*out = bulk;
+	return 0;
+
+on_error:
+	git_buf_free(&path);
+
+	if (bulk->fd >= 0) {
+		p_close(bulk->fd);
+		p_unlink(bulk->path.ptr);
+	}
+
+	bulk->fd = -1;
+	git_odb_bulk_free(bulk);
+	return -1;
+}
+
+int git_odb_bulk_commit(git_odb_bulk *bulk)
+{
+	git_filebuf index_file = GIT_FILEBUF_INIT;
+	git_buf pack_path = GIT_BUF_INIT, idx_path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid pack_hash;
+	int error = -1;
+
+	assert(bulk);
+
+	/* readers use the descriptor until the bulk write is unregistered */
+	if (git_mutex_lock(&bulk->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock bulk write");
+		return -1;
+	}
+
+	if (!bulk->registered) {
+		giterr_set(GITERR_ODB, "the bulk write is no longer in progress");
+		git_mutex_unlock(&bulk->lock);
+		return -1;
+	}
+
+	if (bulk->streaming) {
+		giterr_set(GITERR_ODB,
+			"cannot commit the bulk write while an object is being written");
+		git_mutex_unlock(&bulk->lock);
+		return -1;
+	}
+
+	/* there is nothing to pack */
+	if (!bulk->entries.length) {
+		bulk_unregister(bulk, true);
+		git_mutex_unlock(&bulk->lock);
+		return 0;
+	}
+
+	if (bulk_write_header(bulk) < 0 ||
+		bulk_write_trailer(&pack_hash, bulk) < 0)
+		goto done;
+
+	git_oid_tostr(hex, sizeof(hex), &pack_hash);
+
+	if (git_buf_sets(&pack_path, bulk->path.ptr) < 0 ||
+		git_path_dirname_r(&idx_path, pack_path.ptr) < 0)
+		goto done;
+
+	git_buf_clear(&pack_path);
+	if (git_buf_printf(&pack_path, "%s/pack-%s.pack", idx_path.ptr, hex) < 0 ||
+		git_buf_printf(&idx_path, "/pack-%s.idx", hex) < 0)
+		goto done;
+
+	if (git_filebuf_open(&index_file, idx_path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS, GIT_PACK_FILE_MODE) < 0 ||
+		bulk_write_index(&index_file, bulk, &pack_hash) < 0)
+		goto done;
+
+	/* We need to close the descriptor here so Windows doesn't choke on the rename */
+	p_close(bulk->fd);
+	bulk->fd = -1;
+
+	/* the packfile goes in first, as it's ignored until it has an index */
+	if (p_rename(bulk->path.ptr, pack_path.ptr) < 0) {
+		giterr_set(GITERR_OS, "failed to move packfile to '%s'", pack_path.ptr);
+		goto done;
+	}
+
+	if (git_filebuf_commit(&index_file) < 0) {
+		p_unlink(pack_path.ptr);
+		goto done;
+	}
+
+	bulk_unregister(bulk, false);
+	error = 0;
+
+done:
+	if (bulk->registered)
+		bulk_unregister(bulk, true);
+
+	git_mutex_unlock(&bulk->lock);
+
+	if (!error)
+		error = git_odb_refresh(bulk->db);
+
+	git_filebuf_cleanup(&index_file);
+	git_buf_free(&pack_path);
+	git_buf_free(&idx_path);
+	return error;
+}
+
+void git_odb_bulk_free(git_odb_bulk *bulk)
+{
+	struct bulk_entry *entry;
+	size_t i;
+
+	if (bulk == NULL)
+		return;
+
+	bulk_unregister(bulk, true);
+
+	git_vector_foreach(&bulk->entries, i, entry)
+		git__free(entry);
+
+	git_vector_free(&bulk->entries);
+	git_oidmap_free(bulk->objects);
+	git_buf_free(&bulk->path);
+	git_mutex_free(&bulk->lock);
+
+	git_odb_free(bulk->db);
+	git__free(bulk);
+}
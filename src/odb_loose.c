@@ -14,6 +14,9 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "array.h"
+#include "oid.h"
+#include "sha1_lookup.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -28,9 +31,20 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+/* The sorted names of the objects in a fanout directory */
+typedef struct {
+	git_futils_filestamp stamp;
+	git_array_t(git_oid) ids;
+	bool loaded;
+} loose_fanout;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
+	/* listings of the fanout directories prefix lookups looked into */
+	git_mutex fanout_lock;
+	loose_fanout *fanouts;
+
 	int object_zlib_level; /** loose object zlib compression level. */
 	int fsync_object_files; /** loose object file fsync flag. */
 	mode_t object_file_mode;
@@ -40,19 +54,6 @@ typedef struct loose_backend {
 	char objects_dir[GIT_FLEX_ARRAY];
 } loose_backend;
 
-/* State structure for exploring directories,
- * in order to locate objects matching a short oid.
- */
-typedef struct {
-	size_t dir_len;
-	unsigned char short_oid[GIT_OID_HEXSZ]; /* hex formatted oid to match */
-	size_t short_oid_len;
-	int found;				/* number of matching
-						 * objects already found */
-	unsigned char res_oid[GIT_OID_HEXSZ];	/* hex formatted oid of
-						 * the object found */
-} loose_locate_object_state;
-
 
 /***********************************************************
  *
@@ -82,6 +83,34 @@ static int object_file_name(
 	return 0;
 }
 
+GIT_INLINE(int) filename_to_oid(git_oid *oid, const char *ptr)
+{
+	int v, i = 0;
+	if (strlen(ptr) != GIT_OID_HEXSZ+1)
+		return -1;
+
+	if (ptr[2] != '/') {
+		return -1;
+	}
+
+	v = (git__fromhex(ptr[i]) << 4) | git__fromhex(ptr[i+1]);
+	if (v < 0)
+		return -1;
+
+	oid->id[0] = (unsigned char) v;
+
+	ptr += 3;
+	for (i = 0; i < 38; i += 2) {
+		v = (git__fromhex(ptr[i]) << 4) | git__fromhex(ptr[i + 1]);
+		if (v < 0)
+			return -1;
+
+		oid->id[1 + i/2] = (unsigned char) v;
+	}
+
+	return 0;
+}
+
 static int object_mkdir(const git_buf *name, const loose_backend *be)
 {
 	return git_futils_mkdir(
@@ -481,118 +510,161 @@ static int locate_object(
 	return error;
 }
 
-/* Explore an entry of a directory and see if it matches a short oid */
-static int fn_locate_object_short_oid(void *state, git_buf *pathbuf) {
-	loose_locate_object_state *sstate = (loose_locate_object_state *)state;
+static int fanout_cmp(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid__cmp(a, b);
+}
 
-	if (git_buf_len(pathbuf) - sstate->dir_len != GIT_OID_HEXSZ - 2) {
-		/* Entry cannot be an object. Continue to next entry */
-		return 0;
-	}
+struct fanout_load_state {
+	loose_fanout *fanout;
+	size_t dir_len;
+};
 
-	if (git_path_isdir(pathbuf->ptr) == false) {
-		/* We are already in the directory matching the 2 first hex characters,
-		 * compare the first ncmp characters of the oids */
-		if (!memcmp(sstate->short_oid + 2,
-			(unsigned char *)pathbuf->ptr + sstate->dir_len,
-			sstate->short_oid_len - 2)) {
-
-			if (!sstate->found) {
-				sstate->res_oid[0] = sstate->short_oid[0];
-				sstate->res_oid[1] = sstate->short_oid[1];
-				memcpy(sstate->res_oid+2, pathbuf->ptr+sstate->dir_len, GIT_OID_HEXSZ-2);
-			}
-			sstate->found++;
-		}
-	}
+static int fanout_load_cb(void *payload, git_buf *path)
+{
+	struct fanout_load_state *state = payload;
+	git_oid id, *entry;
 
-	if (sstate->found > 1)
-		return GIT_EAMBIGUOUS;
+	/* anything but an object, like a temporary file, is skipped */
+	if (filename_to_oid(&id, path->ptr + state->dir_len) < 0)
+		return 0;
+
+	if ((entry = git_array_alloc(state->fanout->ids)) == NULL)
+		return -1;
 
+	git_oid_cpy(entry, &id);
 	return 0;
 }
 
-/* Locate an object matching a given short oid */
-static int locate_object_short_oid(
-	git_buf *object_location,
-	git_oid *res_oid,
-	loose_backend *backend,
-	const git_oid *short_oid,
-	size_t len)
+/*
+ * Get the listing of a fanout directory, reading it again if the
+ * directory changed since it was last read. Run with the fanout lock
+ * held.
+ */
+static int fanout_load(loose_fanout **out, loose_backend *backend, int n)
 {
-	char *objects_dir = backend->objects_dir;
-	size_t dir_len = strlen(objects_dir), alloc_len;
-	loose_locate_object_state state;
-	int error;
-
-	/* prealloc memory for OBJ_DIR/xx/xx..38x..xx */
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, dir_len, GIT_OID_HEXSZ);
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, alloc_len, 3);
-	if (git_buf_grow(object_location, alloc_len) < 0)
+	loose_fanout *fanout;
+	struct fanout_load_state state;
+	git_buf path = GIT_BUF_INIT;
+	time_t now = time(NULL);
+	int changed, error = 0;
+
+	if (!backend->fanouts &&
+		(backend->fanouts = git__calloc(256, sizeof(loose_fanout))) == NULL)
 		return -1;
 
-	git_buf_set(object_location, objects_dir, dir_len);
-	git_path_to_dir(object_location);
+	fanout = &backend->fanouts[n];
 
-	/* save adjusted position at end of dir so it can be restored later */
-	dir_len = git_buf_len(object_location);
-
-	/* Convert raw oid to hex formatted oid */
-	git_oid_fmt((char *)state.short_oid, short_oid);
-
-	/* Explore OBJ_DIR/xx/ where xx is the beginning of hex formatted short oid */
-	if (git_buf_put(object_location, (char *)state.short_oid, 3) < 0)
+	if (git_buf_set(&path, backend->objects_dir, backend->objects_dirlen) < 0 ||
+		git_buf_printf(&path, "%02x", n) < 0)
 		return -1;
-	object_location->ptr[object_location->size - 1] = '/';
 
-	/* Check that directory exists */
-	if (git_path_isdir(object_location->ptr) == false)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	changed = git_futils_filestamp_check(&fanout->stamp, path.ptr);
 
-	state.dir_len = git_buf_len(object_location);
-	state.short_oid_len = len;
-	state.found = 0;
+	/* a directory which doesn't exist holds no objects */
+	if (changed == GIT_ENOTFOUND) {
+		git_array_clear(fanout->ids);
+		git_futils_filestamp_set(&fanout->stamp, NULL);
+		fanout->loaded = true;
+		goto done;
+	}
 
-	/* Explore directory to find a unique object matching short_oid */
-	error = git_path_direach(
-		object_location, 0, fn_locate_object_short_oid, &state);
-	if (error < 0 && error != GIT_EAMBIGUOUS)
-		return error;
+	if (!changed && fanout->loaded)
+		goto done;
 
-	if (!state.found)
-		return git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	git_array_clear(fanout->ids);
+	fanout->loaded = false;
 
-	if (state.found > 1)
-		return git_odb__error_ambiguous("multiple matches in loose objects");
+	state.fanout = fanout;
+	state.dir_len = backend->objects_dirlen;
 
-	/* Convert obtained hex formatted oid to raw */
-	error = git_oid_fromstr(res_oid, (char *)state.res_oid);
-	if (error)
-		return error;
+	if ((error = git_path_direach(&path, 0, fanout_load_cb, &state)) < 0) {
+		git_array_clear(fanout->ids);
+		git_futils_filestamp_set(&fanout->stamp, NULL);
+		goto done;
+	}
 
-	/* Update the location according to the oid obtained */
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, dir_len, GIT_OID_HEXSZ);
-	GITERR_CHECK_ALLOC_ADD(&alloc_len, alloc_len, 2);
+	git__qsort_r(fanout->ids.ptr, git_array_size(fanout->ids),
+		sizeof(git_oid), fanout_cmp, NULL);
+	fanout->loaded = true;
 
-	git_buf_truncate(object_location, dir_len);
-	if (git_buf_grow(object_location, alloc_len) < 0)
-		return -1;
+	/* it may change again within this second; never match it */
+	if (fanout->stamp.mtime >= (git_time_t)now) {
+		git_futils_filestamp_set(&fanout->stamp, NULL);
+		fanout->stamp.mtime = -1;
+	}
 
-	git_oid_pathfmt(object_location->ptr + dir_len, res_oid);
+done:
+	git_buf_free(&path);
+	*out = fanout;
+	return error;
+}
 
-	object_location->size += GIT_OID_HEXSZ + 1;
-	object_location->ptr[object_location->size] = '\0';
+/* Find the object whose name starts with the first `len` digits of `short_oid` */
+static int fanout_find_prefix(
+	git_oid *out,
+	loose_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	loose_fanout *fanout;
+	git_oid key = {{0}};
+	size_t lo = 0, hi, size;
+	int error;
 
-	return 0;
-}
+	/* just copy valid part of short_id */
+	memcpy(&key.id, short_oid->id, (len + 1) / 2);
+	if (len & 1)
+		key.id[len / 2] &= 0xF0;
 
+	if (git_mutex_lock(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object cache");
+		return -1;
+	}
 
+	if ((error = fanout_load(&fanout, backend, key.id[0])) < 0)
+		goto done;
 
+	/* find the first object not sorting before the prefix */
+	hi = size = git_array_size(fanout->ids);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
 
+		if (git_oid__cmp(git_array_get(fanout->ids, mid), &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
+	if (lo == size || git_oid_ncmp(git_array_get(fanout->ids, lo), &key, len))
+		error = git_odb__error_notfound("no matching loose object for prefix", short_oid);
+	else if (lo + 1 < size &&
+		!git_oid_ncmp(git_array_get(fanout->ids, lo + 1), &key, len))
+		error = git_odb__error_ambiguous("multiple matches in loose objects");
+	else
+		git_oid_cpy(out, git_array_get(fanout->ids, lo));
 
+done:
+	git_mutex_unlock(&backend->fanout_lock);
+	return error;
+}
 
+/* Locate an object matching a given short oid */
+static int locate_object_short_oid(
+	git_buf *object_location,
+	git_oid *res_oid,
+	loose_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	int error;
 
+	if ((error = fanout_find_prefix(res_oid, backend, short_oid, len)) < 0)
+		return error;
+
+	return object_file_name(object_location, backend, res_oid);
+}
 
 /***********************************************************
  *
@@ -715,40 +787,41 @@ static int loose_backend__exists_prefix(
 	return error;
 }
 
-struct foreach_state {
-	size_t dir_len;
-	git_odb_foreach_cb cb;
-	void *data;
-};
-
-GIT_INLINE(int) filename_to_oid(git_oid *oid, const char *ptr)
+static int loose_backend__unique_prefix_len(
+	size_t *lens, git_odb_backend *_backend, const git_oid *ids, size_t count)
 {
-	int v, i = 0;
-	if (strlen(ptr) != GIT_OID_HEXSZ+1)
-		return -1;
+	loose_backend *backend = (loose_backend *)_backend;
+	loose_fanout *fanout;
+	size_t i, len, size;
+	int error = 0;
 
-	if (ptr[2] != '/') {
+	if (git_mutex_lock(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object cache");
 		return -1;
 	}
 
-	v = (git__fromhex(ptr[i]) << 4) | git__fromhex(ptr[i+1]);
-	if (v < 0)
-		return -1;
+	for (i = 0; i < count; i++) {
+		if ((error = fanout_load(&fanout, backend, ids[i].id[0])) < 0)
+			break;
 
-	oid->id[0] = (unsigned char) v;
+		size = git_array_size(fanout->ids);
+		len = sha1_unique_prefix_len(fanout->ids.ptr, sizeof(git_oid),
+			0, (unsigned)size, (unsigned)size, ids[i].id);
 
-	ptr += 3;
-	for (i = 0; i < 38; i += 2) {
-		v = (git__fromhex(ptr[i]) << 4) | git__fromhex(ptr[i + 1]);
-		if (v < 0)
-			return -1;
-
-		oid->id[1 + i/2] = (unsigned char) v;
+		if (len > lens[i])
+			lens[i] = len;
 	}
 
-	return 0;
+	git_mutex_unlock(&backend->fanout_lock);
+	return error;
 }
 
+struct foreach_state {
+	size_t dir_len;
+	git_odb_foreach_cb cb;
+	void *data;
+};
+
 static int foreach_object_dir_cb(void *_state, git_buf *path)
 {
 	git_oid oid;
@@ -914,12 +987,40 @@ cleanup:
 	return error;
 }
 
+static int loose_backend__refresh(git_odb_backend *_backend)
+{
+	loose_backend *backend = (loose_backend *)_backend;
+	loose_fanout *fanout;
+	int i, error = 0;
+
+	if (git_mutex_lock(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock loose object cache");
+		return -1;
+	}
+
+	/* read the cached fanout directories which changed again */
+	for (i = 0; backend->fanouts && i < 256 && !error; i++) {
+		if (backend->fanouts[i].loaded)
+			error = fanout_load(&fanout, backend, i);
+	}
+
+	git_mutex_unlock(&backend->fanout_lock);
+	return error;
+}
+
 static void loose_backend__free(git_odb_backend *_backend)
 {
 	loose_backend *backend;
+	int i;
+
 	assert(_backend);
 	backend = (loose_backend *)_backend;
 
+	for (i = 0; backend->fanouts && i < 256; i++)
+		git_array_clear(backend->fanouts[i].ids);
+
+	git__free(backend->fanouts);
+	git_mutex_free(&backend->fanout_lock);
 	git__free(backend);
 }
 
@@ -943,6 +1044,12 @@ int git_odb_backend_loose(
 	backend = git__calloc(1, alloclen);
 	GITERR_CHECK_ALLOC(backend);
 
+	if (git_mutex_init(&backend->fanout_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize loose object cache mutex");
+		git__free(backend);
+		return -1;
+	}
+
 	backend->parent.version = GIT_ODB_BACKEND_VERSION;
 	backend->objects_dirlen = objects_dirlen;
 	memcpy(backend->objects_dir, objects_dir, objects_dirlen);
@@ -971,6 +1078,8 @@ int git_odb_backend_loose(
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.exists_prefix = &loose_backend__exists_prefix;
 	backend->parent.foreach = &loose_backend__foreach;
+	backend->parent.refresh = &loose_backend__refresh;
+	backend->parent.unique_prefix_len = &loose_backend__unique_prefix_len;
 	backend->parent.free = &loose_backend__free;
 
 	*backend_out = (git_odb_backend *)backend;
@@ -17,11 +17,15 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "midx.h"
+#include "array.h"
 
 #include "git2/odb_backend.h"
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
@@ -32,6 +36,11 @@ struct pack_writepack {
 	git_indexer *indexer;
 };
 
+struct pack_readstream {
+	git_odb_stream parent;
+	git_packfile_object_stream *stream;
+};
+
 /**
  * The wonderful tale of a Packed Object lookup query
  * ===================================================
@@ -70,10 +79,16 @@ struct pack_writepack {
  *	 |		We don't actually open the packfile to check for internal consistency.
  *	|
  *	|-# packfile_sort__cb
- *		Sort all the preloaded packs according to some specific criteria:
- *		we prioritize the "newer" packs because it's more likely they
- *		contain the objects we are looking for, and we prioritize local
- *		packs over remote ones.
+ *	|	Sort all the preloaded packs according to some specific criteria:
+ *	|	we prioritize the "newer" packs because it's more likely they
+ *	|	contain the objects we are looking for, and we prioritize local
+ *	|	packs over remote ones.
+ *	|
+ *	|-# refresh_multi_pack_index
+ *		If the pack folder has a `multi-pack-index` file, load it and
+ *		the packfiles it covers. Those packs are kept in their own
+ *		`midx_packs` vector (in the order the index refers to them) and
+ *		are not added to the regular `packs` list anymore.
  *
  *
  *
@@ -88,7 +103,9 @@ struct pack_writepack {
  * |-# pack_entry_find
  *	| Iterate through all the packs that have been preloaded
  *	| (starting by the pack where the latest object was found)
- *	| to try to find the OID in one of them.
+ *	| to try to find the OID in one of them. If there is a
+ *	| multi-pack-index, a single lookup into it replaces the
+ *	| search through all the packs that it covers.
  *	|
  *	|-# pack_entry_find1
  *		| Check the index of an individual pack to see if the SHA1
@@ -135,7 +152,7 @@ struct pack_writepack {
 
 static int packfile_sort__cb(const void *a_, const void *b_);
 
-static int packfile_load__cb(void *_data, git_buf *path);
+static int packfile_load__cb(void *data, git_buf *path);
 
 static int pack_entry_find(struct git_pack_entry *e,
 	struct pack_backend *backend, const git_oid *oid);
@@ -190,9 +207,17 @@ static int packfile_sort__cb(const void *a_, const void *b_)
 }
 
 
+struct packfile_load_state {
+	struct pack_backend *backend;
+	/* which of the packs loaded before the refresh are still there */
+	bool *seen;
+	size_t known;
+};
+
 static int packfile_load__cb(void *data, git_buf *path)
 {
-	struct pack_backend *backend = data;
+	struct packfile_load_state *state = data;
+	struct pack_backend *backend = state->backend;
 	struct git_pack_file *pack;
 	const char *path_str = git_buf_cstr(path);
 	size_t i, cmp_len = git_buf_len(path);
@@ -203,11 +228,21 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 	cmp_len -= strlen(".idx");
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
+			return 0;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 
-		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
+		if (memcmp(p->pack_name, path_str, cmp_len) == 0) {
+			if (i < state->known)
+				state->seen[i] = true;
 			return 0;
+		}
 	}
 
 	error = git_mwindow_get_pack(&pack, path->ptr);
@@ -225,6 +260,28 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 }
 
+static int midx_entry_find(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	struct git_pack_file *p;
+	int error;
+
+	if (!backend->midx)
+		return GIT_ENOTFOUND;
+
+	if ((error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	if ((p = git_vector_get(&backend->midx_packs, midx_entry.pack_index)) == NULL)
+		return git_odb__error_notfound("multi-pack-index entry refers to an unknown pack", short_oid);
+
+	return git_pack_entry_from_offset(e, p, &midx_entry.sha1, midx_entry.offset);
+}
+
 static int pack_entry_find_inner(
 	struct git_pack_entry *e,
 	struct pack_backend *backend,
@@ -237,6 +294,9 @@ static int pack_entry_find_inner(
 		git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (midx_entry_find(e, backend, oid, GIT_OID_HEXSZ) == 0)
+		return 0;
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -289,6 +349,18 @@ static int pack_entry_find_prefix(
 		}
 	}
 
+	if (backend->midx) {
+		error = midx_entry_find(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+		}
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -315,6 +387,147 @@ static int pack_entry_find_prefix(
 }
 
 
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX SUPPORT
+ *
+ * Functions needed to support the multi-pack-index.
+ *
+ ***********************************************************/
+
+static void remove_multi_pack_index(struct pack_backend *backend)
+{
+	size_t i;
+	struct git_pack_file *p;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (!p)
+			continue;
+		if (p == backend->last_found)
+			backend->last_found = NULL;
+		git_mwindow_put_pack(p);
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+/*
+ * Remove from the regular list the packs that are now covered by the
+ * multi-pack-index, so that we don't search through them twice.
+ */
+static void prune_packs_covered_by_midx(struct pack_backend *backend)
+{
+	size_t i, j;
+	struct git_pack_file *p, *midx_p;
+
+	for (i = backend->packs.length; i > 0; --i) {
+		p = git_vector_get(&backend->packs, i - 1);
+
+		git_vector_foreach(&backend->midx_packs, j, midx_p) {
+			if (strcmp(p->pack_name, midx_p->pack_name) != 0)
+				continue;
+
+			if (p == backend->last_found)
+				backend->last_found = NULL;
+			git_vector_remove(&backend->packs, i - 1);
+			git_mwindow_put_pack(p);
+			break;
+		}
+	}
+}
+
+static int process_multi_pack_index_pack(
+	struct pack_backend *backend,
+	size_t i,
+	const char *packfile_name)
+{
+	int error;
+	struct git_pack_file *pack;
+	git_buf pack_path = GIT_BUF_INIT;
+
+	if ((error = git_buf_joinpath(&pack_path, backend->pack_folder, packfile_name)) < 0)
+		return error;
+
+	error = git_mwindow_get_pack(&pack, git_buf_cstr(&pack_path));
+	git_buf_free(&pack_path);
+	if (error < 0)
+		return error;
+
+	if ((error = git_vector_set(NULL, &backend->midx_packs, i, pack)) < 0) {
+		git_mwindow_put_pack(pack);
+		return error;
+	}
+
+	return 0;
+}
+
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	int error;
+	git_buf midx_path = GIT_BUF_INIT;
+	const char *packfile_name;
+	size_t i;
+
+	if ((error = git_buf_joinpath(&midx_path, backend->pack_folder, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	/*
+	 * If there's no multi-pack-index file or it is unchanged since we
+	 * loaded it, there is nothing else to do.
+	 */
+	if (!git_path_exists(git_buf_cstr(&midx_path))) {
+		if (backend->midx)
+			remove_multi_pack_index(backend);
+		goto done;
+	}
+
+	if (backend->midx && !git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path)))
+		goto done;
+
+	if (backend->midx)
+		remove_multi_pack_index(backend);
+
+	/*
+	 * A multi-pack-index that we cannot parse is not fatal: like git,
+	 * we simply fall back to looking into the individual packs.
+	 */
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		giterr_clear();
+		backend->midx = NULL;
+		goto done;
+	}
+
+	git_vector_foreach(&backend->midx->packfile_names, i, packfile_name) {
+		if ((error = process_multi_pack_index_pack(backend, i, packfile_name)) < 0)
+			break;
+	}
+
+	/*
+	 * The multi-pack-index is out of date if any of the packs it refers
+	 * to has disappeared (e.g. it has been repacked away); ignore it until
+	 * it gets rewritten.
+	 */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+		remove_multi_pack_index(backend);
+		goto done;
+	}
+
+	if (error < 0) {
+		remove_multi_pack_index(backend);
+		goto done;
+	}
+
+	prune_packs_covered_by_midx(backend);
+
+done:
+	git_buf_free(&midx_path);
+	return error;
+}
+
 /***********************************************************
  *
  * PACKED BACKEND PUBLIC API
@@ -328,6 +541,8 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	struct stat st;
 	git_buf path = GIT_BUF_INIT;
 	struct pack_backend *backend = (struct pack_backend *)backend_;
+	struct packfile_load_state state;
+	size_t i;
 
 	if (backend->pack_folder == NULL)
 		return 0;
@@ -335,11 +550,33 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
+	state.backend = backend;
+	state.known = backend->packs.length;
+	state.seen = git__calloc(state.known ? state.known : 1, sizeof(bool));
+	GITERR_CHECK_ALLOC(state.seen);
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
-	error = git_path_direach(&path, 0, packfile_load__cb, backend);
+	error = git_path_direach(&path, 0, packfile_load__cb, &state);
+
+	/* forget the packs which have been removed, e.g. by a repack */
+	for (i = state.known; !error && i > 0; --i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i - 1);
 
+		if (state.seen[i - 1])
+			continue;
+
+		if (p == backend->last_found)
+			backend->last_found = NULL;
+		git_vector_remove(&backend->packs, i - 1);
+		git_mwindow_put_pack(p);
+	}
+
+	git__free(state.seen);
 	git_buf_free(&path);
 	git_vector_sort(&backend->packs);
 
@@ -414,6 +651,74 @@ static int pack_backend__read(
 	return pack_backend__read_internal(buffer_p, len_p, type_p, backend, oid);
 }
 
+static int pack_readstream__read(
+	git_odb_stream *_stream, char *buffer, size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+	ssize_t read;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	if ((read = git_packfile_object_stream_read(stream->stream, buffer, len)) > 0)
+		stream->parent.received_bytes += read;
+
+	return (int)read;
+}
+
+static void pack_readstream__free(git_odb_stream *_stream)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_object_stream_free(stream->stream);
+	git__free(stream);
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **out, git_odb_backend *_backend, const git_oid *oid)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct pack_readstream *stream;
+	struct git_pack_entry e;
+	git_buf spill_path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = pack_entry_find(&e, backend, oid)) == GIT_ENOTFOUND &&
+		(error = pack_backend__refresh(_backend)) == 0)
+		error = pack_entry_find(&e, backend, oid);
+
+	if (error < 0)
+		return error;
+
+	/* spill large delta bases into the objects directory */
+	if (backend->pack_folder &&
+		(git_path_dirname_r(&spill_path, backend->pack_folder) < 0 ||
+		 git_buf_joinpath(&spill_path, spill_path.ptr, "tmp_stream") < 0))
+		return -1;
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if ((error = git_packfile_object_stream_open(&stream->stream, e.p,
+			e.offset, backend->pack_folder ? spill_path.ptr : NULL)) < 0) {
+		git__free(stream);
+		git_buf_free(&spill_path);
+		return error;
+	}
+
+	git_buf_free(&spill_path);
+
+	stream->parent.backend = _backend;
+	stream->parent.mode = GIT_STREAM_RDONLY;
+	stream->parent.declared_size =
+		(git_off_t)git_packfile_object_stream_size(stream->stream);
+	stream->parent.read = &pack_readstream__read;
+	stream->parent.free = &pack_readstream__free;
+
+	*out = (git_odb_stream *)stream;
+	return 0;
+}
+
 static int pack_backend__read_prefix_internal(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -493,6 +798,169 @@ static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
 	return pack_entry_find(&e, (struct pack_backend *)backend, oid) == 0;
 }
 
+struct batch_hit {
+	git_odb_batch_entry *entry;
+	struct git_pack_file *p;
+	git_off_t offset;
+};
+
+static int batch_hit_cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct batch_hit *a = a_, *b = b_;
+
+	GIT_UNUSED(payload);
+
+	if (a->p != b->p)
+		return ((uintptr_t)a->p < (uintptr_t)b->p) ? -1 : 1;
+
+	return (a->offset < b->offset) ? -1 : (a->offset > b->offset);
+}
+
+static int pack_backend__read_many_internal(
+	size_t *missing,
+	struct pack_backend *backend,
+	git_odb_batch_entry *entries,
+	size_t count,
+	git_odb_batch_t what)
+{
+	git_array_t(struct batch_hit) hits = GIT_ARRAY_INIT;
+	git_odb_batch_entry **pending = NULL;
+	const git_oid **ids = NULL;
+	git_off_t *offsets = NULL;
+	struct git_pack_entry e;
+	struct batch_hit *hit;
+	size_t i, j, n = 0, alloc_len = count ? count : 1;
+	int error = 0;
+
+	pending = git__calloc(alloc_len, sizeof(git_odb_batch_entry *));
+	ids = git__calloc(alloc_len, sizeof(git_oid *));
+	offsets = git__calloc(alloc_len, sizeof(git_off_t));
+
+	if (!pending || !ids || !offsets) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (entries[i].found)
+			continue;
+
+		/* a multi-pack-index covers its packs with a single lookup */
+		if (midx_entry_find(&e, backend, &entries[i].id, GIT_OID_HEXSZ) == 0) {
+			if ((hit = git_array_alloc(hits)) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			hit->entry = &entries[i];
+			hit->p = e.p;
+			hit->offset = e.offset;
+			continue;
+		}
+
+		giterr_clear();
+		pending[n] = &entries[i];
+		ids[n++] = &entries[i].id;
+	}
+
+	/*
+	 * Resolve the remaining ids one pack at a time, walking through
+	 * its index in order rather than searching it once for each id.
+	 */
+	for (i = 0; i < backend->packs.length && n > 0; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i);
+		size_t left = 0;
+
+		if (git_pack_entry_find_many(offsets, p, ids, n) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		for (j = 0; j < n; ++j) {
+			if (offsets[j] < 0) {
+				pending[left] = pending[j];
+				ids[left++] = ids[j];
+				continue;
+			}
+
+			if ((hit = git_array_alloc(hits)) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			hit->entry = pending[j];
+			hit->p = p;
+			hit->offset = offsets[j];
+		}
+
+		n = left;
+	}
+
+	/* read the objects in the order in which they are stored */
+	if (what != GIT_ODB_BATCH_EXISTS)
+		git__qsort_r(hits.ptr, git_array_size(hits), sizeof(struct batch_hit),
+			batch_hit_cmp, NULL);
+
+	for (i = 0; i < git_array_size(hits) && !error; ++i) {
+		git_rawobj raw;
+
+		hit = git_array_get(hits, i);
+
+		switch (what) {
+		case GIT_ODB_BATCH_EXISTS:
+			break;
+
+		case GIT_ODB_BATCH_HEADER:
+			error = git_packfile_resolve_header(
+				&hit->entry->len, &hit->entry->type, hit->p, hit->offset);
+			break;
+
+		case GIT_ODB_BATCH_READ:
+			if ((error = git_packfile_unpack(&raw, hit->p, &hit->offset)) < 0)
+				break;
+
+			hit->entry->data = raw.data;
+			hit->entry->len = raw.len;
+			hit->entry->type = raw.type;
+			break;
+		}
+
+		if (!error)
+			hit->entry->found = 1;
+	}
+
+	*missing = n;
+
+done:
+	git_array_clear(hits);
+	git__free(offsets);
+	git__free(ids);
+	git__free(pending);
+	return error;
+}
+
+static int pack_backend__read_many(
+	git_odb_backend *backend,
+	git_odb_batch_entry *entries,
+	size_t count,
+	git_odb_batch_t what)
+{
+	size_t missing;
+	int error;
+
+	error = pack_backend__read_many_internal(
+		&missing, (struct pack_backend *)backend, entries, count, what);
+
+	if (error < 0 || !missing)
+		return error;
+
+	if ((error = pack_backend__refresh(backend)) < 0)
+		return error;
+
+	return pack_backend__read_many_internal(
+		&missing, (struct pack_backend *)backend, entries, count, what);
+}
+
 static int pack_backend__exists_prefix(
 	git_oid *out, git_odb_backend *backend, const git_oid *short_id, size_t len)
 {
@@ -510,6 +978,34 @@ static int pack_backend__exists_prefix(
 	return error;
 }
 
+static int pack_backend__unique_prefix_len(
+	size_t *lens, git_odb_backend *_backend, const git_oid *ids, size_t count)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct git_pack_file *p;
+	size_t i, j, len;
+	int error;
+
+	if (backend->midx) {
+		for (i = 0; i < count; i++) {
+			len = git_midx_unique_prefix_len(backend->midx, &ids[i]);
+			if (len > lens[i])
+				lens[i] = len;
+		}
+	}
+
+	git_vector_foreach(&backend->packs, j, p) {
+		for (i = 0; i < count; i++) {
+			if ((error = git_pack_unique_prefix_len(&len, p, &ids[i])) < 0)
+				return error;
+			if (len > lens[i])
+				lens[i] = len;
+		}
+	}
+
+	return 0;
+}
+
 static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb cb, void *data)
 {
 	int error;
@@ -524,6 +1020,10 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(backend->midx, cb, data)) < 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
@@ -594,6 +1094,83 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 	return 0;
 }
 
+static int get_idx_path(
+	git_buf *idx_path,
+	struct git_pack_file *p)
+{
+	size_t path_len;
+	int error;
+
+	if ((error = git_buf_sets(idx_path, p->pack_name)) < 0)
+		return error;
+
+	path_len = git_buf_len(idx_path);
+	if (path_len <= strlen(".pack") || git__suffixcmp(git_buf_cstr(idx_path), ".pack") != 0)
+		return git_odb__error_notfound("packfile does not end in .pack", NULL);
+
+	path_len -= strlen(".pack");
+	if ((error = git_buf_splice(idx_path, path_len, strlen(".pack"), ".idx", strlen(".idx"))) < 0)
+		return error;
+
+	return 0;
+}
+
+static int pack_backend__writemidx(git_odb_backend *_backend)
+{
+	struct pack_backend *backend;
+	git_midx_writer *w = NULL;
+	struct git_pack_file *p;
+	size_t i;
+	int error = 0;
+
+	assert(_backend);
+
+	backend = (struct pack_backend *)_backend;
+
+	if (backend->pack_folder == NULL) {
+		giterr_set(GITERR_ODB, "cannot write a multi-pack-index without a pack folder");
+		return -1;
+	}
+
+	if ((error = pack_backend__refresh(_backend)) < 0)
+		return error;
+
+	if ((error = git_midx_writer_new(&w, backend->pack_folder)) < 0)
+		return error;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		git_buf idx_path = GIT_BUF_INIT;
+
+		error = get_idx_path(&idx_path, p);
+		if (!error)
+			error = git_midx_writer_add(w, git_buf_cstr(&idx_path));
+		git_buf_free(&idx_path);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(&backend->packs, i, p) {
+		git_buf idx_path = GIT_BUF_INIT;
+
+		error = get_idx_path(&idx_path, p);
+		if (!error)
+			error = git_midx_writer_add(w, git_buf_cstr(&idx_path));
+		git_buf_free(&idx_path);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_midx_writer_commit(w)) < 0)
+		goto cleanup;
+
+	/* Pick up the index we just wrote. */
+	error = refresh_multi_pack_index(backend);
+
+cleanup:
+	git_midx_writer_free(w);
+	return error;
+}
+
 static void pack_backend__free(git_odb_backend *_backend)
 {
 	struct pack_backend *backend;
@@ -603,6 +1180,9 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	remove_multi_pack_index(backend);
+	git_vector_free(&backend->midx_packs);
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
@@ -618,7 +1198,9 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GITERR_CHECK_ALLOC(backend);
 
-	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0 ||
+		git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
@@ -628,17 +1210,44 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
+	backend->parent.writemidx = &pack_backend__writemidx;
+	backend->parent.read_many = &pack_backend__read_many;
+	backend->parent.unique_prefix_len = &pack_backend__unique_prefix_len;
 	backend->parent.free = &pack_backend__free;
 
 	*out = backend;
 	return 0;
 }
 
+int git_odb_backend__find_pack_entry(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *oid)
+{
+	int error;
+
+	if (backend->read != &pack_backend__read)
+		return GIT_ENOTFOUND;
+
+	if ((error = pack_entry_find(e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	git_atomic_inc(&e->p->refcount);
+	return 0;
+}
+
+const char *git_odb_backend__pack_folder(git_odb_backend *backend)
+{
+	if (backend->read != &pack_backend__read)
+		return NULL;
+
+	return ((struct pack_backend *)backend)->pack_folder;
+}
+
 int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 {
 	struct pack_backend *backend = NULL;
@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "git2/commit.h"
+#include "git2/tree.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "mwindow.h"
+#include "oid.h"
+#include "path.h"
+
+GIT__USE_OIDMAP;
+
+static int bitmap_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid bitmap index - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) bitmap_get_be32(const unsigned char *p)
+{
+	return ntohl(*((uint32_t *)p));
+}
+
+/* The length of the EWAH bitmap at `data`, without decoding it. */
+static int ewah_length(size_t *out, const unsigned char *data, size_t len)
+{
+	size_t word_count;
+
+	if (len < 12)
+		return bitmap_error("truncated bitmap");
+
+	word_count = bitmap_get_be32(data + 4);
+	if (word_count > (len - 12) / 8)
+		return bitmap_error("truncated bitmap");
+
+	*out = 8 + word_count * 8 + 4;
+	return 0;
+}
+
+typedef git_array_t(git_bitmap_object) bitmap_object_array_t;
+
+static int load_object_cb(const git_oid *id, git_off_t offset, void *payload)
+{
+	bitmap_object_array_t *objects = payload;
+	git_bitmap_object *object = git_array_alloc(*objects);
+	GITERR_CHECK_ALLOC(object);
+
+	git_oid_cpy(&object->id, id);
+	object->offset = offset;
+	return 0;
+}
+
+static int pack_order_cmp(const void *a_, const void *b_, void *payload)
+{
+	const git_bitmap_object *objects = payload;
+	git_off_t a = objects[*(const uint32_t *)a_].offset;
+	git_off_t b = objects[*(const uint32_t *)b_].offset;
+
+	return (a > b) - (a < b);
+}
+
+/*
+ * Bitmaps address objects by their position in the pack, so we need the
+ * "reverse index" of the pack: the objects ordered by offset.
+ */
+static int load_pack_objects(git_bitmap_index *index)
+{
+	bitmap_object_array_t objects = GIT_ARRAY_INIT;
+	uint32_t i, count;
+	int error;
+
+	if ((error = git_pack_foreach_entry_offset(index->pack, load_object_cb, &objects)) < 0) {
+		git_array_clear(objects);
+		return error;
+	}
+
+	if (!git__is_uint32(git_array_size(objects))) {
+		git_array_clear(objects);
+		return bitmap_error("too many objects in the pack");
+	}
+
+	index->objects = objects.ptr;
+	index->num_objects = count = (uint32_t)git_array_size(objects);
+
+	index->pack_order = git__calloc(count ? count : 1, sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(index->pack_order);
+	index->bit_pos = git__calloc(count ? count : 1, sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(index->bit_pos);
+
+	for (i = 0; i < count; i++)
+		index->pack_order[i] = i;
+
+	git__qsort_r(index->pack_order, count, sizeof(uint32_t),
+		pack_order_cmp, index->objects);
+
+	for (i = 0; i < count; i++)
+		index->bit_pos[index->pack_order[i]] = i;
+
+	return 0;
+}
+
+static int bitmap_index_parse(git_bitmap_index *index)
+{
+	const struct git_bitmap_header *hdr;
+	const unsigned char *data = index->map.data, *pack_checksum;
+	size_t len = index->map.len, pos, consumed;
+	git_bitmap *type_bitmaps[4];
+	uint32_t i;
+	int error;
+
+	if (len < sizeof(struct git_bitmap_header) + GIT_OID_RAWSZ)
+		return bitmap_error("file is too short");
+
+	/* ignore the trailing checksum */
+	len -= GIT_OID_RAWSZ;
+
+	hdr = (const struct git_bitmap_header *)data;
+	if (hdr->signature != htonl(GIT_BITMAP_SIGNATURE) ||
+		ntohs(hdr->version) != GIT_BITMAP_VERSION)
+		return bitmap_error("unsupported version");
+
+	index->options = ntohs(hdr->options);
+	if (!(index->options & GIT_BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmaps without full closure are not supported");
+
+	if ((error = load_pack_objects(index)) < 0)
+		return error;
+
+	/* the index trailer holds the checksum of the pack it describes */
+	if (index->pack->index_map.len < 2 * GIT_OID_RAWSZ)
+		return bitmap_error("pack index is too short");
+	pack_checksum = (const unsigned char *)index->pack->index_map.data +
+		index->pack->index_map.len - 2 * GIT_OID_RAWSZ;
+	if (memcmp(hdr->checksum, pack_checksum, GIT_OID_RAWSZ) != 0) {
+		giterr_set(GITERR_ODB, "bitmap does not match the pack '%s'",
+			index->pack->pack_name);
+		return GIT_ENOTFOUND;
+	}
+
+	pos = sizeof(struct git_bitmap_header);
+
+	type_bitmaps[0] = &index->commits;
+	type_bitmaps[1] = &index->trees;
+	type_bitmaps[2] = &index->blobs;
+	type_bitmaps[3] = &index->tags;
+	for (i = 0; i < 4; i++) {
+		if ((error = git_ewah_read(type_bitmaps[i], &consumed, data + pos, len - pos)) < 0)
+			return error;
+		pos += consumed;
+	}
+
+	index->entry_count = ntohl(hdr->entry_count);
+	index->entries = git__calloc(
+		index->entry_count ? index->entry_count : 1, sizeof(git_stored_bitmap));
+	GITERR_CHECK_ALLOC(index->entries);
+
+	index->entries_by_commit = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(index->entries_by_commit);
+
+	for (i = 0; i < index->entry_count; i++) {
+		git_stored_bitmap *entry = &index->entries[i];
+		uint32_t commit_pos;
+		uint8_t xor_offset;
+
+		if (len - pos < 6)
+			return bitmap_error("truncated bitmap entry");
+
+		commit_pos = bitmap_get_be32(data + pos);
+		xor_offset = data[pos + 4];
+		entry->flags = data[pos + 5];
+		pos += 6;
+
+		if (commit_pos >= index->num_objects)
+			return bitmap_error("commit position out of range");
+		if (xor_offset > GIT_BITMAP_MAX_XOR_OFFSET || xor_offset > i)
+			return bitmap_error("invalid XOR offset");
+
+		git_oid_cpy(&entry->commit, &index->objects[commit_pos].id);
+		entry->xor_base = xor_offset ? &index->entries[i - xor_offset] : NULL;
+
+		if ((error = ewah_length(&entry->ewah_len, data + pos, len - pos)) < 0)
+			return error;
+		entry->ewah = data + pos;
+		pos += entry->ewah_len;
+
+		git_oidmap_insert(index->entries_by_commit, &entry->commit, entry, error);
+		if (error < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+	}
+
+	if (index->options & GIT_BITMAP_OPT_HASH_CACHE) {
+		if ((len - pos) / 4 < index->num_objects)
+			return bitmap_error("truncated name-hash cache");
+		index->hash_cache = data + pos;
+	}
+
+	return 0;
+}
+
+int git_bitmap_index_open(git_bitmap_index **out, struct git_pack_file *pack)
+{
+	git_bitmap_index *index;
+	git_buf path = GIT_BUF_INIT;
+	git_file fd;
+	struct stat st;
+	int error;
+
+	assert(out && pack);
+
+	*out = NULL;
+
+	if (git_buf_sets(&path, pack->pack_name) < 0)
+		return -1;
+	git_buf_shorten(&path, strlen("pack"));
+	git_buf_puts(&path, "bitmap");
+	if (git_buf_oom(&path))
+		return -1;
+
+	if ((fd = git_futils_open_ro(git_buf_cstr(&path))) < 0) {
+		git_buf_free(&path);
+		return fd;
+	}
+	git_buf_free(&path);
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+		!git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid bitmap index for '%s'", pack->pack_name);
+		return -1;
+	}
+
+	index = git__calloc(1, sizeof(git_bitmap_index));
+	GITERR_CHECK_ALLOC(index);
+	index->pack = pack;
+
+	error = git_futils_mmap_ro(&index->map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0 || (error = bitmap_index_parse(index)) < 0) {
+		git_bitmap_index_free(index);
+		return error;
+	}
+
+	*out = index;
+	return 0;
+}
+
+struct open_dir_state {
+	git_bitmap_index *index;
+};
+
+static int open_dir_cb(void *payload, git_buf *path)
+{
+	struct open_dir_state *state = payload;
+	struct git_pack_file *pack;
+	int error;
+
+	if (git__suffixcmp(git_buf_cstr(path), ".bitmap") != 0)
+		return 0;
+
+	git_buf_shorten(path, strlen("bitmap"));
+	if (git_buf_puts(path, "idx") < 0)
+		return -1;
+
+	if (git_mwindow_get_pack(&pack, git_buf_cstr(path)) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	if ((error = git_bitmap_index_open(&state->index, pack)) < 0) {
+		git_mwindow_put_pack(pack);
+
+		/* a broken or stale bitmap just means we cannot use it */
+		giterr_clear();
+		return 0;
+	}
+
+	state->index->owns_pack = 1;
+	return 1;
+}
+
+int git_bitmap_index_open_dir(git_bitmap_index **out, const char *pack_dir)
+{
+	struct open_dir_state state = {0};
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	assert(out && pack_dir);
+
+	*out = NULL;
+
+	if (!git_path_isdir(pack_dir))
+		return GIT_ENOTFOUND;
+
+	if (git_buf_sets(&path, pack_dir) < 0)
+		return -1;
+
+	error = git_path_direach(&path, 0, open_dir_cb, &state);
+	git_buf_free(&path);
+
+	if (error < 0) {
+		git_bitmap_index_free(state.index);
+		return error;
+	}
+
+	if (!state.index)
+		return GIT_ENOTFOUND;
+
+	*out = state.index;
+	return 0;
+}
+
+void git_bitmap_index_free(git_bitmap_index *index)
+{
+	if (!index)
+		return;
+
+	if (index->entries_by_commit)
+		git_oidmap_free(index->entries_by_commit);
+	git__free(index->entries);
+
+	git_bitmap_free(&index->commits);
+	git_bitmap_free(&index->trees);
+	git_bitmap_free(&index->blobs);
+	git_bitmap_free(&index->tags);
+
+	git__free(index->objects);
+	git__free(index->pack_order);
+	git__free(index->bit_pos);
+
+	if (index->map.data)
+		git_futils_mmap_free(&index->map);
+
+	if (index->owns_pack)
+		git_mwindow_put_pack(index->pack);
+
+	git__free(index);
+}
+
+static int object_cmp(const void *key, const void *entry)
+{
+	return git_oid__cmp(key, &((const git_bitmap_object *)entry)->id);
+}
+
+int git_bitmap_index_position(
+	size_t *out, const git_bitmap_index *index, const git_oid *id)
+{
+	size_t lo = 0, hi = index->num_objects;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = object_cmp(id, &index->objects[mid]);
+
+		if (cmp == 0) {
+			*out = index->bit_pos[mid];
+			return 0;
+		}
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+uint32_t git_bitmap_index_name_hash(const git_bitmap_index *index, size_t pos)
+{
+	if (!index->hash_cache)
+		return 0;
+
+	return bitmap_get_be32(index->hash_cache + 4 * index->pack_order[pos]);
+}
+
+int git_bitmap_index_lookup(
+	git_bitmap *out, const git_bitmap_index *index, const git_oid *commit)
+{
+	const git_stored_bitmap *entry;
+	git_bitmap decoded = GIT_BITMAP_INIT;
+	khiter_t pos;
+	size_t consumed;
+	int error = 0;
+
+	pos = git_oidmap_lookup_index(index->entries_by_commit, commit);
+	if (!git_oidmap_valid_index(index->entries_by_commit, pos))
+		return GIT_ENOTFOUND;
+
+	/*
+	 * A stored bitmap is XORed against the full bitmap of its base, so
+	 * the full bitmap is the XOR of the whole chain.
+	 */
+	for (entry = git_oidmap_value_at(index->entries_by_commit, pos);
+		entry != NULL; entry = entry->xor_base) {
+		if ((error = git_ewah_read(&decoded, &consumed, entry->ewah, entry->ewah_len)) < 0 ||
+			(error = git_bitmap_xor(out, &decoded)) < 0)
+			break;
+
+		memset(decoded.words, 0x0, decoded.word_alloc * sizeof(uint64_t));
+	}
+
+	git_bitmap_free(&decoded);
+	return error;
+}
+
+static int add_tree_reachable(
+	git_bitmap *out,
+	const git_bitmap_index *index,
+	git_repository *repo,
+	const git_oid *tree_id)
+{
+	git_tree *tree;
+	size_t i, pos;
+	int error;
+
+	if ((error = git_bitmap_index_position(&pos, index, tree_id)) < 0)
+		return error;
+
+	if (git_bitmap_get(out, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(out, pos)) < 0 ||
+		(error = git_tree_lookup(&tree, repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *entry_id = git_tree_entry_id(entry);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = add_tree_reachable(out, index, repo, entry_id);
+			break;
+		case GIT_OBJ_BLOB:
+			if ((error = git_bitmap_index_position(&pos, index, entry_id)) == 0)
+				error = git_bitmap_set(out, pos);
+			break;
+		default:
+			/* it's a submodule or something unknown, we don't want it */
+			;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+int git_bitmap_index_add_reachable(
+	git_bitmap *out,
+	const git_bitmap_index *index,
+	git_repository *repo,
+	const git_oid *commit_id)
+{
+	git_array_t(git_oid) stack = GIT_ARRAY_INIT;
+	git_bitmap stored = GIT_BITMAP_INIT;
+	git_commit *commit;
+	git_oid *id, current;
+	size_t pos;
+	unsigned int i;
+	int error = 0;
+
+	assert(out && index && repo && commit_id);
+
+	id = git_array_alloc(stack);
+	GITERR_CHECK_ALLOC(id);
+	git_oid_cpy(id, commit_id);
+
+	while ((id = git_array_pop(stack)) != NULL) {
+		git_oid_cpy(&current, id);
+
+		if ((error = git_bitmap_index_position(&pos, index, &current)) < 0)
+			break;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		/* a commit with a bitmap of its own ends this part of the walk */
+		if ((error = git_bitmap_index_lookup(&stored, index, &current)) == 0) {
+			error = git_bitmap_or(out, &stored);
+			git_bitmap_free(&stored);
+
+			if (error < 0)
+				break;
+			continue;
+		} else if (error != GIT_ENOTFOUND) {
+			break;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0 ||
+			(error = git_commit_lookup(&commit, repo, &current)) < 0)
+			break;
+
+		error = add_tree_reachable(out, index, repo, git_commit_tree_id(commit));
+
+		for (i = 0; !error && i < git_commit_parentcount(commit); i++) {
+			git_oid *parent = git_array_alloc(stack);
+
+			if (!parent) {
+				error = -1;
+				break;
+			}
+			git_oid_cpy(parent, git_commit_parent_id(commit, i));
+		}
+
+		git_commit_free(commit);
+		if (error < 0)
+			break;
+	}
+
+	git_array_clear(stack);
+	return error;
+}
+
+int git_bitmap_writer_new(
+	git_bitmap_writer **out, struct git_pack_file *pack, git_repository *repo)
+{
+	git_bitmap_writer *w;
+	uint32_t count;
+
+	assert(out && pack && repo);
+
+	w = git__calloc(1, sizeof(git_bitmap_writer));
+	GITERR_CHECK_ALLOC(w);
+	w->repo = repo;
+
+	if ((w->index = git__calloc(1, sizeof(git_bitmap_index))) == NULL)
+		goto on_error;
+
+	w->index->pack = pack;
+	w->index->options = GIT_BITMAP_OPT_FULL_DAG | GIT_BITMAP_OPT_HASH_CACHE;
+
+	if (load_pack_objects(w->index) < 0)
+		goto on_error;
+
+	count = w->index->num_objects;
+	w->index->entries_by_commit = git_oidmap_alloc();
+	w->hash_cache = git__calloc(count ? count : 1, sizeof(uint32_t));
+
+	if (!w->index->entries_by_commit || !w->hash_cache)
+		goto on_error;
+
+	*out = w;
+	return 0;
+
+on_error:
+	git_bitmap_writer_free(w);
+	return -1;
+}
+
+int git_bitmap_writer_set_object(
+	git_bitmap_writer *w, const git_oid *id, git_otype type, uint32_t name_hash)
+{
+	git_bitmap *type_bitmap;
+	size_t pos;
+	int error;
+
+	if ((error = git_bitmap_index_position(&pos, w->index, id)) < 0) {
+		giterr_set(GITERR_ODB, "object %s is not in the pack",
+			git_oid_tostr_s(id));
+		return error;
+	}
+
+	switch (type) {
+	case GIT_OBJ_COMMIT: type_bitmap = &w->index->commits; break;
+	case GIT_OBJ_TREE: type_bitmap = &w->index->trees; break;
+	case GIT_OBJ_BLOB: type_bitmap = &w->index->blobs; break;
+	case GIT_OBJ_TAG: type_bitmap = &w->index->tags; break;
+	default:
+		giterr_set(GITERR_INVALID, "invalid object type");
+		return -1;
+	}
+
+	w->hash_cache[w->index->pack_order[pos]] = name_hash;
+	return git_bitmap_set(type_bitmap, pos);
+}
+
+int git_bitmap_writer_build(
+	git_bitmap_writer *w, const git_oid *commits, size_t count)
+{
+	git_bitmap_index *index = w->index;
+	git_bitmap reachable = GIT_BITMAP_INIT;
+	size_t i;
+	int error = 0;
+
+	if (!git__is_uint32(index->entry_count + count)) {
+		giterr_set(GITERR_INVALID, "too many bitmaps");
+		return -1;
+	}
+
+	/* the map points into `entries`, so it cannot be reallocated later */
+	if (index->entries || w->bitmaps) {
+		giterr_set(GITERR_INVALID, "bitmaps have already been built");
+		return -1;
+	}
+
+	index->entries = git__calloc(count ? count : 1, sizeof(git_stored_bitmap));
+	GITERR_CHECK_ALLOC(index->entries);
+	w->bitmaps = git__calloc(count ? count : 1, sizeof(git_buf));
+	GITERR_CHECK_ALLOC(w->bitmaps);
+	w->bitmaps_alloc = count;
+
+	for (i = 0; i < count; i++) {
+		git_stored_bitmap *entry = &index->entries[index->entry_count];
+		git_buf *ewah = &w->bitmaps[index->entry_count];
+
+		/*
+		 * Bitmaps of the commits before this one are reused by the walk,
+		 * which is why the caller passes ancestors first.
+		 */
+		memset(reachable.words, 0x0, reachable.word_alloc * sizeof(uint64_t));
+		if ((error = git_bitmap_index_add_reachable(
+				&reachable, index, w->repo, &commits[i])) == GIT_ENOTFOUND) {
+			/* the pack is missing some of its history, skip it */
+			giterr_clear();
+			error = 0;
+			continue;
+		}
+
+		if (error < 0 ||
+			(error = git_ewah_write(ewah, &reachable, index->num_objects)) < 0)
+			break;
+
+		git_oid_cpy(&entry->commit, &commits[i]);
+		entry->ewah = (const unsigned char *)ewah->ptr;
+		entry->ewah_len = git_buf_len(ewah);
+
+		git_oidmap_insert(index->entries_by_commit, &entry->commit, entry, error);
+		if (error < 0) {
+			giterr_set_oom();
+			break;
+		}
+
+		index->entry_count++;
+		error = 0;
+	}
+
+	git_bitmap_free(&reachable);
+	return error;
+}
+
+/*
+ * Compress the bitmap of every entry, XORed against whichever of the
+ * bitmaps shortly before it gives the smallest result.
+ */
+static int write_entries(git_filebuf *file, git_bitmap_writer *w)
+{
+	git_bitmap_index *index = w->index;
+	git_bitmap window[GIT_BITMAP_XOR_WINDOW], xored = GIT_BITMAP_INIT;
+	git_buf best = GIT_BUF_INIT, candidate = GIT_BUF_INIT;
+	unsigned char header[6];
+	size_t i, j, consumed, pos;
+	uint32_t commit_pos;
+	int error = 0;
+
+	memset(window, 0x0, sizeof(window));
+
+	for (i = 0; i < index->entry_count; i++) {
+		git_bitmap *current = &window[i % GIT_BITMAP_XOR_WINDOW];
+		uint8_t xor_offset = 0;
+
+		memset(current->words, 0x0, current->word_alloc * sizeof(uint64_t));
+		if ((error = git_ewah_read(current, &consumed,
+				(const unsigned char *)w->bitmaps[i].ptr, w->bitmaps[i].size)) < 0)
+			break;
+
+		git_buf_clear(&best);
+		if ((error = git_buf_put(&best, w->bitmaps[i].ptr, w->bitmaps[i].size)) < 0)
+			break;
+
+		for (j = 1; j <= i && j < GIT_BITMAP_XOR_WINDOW; j++) {
+			git_buf_clear(&candidate);
+			memset(xored.words, 0x0, xored.word_alloc * sizeof(uint64_t));
+
+			if ((error = git_bitmap_or(&xored, current)) < 0 ||
+				(error = git_bitmap_xor(&xored, &window[(i - j) % GIT_BITMAP_XOR_WINDOW])) < 0 ||
+				(error = git_ewah_write(&candidate, &xored, index->num_objects)) < 0)
+				goto done;
+
+			if (git_buf_len(&candidate) < git_buf_len(&best)) {
+				git_buf_swap(&best, &candidate);
+				xor_offset = (uint8_t)j;
+			}
+		}
+
+		if ((error = git_bitmap_index_position(&pos, index, &index->entries[i].commit)) < 0)
+			break;
+		commit_pos = htonl(index->pack_order[pos]);
+
+		memcpy(header, &commit_pos, 4);
+		header[4] = xor_offset;
+		header[5] = 0;
+
+		if ((error = git_filebuf_write(file, header, sizeof(header))) < 0 ||
+			(error = git_filebuf_write(file, best.ptr, best.size)) < 0)
+			break;
+	}
+
+done:
+	for (i = 0; i < GIT_BITMAP_XOR_WINDOW; i++)
+		git_bitmap_free(&window[i]);
+	git_bitmap_free(&xored);
+	git_buf_free(&best);
+	git_buf_free(&candidate);
+	return error;
+}
+
+int git_bitmap_writer_write(
+	git_bitmap_writer *w, const char *path, mode_t mode)
+{
+	git_bitmap_index *index = w->index;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	struct git_bitmap_header hdr;
+	git_buf ewah = GIT_BUF_INIT;
+	git_bitmap *type_bitmaps[4];
+	git_oid checksum;
+	uint32_t i, hash;
+	int error;
+
+	assert(w && path);
+
+	if (index->pack->index_map.len < 2 * GIT_OID_RAWSZ) {
+		giterr_set(GITERR_ODB, "pack index is too short");
+		return -1;
+	}
+
+	hdr.signature = htonl(GIT_BITMAP_SIGNATURE);
+	hdr.version = htons(GIT_BITMAP_VERSION);
+	hdr.options = htons(index->options);
+	hdr.entry_count = htonl(index->entry_count);
+	memcpy(hdr.checksum, (const unsigned char *)index->pack->index_map.data +
+		index->pack->index_map.len - 2 * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+
+	if ((error = git_filebuf_open(&file, path, GIT_FILEBUF_HASH_CONTENTS, mode)) < 0)
+		return error;
+
+	if ((error = git_filebuf_write(&file, &hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	type_bitmaps[0] = &index->commits;
+	type_bitmaps[1] = &index->trees;
+	type_bitmaps[2] = &index->blobs;
+	type_bitmaps[3] = &index->tags;
+	for (i = 0; i < 4; i++) {
+		git_buf_clear(&ewah);
+
+		if ((error = git_ewah_write(&ewah, type_bitmaps[i], index->num_objects)) < 0 ||
+			(error = git_filebuf_write(&file, ewah.ptr, ewah.size)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = write_entries(&file, w)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < index->num_objects; i++) {
+		hash = htonl(w->hash_cache[i]);
+		if ((error = git_filebuf_write(&file, &hash, sizeof(hash))) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_filebuf_hash(&checksum, &file)) < 0 ||
+		(error = git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&file);
+
+cleanup:
+	git_filebuf_cleanup(&file);
+	git_buf_free(&ewah);
+	return error;
+}
+
+void git_bitmap_writer_free(git_bitmap_writer *w)
+{
+	size_t i;
+
+	if (!w)
+		return;
+
+	for (i = 0; i < w->bitmaps_alloc; i++)
+		git_buf_free(&w->bitmaps[i]);
+	git__free(w->bitmaps);
+
+	git_bitmap_index_free(w->index);
+	git__free(w->hash_cache);
+	git__free(w);
+}
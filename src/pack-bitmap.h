@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "ewah.h"
+#include "map.h"
+#include "oidmap.h"
+#include "pack.h"
+
+#define GIT_BITMAP_SIGNATURE 0x4249544d /* "BITM" */
+#define GIT_BITMAP_VERSION 1
+
+#define GIT_BITMAP_OPT_FULL_DAG 0x1
+#define GIT_BITMAP_OPT_HASH_CACHE 0x4
+
+/* The maximum distance to the bitmap a stored bitmap is XORed against */
+#define GIT_BITMAP_MAX_XOR_OFFSET 160
+
+/* The number of previous bitmaps the writer tries to XOR against */
+#define GIT_BITMAP_XOR_WINDOW 10
+
+struct git_bitmap_header {
+	uint32_t signature;
+	uint16_t version;
+	uint16_t options;
+	uint32_t entry_count;
+	unsigned char checksum[GIT_OID_RAWSZ];
+};
+
+/*
+ * An object of the bitmapped pack. Bitmaps refer to objects by their
+ * position in the pack (i.e. ordered by offset), while the `.idx` lists
+ * them ordered by name.
+ */
+typedef struct {
+	git_oid id;
+	git_off_t offset;
+} git_bitmap_object;
+
+/*
+ * A reachability bitmap for a single commit, as stored in the file. The
+ * bitmap may be XORed against the one of a previous commit.
+ */
+typedef struct git_stored_bitmap {
+	git_oid commit;
+	const unsigned char *ewah;
+	size_t ewah_len;
+	struct git_stored_bitmap *xor_base;
+	uint8_t flags;
+} git_stored_bitmap;
+
+/*
+ * A `.bitmap` file, along with the reverse index of its pack which is
+ * required to map object names to bit positions.
+ */
+typedef struct git_bitmap_index {
+	struct git_pack_file *pack;
+	unsigned int owns_pack:1;
+	git_map map;
+
+	uint16_t options;
+	uint32_t num_objects;
+
+	/* objects in index order */
+	git_bitmap_object *objects;
+	/* pack_order[bit] is the index position of the object at that bit */
+	uint32_t *pack_order;
+	/* bit_pos[index position] is the bit of that object */
+	uint32_t *bit_pos;
+
+	/* type bitmaps: every object of the pack of the given type */
+	git_bitmap commits;
+	git_bitmap trees;
+	git_bitmap blobs;
+	git_bitmap tags;
+
+	/* stored commit bitmaps, in file order and by commit id */
+	git_stored_bitmap *entries;
+	uint32_t entry_count;
+	git_oidmap *entries_by_commit;
+
+	/* name-hash of every object in index order (network byte order) */
+	const unsigned char *hash_cache;
+} git_bitmap_index;
+
+/*
+ * Load the `.bitmap` file of the given pack. Returns GIT_ENOTFOUND if
+ * there is no such file, or if it does not belong to the pack.
+ */
+int git_bitmap_index_open(git_bitmap_index **out, struct git_pack_file *pack);
+
+/*
+ * Find the pack with a `.bitmap` in the given pack directory and load
+ * it. Returns GIT_ENOTFOUND if none of the packs has a usable bitmap.
+ */
+int git_bitmap_index_open_dir(git_bitmap_index **out, const char *pack_dir);
+
+void git_bitmap_index_free(git_bitmap_index *index);
+
+/* Find the bit position of an object in the bitmapped pack. */
+int git_bitmap_index_position(
+	size_t *out, const git_bitmap_index *index, const git_oid *id);
+
+/* The object at the given bit position. */
+GIT_INLINE(const git_bitmap_object *) git_bitmap_index_object(
+	const git_bitmap_index *index, size_t pos)
+{
+	return &index->objects[index->pack_order[pos]];
+}
+
+/* The name-hash of the object at the given bit position, or 0 */
+uint32_t git_bitmap_index_name_hash(const git_bitmap_index *index, size_t pos);
+
+/*
+ * Get the full reachability bitmap of a commit which has a stored bitmap
+ * into `out`, which must be empty. Returns GIT_ENOTFOUND if the commit
+ * has no bitmap of its own.
+ */
+int git_bitmap_index_lookup(
+	git_bitmap *out, const git_bitmap_index *index, const git_oid *commit);
+
+/*
+ * Add every object reachable from `commit` to `out`. Commits without a
+ * stored bitmap are walked until commits which do have one (or are
+ * already in `out`) are found. Returns GIT_ENOTFOUND if any reachable
+ * object is not in the bitmapped pack.
+ */
+int git_bitmap_index_add_reachable(
+	git_bitmap *out,
+	const git_bitmap_index *index,
+	git_repository *repo,
+	const git_oid *commit);
+
+/*
+ * Builds the `.bitmap` file of a pack which has just been written: the
+ * type bitmaps and name-hashes are filled in one object at a time, and
+ * the reachability bitmaps are computed for a set of commits at once.
+ */
+typedef struct git_bitmap_writer {
+	git_repository *repo;
+	git_bitmap_index *index;
+
+	/* the full bitmap of every entry of `index`, EWAH-compressed */
+	git_buf *bitmaps;
+	size_t bitmaps_alloc;
+
+	/* name-hash of every object in index order */
+	uint32_t *hash_cache;
+} git_bitmap_writer;
+
+int git_bitmap_writer_new(
+	git_bitmap_writer **out, struct git_pack_file *pack, git_repository *repo);
+
+/* Record the type and name-hash of an object of the pack. */
+int git_bitmap_writer_set_object(
+	git_bitmap_writer *w, const git_oid *id, git_otype type, uint32_t name_hash);
+
+/*
+ * Compute the reachability bitmaps of the given commits. These should be
+ * ordered with ancestors first, so that the walk for each commit can stop
+ * at the bitmaps of the commits before it. Commits which reach objects
+ * outside of the pack are skipped.
+ */
+int git_bitmap_writer_build(
+	git_bitmap_writer *w, const git_oid *commits, size_t count);
+
+/* Write the `.bitmap` file to `path`. */
+int git_bitmap_writer_write(
+	git_bitmap_writer *w, const char *path, mode_t mode);
+
+void git_bitmap_writer_free(git_bitmap_writer *w);
+
+#endif
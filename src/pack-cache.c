@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-cache.h"
+#include "global.h"
+#include "offmap.h"
+
+GIT__USE_OFFMAP
+
+typedef struct {
+	git_mutex lock;
+	git_offmap *entries;
+	git_pack_cache_entry *lru_head, *lru_tail;
+	size_t memory_used;
+} pack_cache_stripe;
+
+static pack_cache_stripe stripes[GIT_PACK_CACHE_STRIPES];
+
+static git_atomic next_pack_id;
+static git_atomic_ssize cache_hits, cache_misses;
+
+size_t git_pack_cache__max_storage = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+static size_t git_pack_cache__max_object_size[8] = {
+	0,                         /* GIT_OBJ__EXT1 */
+	GIT_PACK_CACHE_SIZE_LIMIT, /* GIT_OBJ_COMMIT */
+	GIT_PACK_CACHE_SIZE_LIMIT, /* GIT_OBJ_TREE */
+	GIT_PACK_CACHE_SIZE_LIMIT, /* GIT_OBJ_BLOB */
+	GIT_PACK_CACHE_SIZE_LIMIT, /* GIT_OBJ_TAG */
+	0,                         /* GIT_OBJ__EXT2 */
+	0,                         /* GIT_OBJ_OFS_DELTA */
+	0                          /* GIT_OBJ_REF_DELTA */
+};
+
+int git_pack_cache_set_max_object_size(git_otype type, size_t size)
+{
+	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_pack_cache__max_object_size)) {
+		giterr_set(GITERR_INVALID, "type out of range");
+		return -1;
+	}
+
+	git_pack_cache__max_object_size[type] = size;
+	return 0;
+}
+
+unsigned int git_pack_cache_new_id(void)
+{
+	return (unsigned int)git_atomic_inc(&next_pack_id);
+}
+
+GIT_INLINE(pack_cache_stripe *) stripe_for(unsigned int pack_id, git_off_t offset)
+{
+	uint64_t key = (uint64_t)offset ^ ((uint64_t)pack_id << 32);
+
+	key *= 0x9e3779b97f4a7c15ULL;
+	return &stripes[(key >> 32) % GIT_PACK_CACHE_STRIPES];
+}
+
+static void entry_free(git_pack_cache_entry *entry)
+{
+	git__free(entry->raw.data);
+	git__free(entry);
+}
+
+GIT_INLINE(void) lru_unlink(pack_cache_stripe *stripe, git_pack_cache_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		stripe->lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		stripe->lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+GIT_INLINE(void) lru_push(pack_cache_stripe *stripe, git_pack_cache_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = stripe->lru_head;
+
+	if (stripe->lru_head)
+		stripe->lru_head->lru_prev = entry;
+	else
+		stripe->lru_tail = entry;
+
+	stripe->lru_head = entry;
+}
+
+/* Run with the stripe lock held */
+static git_pack_cache_entry *stripe_lookup(
+	pack_cache_stripe *stripe, unsigned int pack_id, git_off_t offset)
+{
+	git_pack_cache_entry *entry;
+	khiter_t pos;
+
+	if (!stripe->entries)
+		return NULL;
+
+	pos = git_offmap_lookup_index(stripe->entries, offset);
+	if (!git_offmap_valid_index(stripe->entries, pos))
+		return NULL;
+
+	for (entry = git_offmap_value_at(stripe->entries, pos); entry; entry = entry->chain) {
+		if (entry->pack_id == pack_id)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Run with the stripe lock held */
+static void stripe_remove(pack_cache_stripe *stripe, git_pack_cache_entry *entry)
+{
+	git_pack_cache_entry **link;
+	khiter_t pos;
+
+	pos = git_offmap_lookup_index(stripe->entries, entry->offset);
+	assert(git_offmap_valid_index(stripe->entries, pos));
+
+	link = (git_pack_cache_entry **)&git_offmap_value_at(stripe->entries, pos);
+	while (*link != entry)
+		link = &(*link)->chain;
+	*link = entry->chain;
+
+	if (git_offmap_value_at(stripe->entries, pos) == NULL)
+		git_offmap_delete_at(stripe->entries, pos);
+
+	lru_unlink(stripe, entry);
+	stripe->memory_used -= entry->raw.len;
+
+	git_pack_cache_release(entry);
+}
+
+git_pack_cache_entry *git_pack_cache_get(unsigned int pack_id, git_off_t offset)
+{
+	pack_cache_stripe *stripe = stripe_for(pack_id, offset);
+	git_pack_cache_entry *entry;
+
+	if (git_mutex_lock(&stripe->lock) < 0)
+		return NULL;
+
+	if ((entry = stripe_lookup(stripe, pack_id, offset)) != NULL) {
+		git_atomic_inc(&entry->refcount);
+
+		lru_unlink(stripe, entry);
+		lru_push(stripe, entry);
+	}
+
+	git_mutex_unlock(&stripe->lock);
+
+	git_atomic_ssize_add(entry ? &cache_hits : &cache_misses, 1);
+	return entry;
+}
+
+int git_pack_cache_add(
+	git_pack_cache_entry **out,
+	unsigned int pack_id,
+	git_off_t offset,
+	git_rawobj *base)
+{
+	pack_cache_stripe *stripe = stripe_for(pack_id, offset);
+	size_t stripe_limit = git_pack_cache__max_storage / GIT_PACK_CACHE_STRIPES;
+	git_pack_cache_entry *entry, *head = NULL;
+	khiter_t pos;
+	int error;
+
+	if (base->type < 0 ||
+		(size_t)base->type >= ARRAY_SIZE(git_pack_cache__max_object_size) ||
+		base->len > git_pack_cache__max_object_size[base->type] ||
+		base->len > stripe_limit)
+		return -1;
+
+	entry = git__calloc(1, sizeof(git_pack_cache_entry));
+	if (!entry)
+		return -1;
+
+	entry->pack_id = pack_id;
+	entry->offset = offset;
+	memcpy(&entry->raw, base, sizeof(git_rawobj));
+	git_atomic_set(&entry->refcount, 2);
+
+	if (git_mutex_lock(&stripe->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock cache");
+		git__free(entry);
+		return -1;
+	}
+
+	if (!stripe->entries && (stripe->entries = git_offmap_alloc()) == NULL)
+		goto on_error;
+
+	/* Somebody beat us to adding it into the cache */
+	if (stripe_lookup(stripe, pack_id, offset) != NULL)
+		goto on_error;
+
+	pos = kh_put(off, stripe->entries, offset, &error);
+	if (error < 0)
+		goto on_error;
+
+	if (error == 0)
+		head = git_offmap_value_at(stripe->entries, pos);
+
+	entry->chain = head;
+	git_offmap_set_value_at(stripe->entries, pos, entry);
+
+	lru_push(stripe, entry);
+	stripe->memory_used += entry->raw.len;
+
+	while (stripe->memory_used > stripe_limit && stripe->lru_tail != entry)
+		stripe_remove(stripe, stripe->lru_tail);
+
+	git_mutex_unlock(&stripe->lock);
+
+	*out = entry;
+	return 0;
+
+on_error:
+	git_mutex_unlock(&stripe->lock);
+	git__free(entry);
+	return -1;
+}
+
+void git_pack_cache_release(git_pack_cache_entry *entry)
+{
+	if (entry && git_atomic_dec(&entry->refcount) == 0)
+		entry_free(entry);
+}
+
+void git_pack_cache_purge(unsigned int pack_id)
+{
+	git_pack_cache_entry *entry, *next;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_STRIPES; i++) {
+		pack_cache_stripe *stripe = &stripes[i];
+
+		if (git_mutex_lock(&stripe->lock) < 0)
+			continue;
+
+		for (entry = stripe->lru_head; entry; entry = next) {
+			next = entry->lru_next;
+
+			if (entry->pack_id == pack_id)
+				stripe_remove(stripe, entry);
+		}
+
+		git_mutex_unlock(&stripe->lock);
+	}
+}
+
+void git_pack_cache_stats(size_t *hits, size_t *misses, size_t *used)
+{
+	size_t i, total = 0;
+
+	for (i = 0; i < GIT_PACK_CACHE_STRIPES; i++) {
+		if (git_mutex_lock(&stripes[i].lock) < 0)
+			continue;
+
+		total += stripes[i].memory_used;
+		git_mutex_unlock(&stripes[i].lock);
+	}
+
+	if (hits)
+		*hits = (size_t)cache_hits.val;
+	if (misses)
+		*misses = (size_t)cache_misses.val;
+	if (used)
+		*used = total;
+}
+
+static void pack_cache_shutdown(void)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_STRIPES; i++) {
+		pack_cache_stripe *stripe = &stripes[i];
+
+		while (stripe->lru_tail)
+			stripe_remove(stripe, stripe->lru_tail);
+
+		if (stripe->entries)
+			git_offmap_free(stripe->entries);
+
+		git_mutex_free(&stripe->lock);
+	}
+
+	git_atomic_ssize_add(&cache_hits, -(ssize_t)cache_hits.val);
+	git_atomic_ssize_add(&cache_misses, -(ssize_t)cache_misses.val);
+}
+
+int git_pack_cache_global_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_STRIPES; i++) {
+		memset(&stripes[i], 0, sizeof(pack_cache_stripe));
+
+		if (git_mutex_init(&stripes[i].lock)) {
+			giterr_set(GITERR_OS, "failed to initialize pack cache mutex");
+			return -1;
+		}
+	}
+
+	git__on_shutdown(pack_cache_shutdown);
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_cache_h__
+#define INCLUDE_pack_cache_h__
+
+#include "common.h"
+#include "thread-utils.h"
+#include "odb.h"
+
+/*
+ * The delta base cache is shared by every pack of the process. Entries
+ * are keyed by the id of their pack and their offset in it, and spread
+ * over a number of stripes with a lock and an LRU list each.
+ */
+#define GIT_PACK_CACHE_STRIPES 16
+#define GIT_PACK_CACHE_MEMORY_LIMIT (96 * 1024 * 1024)
+#define GIT_PACK_CACHE_SIZE_LIMIT (1024 * 1024) /* don't bother caching anything over 1MB */
+
+typedef struct git_pack_cache_entry {
+	unsigned int pack_id;
+	git_off_t offset;
+
+	/* one reference for the cache, and one for each user */
+	git_atomic refcount;
+	git_rawobj raw;
+
+	/* entries of other packs at the same offset */
+	struct git_pack_cache_entry *chain;
+	/* the LRU list of the stripe, most recently used first */
+	struct git_pack_cache_entry *lru_prev, *lru_next;
+} git_pack_cache_entry;
+
+extern size_t git_pack_cache__max_storage;
+
+int git_pack_cache_global_init(void);
+
+int git_pack_cache_set_max_object_size(git_otype type, size_t size);
+
+/* Get the id under which the objects of a new pack are cached */
+unsigned int git_pack_cache_new_id(void);
+
+/*
+ * Look up a cached base. The entry must be given back with
+ * `git_pack_cache_release` once the caller is done with it.
+ */
+git_pack_cache_entry *git_pack_cache_get(unsigned int pack_id, git_off_t offset);
+
+/*
+ * Add a base to the cache. On success the cache takes over the data,
+ * and `out` is an entry which must be released like one which has been
+ * looked up. Returns -1 if the base is not cached, in which case the
+ * data still belongs to the caller.
+ */
+int git_pack_cache_add(
+	git_pack_cache_entry **out,
+	unsigned int pack_id,
+	git_off_t offset,
+	git_rawobj *base);
+
+void git_pack_cache_release(git_pack_cache_entry *entry);
+
+/* Drop every cached base of a pack which is being closed */
+void git_pack_cache_purge(unsigned int pack_id);
+
+void git_pack_cache_stats(size_t *hits, size_t *misses, size_t *used);
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "zstream.h"
 #include "delta.h"
+#include "filebuf.h"
 #include "iterator.h"
 #include "netops.h"
 #include "pack.h"
@@ -17,12 +18,14 @@
 #include "util.h"
 #include "revwalk.h"
 #include "commit_list.h"
+#include "mwindow.h"
+#include "oidarray.h"
 
 #include "git2/pack.h"
 #include "git2/commit.h"
 #include "git2/tag.h"
-#include "git2/indexer.h"
 #include "git2/config.h"
+#include "git2/refs.h"
 
 struct unpacked {
 	git_pobject *object;
@@ -37,8 +40,11 @@ struct tree_walk_context {
 };
 
 struct pack_write_context {
-	git_indexer *indexer;
+	git_packbuilder *pb;
+	git_filebuf *file;
 	git_transfer_progress *stats;
+	git_transfer_progress_cb progress_cb;
+	void *progress_cb_payload;
 };
 
 GIT__USE_OIDMAP;
@@ -113,9 +119,15 @@ static int packbuilder_config(git_packbuilder *pb)
 
 #undef config_get
 
+	ret = git_config_get_bool(&pb->use_bitmaps, config, "pack.usebitmaps");
+	if (ret == GIT_ENOTFOUND) {
+		pb->use_bitmaps = 1;
+		ret = 0;
+	}
+
 	git_config_free(config);
 
-	return 0;
+	return ret;
 }
 
 int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
@@ -140,6 +152,7 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse_objects = 1;
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
 		git_zstream_init(&pb->zstream) < 0 ||
@@ -195,8 +208,8 @@ static void rehash(git_packbuilder *pb)
 	}
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      unsigned int hash)
 {
 	git_pobject *po;
 	khiter_t pos;
@@ -236,7 +249,7 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
 	if (ret < 0) {
@@ -267,6 +280,12 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	return packbuilder_insert(pb, oid, name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -301,6 +320,182 @@ on_error:
 	return -1;
 }
 
+/*
+ * Write out a part of the pack, keeping track of the pack checksum and of
+ * the offset and CRC32 of the object being written, if any.
+ */
+static int write_pack_data(
+	git_packbuilder *pb,
+	git_pobject *po,
+	void *data,
+	size_t len,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	int error;
+
+	if ((error = write_cb(data, len, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, data, len)) < 0)
+		return error;
+
+	if (po)
+		po->crc = crc32(po->crc, data, (uInt)len);
+
+	pb->pack_offset += len;
+	return 0;
+}
+
+static int reuse_revindex(
+	git_pack_revindex **out, git_packbuilder *pb, struct git_pack_file *p)
+{
+	git_pack_revindex *revindex;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&pb->reuse_packs, i, revindex) {
+		if (revindex->p == p) {
+			*out = revindex;
+			return 0;
+		}
+	}
+
+	revindex = git__malloc(sizeof(git_pack_revindex));
+	GITERR_CHECK_ALLOC(revindex);
+
+	if ((error = git_pack_revindex_init(revindex, p)) < 0 ||
+		(error = git_vector_insert(&pb->reuse_packs, revindex)) < 0) {
+		git_pack_revindex_free(revindex);
+		git__free(revindex);
+		return error;
+	}
+
+	*out = revindex;
+	return 0;
+}
+
+/*
+ * Pass the bytes of the pack between `start` and `end` to the callback,
+ * or compute their CRC32 if there is no callback. `w` may hold a window
+ * opened already; it is closed when done.
+ */
+static int copy_pack_data(
+	uint32_t *crc,
+	git_packbuilder *pb,
+	git_pobject *po,
+	struct git_pack_file *p,
+	git_mwindow **w,
+	git_off_t start,
+	git_off_t end,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	unsigned char *data;
+	unsigned int left;
+	size_t len;
+	int error = 0;
+
+	while (start < end) {
+		if ((data = git_mwindow_open(&p->mwf, w, start, 0, &left)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		len = (size_t)min((git_off_t)left, end - start);
+
+		if (write_cb)
+			error = write_pack_data(pb, po, data, len, write_cb, cb_data);
+		else
+			*crc = crc32(*crc, data, (uInt)len);
+
+		if (error < 0)
+			break;
+
+		start += len;
+	}
+
+	git_mwindow_close(w);
+	return error;
+}
+
+/*
+ * Copy an object the way it is stored in an existing pack, after
+ * checking it against the CRC32 in that pack's index. A reused delta
+ * refers to its base, which is part of the new pack too, by name.
+ * `reused` is set to 0 if the object has to be written some other way.
+ */
+static int write_reused_object(
+	int *reused,
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct git_pack_file *p = po->reuse_pack;
+	git_pack_revindex *revindex;
+	const git_pack_revindex_entry *entry;
+	git_mwindow *w = NULL;
+	git_off_t data_start, end, base_offset;
+	git_otype type;
+	unsigned char hdr[32];
+	size_t size, hdr_len;
+	uint32_t expected_crc, crc = crc32(0L, Z_NULL, 0);
+	int error;
+
+	*reused = 0;
+
+	/* the base may have been dropped to break a cycle */
+	if (po->reuse_delta && !po->delta)
+		goto fallback;
+
+	if ((error = reuse_revindex(&revindex, pb, p)) < 0 ||
+		(error = git_pack_revindex_find(&entry, &end, revindex, po->reuse_offset)) < 0 ||
+		(error = git_pack_nth_crc(&expected_crc, p, entry->nth)) < 0)
+		goto fallback;
+
+	data_start = po->reuse_offset;
+	if ((error = git_packfile_unpack_header(&size, &type, &p->mwf, &w, &data_start)) < 0)
+		goto fallback;
+
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		base_offset = get_delta_base(p, &w, &data_start, type, po->reuse_offset);
+		git_mwindow_close(&w);
+
+		if (base_offset <= 0 || !po->reuse_delta)
+			goto fallback;
+	}
+
+	if ((error = copy_pack_data(&crc, pb, po, p, &w, po->reuse_offset, end, NULL, NULL)) < 0 ||
+		crc != expected_crc)
+		goto fallback;
+
+	/* nothing is written until the data can be read */
+	if (git_mwindow_open(&p->mwf, &w, data_start, 0, NULL) == NULL)
+		goto fallback;
+
+	/* like the deltas we compute, as not every receiver takes ofs-delta */
+	if (po->reuse_delta) {
+		hdr_len = git_packfile__object_header(hdr, size, GIT_OBJ_REF_DELTA);
+		memcpy(hdr + hdr_len, po->delta->id.id, GIT_OID_RAWSZ);
+		hdr_len += GIT_OID_RAWSZ;
+	} else {
+		hdr_len = git_packfile__object_header(hdr, size, type);
+	}
+
+	*reused = 1;
+
+	if ((error = write_pack_data(pb, po, hdr, hdr_len, write_cb, cb_data)) < 0) {
+		git_mwindow_close(&w);
+		return error;
+	}
+
+	return copy_pack_data(NULL, pb, po, p, &w, data_start, end, write_cb, cb_data);
+
+fallback:
+	/* the object is written like any other */
+	giterr_clear();
+	return 0;
+}
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -312,7 +507,26 @@ static int write_object(
 	unsigned char hdr[10], *zbuf = NULL;
 	void *data = NULL;
 	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
-	int error;
+	int error, reused;
+
+	po->offset = pb->pack_offset;
+	po->crc = crc32(0L, Z_NULL, 0);
+
+	if (po->reuse_pack) {
+		if ((error = write_reused_object(&reused, pb, po, write_cb, cb_data)) < 0)
+			return error;
+
+		if (reused) {
+			pb->nr_written++;
+			return 0;
+		}
+
+		/* we have no delta data of our own, so write it whole */
+		if (po->reuse_delta) {
+			po->delta = NULL;
+			po->reuse_delta = 0;
+		}
+	}
 
 	/*
 	 * If we have a delta base, let's use the delta to save space.
@@ -339,13 +553,12 @@ static int write_object(
 	/* Write header */
 	hdr_len = git_packfile__object_header(hdr, data_len, type);
 
-	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+	if ((error = write_pack_data(pb, po, hdr, hdr_len, write_cb, cb_data)) < 0)
 		goto done;
 
 	if (type == GIT_OBJ_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
+		if ((error = write_pack_data(pb, po,
+				po->delta->id.id, GIT_OID_RAWSZ, write_cb, cb_data)) < 0)
 			goto done;
 	}
 
@@ -353,8 +566,7 @@ static int write_object(
 	if (po->z_delta_size) {
 		data_len = po->z_delta_size;
 
-		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
+		if ((error = write_pack_data(pb, po, data, data_len, write_cb, cb_data)) < 0)
 			goto done;
 	} else {
 		zbuf = git__malloc(zbuf_len);
@@ -365,8 +577,7 @@ static int write_object(
 
 		while (!git_zstream_done(&pb->zstream)) {
 			if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
-				(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
-				(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
+				(error = write_pack_data(pb, po, zbuf, zbuf_len, write_cb, cb_data)) < 0)
 				goto done;
 
 			zbuf_len = COMPRESS_BUFLEN; /* reuse buffer */
@@ -621,7 +832,6 @@ static int write_pack(git_packbuilder *pb,
 	git_pobject *po;
 	enum write_one_status status;
 	struct git_pack_header ph;
-	git_oid entry_oid;
 	unsigned int i = 0;
 	int error = 0;
 
@@ -636,8 +846,8 @@ static int write_pack(git_packbuilder *pb,
 	ph.hdr_version = htonl(PACK_VERSION);
 	ph.hdr_entries = htonl(pb->nr_objects);
 
-	if ((error = write_cb(&ph, sizeof(ph), cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
+	pb->pack_offset = 0;
+	if ((error = write_pack_data(pb, NULL, &ph, sizeof(ph), write_cb, cb_data)) < 0)
 		goto done;
 
 	pb->nr_remaining = pb->nr_objects;
@@ -653,10 +863,10 @@ static int write_pack(git_packbuilder *pb,
 		pb->nr_remaining -= pb->nr_written;
 	} while (pb->nr_remaining && i < pb->nr_objects);
 
-	if ((error = git_hash_final(&entry_oid, &pb->ctx)) < 0)
+	if ((error = git_hash_final(&pb->pack_checksum, &pb->ctx)) < 0)
 		goto done;
 
-	error = write_cb(entry_oid.id, GIT_OID_RAWSZ, cb_data);
+	error = write_cb(pb->pack_checksum.id, GIT_OID_RAWSZ, cb_data);
 
 done:
 	/* if callback cancelled writing, we must still free delta_data */
@@ -1278,6 +1488,102 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 #define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
 #endif
 
+static void drop_reuse_pack(git_pobject *po)
+{
+	git_mwindow_put_pack(po->reuse_pack);
+	po->reuse_pack = NULL;
+}
+
+/*
+ * Find the objects which are stored in a pack already, so that their
+ * data can be copied instead of being compressed again. A delta is kept
+ * if its base is also part of the new pack and comes from the same pack.
+ */
+static int find_reusable_objects(git_packbuilder *pb)
+{
+	struct git_pack_entry e;
+	git_pack_revindex *revindex;
+	const git_pack_revindex_entry *entry;
+	git_mwindow *w = NULL;
+	git_off_t curpos, base_offset, end;
+	git_otype type;
+	git_oid base_id;
+	git_pobject *base;
+	size_t size;
+	unsigned int i;
+	khiter_t pos;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+
+		if ((error = git_odb__find_pack_entry(&e, pb->odb, &po->id)) < 0) {
+			if (error != GIT_ENOTFOUND)
+				return error;
+
+			giterr_clear();
+			continue;
+		}
+
+		/* there are no CRCs to check the data against */
+		if (e.p->index_version == 1) {
+			git_mwindow_put_pack(e.p);
+			continue;
+		}
+
+		/* the reference on the pack is kept as long as the object */
+		po->reuse_pack = e.p;
+		po->reuse_offset = e.offset;
+	}
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = pb->object_list + i;
+		struct git_pack_file *p = po->reuse_pack;
+
+		if (!p)
+			continue;
+
+		curpos = po->reuse_offset;
+		if (git_packfile_unpack_header(&size, &type, &p->mwf, &w, &curpos) < 0) {
+			giterr_clear();
+			drop_reuse_pack(po);
+			continue;
+		}
+
+		if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA) {
+			git_mwindow_close(&w);
+			continue;
+		}
+
+		base_offset = get_delta_base(p, &w, &curpos, type, po->reuse_offset);
+		git_mwindow_close(&w);
+
+		if (base_offset <= 0 ||
+			reuse_revindex(&revindex, pb, p) < 0 ||
+			git_pack_revindex_find(&entry, &end, revindex, base_offset) < 0 ||
+			git_pack_nth_oid(&base_id, p, entry->nth) < 0) {
+			giterr_clear();
+			drop_reuse_pack(po);
+			continue;
+		}
+
+		pos = kh_get(oid, pb->object_ix, &base_id);
+		base = (pos != kh_end(pb->object_ix)) ?
+			kh_value(pb->object_ix, pos) : NULL;
+
+		if (!base || base->reuse_pack != p || base->reuse_offset != base_offset) {
+			/* the delta is of no use without its base */
+			drop_reuse_pack(po);
+			continue;
+		}
+
+		po->delta = base;
+		po->reuse_delta = 1;
+	}
+
+	return 0;
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1293,6 +1599,9 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->progress_cb)
 			pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, pb->nr_objects, pb->progress_cb_payload);
 
+	if (pb->reuse_objects && find_reusable_objects(pb) < 0)
+		return -1;
+
 	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
 	GITERR_CHECK_ALLOC(delta_list);
 
@@ -1303,6 +1612,10 @@ static int prepare_pack(git_packbuilder *pb)
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
 
+		/* Objects we copy from a pack are not deltified again */
+		if (po->reuse_pack)
+			continue;
+
 		delta_list[n++] = po;
 	}
 
@@ -1338,10 +1651,336 @@ int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb)
 	return write_pack(pb, &write_pack_buf, buf);
 }
 
-static int write_cb(void *buf, size_t len, void *payload)
+static int report_write_progress(struct pack_write_context *ctx, bool force)
+{
+	unsigned int written = ctx->pb->nr_written;
+
+	if (!ctx->progress_cb ||
+		(!force && written == ctx->stats->indexed_objects))
+		return 0;
+
+	ctx->stats->received_objects = ctx->stats->indexed_objects = written;
+
+	return giterr_set_after_callback_function(
+		ctx->progress_cb(ctx->stats, ctx->progress_cb_payload),
+		"packbuilder progress");
+}
+
+static int write_file_cb(void *buf, size_t len, void *payload)
 {
 	struct pack_write_context *ctx = payload;
-	return git_indexer_append(ctx->indexer, buf, len, ctx->stats);
+	int error;
+
+	if ((error = report_write_progress(ctx, false)) < 0)
+		return error;
+
+	ctx->stats->received_bytes += len;
+	return git_filebuf_write(ctx->file, buf, len);
+}
+
+static int pobject_oid_cmp(const void *a, const void *b)
+{
+	const git_pobject *po_a = a, *po_b = b;
+
+	return git_oid__cmp(&po_a->id, &po_b->id);
+}
+
+/*
+ * Write the version 2 index of the pack we have just written. We know
+ * the name, offset and CRC32 of every object already, so there is no
+ * need to go through the indexer and parse the pack all over again.
+ */
+static int write_pack_index(
+	git_packbuilder *pb, git_pobject **sorted, const char *path, unsigned int mode)
+{
+	git_filebuf index_file = GIT_FILEBUF_INIT;
+	struct git_pack_idx_header hdr;
+	git_oid idx_checksum;
+	uint32_t fanout[256], n, i, long_offsets = 0;
+	int error;
+
+	if ((error = git_filebuf_open(&index_file, path,
+			GIT_FILEBUF_HASH_CONTENTS, mode)) < 0)
+		return error;
+
+	hdr.idx_signature = htonl(PACK_IDX_SIGNATURE);
+	hdr.idx_version = htonl(2);
+	git_filebuf_write(&index_file, &hdr, sizeof(hdr));
+
+	memset(fanout, 0x0, sizeof(fanout));
+	for (i = 0; i < pb->nr_objects; i++)
+		fanout[sorted[i]->id.id[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; i++) {
+		n = htonl(fanout[i]);
+		git_filebuf_write(&index_file, &n, sizeof(n));
+	}
+
+	for (i = 0; i < pb->nr_objects; i++)
+		git_filebuf_write(&index_file, sorted[i]->id.id, GIT_OID_RAWSZ);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		n = htonl(sorted[i]->crc);
+		git_filebuf_write(&index_file, &n, sizeof(n));
+	}
+
+	/* offsets which don't fit in 31 bits go into the 64-bit table */
+	for (i = 0; i < pb->nr_objects; i++) {
+		if (sorted[i]->offset > 0x7fffffff)
+			n = htonl(0x80000000 | long_offsets++);
+		else
+			n = htonl((uint32_t)sorted[i]->offset);
+
+		git_filebuf_write(&index_file, &n, sizeof(n));
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		uint32_t split[2];
+
+		if (sorted[i]->offset <= 0x7fffffff)
+			continue;
+
+		split[0] = htonl((uint32_t)(sorted[i]->offset >> 32));
+		split[1] = htonl((uint32_t)(sorted[i]->offset & 0xffffffff));
+		git_filebuf_write(&index_file, split, sizeof(split));
+	}
+
+	git_filebuf_write(&index_file, pb->pack_checksum.id, GIT_OID_RAWSZ);
+
+	if ((error = git_filebuf_hash(&idx_checksum, &index_file)) < 0 ||
+		(error = git_filebuf_write(&index_file, idx_checksum.id, GIT_OID_RAWSZ)) < 0 ||
+		(error = git_filebuf_commit(&index_file)) < 0)
+		goto on_error;
+
+	return 0;
+
+on_error:
+	git_filebuf_cleanup(&index_file);
+	return error;
+}
+
+/*
+ * Packs are named after the hash of the sorted names of their objects,
+ * which we can compute before writing anything.
+ */
+static int compute_pack_name(git_packbuilder *pb, git_pobject **sorted)
+{
+	git_hash_ctx ctx;
+	uint32_t i;
+	int error;
+
+	if ((error = git_hash_ctx_init(&ctx)) < 0)
+		return error;
+
+	for (i = 0; !error && i < pb->nr_objects; i++)
+		error = git_hash_update(&ctx, sorted[i]->id.id, GIT_OID_RAWSZ);
+
+	if (!error)
+		error = git_hash_final(&pb->pack_oid, &ctx);
+
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+struct bitmap_commit {
+	const git_oid *id;
+	git_time_t time;
+};
+
+static int bitmap_commit_cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct bitmap_commit *a = a_, *b = b_;
+	GIT_UNUSED(payload);
+
+	/* newest first */
+	if (a->time != b->time)
+		return a->time < b->time ? 1 : -1;
+	return git_oid__cmp(a->id, b->id);
+}
+
+/* Collect the commits of the pack which are the tip of a reference. */
+static int load_ref_tips(git_oidmap *tips, git_packbuilder *pb)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_object *commit;
+	khiter_t pos;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, pb->repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		error = git_reference_peel(&commit, ref, GIT_OBJ_COMMIT);
+		git_reference_free(ref);
+
+		/* references to something else than a commit don't matter */
+		if (error < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		pos = git_oidmap_lookup_index(pb->object_ix, git_object_id(commit));
+		git_object_free(commit);
+
+		if (!git_oidmap_valid_index(pb->object_ix, pos))
+			continue;
+
+		git_oidmap_insert(tips,
+			&((git_pobject *)git_oidmap_value_at(pb->object_ix, pos))->id,
+			NULL, error);
+		if (error < 0) {
+			giterr_set_oom();
+			break;
+		}
+	}
+
+	git_reference_iterator_free(iter);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+/*
+ * Choose the commits which get a bitmap: the most recent reference tips
+ * and commits spaced exponentially further apart going back in history.
+ * They are returned oldest first, so that the bitmaps of older commits
+ * can be reused when building the newer ones.
+ */
+static int select_bitmap_commits(git_array_oid_t *out, git_packbuilder *pb)
+{
+	const git_packbuilder_bitmap_options *opts = &pb->bitmap_opts;
+	git_array_t(struct bitmap_commit) commits = GIT_ARRAY_INIT;
+	git_oidmap *tips;
+	git_commit *commit;
+	size_t i, next = 0, span = opts->history_span;
+	unsigned int tips_left = opts->ref_tips;
+	int error = 0;
+
+	tips = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(tips);
+
+	if ((error = load_ref_tips(tips, pb)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = &pb->object_list[i];
+		struct bitmap_commit *c;
+
+		if (po->type != GIT_OBJ_COMMIT)
+			continue;
+
+		if ((error = git_commit_lookup(&commit, pb->repo, &po->id)) < 0)
+			goto cleanup;
+
+		c = git_array_alloc(commits);
+		if (c) {
+			c->id = &po->id;
+			c->time = git_commit_time(commit);
+		}
+
+		git_commit_free(commit);
+
+		if (!c) {
+			error = -1;
+			goto cleanup;
+		}
+	}
+
+	git__qsort_r(commits.ptr, git_array_size(commits),
+		sizeof(struct bitmap_commit), bitmap_commit_cmp, NULL);
+
+	for (i = 0; i < git_array_size(commits); i++) {
+		const git_oid *id = git_array_get(commits, i)->id;
+		bool selected = false;
+
+		if (tips_left &&
+			git_oidmap_valid_index(tips, git_oidmap_lookup_index(tips, id))) {
+			selected = true;
+			tips_left--;
+		}
+
+		if (span && i >= next) {
+			selected = true;
+			next = i + span;
+
+			if (span * 2 <= opts->max_history_span)
+				span *= 2;
+			else if (span < opts->max_history_span)
+				span = opts->max_history_span;
+		}
+
+		if (selected) {
+			git_oid *selected_id = git_array_alloc(*out);
+
+			if (!selected_id) {
+				error = -1;
+				goto cleanup;
+			}
+			git_oid_cpy(selected_id, id);
+		}
+	}
+
+	/* oldest first */
+	for (i = 0; i < git_array_size(*out) / 2; i++) {
+		git_oid tmp, *a = git_array_get(*out, i),
+			*b = git_array_get(*out, git_array_size(*out) - 1 - i);
+
+		git_oid_cpy(&tmp, a);
+		git_oid_cpy(a, b);
+		git_oid_cpy(b, &tmp);
+	}
+
+cleanup:
+	git_oidmap_free(tips);
+	git_array_clear(commits);
+	return error;
+}
+
+static int write_bitmap_index(
+	git_packbuilder *pb, const char *path, unsigned int mode)
+{
+	git_buf filename = GIT_BUF_INIT;
+	struct git_pack_file *pack = NULL;
+	git_bitmap_writer *writer = NULL;
+	git_array_oid_t commits = GIT_ARRAY_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	uint32_t i;
+	int error;
+
+	git_oid_tostr(hex, sizeof(hex), &pb->pack_oid);
+
+	if ((error = git_buf_joinpath(&filename, path, "pack-")) < 0 ||
+		(error = git_buf_printf(&filename, "%s.idx", hex)) < 0 ||
+		(error = git_mwindow_get_pack(&pack, git_buf_cstr(&filename))) < 0 ||
+		(error = git_bitmap_writer_new(&writer, pack, pb->repo)) < 0)
+		goto cleanup;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = &pb->object_list[i];
+
+		if ((error = git_bitmap_writer_set_object(
+				writer, &po->id, po->type, po->hash)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = select_bitmap_commits(&commits, pb)) < 0 ||
+		(error = git_bitmap_writer_build(
+			writer, commits.ptr, git_array_size(commits))) < 0)
+		goto cleanup;
+
+	git_buf_shorten(&filename, strlen("idx"));
+	if ((error = git_buf_puts(&filename, "bitmap")) < 0)
+		goto cleanup;
+
+	error = git_bitmap_writer_write(writer, git_buf_cstr(&filename), mode);
+
+cleanup:
+	git_bitmap_writer_free(writer);
+	if (pack)
+		git_mwindow_put_pack(pack);
+	git_array_clear(commits);
+	git_buf_free(&filename);
+	return error;
 }
 
 int git_packbuilder_write(
@@ -1351,29 +1990,64 @@ int git_packbuilder_write(
 	git_transfer_progress_cb progress_cb,
 	void *progress_cb_payload)
 {
-	git_indexer *indexer;
+	git_filebuf pack_file = GIT_FILEBUF_INIT;
 	git_transfer_progress stats;
 	struct pack_write_context ctx;
+	git_pobject **sorted = NULL;
+	git_buf filename = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	uint32_t i;
+	int error;
 
 	PREPARE_PACK;
 
-	if (git_indexer_new(
-		&indexer, path, mode, pb->odb, progress_cb, progress_cb_payload) < 0)
-		return -1;
+	if (!mode)
+		mode = GIT_PACK_FILE_MODE;
+
+	sorted = git__calloc(pb->nr_objects ? pb->nr_objects : 1, sizeof(git_pobject *));
+	GITERR_CHECK_ALLOC(sorted);
+
+	for (i = 0; i < pb->nr_objects; i++)
+		sorted[i] = &pb->object_list[i];
+	git__tsort((void **)sorted, pb->nr_objects, pobject_oid_cmp);
+
+	if ((error = compute_pack_name(pb, sorted)) < 0)
+		goto cleanup;
+
+	git_oid_tostr(hex, sizeof(hex), &pb->pack_oid);
+	if ((error = git_buf_joinpath(&filename, path, "pack-")) < 0 ||
+		(error = git_buf_printf(&filename, "%s.pack", hex)) < 0 ||
+		(error = git_filebuf_open(&pack_file, git_buf_cstr(&filename), 0, mode)) < 0)
+		goto cleanup;
 
-	ctx.indexer = indexer;
+	memset(&stats, 0x0, sizeof(stats));
+	stats.total_objects = pb->nr_objects;
+
+	ctx.pb = pb;
+	ctx.file = &pack_file;
 	ctx.stats = &stats;
+	ctx.progress_cb = progress_cb;
+	ctx.progress_cb_payload = progress_cb_payload;
 
-	if (git_packbuilder_foreach(pb, write_cb, &ctx) < 0 ||
-		git_indexer_commit(indexer, &stats) < 0) {
-		git_indexer_free(indexer);
-		return -1;
-	}
+	if ((error = write_pack(pb, write_file_cb, &ctx)) < 0 ||
+		(error = report_write_progress(&ctx, true)) < 0 ||
+		(error = git_filebuf_commit(&pack_file)) < 0)
+		goto cleanup;
 
-	git_oid_cpy(&pb->pack_oid, git_indexer_hash(indexer));
+	/* the index goes last, as it is what makes the pack visible */
+	git_buf_shorten(&filename, strlen("pack"));
+	if ((error = git_buf_puts(&filename, "idx")) < 0 ||
+		(error = write_pack_index(pb, sorted, git_buf_cstr(&filename), mode)) < 0)
+		goto cleanup;
 
-	git_indexer_free(indexer);
-	return 0;
+	if (pb->write_bitmaps)
+		error = write_bitmap_index(pb, path, mode);
+
+cleanup:
+	git_filebuf_cleanup(&pack_file);
+	git_buf_free(&filename);
+	git__free(sorted);
+	return error;
 }
 
 #undef PREPARE_PACK
@@ -1671,6 +2345,80 @@ cleanup:
 	return error;
 }
 
+static int load_bitmaps(git_packbuilder *pb)
+{
+	git_buf pack_dir = GIT_BUF_INIT;
+	int error;
+
+	if (pb->bitmaps_loaded)
+		return pb->bitmaps ? 0 : GIT_ENOTFOUND;
+
+	pb->bitmaps_loaded = true;
+
+	if ((error = git_buf_joinpath(&pack_dir,
+			git_repository_path(pb->repo), GIT_OBJECTS_DIR "pack")) < 0)
+		return error;
+
+	error = git_bitmap_index_open_dir(&pb->bitmaps, git_buf_cstr(&pack_dir));
+	git_buf_free(&pack_dir);
+
+	return error;
+}
+
+struct bitmap_insert_context {
+	git_packbuilder *pb;
+	const git_bitmap_index *index;
+};
+
+static int bitmap_insert_cb(size_t pos, void *payload)
+{
+	struct bitmap_insert_context *ctx = payload;
+	const git_bitmap_object *obj = git_bitmap_index_object(ctx->index, pos);
+
+	return packbuilder_insert(ctx->pb, &obj->id,
+		git_bitmap_index_name_hash(ctx->index, pos));
+}
+
+/*
+ * Count the objects of the walk with the reachability bitmaps: the objects
+ * to send are those reachable from the wanted commits but not from the
+ * ones the other end has. Returns GIT_ENOTFOUND when the bitmaps cannot
+ * answer this walk, in which case the caller falls back to walking the
+ * trees.
+ */
+static int insert_walk_bitmaps(git_packbuilder *pb, git_revwalk *walk)
+{
+	struct bitmap_insert_context ctx;
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	git_commit_list *list;
+	int error;
+
+	if (!pb->use_bitmaps || walk->hide_cb || walk->first_parent)
+		return GIT_ENOTFOUND;
+
+	if ((error = load_bitmaps(pb)) < 0)
+		goto cleanup;
+
+	for (list = walk->user_input; list; list = list->next) {
+		git_bitmap *target = list->item->uninteresting ? &haves : &wants;
+
+		if ((error = git_bitmap_index_add_reachable(
+				target, pb->bitmaps, pb->repo, &list->item->oid)) < 0)
+			goto cleanup;
+	}
+
+	git_bitmap_and_not(&wants, &haves);
+
+	ctx.pb = pb;
+	ctx.index = pb->bitmaps;
+	error = git_bitmap_foreach(&wants, bitmap_insert_cb, &ctx);
+
+cleanup:
+	git_bitmap_free(&wants);
+	git_bitmap_free(&haves);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1679,6 +2427,11 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmaps(pb, walk)) != GIT_ENOTFOUND)
+		return error;
+
+	giterr_clear();
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1707,6 +2460,33 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 	return 0;
 }
 
+int git_packbuilder_init_bitmap_options(
+	git_packbuilder_bitmap_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_packbuilder_bitmap_options,
+		GIT_PACKBUILDER_BITMAP_OPTIONS_INIT);
+	return 0;
+}
+
+int git_packbuilder_set_bitmap_options(
+	git_packbuilder *pb, const git_packbuilder_bitmap_options *opts)
+{
+	assert(pb);
+
+	if (!opts) {
+		pb->write_bitmaps = false;
+		return 0;
+	}
+
+	GITERR_CHECK_VERSION(opts, GIT_PACKBUILDER_BITMAP_OPTIONS_VERSION,
+		"git_packbuilder_bitmap_options");
+
+	memcpy(&pb->bitmap_opts, opts, sizeof(git_packbuilder_bitmap_options));
+	pb->write_bitmaps = true;
+	return 0;
+}
+
 int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress progress_cb, void *progress_cb_payload)
 {
 	if (!pb)
@@ -1720,6 +2500,9 @@ int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress
 
 void git_packbuilder_free(git_packbuilder *pb)
 {
+	git_pack_revindex *revindex;
+	size_t i;
+
 	if (pb == NULL)
 		return;
 
@@ -1731,9 +2514,22 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 #endif
 
+	git_vector_foreach(&pb->reuse_packs, i, revindex) {
+		git_pack_revindex_free(revindex);
+		git__free(revindex);
+	}
+	git_vector_free(&pb->reuse_packs);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		if (pb->object_list[i].reuse_pack)
+			git_mwindow_put_pack(pb->object_list[i].reuse_pack);
+	}
+
 	if (pb->odb)
 		git_odb_free(pb->odb);
 
+	git_bitmap_index_free(pb->bitmaps);
+
 	if (pb->object_ix)
 		git_oidmap_free(pb->object_ix);
 
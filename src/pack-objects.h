@@ -16,6 +16,7 @@
 #include "netops.h"
 #include "zstream.h"
 #include "pool.h"
+#include "pack-bitmap.h"
 
 #include "git2/oid.h"
 #include "git2/pack.h"
@@ -29,7 +30,8 @@
 typedef struct git_pobject {
 	git_oid id;
 	git_otype type;
-	git_off_t offset;
+	git_off_t offset; /* where the object was written in the pack */
+	uint32_t crc; /* CRC32 of the object as written in the pack */
 
 	size_t size;
 
@@ -45,10 +47,15 @@ typedef struct git_pobject {
 	unsigned long delta_size;
 	unsigned long z_delta_size;
 
+	/* where the object is in an existing pack, to copy it from there */
+	struct git_pack_file *reuse_pack;
+	git_off_t reuse_offset;
+
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    reuse_delta:1; /* it is reused as a delta against `delta` */
 } git_pobject;
 
 typedef struct {
@@ -78,6 +85,8 @@ struct git_packbuilder {
 	git_pool object_pool;
 
 	git_oid pack_oid; /* hash of written pack */
+	git_oid pack_checksum; /* trailer of written pack */
+	git_off_t pack_offset; /* size of the pack written so far */
 
 	/* synchronization objects */
 	git_mutex cache_mutex;
@@ -93,6 +102,19 @@ struct git_packbuilder {
 
 	int nr_threads; /* nr of threads to use */
 
+	/* reachability bitmaps, used to count the objects of a walk */
+	int use_bitmaps;
+	bool bitmaps_loaded;
+	git_bitmap_index *bitmaps;
+
+	/* copy objects from existing packs instead of compressing them again */
+	int reuse_objects;
+	git_vector reuse_packs; /* the git_pack_revindex of the packs in use */
+
+	/* whether git_packbuilder_write writes a bitmap index, and how */
+	bool write_bitmaps;
+	git_packbuilder_bitmap_options bitmap_opts;
+
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
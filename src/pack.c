@@ -8,6 +8,7 @@
 #include "common.h"
 #include "odb.h"
 #include "pack.h"
+#include "pack-cache.h"
 #include "delta-apply.h"
 #include "sha1_lookup.h"
 #include "mwindow.h"
@@ -16,11 +17,11 @@
 
 #include <zlib.h>
 
-GIT__USE_OFFMAP;
 GIT__USE_OIDMAP;
 
 static int packfile_open(struct git_pack_file *p);
 static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_t n);
+static ssize_t zstream_read(git_packfile_stream *zstream, void *buffer, size_t len);
 int packfile_unpack_compressed(
 		git_rawobj *obj,
 		struct git_pack_file *p,
@@ -49,150 +50,6 @@ static int packfile_error(const char *message)
 	return -1;
 }
 
-/********************
- * Delta base cache
- ********************/
-
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
-{
-	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
-	if (!e)
-		return NULL;
-
-	git_atomic_inc(&e->refcount);
-	memcpy(&e->raw, source, sizeof(git_rawobj));
-
-	return e;
-}
-
-static void free_cache_object(void *o)
-{
-	git_pack_cache_entry *e = (git_pack_cache_entry *)o;
-
-	if (e != NULL) {
-		assert(e->refcount.val == 0);
-		git__free(e->raw.data);
-		git__free(e);
-	}
-}
-
-static void cache_free(git_pack_cache *cache)
-{
-	khiter_t k;
-
-	if (cache->entries) {
-		for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-			if (kh_exist(cache->entries, k))
-				free_cache_object(kh_value(cache->entries, k));
-		}
-
-		git_offmap_free(cache->entries);
-		cache->entries = NULL;
-	}
-}
-
-static int cache_init(git_pack_cache *cache)
-{
-	cache->entries = git_offmap_alloc();
-	GITERR_CHECK_ALLOC(cache->entries);
-
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
-
-	if (git_mutex_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize pack cache mutex");
-
-		git__free(cache->entries);
-		cache->entries = NULL;
-
-		return -1;
-	}
-
-	return 0;
-}
-
-static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
-{
-	khiter_t k;
-	git_pack_cache_entry *entry = NULL;
-
-	if (git_mutex_lock(&cache->lock) < 0)
-		return NULL;
-
-	k = kh_get(off, cache->entries, offset);
-	if (k != kh_end(cache->entries)) { /* found it */
-		entry = kh_value(cache->entries, k);
-		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
-	}
-	git_mutex_unlock(&cache->lock);
-
-	return entry;
-}
-
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
-{
-	git_pack_cache_entry *entry;
-	khiter_t k;
-
-	for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-		if (!kh_exist(cache->entries, k))
-			continue;
-
-		entry = kh_value(cache->entries, k);
-
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			kh_del(off, cache->entries, k);
-			free_cache_object(entry);
-		}
-	}
-}
-
-static int cache_add(
-		git_pack_cache_entry **cached_out,
-		git_pack_cache *cache,
-		git_rawobj *base,
-		git_off_t offset)
-{
-	git_pack_cache_entry *entry;
-	int error, exists = 0;
-	khiter_t k;
-
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
-		return -1;
-
-	entry = new_cache_object(base);
-	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
-			giterr_set(GITERR_OS, "failed to lock cache");
-			git__free(entry);
-			return -1;
-		}
-		/* Add it to the cache if nobody else has */
-		exists = kh_get(off, cache->entries, offset) != kh_end(cache->entries);
-		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
-
-			k = kh_put(off, cache->entries, offset, &error);
-			assert(error != 0);
-			kh_value(cache->entries, k) = entry;
-			cache->memory_used += entry->raw.len;
-
-			*cached_out = entry;
-		}
-		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
-		if (exists) {
-			git__free(entry);
-			return -1;
-		}
-	}
-
-	return 0;
-}
-
 /***********************************************************
  *
  * PACK INDEX METHODS
@@ -368,8 +225,9 @@ static unsigned char *pack_window_open(
 	if (offset > (p->mwf.size - 20))
 		return NULL;
 
+	/* a pack closed to stay within the open file limit is reopened */
 	return git_mwindow_open(&p->mwf, w_cursor, offset, 20, left);
- }
+}
 
 /*
  * The per-object header is a pretty dense thing, which is
@@ -474,6 +332,35 @@ int git_packfile_unpack_header(
 	return 0;
 }
 
+/* Read the sizes at the start of a delta, without inflating all of it */
+static int read_delta_header(
+	size_t *base_size, size_t *result_size,
+	struct git_pack_file *p, git_off_t curpos)
+{
+	git_packfile_stream stream;
+	unsigned char header[20]; /* two sizes of up to 10 bytes each */
+	size_t len = 0;
+	ssize_t read = 0;
+	int error;
+
+	if ((error = git_packfile_stream_open(&stream, p, curpos)) < 0)
+		return error;
+
+	while (len < sizeof(header) &&
+		(read = zstream_read(&stream, header + len, sizeof(header) - len)) > 0)
+		len += (size_t)read;
+
+	git_packfile_stream_free(&stream);
+
+	if (read < 0)
+		return (int)read;
+
+	if (git__delta_read_header(header, len, base_size, result_size) < 0)
+		return packfile_error("invalid delta header");
+
+	return 0;
+}
+
 int git_packfile_resolve_header(
 		size_t *size_p,
 		git_otype *type_p,
@@ -494,16 +381,9 @@ int git_packfile_resolve_header(
 
 	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
 		size_t base_size;
-		git_rawobj delta;
 		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
 		git_mwindow_close(&w_curs);
-		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, size, type);
-		git_mwindow_close(&w_curs);
-		if (error < 0)
-			return error;
-		error = git__delta_read_header(delta.data, delta.len, &base_size, size_p);
-		git__free(delta.data);
-		if (error < 0)
+		if ((error = read_delta_header(&base_size, size_p, p, curpos)) < 0)
 			return error;
 	} else
 		*size_p = size;
@@ -550,7 +430,7 @@ static int pack_dependency_chain(git_dependency_chain *chain_out,
 		git_pack_cache_entry *cached = NULL;
 
 		/* if we have a base cached, we can stop here instead */
-		if ((cached = cache_get(&p->bases, obj_offset)) != NULL) {
+		if ((cached = git_pack_cache_get(p->cache_id, obj_offset)) != NULL) {
 			*cached_out = cached;
 			*cached_off = obj_offset;
 			break;
@@ -699,7 +579,7 @@ int git_packfile_unpack(
 		GITERR_CHECK_ALLOC(obj->data);
 
 		memcpy(obj->data, data, obj->len + 1);
-		git_atomic_dec(&cached->refcount);
+		git_pack_cache_release(cached);
 		goto cleanup;
 	}
 
@@ -712,7 +592,7 @@ int git_packfile_unpack(
 		 * long as it's not already the cached one.
 		 */
 		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+			free_base = !!git_pack_cache_add(&cached, p->cache_id, elem->base_key, obj);
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
@@ -743,7 +623,7 @@ int git_packfile_unpack(
 		}
 
 		if (cached) {
-			git_atomic_dec(&cached->refcount);
+			git_pack_cache_release(cached);
 			cached = NULL;
 		}
 
@@ -789,7 +669,6 @@ int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p,
 	obj->zstream.next_out = Z_NULL;
 	st = inflateInit(&obj->zstream);
 	if (st != Z_OK) {
-		git__free(obj);
 		giterr_set(GITERR_ZLIB, "failed to init packfile stream");
 		return -1;
 	}
@@ -842,6 +721,394 @@ void git_packfile_stream_free(git_packfile_stream *obj)
 	inflateEnd(&obj->zstream);
 }
 
+/*
+ * Streaming reads of whole objects
+ */
+
+size_t git_packfile__spill_threshold = GIT_PACK_SPILL_THRESHOLD;
+
+#define OBJECT_STREAM_BUFSIZE (16 * 1024)
+
+struct git_packfile_object_stream {
+	struct git_pack_file *p;
+	git_packfile_stream zstream; /* the object's data, or its delta */
+	size_t size;
+	size_t left; /* bytes of the object still to be read */
+
+	/* deltified objects are applied on a base in memory or spilled */
+	unsigned int is_delta:1, base_mapped:1;
+	const unsigned char *base;
+	size_t base_len;
+	git_rawobj base_obj;
+	git_map base_map;
+	git_buf spill_path;
+
+	/* the delta instruction being applied */
+	size_t copy_off, copy_left, insert_left;
+	unsigned char *in;
+	size_t in_pos, in_len;
+};
+
+/* Like git_packfile_stream_read, but carries on across mmap windows */
+static ssize_t zstream_read(git_packfile_stream *zstream, void *buffer, size_t len)
+{
+	git_off_t curpos;
+	ssize_t read;
+
+	do {
+		curpos = zstream->curpos;
+		read = git_packfile_stream_read(zstream, buffer, len);
+	} while (read == GIT_EBUFS && zstream->curpos != curpos);
+
+	if (read == GIT_EBUFS)
+		return packfile_error("object is truncated");
+
+	return read;
+}
+
+static int delta_fill(git_packfile_object_stream *s)
+{
+	ssize_t read;
+
+	if (s->in_pos < s->in_len)
+		return 0;
+
+	if ((read = zstream_read(&s->zstream, s->in, OBJECT_STREAM_BUFSIZE)) < 0)
+		return (int)read;
+
+	if (read == 0)
+		return packfile_error("delta is truncated");
+
+	s->in_pos = 0;
+	s->in_len = (size_t)read;
+	return 0;
+}
+
+GIT_INLINE(int) delta_getc(unsigned char *out, git_packfile_object_stream *s)
+{
+	if (delta_fill(s) < 0)
+		return -1;
+
+	*out = s->in[s->in_pos++];
+	return 0;
+}
+
+static int delta_read_size(size_t *out, git_packfile_object_stream *s)
+{
+	size_t size = 0;
+	unsigned int shift = 0;
+	unsigned char c;
+
+	do {
+		if (shift >= sizeof(size_t) * 8)
+			return packfile_error("delta size overflow");
+
+		if (delta_getc(&c, s) < 0)
+			return -1;
+
+		size |= (size_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	*out = size;
+	return 0;
+}
+
+/* Decode the next delta instruction */
+static int delta_next_op(git_packfile_object_stream *s)
+{
+	unsigned char op, c;
+	size_t off = 0, len = 0;
+	int i;
+
+	if (delta_getc(&op, s) < 0)
+		return -1;
+
+	if (!(op & 0x80)) {
+		if (!op || op > s->left)
+			return packfile_error("invalid delta insert");
+
+		s->insert_left = op;
+		return 0;
+	}
+
+	/* copy from the base; which bytes of the offset and length follow
+	 * is given by the low bits of the opcode */
+	for (i = 0; i < 4; i++) {
+		if (op & (1 << i)) {
+			if (delta_getc(&c, s) < 0)
+				return -1;
+			off |= (size_t)c << (i * 8);
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (op & (0x10 << i)) {
+			if (delta_getc(&c, s) < 0)
+				return -1;
+			len |= (size_t)c << (i * 8);
+		}
+	}
+
+	if (!len)
+		len = 0x10000;
+
+	if (off > s->base_len || len > s->base_len - off || len > s->left)
+		return packfile_error("invalid delta copy");
+
+	s->copy_off = off;
+	s->copy_left = len;
+	return 0;
+}
+
+static ssize_t delta_stream_read(
+	git_packfile_object_stream *s, unsigned char *buffer, size_t len)
+{
+	size_t written = 0, n;
+
+	while (written < len && s->left) {
+		if (s->copy_left) {
+			n = min(s->copy_left, len - written);
+			memcpy(buffer + written, s->base + s->copy_off, n);
+
+			s->copy_off += n;
+			s->copy_left -= n;
+		} else if (s->insert_left) {
+			if (delta_fill(s) < 0)
+				return -1;
+
+			n = min(s->insert_left, len - written);
+			n = min(n, s->in_len - s->in_pos);
+			memcpy(buffer + written, s->in + s->in_pos, n);
+
+			s->in_pos += n;
+			s->insert_left -= n;
+		} else {
+			if (delta_next_op(s) < 0)
+				return -1;
+			continue;
+		}
+
+		written += n;
+		s->left -= n;
+	}
+
+	return (ssize_t)written;
+}
+
+ssize_t git_packfile_object_stream_read(
+	git_packfile_object_stream *s, void *buffer, size_t len)
+{
+	ssize_t read;
+
+	if (!s->left || !len)
+		return 0;
+
+	if (s->is_delta)
+		return delta_stream_read(s, buffer, len);
+
+	if ((read = zstream_read(&s->zstream, buffer, min(len, s->left))) < 0)
+		return read;
+
+	if (read == 0)
+		return packfile_error("object is truncated");
+
+	s->left -= (size_t)read;
+	return read;
+}
+
+/*
+ * Write the base of a deltified object to a temporary file, and map it.
+ * Returns GIT_PASSTHROUGH if the file can't be created, in which case
+ * the caller can still fall back to reading the base into memory.
+ */
+static int spill_base(
+	git_packfile_object_stream *s,
+	git_off_t base_offset,
+	size_t base_size,
+	const char *spill_path)
+{
+	git_packfile_object_stream *base = NULL;
+	char *buffer = NULL;
+	ssize_t read;
+	int fd = -1, error;
+
+	/* open the base first, so that it's done with any spill of its own
+	 * by the time we create ours */
+	if ((error = git_packfile_object_stream_open(
+			&base, s->p, base_offset, spill_path)) < 0)
+		return error;
+
+	if (base->size != base_size) {
+		error = packfile_error("delta base has the wrong size");
+		goto done;
+	}
+
+	if ((fd = git_futils_mktmp(&s->spill_path, spill_path, 0600)) < 0) {
+		giterr_clear();
+		git_buf_clear(&s->spill_path);
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	if ((buffer = git__malloc(OBJECT_STREAM_BUFSIZE)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	while ((read = git_packfile_object_stream_read(
+			base, buffer, OBJECT_STREAM_BUFSIZE)) > 0) {
+		if ((error = p_write(fd, buffer, (size_t)read)) < 0) {
+			giterr_set(GITERR_OS,
+				"failed to write delta base to '%s'", s->spill_path.ptr);
+			goto done;
+		}
+	}
+
+	if (read < 0) {
+		error = (int)read;
+		goto done;
+	}
+
+	if ((error = git_futils_mmap_ro(&s->base_map, fd, 0, base_size)) < 0)
+		goto done;
+
+	s->base_mapped = 1;
+	s->base = s->base_map.data;
+	s->base_len = base_size;
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+
+	git__free(buffer);
+	git_packfile_object_stream_free(base);
+	return error;
+}
+
+static int open_base(
+	git_packfile_object_stream *s,
+	git_off_t base_offset,
+	size_t base_size,
+	const char *spill_path)
+{
+	int error;
+
+	if (spill_path && base_size >= git_packfile__spill_threshold &&
+		(error = spill_base(s, base_offset, base_size, spill_path)) != GIT_PASSTHROUGH)
+		return error;
+
+	if ((error = git_packfile_unpack(&s->base_obj, s->p, &base_offset)) < 0)
+		return error;
+
+	if (s->base_obj.len != base_size)
+		return packfile_error("delta base has the wrong size");
+
+	s->base = s->base_obj.data;
+	s->base_len = base_size;
+	return 0;
+}
+
+int git_packfile_object_stream_open(
+	git_packfile_object_stream **out,
+	struct git_pack_file *p,
+	git_off_t offset,
+	const char *spill_path)
+{
+	git_packfile_object_stream *s;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset, base_offset = 0;
+	size_t size, base_size;
+	git_otype type;
+	int error;
+
+	*out = NULL;
+
+	s = git__calloc(1, sizeof(git_packfile_object_stream));
+	GITERR_CHECK_ALLOC(s);
+
+	/* the pack may be dropped by a refresh while the stream is open */
+	git_atomic_inc(&p->refcount);
+	s->p = p;
+	git_buf_init(&s->spill_path, 0);
+
+	error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+
+	if (error < 0)
+		goto on_error;
+
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (base_offset == 0) {
+			error = packfile_error("delta offset is zero");
+			goto on_error;
+		}
+		if (base_offset < 0) {
+			error = (int)base_offset;
+			goto on_error;
+		}
+
+		s->is_delta = 1;
+
+		if ((s->in = git__malloc(OBJECT_STREAM_BUFSIZE)) == NULL) {
+			error = -1;
+			goto on_error;
+		}
+	}
+
+	if ((error = git_packfile_stream_open(&s->zstream, p, curpos)) < 0)
+		goto on_error;
+
+	if (s->is_delta) {
+		if ((error = delta_read_size(&base_size, s)) < 0 ||
+			(error = delta_read_size(&s->size, s)) < 0 ||
+			(error = open_base(s, base_offset, base_size, spill_path)) < 0)
+			goto on_error;
+	} else {
+		s->size = size;
+	}
+
+	s->left = s->size;
+
+	*out = s;
+	return 0;
+
+on_error:
+	git_packfile_object_stream_free(s);
+	return error;
+}
+
+size_t git_packfile_object_stream_size(git_packfile_object_stream *s)
+{
+	return s->size;
+}
+
+void git_packfile_object_stream_free(git_packfile_object_stream *s)
+{
+	if (!s)
+		return;
+
+	git_packfile_stream_free(&s->zstream);
+
+	if (s->base_mapped)
+		git_futils_mmap_free(&s->base_map);
+
+	if (git_buf_len(&s->spill_path) > 0)
+		p_unlink(s->spill_path.ptr);
+
+	git_buf_free(&s->spill_path);
+	git__free(s->base_obj.data);
+	git__free(s->in);
+
+	if (s->p)
+		git_mwindow_put_pack(s->p);
+
+	git__free(s);
+}
+
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -982,7 +1249,7 @@ void git_packfile_free(struct git_pack_file *p)
 	if (!p)
 		return;
 
-	cache_free(&p->bases);
+	git_pack_cache_purge(p->cache_id);
 
 	if (p->mwf.fd >= 0) {
 		git_mwindow_free_all_locked(&p->mwf);
@@ -993,8 +1260,8 @@ void git_packfile_free(struct git_pack_file *p)
 
 	git__free(p->bad_object_sha1);
 
+	git_mutex_free(&p->mwf.lock);
 	git_mutex_free(&p->lock);
-	git_mutex_free(&p->bases.lock);
 	git__free(p);
 }
 
@@ -1004,6 +1271,7 @@ static int packfile_open(struct git_pack_file *p)
 	struct git_pack_header hdr;
 	git_oid sha1;
 	unsigned char *idx_sha1;
+	git_file fd;
 
 	if (p->index_version == -1 && pack_index_open(p) < 0)
 		return git_odb__error_notfound("failed to open packfile", NULL);
@@ -1017,28 +1285,39 @@ static int packfile_open(struct git_pack_file *p)
 		return 0;
 	}
 
-	/* TODO: open with noatime */
-	p->mwf.fd = git_futils_open_ro(p->pack_name);
-	if (p->mwf.fd < 0)
+	/*
+	 * The descriptor is only published once the pack has been
+	 * checked, as it may be closed again as soon as it is registered
+	 * if we're over the open file limit.
+	 *
+	 * TODO: open with noatime
+	 */
+	fd = git_futils_open_ro(p->pack_name);
+	if (fd < 0)
 		goto cleanup;
 
-	if (p_fstat(p->mwf.fd, &st) < 0 ||
-		git_mwindow_file_register(&p->mwf) < 0)
+	if (p_fstat(fd, &st) < 0)
 		goto cleanup;
 
-	/* If we created the struct before we had the pack we lack size. */
+	/*
+	 * If we created the struct before we had the pack we lack size.
+	 * When reopening a pack which was closed to stay within the
+	 * open file limit, make sure it is still the same file, as the
+	 * offsets we know about would be meaningless in a new one.
+	 */
 	if (!p->mwf.size) {
 		if (!S_ISREG(st.st_mode))
 			goto cleanup;
 		p->mwf.size = (git_off_t)st.st_size;
-	} else if (p->mwf.size != st.st_size)
+	} else if (p->mwf.size != st.st_size ||
+		(p->mtime && p->mtime != (git_time_t)st.st_mtime))
 		goto cleanup;
 
 #if 0
 	/* We leave these file descriptors open with sliding mmap;
 	 * there is no point keeping them open across exec(), though.
 	 */
-	fd_flag = fcntl(p->mwf.fd, F_GETFD, 0);
+	fd_flag = fcntl(fd, F_GETFD, 0);
 	if (fd_flag < 0)
 		goto cleanup;
 
@@ -1048,15 +1327,15 @@ static int packfile_open(struct git_pack_file *p)
 #endif
 
 	/* Verify we recognize this pack file format. */
-	if (p_read(p->mwf.fd, &hdr, sizeof(hdr)) < 0 ||
+	if (p_read(fd, &hdr, sizeof(hdr)) < 0 ||
 		hdr.hdr_signature != htonl(PACK_SIGNATURE) ||
 		!pack_version_ok(hdr.hdr_version))
 		goto cleanup;
 
 	/* Verify the pack matches its index. */
 	if (p->num_objects != ntohl(hdr.hdr_entries) ||
-		p_lseek(p->mwf.fd, p->mwf.size - GIT_OID_RAWSZ, SEEK_SET) == -1 ||
-		p_read(p->mwf.fd, sha1.id, GIT_OID_RAWSZ) < 0)
+		p_lseek(fd, p->mwf.size - GIT_OID_RAWSZ, SEEK_SET) == -1 ||
+		p_read(fd, sha1.id, GIT_OID_RAWSZ) < 0)
 		goto cleanup;
 
 	idx_sha1 = ((unsigned char *)p->index_map.data) + p->index_map.len - 40;
@@ -1064,21 +1343,33 @@ static int packfile_open(struct git_pack_file *p)
 	if (git_oid__cmp(&sha1, (git_oid *)idx_sha1) != 0)
 		goto cleanup;
 
+	p->mwf.fd = fd;
+	p->mwf.closeable = 1;
+
+	if (git_mwindow_file_register(&p->mwf) < 0) {
+		p->mwf.fd = -1;
+		goto cleanup;
+	}
+
 	git_mutex_unlock(&p->lock);
 	return 0;
 
 cleanup:
 	giterr_set(GITERR_OS, "Invalid packfile '%s'", p->pack_name);
 
-	if (p->mwf.fd >= 0)
-		p_close(p->mwf.fd);
-	p->mwf.fd = -1;
+	if (fd >= 0)
+		p_close(fd);
 
 	git_mutex_unlock(&p->lock);
 
 	return -1;
 }
 
+static int packfile_reopen(git_mwindow_file *mwf)
+{
+	return packfile_open((struct git_pack_file *)mwf);
+}
+
 int git_packfile__name(char **out, const char *path)
 {
 	size_t path_len;
@@ -1138,6 +1429,7 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 	 * actually mapping the pack file.
 	 */
 	p->mwf.fd = -1;
+	p->mwf.reopen = packfile_reopen;
 	p->mwf.size = st.st_size;
 	p->pack_local = 1;
 	p->mtime = (git_time_t)st.st_mtime;
@@ -1149,11 +1441,15 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 		return -1;
 	}
 
-	if (cache_init(&p->bases) < 0) {
+	if (git_mutex_init(&p->mwf.lock)) {
+		giterr_set(GITERR_OS, "Failed to initialize packfile window mutex");
+		git_mutex_free(&p->lock);
 		git__free(p);
 		return -1;
 	}
 
+	p->cache_id = git_pack_cache_new_id();
+
 	*pack_out = p;
 
 	return 0;
@@ -1246,6 +1542,178 @@ int git_pack_foreach_entry(
 	return error;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	size_t stride;
+	uint32_t i;
+	int error = 0;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	assert(p->index_map.data);
+	index = p->index_map.data;
+
+	if (p->index_version > 1) {
+		index += 8 + 4 * 256;
+		stride = 20;
+	} else {
+		index += 4 * 256 + 4;
+		stride = 24;
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		git_oid oid;
+
+		git_oid_fromraw(&oid, index + stride * i);
+
+		if ((error = cb(&oid, nth_packed_object_offset(p, i), data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return error;
+}
+
+int git_pack_object_count(uint32_t *out, struct git_pack_file *p)
+{
+	int error;
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	*out = p->num_objects;
+	return 0;
+}
+
+int git_pack_nth_oid(git_oid *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (n >= p->num_objects) {
+		giterr_set(GITERR_ODB, "object position out of range");
+		return -1;
+	}
+
+	index = p->index_map.data;
+	if (p->index_version > 1)
+		git_oid_fromraw(out, index + 8 + 4 * 256 + 20 * n);
+	else
+		git_oid_fromraw(out, index + 4 * 256 + 24 * n + 4);
+
+	return 0;
+}
+
+int git_pack_nth_crc(uint32_t *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (p->index_version < 2)
+		return GIT_ENOTFOUND;
+
+	if (n >= p->num_objects) {
+		giterr_set(GITERR_ODB, "object position out of range");
+		return -1;
+	}
+
+	index = p->index_map.data;
+	index += 8 + 4 * 256 + 20 * p->num_objects;
+	*out = ntohl(*((uint32_t *)(index + 4 * n)));
+
+	return 0;
+}
+
+static int revindex_entry_cmp(const void *a_, const void *b_, void *payload)
+{
+	const git_pack_revindex_entry *a = a_, *b = b_;
+	GIT_UNUSED(payload);
+
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+int git_pack_revindex_init(git_pack_revindex *out, struct git_pack_file *p)
+{
+	uint32_t i;
+	int error;
+
+	assert(out && p);
+
+	memset(out, 0x0, sizeof(git_pack_revindex));
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	/* we need the size of the pack to know where the last object ends */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	out->entries = git__calloc(
+		p->num_objects ? p->num_objects : 1, sizeof(git_pack_revindex_entry));
+	GITERR_CHECK_ALLOC(out->entries);
+
+	for (i = 0; i < p->num_objects; i++) {
+		out->entries[i].offset = nth_packed_object_offset(p, i);
+		out->entries[i].nth = i;
+	}
+
+	git__qsort_r(out->entries, p->num_objects,
+		sizeof(git_pack_revindex_entry), revindex_entry_cmp, NULL);
+
+	out->p = p;
+	out->count = p->num_objects;
+	return 0;
+}
+
+void git_pack_revindex_free(git_pack_revindex *revindex)
+{
+	if (!revindex)
+		return;
+
+	git__free(revindex->entries);
+	revindex->entries = NULL;
+	revindex->count = 0;
+}
+
+int git_pack_revindex_find(
+	const git_pack_revindex_entry **out,
+	git_off_t *end_offset,
+	const git_pack_revindex *revindex,
+	git_off_t offset)
+{
+	uint32_t lo = 0, hi = revindex->count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const git_pack_revindex_entry *entry = &revindex->entries[mid];
+
+		if (entry->offset == offset) {
+			*out = entry;
+			*end_offset = (mid + 1 < revindex->count) ?
+				revindex->entries[mid + 1].offset :
+				revindex->p->mwf.size - GIT_OID_RAWSZ;
+			return 0;
+		}
+
+		if (entry->offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
@@ -1344,6 +1812,34 @@ static int pack_entry_find_offset(
 	return 0;
 }
 
+int git_pack_entry_from_offset(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	int error;
+
+	assert(e && p && oid);
+
+	if (p->num_bad_objects) {
+		unsigned i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+				return packfile_error("bad object found in packfile");
+	}
+
+	/* make sure the packfile backing the entry still exists on disk */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
+
 int git_pack_entry_find(
 		struct git_pack_entry *e,
 		struct git_pack_file *p,
@@ -1379,3 +1875,115 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_find_many(
+		git_off_t *offsets,
+		struct git_pack_file *p,
+		const git_oid **ids,
+		size_t count)
+{
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
+	unsigned hi, lo, cursor = 0, stride;
+	size_t i, j, found = 0;
+	int pos, error;
+
+	assert(offsets && p && (ids || !count));
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	level1_ofs = p->index_map.data;
+	index = p->index_map.data;
+
+	if (p->index_version > 1) {
+		level1_ofs += 2;
+		index += 8;
+	}
+
+	index += 4 * 256;
+
+	if (p->index_version > 1) {
+		stride = 20;
+	} else {
+		stride = 24;
+		index += 4;
+	}
+
+	for (i = 0; i < count; ++i) {
+		const git_oid *id = ids[i];
+
+		offsets[i] = -1;
+
+		hi = ntohl(level1_ofs[(int)id->id[0]]);
+		lo = ((id->id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)id->id[0] - 1]));
+
+		/* the ids are sorted, so nothing before the last match can match */
+		if (cursor > lo)
+			lo = cursor;
+		if (lo >= hi)
+			continue;
+
+		pos = sha1_position(index, stride, lo, hi, id->id);
+		if (pos < 0) {
+			cursor = (unsigned)(-1 - pos);
+			continue;
+		}
+
+		cursor = (unsigned)pos;
+
+		for (j = 0; j < p->num_bad_objects; j++)
+			if (git_oid__cmp(id, &p->bad_object_sha1[j]) == 0)
+				break;
+
+		if (j < p->num_bad_objects)
+			continue;
+
+		offsets[i] = nth_packed_object_offset(p, pos);
+		found++;
+	}
+
+	/* make sure the packfile backing the index still exists on disk */
+	if (found && p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_pack_unique_prefix_len(
+		size_t *out,
+		struct git_pack_file *p,
+		const git_oid *id)
+{
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
+	unsigned hi, lo, stride;
+	int error;
+
+	assert(out && p && id);
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	level1_ofs = p->index_map.data;
+	index = p->index_map.data;
+
+	if (p->index_version > 1) {
+		level1_ofs += 2;
+		index += 8;
+	}
+
+	index += 4 * 256;
+	hi = ntohl(level1_ofs[(int)id->id[0]]);
+	lo = ((id->id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)id->id[0] - 1]));
+
+	if (p->index_version > 1) {
+		stride = 20;
+	} else {
+		stride = 24;
+		index += 4;
+	}
+
+	*out = sha1_unique_prefix_len(index, stride, lo, hi, p->num_objects, id->id);
+	return 0;
+}
@@ -55,12 +55,6 @@ struct git_pack_idx_header {
 	uint32_t idx_version;
 };
 
-typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
-	git_atomic refcount;
-	git_rawobj raw;
-} git_pack_cache_entry;
-
 struct pack_chain_elem {
 	git_off_t base_key;
 	git_off_t offset;
@@ -73,17 +67,6 @@ typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 #include "offmap.h"
 #include "oidmap.h"
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
-#define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
-
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
-	git_offmap *entries;
-} git_pack_cache;
-
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -100,7 +83,7 @@ struct git_pack_file {
 	git_oidmap *idx_cache;
 	git_oid **oids;
 
-	git_pack_cache bases; /* delta base cache */
+	unsigned int cache_id; /* the key of its bases in the delta base cache */
 
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[GIT_FLEX_ARRAY]; /* more */
@@ -150,6 +133,36 @@ int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p,
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
 void git_packfile_stream_free(git_packfile_stream *obj);
 
+/*
+ * A stream over the contents of an object, which only ever holds a
+ * bounded part of it in memory. Deltified objects are applied on their
+ * base as they are read; a base of `git_packfile__spill_threshold` bytes
+ * or more is itself streamed into a temporary file at `spill_path` and
+ * mapped, rather than read into memory. Without a `spill_path`, or if
+ * the file can't be created, bases are read into memory.
+ */
+#define GIT_PACK_SPILL_THRESHOLD (16 * 1024 * 1024)
+
+extern size_t git_packfile__spill_threshold;
+
+typedef struct git_packfile_object_stream git_packfile_object_stream;
+
+/* The stream holds a reference on `p` until it is freed */
+int git_packfile_object_stream_open(
+		git_packfile_object_stream **out,
+		struct git_pack_file *p,
+		git_off_t offset,
+		const char *spill_path);
+
+/* The size of the object */
+size_t git_packfile_object_stream_size(git_packfile_object_stream *s);
+
+/* Returns the number of bytes read, 0 at the end of the object */
+ssize_t git_packfile_object_stream_read(
+		git_packfile_object_stream *s, void *buffer, size_t len);
+
+void git_packfile_object_stream_free(git_packfile_object_stream *s);
+
 git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 		git_off_t *curpos, git_otype type,
 		git_off_t delta_obj_offset);
@@ -162,9 +175,92 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+
+/*
+ * Find the offsets of several objects in a pack at once. `ids` must be
+ * sorted, as each lookup only searches the part of the index after
+ * the previous one. The offset of an object which is not in the pack
+ * is set to -1.
+ */
+int git_pack_entry_find_many(
+		git_off_t *offsets,
+		struct git_pack_file *p,
+		const git_oid **ids,
+		size_t count);
+
+/*
+ * The number of hex digits of `id` needed to tell it apart from every
+ * other object in the pack, whether or not the pack holds `id` itself.
+ */
+int git_pack_unique_prefix_len(
+		size_t *out,
+		struct git_pack_file *p,
+		const git_oid *id);
+
+int git_pack_entry_from_offset(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		git_odb_foreach_cb cb,
 		void *data);
 
+/*
+ * Callback used by `git_pack_foreach_entry_offset`, called once for
+ * every object in the index, in index (i.e. object name) order.
+ */
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/* The number of objects in the pack, as recorded in its index. */
+int git_pack_object_count(uint32_t *out, struct git_pack_file *p);
+
+/* The name of the `n`th object in the index of the pack. */
+int git_pack_nth_oid(git_oid *out, struct git_pack_file *p, uint32_t n);
+
+/*
+ * The CRC32 of the `n`th object in the index of the pack, as stored in
+ * the index. Returns GIT_ENOTFOUND for version 1 indexes, which don't
+ * record it.
+ */
+int git_pack_nth_crc(uint32_t *out, struct git_pack_file *p, uint32_t n);
+
+/*
+ * The objects of a pack ordered by their offset, which tells where each
+ * object ends and which object starts at a given offset.
+ */
+typedef struct {
+	git_off_t offset;
+	uint32_t nth; /* position in the index */
+} git_pack_revindex_entry;
+
+typedef struct {
+	struct git_pack_file *p;
+	git_pack_revindex_entry *entries;
+	uint32_t count;
+} git_pack_revindex;
+
+int git_pack_revindex_init(git_pack_revindex *out, struct git_pack_file *p);
+
+void git_pack_revindex_free(git_pack_revindex *revindex);
+
+/*
+ * Find the object starting at `offset`, and the offset where it ends.
+ * Returns GIT_ENOTFOUND if no object starts there.
+ */
+int git_pack_revindex_find(
+		const git_pack_revindex_entry **out,
+		git_off_t *end_offset,
+		const git_pack_revindex *revindex,
+		git_off_t offset);
+
 #endif
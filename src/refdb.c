@@ -222,6 +222,121 @@ int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name)
 	return 0;
 }
 
+/*
+ * For backends without a reflog iterator, the reflog is read whole and
+ * its entries handed out one by one.
+ */
+typedef struct {
+	git_reflog_iterator parent;
+	git_reflog *reflog;
+	size_t idx;
+} refdb_reflog_iter;
+
+static int refdb_reflog_iter_byindex(
+	const git_reflog_entry **out, git_reflog_iterator *_iter, size_t idx)
+{
+	refdb_reflog_iter *iter = (refdb_reflog_iter *)_iter;
+
+	if ((*out = git_reflog_entry_byindex(iter->reflog, idx)) == NULL) {
+		giterr_set(GITERR_REFERENCE, "No reflog entry at index %"PRIuZ, idx);
+		return GIT_ENOTFOUND;
+	}
+
+	iter->idx = idx + 1;
+	return 0;
+}
+
+static int refdb_reflog_iter_next(const git_reflog_entry **out, git_reflog_iterator *_iter)
+{
+	refdb_reflog_iter *iter = (refdb_reflog_iter *)_iter;
+
+	if ((*out = git_reflog_entry_byindex(iter->reflog, iter->idx)) == NULL)
+		return GIT_ITEROVER;
+
+	iter->idx++;
+	return 0;
+}
+
+static void refdb_reflog_iter_free(git_reflog_iterator *_iter)
+{
+	refdb_reflog_iter *iter = (refdb_reflog_iter *)_iter;
+
+	git_reflog_free(iter->reflog);
+	git__free(iter);
+}
+
+int git_refdb_reflog_iterator(git_reflog_iterator **out, git_refdb *db, const char *name)
+{
+	refdb_reflog_iter *iter;
+	int error;
+
+	assert(out && db && db->backend && name);
+
+	if (db->backend->reflog_iterator)
+		return db->backend->reflog_iterator(out, db->backend, name);
+
+	iter = git__calloc(1, sizeof(refdb_reflog_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	if ((error = git_refdb_reflog_read(&iter->reflog, db, name)) < 0) {
+		git__free(iter);
+		return error;
+	}
+
+	iter->parent.next = refdb_reflog_iter_next;
+	iter->parent.entry_byindex = refdb_reflog_iter_byindex;
+	iter->parent.free = refdb_reflog_iter_free;
+
+	*out = &iter->parent;
+	return 0;
+}
+
+static bool reflog_entry_expired(
+	const git_reflog_entry *entry, size_t idx, const git_reflog_expire_options *opts)
+{
+	if (opts->max_entries && idx >= opts->max_entries)
+		return true;
+
+	return opts->expire_time && entry->committer->when.time < opts->expire_time;
+}
+
+int git_refdb_reflog_expire(
+	size_t *removed, git_refdb *db, const char *name, const git_reflog_expire_options *opts)
+{
+	git_reflog *reflog;
+	size_t i, count = 0;
+	int error;
+
+	assert(db && db->backend && name && opts);
+
+	if (removed)
+		*removed = 0;
+
+	if (db->backend->reflog_expire)
+		return db->backend->reflog_expire(removed, db->backend, name, opts);
+
+	if ((error = git_refdb_reflog_read(&reflog, db, name)) < 0)
+		return error;
+
+	/* from the oldest entry, so that the indices stay valid */
+	for (i = git_reflog_entrycount(reflog); i > 0 && !error; i--) {
+		if (!reflog_entry_expired(git_reflog_entry_byindex(reflog, i - 1), i - 1, opts))
+			continue;
+
+		if (!(error = git_reflog_drop(reflog, i - 1, false)))
+			count++;
+	}
+
+	if (!error && count)
+		error = git_reflog_write(reflog);
+
+	if (!error && removed)
+		*removed = count;
+
+	git_reflog_free(reflog);
+	return error;
+}
+
 int git_refdb_has_log(git_refdb *db, const char *refname)
 {
 	assert(db && refname);
@@ -8,6 +8,7 @@
 #define INCLUDE_refdb_h__
 
 #include "git2/refdb.h"
+#include "git2/reflog.h"
 #include "repository.h"
 
 struct git_refdb {
@@ -47,6 +48,8 @@ int git_refdb_delete(git_refdb *refdb, const char *ref_name, const git_oid *old_
 
 int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name);
 int git_refdb_reflog_write(git_reflog *reflog);
+int git_refdb_reflog_iterator(git_reflog_iterator **out, git_refdb *db, const char *name);
+int git_refdb_reflog_expire(size_t *removed, git_refdb *db, const char *name, const git_reflog_expire_options *opts);
 
 int git_refdb_has_log(git_refdb *db, const char *refname);
 int git_refdb_ensure_log(git_refdb *refdb, const char *refname);
@@ -36,6 +36,7 @@ enum {
 	PACKREF_WAS_LOOSE = 2,
 	PACKREF_CANNOT_PEEL = 4,
 	PACKREF_SHADOWED = 8,
+	PACKREF_DELETED = 16,
 };
 
 enum {
@@ -51,6 +52,50 @@ struct packref {
 	char name[GIT_FLEX_ARRAY];
 };
 
+/*
+ * A `packed-refs` file whose header has the `sorted` trait is not parsed
+ * into the refcache to be read: it is mapped as it is, and lookups and
+ * iterations binary search its records. Only writing to the file loads
+ * all of its references into the refcache.
+ */
+typedef struct {
+	git_refcount rc;
+	git_map map;
+	git_buf buf;
+	const char *start; /* the first record */
+	const char *end;
+} packed_snapshot;
+
+/*
+ * The updates of a transaction, which are applied when it is committed:
+ * `packed-refs` is rewritten once for all the references which are
+ * deleted or written into it, and the new reflog entries are appended
+ * once per file. The loose references stay locked until then.
+ */
+typedef struct {
+	git_buf log;
+	char path[GIT_FLEX_ARRAY];
+} batch_reflog;
+
+typedef struct {
+	git_vector held; /* the loose locks, released after the rewrite */
+	git_vector loose; /* the loose locks to commit, with their new contents */
+	git_vector updated; /* packrefs to write into packed-refs */
+	git_vector deleted; /* names of the references to delete */
+	git_vector reflogs; /* batch_reflogs, in the order of creation */
+	git_strmap *reflog_paths;
+
+	/* the branch HEAD points to, for the reflog of HEAD */
+	git_buf head_branch;
+	bool head_resolved;
+} refdb_fs_batch;
+
+/* A reference locked by a transaction, and the batch its update goes to */
+typedef struct {
+	git_filebuf file;
+	refdb_fs_batch *batch;
+} refdb_fs_lock;
+
 typedef struct refdb_fs_backend {
 	git_refdb_backend parent;
 
@@ -61,6 +106,10 @@ typedef struct refdb_fs_backend {
 	int peeling_mode;
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
+
+	git_mutex snapshot_lock;
+	packed_snapshot *snapshot; /* NULL unless the file is sorted */
+	git_futils_filestamp snapshot_stamp;
 } refdb_fs_backend;
 
 static int packref_cmp(const void *a_, const void *b_)
@@ -192,6 +241,271 @@ parse_failed:
 	return -1;
 }
 
+static void packed_snapshot_free(packed_snapshot *snapshot)
+{
+	if (snapshot->map.data)
+		git_futils_mmap_free(&snapshot->map);
+
+	git_buf_free(&snapshot->buf);
+	git__free(snapshot);
+}
+
+static void packed_snapshot_release(packed_snapshot *snapshot)
+{
+	if (snapshot)
+		GIT_REFCOUNT_DEC(snapshot, packed_snapshot_free);
+}
+
+/* Find where the records start, if the header says they are sorted */
+static const char *packed_sorted_records(const char *data, size_t size)
+{
+	static const char *traits_header = "# pack-refs with: ";
+	static const char *sorted_trait = " sorted ";
+	size_t header_len = strlen(traits_header), trait_len = strlen(sorted_trait);
+	const char *end = data + size, *eol, *scan;
+
+	if (size < header_len || memcmp(data, traits_header, header_len) != 0 ||
+		end[-1] != '\n')
+		return NULL;
+
+	eol = memchr(data, '\n', size);
+
+	/* leave files with CRLF line endings to the full parser */
+	if (eol[-1] == '\r')
+		return NULL;
+
+	for (scan = data + header_len - 1; scan + trait_len <= eol; scan++) {
+		if (memcmp(scan, sorted_trait, trait_len) == 0)
+			break;
+	}
+
+	if (scan + trait_len > eol)
+		return NULL;
+
+	for (scan = eol + 1; scan < end && *scan == '#'; )
+		scan = (const char *)memchr(scan, '\n', end - scan) + 1;
+
+	return scan;
+}
+
+/*
+ * Load the snapshot of the `packed-refs` file at `path`. If the file is
+ * not sorted, there is no snapshot.
+ */
+static int packed_snapshot_load(
+	packed_snapshot **out, git_futils_filestamp *stamp, const char *path)
+{
+	packed_snapshot *snapshot;
+	const char *data = NULL;
+	struct stat st;
+	git_file fd;
+	int error = 0;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || !git__is_sizet(st.st_size)) {
+		giterr_set(GITERR_OS, "Failed to stat '%s'", path);
+		p_close(fd);
+		return -1;
+	}
+
+	git_futils_filestamp_set_from_stat(stamp, &st);
+
+	/* it may be rewritten again within this second; never match it */
+	if (st.st_mtime >= time(NULL))
+		stamp->mtime = -1;
+
+	if (!st.st_size) {
+		p_close(fd);
+		return 0;
+	}
+
+	snapshot = git__calloc(1, sizeof(packed_snapshot));
+	if (!snapshot) {
+		p_close(fd);
+		return -1;
+	}
+
+#ifdef GIT_WIN32
+	/* a mapped file could not be replaced by the next writer */
+	if (!(error = git_futils_readbuffer_fd(&snapshot->buf, fd, (size_t)st.st_size)))
+		data = snapshot->buf.ptr;
+#else
+	if (!(error = git_futils_mmap_ro(&snapshot->map, fd, 0, (size_t)st.st_size)))
+		data = snapshot->map.data;
+#endif
+
+	p_close(fd);
+
+	if (error < 0 ||
+		!(snapshot->start = packed_sorted_records(data, (size_t)st.st_size))) {
+		packed_snapshot_free(snapshot);
+		return error;
+	}
+
+	snapshot->end = data + st.st_size;
+	GIT_REFCOUNT_INC(snapshot);
+
+	*out = snapshot;
+	return 0;
+}
+
+/*
+ * Get the snapshot of the current `packed-refs` file. There is none if
+ * the file doesn't exist or is not sorted, and the refcache has to be
+ * used instead.
+ */
+static int packed_snapshot_get(packed_snapshot **out, refdb_fs_backend *backend)
+{
+	const char *path;
+	packed_snapshot *snapshot;
+	int error;
+
+	*out = NULL;
+
+	if (!backend->path)
+		return 0;
+
+	path = git_sortedcache_path(backend->refcache);
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock packed references");
+		return -1;
+	}
+
+	error = git_futils_filestamp_check(&backend->snapshot_stamp, path);
+
+	if (error > 0) {
+		packed_snapshot_release(backend->snapshot);
+		backend->snapshot = NULL;
+
+		if ((error = packed_snapshot_load(
+				&snapshot, &backend->snapshot_stamp, path)) == 0)
+			backend->snapshot = snapshot;
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		packed_snapshot_release(backend->snapshot);
+		backend->snapshot = NULL;
+		giterr_clear();
+		error = 0;
+	}
+
+	if (error < 0)
+		git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+	else if ((*out = backend->snapshot) != NULL)
+		GIT_REFCOUNT_INC(*out);
+
+	git_mutex_unlock(&backend->snapshot_lock);
+	return error;
+}
+
+typedef struct {
+	git_oid oid;
+	git_oid peel;
+	const char *name; /* not NUL-terminated */
+	size_t name_len;
+	const char *next; /* the start of the next record */
+} packed_record;
+
+/* Parse "<OID> <refname>\n" and the optional "^<OID>\n" */
+static int packed_record_parse(packed_record *out, const char *rec, const char *end)
+{
+	const char *eol;
+
+	if (end - rec < GIT_OID_HEXSZ + 2 || rec[GIT_OID_HEXSZ] != ' ' ||
+		git_oid_fromstrn(&out->oid, rec, GIT_OID_HEXSZ) < 0)
+		goto corrupted;
+
+	/* the file is known to end with a newline */
+	out->name = rec + GIT_OID_HEXSZ + 1;
+	eol = memchr(out->name, '\n', end - out->name);
+	out->name_len = eol - out->name;
+	out->next = eol + 1;
+
+	memset(&out->peel, 0, sizeof(git_oid));
+
+	if (out->next < end && *out->next == '^') {
+		if (end - out->next < GIT_OID_HEXSZ + 2 ||
+			out->next[GIT_OID_HEXSZ + 1] != '\n' ||
+			git_oid_fromstrn(&out->peel, out->next + 1, GIT_OID_HEXSZ) < 0)
+			goto corrupted;
+
+		out->next += GIT_OID_HEXSZ + 2;
+	}
+
+	if (!out->name_len)
+		goto corrupted;
+
+	return 0;
+
+corrupted:
+	giterr_set(GITERR_REFERENCE, "Corrupted packed references file");
+	return -1;
+}
+
+static int packed_record_cmp(const packed_record *rec, const char *refname)
+{
+	size_t len = strlen(refname);
+	int cmp = memcmp(rec->name, refname, min(rec->name_len, len));
+
+	if (cmp)
+		return cmp;
+
+	return (rec->name_len < len) ? -1 : (rec->name_len > len);
+}
+
+/* Back up from anywhere in a record to its start */
+static const char *packed_record_start(const char *start, const char *p)
+{
+	while (p > start && (p[-1] != '\n' || *p == '^'))
+		p--;
+
+	return p;
+}
+
+/*
+ * Find the record of `refname`. If there is none, `out` is set to where
+ * it would be, which is also where the names starting with it start.
+ */
+static int packed_snapshot_find(
+	const char **out, bool *found, packed_snapshot *snapshot, const char *refname)
+{
+	const char *lo = snapshot->start, *hi = snapshot->end;
+	packed_record rec;
+	int cmp;
+
+	*found = false;
+
+	while (lo < hi) {
+		const char *rec_start = packed_record_start(lo, lo + (hi - lo) / 2);
+
+		if (packed_record_parse(&rec, rec_start, snapshot->end) < 0)
+			return -1;
+
+		if ((cmp = packed_record_cmp(&rec, refname)) < 0) {
+			lo = rec.next;
+		} else if (cmp > 0) {
+			hi = rec_start;
+		} else {
+			*out = rec_start;
+			*found = true;
+			return 0;
+		}
+	}
+
+	*out = lo;
+	return 0;
+}
+
+static bool packed_record_has_prefix(const packed_record *rec, const char *prefix, size_t len)
+{
+	return rec->name_len >= len && memcmp(rec->name, prefix, len) == 0;
+}
+
 static int loose_parse_oid(
 	git_oid *oid, const char *filename, git_buf *file_content)
 {
@@ -324,17 +638,37 @@ static int refdb_fs_backend__exists(
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
 	git_buf ref_path = GIT_BUF_INIT;
+	packed_snapshot *snapshot;
+	const char *pos;
+	bool found;
+	int error;
 
 	assert(backend);
 
-	if (packed_reload(backend) < 0 ||
-		git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
+	if (git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
 		return -1;
 
-	*exists = git_path_isfile(ref_path.ptr) ||
-		(git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
-
+	*exists = git_path_isfile(ref_path.ptr);
 	git_buf_free(&ref_path);
+
+	if (*exists)
+		return 0;
+
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		if (!(error = packed_snapshot_find(&pos, &found, snapshot, ref_name)))
+			*exists = found;
+
+		packed_snapshot_release(snapshot);
+		return error;
+	}
+
+	if (packed_reload(backend) < 0)
+		return -1;
+
+	*exists = (git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
 	return 0;
 }
 
@@ -399,6 +733,29 @@ static int ref_error_notfound(const char *name)
 	return GIT_ENOTFOUND;
 }
 
+static int packed_snapshot_lookup(
+	git_reference **out, packed_snapshot *snapshot, const char *ref_name)
+{
+	packed_record rec;
+	const char *pos;
+	bool found;
+	int error;
+
+	if ((error = packed_snapshot_find(&pos, &found, snapshot, ref_name)) < 0)
+		return error;
+
+	if (!found)
+		return ref_error_notfound(ref_name);
+
+	if ((error = packed_record_parse(&rec, pos, snapshot->end)) < 0)
+		return error;
+
+	*out = git_reference__alloc(ref_name, &rec.oid, &rec.peel);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
 static int packed_lookup(
 	git_reference **out,
 	refdb_fs_backend *backend,
@@ -406,6 +763,16 @@ static int packed_lookup(
 {
 	int error = 0;
 	struct packref *entry;
+	packed_snapshot *snapshot;
+
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		error = packed_snapshot_lookup(out, snapshot, ref_name);
+		packed_snapshot_release(snapshot);
+		return error;
+	}
 
 	if (packed_reload(backend) < 0)
 		return -1;
@@ -453,16 +820,59 @@ static int refdb_fs_backend__lookup(
 typedef struct {
 	git_reference_iterator parent;
 
+	/* NULL when the prefix is all there is to match */
 	char *glob;
 
+	/* the literal start of the glob; all the names start with it */
+	char *prefix;
+	size_t prefix_len;
+
 	git_pool pool;
 	git_vector loose;
 
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/* iterating over a sorted packed-refs file */
+	packed_snapshot *snapshot;
+	const char *snapshot_pos;
+	git_buf name;
 } refdb_fs_iter;
 
+static bool iter_matches(refdb_fs_iter *iter, const char *name)
+{
+	if (iter->prefix && git__prefixcmp(name, iter->prefix) != 0)
+		return false;
+
+	return !iter->glob || p_fnmatch(iter->glob, name, 0) == 0;
+}
+
+/*
+ * Take the literal start of the glob as the prefix which all the names
+ * have. A trailing `*` matches any name with the prefix, so a glob
+ * which is only a prefix and a star does not need to be matched at all.
+ */
+static int iter_set_glob(refdb_fs_iter *iter, const char *glob)
+{
+	size_t len = strcspn(glob, "*?[\\");
+
+	if (len) {
+		if ((iter->prefix = git_pool_strndup(&iter->pool, glob, len)) == NULL)
+			return -1;
+
+		iter->prefix_len = len;
+	}
+
+	if (!strcmp(glob + len, "*"))
+		return 0;
+
+	if ((iter->glob = git_pool_strdup(&iter->pool, glob)) == NULL)
+		return -1;
+
+	return 0;
+}
+
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 {
 	refdb_fs_iter *iter = (refdb_fs_iter *) _iter;
@@ -470,39 +880,132 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	git_vector_free(&iter->loose);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_snapshot_release(iter->snapshot);
+	git_buf_free(&iter->name);
 	git__free(iter);
 }
 
+/*
+ * Move to the next reference of the snapshot which matches the glob and
+ * is not shadowed by a loose one, and put its name in `iter->name`.
+ */
+static int iter_snapshot_next(packed_record *rec, refdb_fs_iter *iter)
+{
+	packed_snapshot *snapshot = iter->snapshot;
+	size_t pos;
+
+	while (iter->snapshot_pos < snapshot->end) {
+		if (packed_record_parse(rec, iter->snapshot_pos, snapshot->end) < 0)
+			return -1;
+
+		iter->snapshot_pos = rec->next;
+
+		/* the names with the prefix of the glob are all together */
+		if (iter->prefix && !packed_record_has_prefix(rec, iter->prefix, iter->prefix_len)) {
+			iter->snapshot_pos = snapshot->end;
+			break;
+		}
+
+		git_buf_clear(&iter->name);
+		if (git_buf_put(&iter->name, rec->name, rec->name_len) < 0)
+			return -1;
+
+		if (git_vector_bsearch(&pos, &iter->loose, iter->name.ptr) == 0)
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
+static int iter_snapshot_init(refdb_fs_iter *iter, packed_snapshot *snapshot)
+{
+	bool found;
+
+	iter->snapshot = snapshot;
+	iter->snapshot_pos = snapshot->start;
+
+	if (!iter->prefix)
+		return 0;
+
+	return packed_snapshot_find(&iter->snapshot_pos, &found, snapshot, iter->prefix);
+}
+
+/* Copy the refcache and skip to the names with the prefix */
+static int iter_cache_init(refdb_fs_iter *iter, refdb_fs_backend *backend)
+{
+	int error;
+
+	if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+		return error;
+
+	if (iter->prefix &&
+		(error = git_sortedcache_lookup_index(&iter->packed_pos, iter->cache, iter->prefix)) == GIT_ENOTFOUND)
+		error = 0;
+
+	return error;
+}
+
+/*
+ * The loose references are only looked for in the deepest directory
+ * which the prefix names, or nowhere if it is not below `refs/`.
+ */
+static int iter_loose_dir(git_buf *out, refdb_fs_iter *iter)
+{
+	const char *slash;
+
+	if (!iter->prefix || !git__prefixcmp(GIT_REFS_DIR, iter->prefix))
+		return git_buf_sets(out, GIT_REFS_DIR);
+
+	if (git__prefixcmp(iter->prefix, GIT_REFS_DIR) != 0)
+		return GIT_ENOTFOUND;
+
+	slash = strrchr(iter->prefix, '/');
+	return git_buf_set(out, iter->prefix, slash - iter->prefix + 1);
+}
+
 static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 {
 	int error = 0;
-	git_buf path = GIT_BUF_INIT;
+	git_buf dir = GIT_BUF_INIT, path = GIT_BUF_INIT;
 	git_iterator *fsit = NULL;
 	const git_index_entry *entry = NULL;
 
 	if (!backend->path) /* do nothing if no path for loose refs */
 		return 0;
 
-	if ((error = git_buf_printf(&path, "%s/refs", backend->path)) < 0 ||
-		(error = git_iterator_for_filesystem(
-			&fsit, path.ptr, backend->iterator_flags, NULL, NULL)) < 0) {
-		git_buf_free(&path);
-		return error;
+	if ((error = iter_loose_dir(&dir, iter)) < 0) {
+		git_buf_free(&dir);
+		return (error == GIT_ENOTFOUND) ? 0 : error;
 	}
 
-	error = git_buf_sets(&path, GIT_REFS_DIR);
+	if ((error = git_buf_joinpath(&path, backend->path, dir.ptr)) < 0)
+		goto done;
+
+	/* the directory the prefix names need not be there */
+	if (!git_path_isdir(path.ptr))
+		goto done;
+
+	if ((error = git_iterator_for_filesystem(
+			&fsit, path.ptr, backend->iterator_flags, NULL, NULL)) < 0)
+		goto done;
+
+	error = git_buf_set(&path, dir.ptr, dir.size);
 
 	while (!error && !git_iterator_advance(&entry, fsit)) {
 		const char *ref_name;
 		struct packref *ref;
 		char *ref_dup;
 
-		git_buf_truncate(&path, strlen(GIT_REFS_DIR));
+		git_buf_truncate(&path, dir.size);
 		git_buf_puts(&path, entry->path);
 		ref_name = git_buf_cstr(&path);
 
 		if (git__suffixcmp(ref_name, ".lock") == 0 ||
-			(iter->glob && p_fnmatch(iter->glob, ref_name, 0) != 0))
+			!iter_matches(iter, ref_name))
 			continue;
 
 		git_sortedcache_rlock(backend->refcache);
@@ -518,7 +1021,9 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			error = git_vector_insert(&iter->loose, ref_dup);
 	}
 
+done:
 	git_iterator_free(fsit);
+	git_buf_free(&dir);
 	git_buf_free(&path);
 
 	return error;
@@ -541,17 +1046,32 @@ static int refdb_fs_backend__iterator_next(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (iter->snapshot) {
+		packed_record rec;
+
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
 			return error;
+
+		*out = git_reference__alloc(iter->name.ptr, &rec.oid, &rec.peel);
+		GITERR_CHECK_ALLOC(*out);
+		return 0;
 	}
 
+	if (!iter->cache && (error = iter_cache_init(iter, backend)) < 0)
+		return error;
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		/* the names with the prefix are all together */
+		if (iter->prefix && git__prefixcmp(ref->name, iter->prefix) != 0) {
+			iter->packed_pos = git_sortedcache_entrycount(iter->cache);
+			break;
+		}
+
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -584,17 +1104,33 @@ static int refdb_fs_backend__iterator_next_name(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (iter->snapshot) {
+		packed_record rec;
+
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
 			return error;
+
+		/* the names are kept as long as the iterator, like loose ones */
+		*out = git_pool_strdup(&iter->pool, iter->name.ptr);
+		GITERR_CHECK_ALLOC(*out);
+		return 0;
 	}
 
+	if (!iter->cache && (error = iter_cache_init(iter, backend)) < 0)
+		return error;
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		/* the names with the prefix are all together */
+		if (iter->prefix && git__prefixcmp(ref->name, iter->prefix) != 0) {
+			iter->packed_pos = git_sortedcache_entrycount(iter->cache);
+			break;
+		}
+
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -613,34 +1149,48 @@ static int refdb_fs_backend__iterator(
 {
 	refdb_fs_iter *iter;
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	packed_snapshot *snapshot;
 
 	assert(backend);
 
-	if (packed_reload(backend) < 0)
+	if (packed_snapshot_get(&snapshot, backend) < 0 ||
+		(!snapshot && packed_reload(backend) < 0))
 		return -1;
 
 	iter = git__calloc(1, sizeof(refdb_fs_iter));
-	GITERR_CHECK_ALLOC(iter);
+	if (!iter) {
+		packed_snapshot_release(snapshot);
+		return -1;
+	}
 
 	if (git_pool_init(&iter->pool, 1, 0) < 0 ||
-		git_vector_init(&iter->loose, 8, NULL) < 0)
+		git_vector_init(&iter->loose, 8, git__strcmp_cb) < 0)
 		goto fail;
 
-	if (glob != NULL &&
-		(iter->glob = git_pool_strdup(&iter->pool, glob)) == NULL)
+	if (glob != NULL && iter_set_glob(iter, glob) < 0)
 		goto fail;
 
 	iter->parent.next = refdb_fs_backend__iterator_next;
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
 	iter->parent.free = refdb_fs_backend__iterator_free;
 
+	if (snapshot) {
+		if (iter_snapshot_init(iter, snapshot) < 0)
+			goto fail;
+		snapshot = NULL;
+	}
+
 	if (iter_load_loose_paths(backend, iter) < 0)
 		goto fail;
 
+	/* to find the packed references which are shadowed */
+	git_vector_sort(&iter->loose);
+
 	*out = (git_reference_iterator *)iter;
 	return 0;
 
 fail:
+	packed_snapshot_release(snapshot);
 	refdb_fs_backend__iterator_free((git_reference_iterator *)iter);
 	return -1;
 }
@@ -662,15 +1212,68 @@ static bool ref_is_available(
 	return true;
 }
 
+/*
+ * Whether a packed reference is a directory of `new_ref`, or below it;
+ * only the names with these prefixes need to be looked at.
+ */
+static int packed_snapshot_collides(
+	bool *out, packed_snapshot *snapshot, const char *new_ref, const char *old_ref)
+{
+	git_buf name = GIT_BUF_INIT;
+	packed_record rec;
+	const char *pos, *slash;
+	bool found;
+	int error = 0;
+
+	*out = false;
+
+	for (slash = strchr(new_ref, '/'); slash && !*out; slash = strchr(slash + 1, '/')) {
+		git_buf_clear(&name);
+		if ((error = git_buf_put(&name, new_ref, slash - new_ref)) < 0 ||
+			(error = packed_snapshot_find(&pos, &found, snapshot, name.ptr)) < 0)
+			goto done;
+
+		*out = found && (!old_ref || strcmp(old_ref, name.ptr) != 0);
+	}
+
+	if (*out)
+		goto done;
+
+	git_buf_clear(&name);
+	if ((error = git_buf_printf(&name, "%s/", new_ref)) < 0 ||
+		(error = packed_snapshot_find(&pos, &found, snapshot, name.ptr)) < 0)
+		goto done;
+
+	while (pos < snapshot->end && !*out) {
+		if ((error = packed_record_parse(&rec, pos, snapshot->end)) < 0)
+			goto done;
+
+		if (!packed_record_has_prefix(&rec, name.ptr, name.size))
+			break;
+
+		*out = !old_ref || strlen(old_ref) != rec.name_len ||
+			memcmp(old_ref, rec.name, rec.name_len) != 0;
+		pos = rec.next;
+	}
+
+done:
+	git_buf_free(&name);
+	return error;
+}
+
 static int reference_path_available(
 	refdb_fs_backend *backend,
 	const char *new_ref,
 	const char* old_ref,
 	int force)
 {
+	packed_snapshot *snapshot;
 	size_t i;
 
-	if (packed_reload(backend) < 0)
+	if (packed_snapshot_get(&snapshot, backend) < 0)
+		return -1;
+
+	if (!snapshot && packed_reload(backend) < 0)
 		return -1;
 
 	if (!force) {
@@ -681,6 +1284,7 @@ static int reference_path_available(
 			return -1;
 
 		if (exists) {
+			packed_snapshot_release(snapshot);
 			giterr_set(GITERR_REFERENCE,
 				"Failed to write reference '%s': a reference with "
 				"that name already exists.", new_ref);
@@ -688,6 +1292,21 @@ static int reference_path_available(
 		}
 	}
 
+	if (snapshot) {
+		bool collides;
+		int error = packed_snapshot_collides(&collides, snapshot, new_ref, old_ref);
+
+		packed_snapshot_release(snapshot);
+
+		if (!error && collides) {
+			giterr_set(GITERR_REFERENCE,
+				"Path to reference '%s' collides with existing one", new_ref);
+			error = -1;
+		}
+
+		return error;
+	}
+
 	git_sortedcache_rlock(backend->refcache);
 
 	for (i = 0; i < git_sortedcache_entrycount(backend->refcache); ++i) {
@@ -732,7 +1351,7 @@ static int loose_lock(git_filebuf *file, refdb_fs_backend *backend, const char *
         return error;
 }
 
-static int loose_commit(git_filebuf *file, const git_reference *ref)
+static void loose_write(git_filebuf *file, const git_reference *ref)
 {
 	assert(file && ref);
 
@@ -746,24 +1365,32 @@ static int loose_commit(git_filebuf *file, const git_reference *ref)
 	} else {
 		assert(0); /* don't let this happen */
 	}
+}
 
+static int loose_commit(git_filebuf *file, const git_reference *ref)
+{
+	loose_write(file, ref);
 	return git_filebuf_commit(file);
 }
 
 static int refdb_fs_backend__lock(void **out, git_refdb_backend *_backend, const char *refname)
 {
 	int error;
-	git_filebuf *lock;
+	refdb_fs_lock *lock;
 	refdb_fs_backend *backend = (refdb_fs_backend *) _backend;
 
-	lock = git__calloc(1, sizeof(git_filebuf));
+	/* the transaction passes its batch in */
+	assert(*out);
+
+	lock = git__calloc(1, sizeof(refdb_fs_lock));
 	GITERR_CHECK_ALLOC(lock);
 
-	if ((error = loose_lock(lock, backend, refname)) < 0) {
+	if ((error = loose_lock(&lock->file, backend, refname)) < 0) {
 		git__free(lock);
 		return error;
 	}
 
+	lock->batch = *out;
 	*out = lock;
 	return 0;
 }
@@ -778,29 +1405,6 @@ static int refdb_fs_backend__write_tail(
 	const git_oid *old_id,
 	const char *old_target);
 
-static int refdb_fs_backend__delete_tail(
-	git_refdb_backend *_backend,
-	git_filebuf *file,
-	const char *ref_name,
-	const git_oid *old_id, const char *old_target);
-
-static int refdb_fs_backend__unlock(git_refdb_backend *backend, void *payload, int success, int update_reflog,
-				    const git_reference *ref, const git_signature *sig, const char *message)
-{
-	git_filebuf *lock = (git_filebuf *) payload;
-	int error = 0;
-
-	if (success == 2)
-		error = refdb_fs_backend__delete_tail(backend, lock, ref->name, NULL, NULL);
-	else if (success)
-		error = refdb_fs_backend__write_tail(backend, ref, lock, update_reflog, sig, message, NULL, NULL);
-	else
-		git_filebuf_cleanup(lock);
-
-	git__free(lock);
-	return error;
-}
-
 /*
  * Find out what object this reference resolves to.
  *
@@ -907,6 +1511,9 @@ static int packed_remove_loose(refdb_fs_backend *backend)
 		if (git_buf_joinpath(&full_path, backend->path, ref->name) < 0)
 			return -1; /* critical; do not try to recover on oom */
 
+		/* a later rewrite must not remove a newer loose file */
+		ref->flags &= ~PACKREF_WAS_LOOSE;
+
 		if (git_path_exists(full_path.ptr) && p_unlink(full_path.ptr) < 0) {
 			if (failed)
 				continue;
@@ -985,7 +1592,8 @@ fail:
 	return -1;
 }
 
-static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message);
+static int reflog_append(refdb_fs_backend *backend, refdb_fs_batch *batch, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message);
+static int reflog_write_entries(const char *path, const git_buf *entries);
 static int has_reflog(git_repository *repo, const char *name);
 
 /* We only write if it's under heads/, remotes/ or notes/ or if it already has a log */
@@ -1067,26 +1675,18 @@ out:
  * check with HEAD only which should cover 99% of all usage
  * scenarios (even 100% of the default ones).
  */
-static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref, const git_signature *who, const char *message)
+static int head_branch_name(git_buf *out, refdb_fs_backend *backend)
 {
 	int error;
-	git_oid old_id = {{0}};
-	git_reference *tmp = NULL, *head = NULL, *peeled = NULL;
+	git_reference *tmp = NULL, *peeled = NULL;
 	const char *name;
 
-	if (ref->type == GIT_REF_SYMBOLIC)
-		return 0;
-
-	/* if we can't resolve, we use {0}*40 as old id */
-	git_reference_name_to_id(&old_id, backend->repo, ref->name);
+	git_buf_clear(out);
 
-	if ((error = git_reference_lookup(&head, backend->repo, GIT_HEAD_FILE)) < 0)
+	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
 		return error;
 
-	if (git_reference_type(head) == GIT_REF_OID)
-		goto cleanup;
-
-	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
+	if (git_reference_type(tmp) == GIT_REF_OID)
 		goto cleanup;
 
 	/* Go down the symref chain until we find the branch */
@@ -1108,14 +1708,53 @@ static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref
 		name = git_reference_name(tmp);
 	}
 
-	if (strcmp(name, ref->name))
+	error = git_buf_sets(out, name);
+
+cleanup:
+	git_reference_free(tmp);
+	return error;
+}
+
+/*
+ * In a batch, the branch HEAD points to is only looked up once, until a
+ * symbolic reference is written or a reference is deleted.
+ */
+static int maybe_append_head(
+	refdb_fs_backend *backend, refdb_fs_batch *batch,
+	const git_reference *ref, const git_signature *who, const char *message)
+{
+	int error = 0;
+	git_oid old_id = {{0}};
+	git_reference *head = NULL;
+	git_buf local = GIT_BUF_INIT, *name;
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		return 0;
+
+	name = batch ? &batch->head_branch : &local;
+
+	if (!batch || !batch->head_resolved) {
+		if ((error = head_branch_name(name, backend)) < 0)
+			goto cleanup;
+
+		if (batch)
+			batch->head_resolved = true;
+	}
+
+	if (strcmp(name->ptr, ref->name))
 		goto cleanup;
 
-	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message);
+	/* if we can't resolve, we use {0}*40 as old id */
+	git_reference_name_to_id(&old_id, backend->repo, ref->name);
+
+	if ((error = git_reference_lookup(&head, backend->repo, GIT_HEAD_FILE)) < 0)
+		goto cleanup;
+
+	error = reflog_append(backend, batch, head, &old_id, git_reference_target(ref), who, message);
 
 cleanup:
-	git_reference_free(tmp);
 	git_reference_free(head);
+	git_buf_free(&local);
 	return error;
 }
 
@@ -1145,28 +1784,31 @@ static int refdb_fs_backend__write(
 	return refdb_fs_backend__write_tail(_backend, ref, &file, true, who, message, old_id, old_target);
 }
 
-static int refdb_fs_backend__write_tail(
-	git_refdb_backend *_backend,
+/*
+ * Check the old value of a reference which is about to be written and
+ * write its reflog. Returns 1 if it already has the new value.
+ */
+static int write_prepare(
+	refdb_fs_backend *backend,
+	refdb_fs_batch *batch,
 	const git_reference *ref,
-	git_filebuf *file,
 	int update_reflog,
 	const git_signature *who,
 	const char *message,
 	const git_oid *old_id,
 	const char *old_target)
 {
-	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_refdb_backend *_backend = (git_refdb_backend *)backend;
 	int error = 0, cmp = 0, should_write;
 	const char *new_target = NULL;
 	const git_oid *new_id = NULL;
 
 	if ((error = cmp_old_ref(&cmp, _backend, ref->name, old_id, old_target)) < 0)
-		goto on_error;
+		return error;
 
 	if (cmp) {
 		giterr_set(GITERR_REFERENCE, "old reference value does not match");
-		error = GIT_EMODIFIED;
-		goto on_error;
+		return GIT_EMODIFIED;
 	}
 
 	if (ref->type == GIT_REF_SYMBOLIC)
@@ -1176,33 +1818,58 @@ static int refdb_fs_backend__write_tail(
 
 	error = cmp_old_ref(&cmp, _backend, ref->name, new_id, new_target);
 	if (error < 0 && error != GIT_ENOTFOUND)
-		goto on_error;
+		return error;
 
 	/* Don't update if we have the same value */
-	if (!error && !cmp) {
-		error = 0;
-		goto on_error; /* not really error */
-	}
+	if (!error && !cmp)
+		return 1;
+
+	if (batch && ref->type == GIT_REF_SYMBOLIC)
+		batch->head_resolved = false;
 
 	if (update_reflog) {
 		if ((error = should_write_reflog(&should_write, backend->repo, ref->name)) < 0)
-			goto on_error;
+			return error;
 
 		if (should_write) {
-			if ((error = reflog_append(backend, ref, NULL, NULL, who, message)) < 0)
-				goto on_error;
-			if ((error = maybe_append_head(backend, ref, who, message)) < 0)
-				goto on_error;
+			if ((error = reflog_append(backend, batch, ref, NULL, NULL, who, message)) < 0)
+				return error;
+			if ((error = maybe_append_head(backend, batch, ref, who, message)) < 0)
+				return error;
 		}
 	}
 
-	return loose_commit(file, ref);
+	return 0;
+}
 
-on_error:
-        git_filebuf_cleanup(file);
-        return error;
+static int refdb_fs_backend__write_tail(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	git_filebuf *file,
+	int update_reflog,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	int error;
+
+	if ((error = write_prepare(backend, NULL, ref, update_reflog,
+			who, message, old_id, old_target)) != 0) {
+		git_filebuf_cleanup(file);
+		return (error > 0) ? 0 : error;
+	}
+
+	return loose_commit(file, ref);
 }
 
+static int refdb_fs_backend__delete_tail(
+	git_refdb_backend *_backend,
+	git_filebuf *file,
+	const char *ref_name,
+	const git_oid *old_id, const char *old_target);
+
 static int refdb_fs_backend__delete(
 	git_refdb_backend *_backend,
 	const char *ref_name,
@@ -1228,6 +1895,7 @@ static int refdb_fs_backend__delete_tail(
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
 	git_buf loose_path = GIT_BUF_INIT;
+	packed_snapshot *snapshot;
 	size_t pack_pos;
 	int error = 0, cmp = 0;
 	bool loose_deleted = 0;
@@ -1251,35 +1919,383 @@ static int refdb_fs_backend__delete_tail(
 		loose_deleted = 1;
 	}
 
-	git_buf_free(&loose_path);
+	git_buf_free(&loose_path);
+
+	if (error != 0)
+		goto cleanup;
+
+	/* Without a packed reference there is no need to parse the whole file */
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		goto cleanup;
+
+	if (snapshot) {
+		const char *pos;
+		bool found;
+
+		error = packed_snapshot_find(&pos, &found, snapshot, ref_name);
+		packed_snapshot_release(snapshot);
+
+		if (error < 0)
+			goto cleanup;
+
+		if (!found) {
+			error = loose_deleted ? 0 : ref_error_notfound(ref_name);
+			goto cleanup;
+		}
+	}
+
+	if ((error = packed_reload(backend)) < 0)
+		goto cleanup;
+
+	/* If a packed reference exists, remove it from the packfile and repack */
+	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
+		goto cleanup;
+
+	if (!(error = git_sortedcache_lookup_index(
+			&pack_pos, backend->refcache, ref_name)))
+		error = git_sortedcache_remove(backend->refcache, pack_pos);
+
+	git_sortedcache_wunlock(backend->refcache);
+
+	if (error == GIT_ENOTFOUND) {
+		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
+		goto cleanup;
+	}
+
+	error = packed_write(backend);
+
+cleanup:
+	git_filebuf_cleanup(file);
+
+	return error;
+}
+
+static void batch_release_lock(refdb_fs_lock *lock)
+{
+	git_filebuf_cleanup(&lock->file);
+	git__free(lock);
+}
+
+static int batch_delete(
+	refdb_fs_backend *backend,
+	refdb_fs_batch *batch,
+	refdb_fs_lock *lock,
+	const char *ref_name)
+{
+	char *name;
+	int error, exists;
+
+	if ((error = refdb_fs_backend__exists(&exists, (git_refdb_backend *)backend, ref_name)) < 0)
+		goto on_error;
+
+	if (!exists) {
+		error = ref_error_notfound(ref_name);
+		goto on_error;
+	}
+
+	name = git__strdup(ref_name);
+	GITERR_CHECK_ALLOC(name);
+
+	if ((error = git_vector_insert(&batch->deleted, name)) < 0) {
+		git__free(name);
+		goto on_error;
+	}
+
+	if ((error = git_vector_insert(&batch->held, lock)) < 0)
+		goto on_error;
+
+	/* HEAD might have pointed to it */
+	batch->head_resolved = false;
+	return 0;
+
+on_error:
+	batch_release_lock(lock);
+	return error;
+}
+
+static int batch_write(
+	refdb_fs_backend *backend,
+	refdb_fs_batch *batch,
+	refdb_fs_lock *lock,
+	const git_reference *ref,
+	int packed,
+	int update_reflog,
+	const git_signature *who,
+	const char *message)
+{
+	struct packref *pack;
+	size_t namelen, alloclen;
+	int error;
+
+	if ((error = write_prepare(backend, batch, ref, update_reflog, who, message, NULL, NULL)) != 0) {
+		batch_release_lock(lock);
+		return (error > 0) ? 0 : error;
+	}
+
+	/* symbolic references cannot be packed; the loose file is committed
+	 * once the reflogs are written */
+	if (!packed || ref->type != GIT_REF_OID) {
+		loose_write(&lock->file, ref);
+
+		if ((error = git_vector_insert(&batch->loose, lock)) < 0)
+			batch_release_lock(lock);
+
+		return error;
+	}
+
+	namelen = strlen(ref->name);
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(struct packref), namelen);
+	GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+	pack = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(pack);
+
+	git_oid_cpy(&pack->oid, &ref->target.oid);
+	memcpy(pack->name, ref->name, namelen);
+
+	if ((error = git_vector_insert(&batch->updated, pack)) < 0) {
+		git__free(pack);
+		batch_release_lock(lock);
+		return error;
+	}
+
+	if ((error = git_vector_insert(&batch->held, lock)) < 0)
+		batch_release_lock(lock);
+
+	return error;
+}
+
+static int packref_is_deleted(void *item, void *payload)
+{
+	struct packref *ref = item;
+	GIT_UNUSED(payload);
+
+	return (ref->flags & PACKREF_DELETED) != 0;
+}
+
+/*
+ * Whether any of the references deleted by a batch is in `packed-refs`;
+ * a sorted one tells without being loaded.
+ */
+static int batch_deletes_packed(bool *out, refdb_fs_backend *backend, refdb_fs_batch *batch)
+{
+	packed_snapshot *snapshot;
+	const char *pos, *name;
+	bool found = false;
+	size_t i;
+	int error;
+
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		git_vector_foreach(&batch->deleted, i, name) {
+			if ((error = packed_snapshot_find(&pos, &found, snapshot, name)) < 0 || found)
+				break;
+		}
+
+		packed_snapshot_release(snapshot);
+
+		*out = found;
+		return error;
+	}
+
+	/* an unsorted one has to be loaded */
+	if ((error = packed_reload(backend)) < 0 ||
+		(error = git_sortedcache_rlock(backend->refcache)) < 0)
+		return error;
+
+	git_vector_foreach(&batch->deleted, i, name) {
+		if ((found = (git_sortedcache_lookup(backend->refcache, name) != NULL)))
+			break;
+	}
+
+	git_sortedcache_runlock(backend->refcache);
+
+	*out = found;
+	return 0;
+}
+
+/*
+ * Rewrite `packed-refs` once for all the references which a batch
+ * deletes or writes into it, then remove their loose files.
+ */
+static int batch_write_packed(refdb_fs_backend *backend, refdb_fs_batch *batch)
+{
+	struct packref *ref, *pack;
+	git_buf loose_path = GIT_BUF_INIT;
+	const char *name;
+	bool rewrite = batch->updated.length > 0;
+	size_t i;
+	int error = 0;
+
+	if (!rewrite && (error = batch_deletes_packed(&rewrite, backend, batch)) < 0)
+		return error;
+
+	if (rewrite) {
+		if ((error = packed_reload(backend)) < 0 ||
+			(error = git_sortedcache_wlock(backend->refcache)) < 0)
+			return error;
+
+		git_vector_foreach(&batch->deleted, i, name) {
+			if ((ref = git_sortedcache_lookup(backend->refcache, name)) != NULL)
+				ref->flags |= PACKREF_DELETED;
+		}
+
+		git_sortedcache_remove_matching(backend->refcache, packref_is_deleted, NULL);
+
+		git_vector_foreach(&batch->updated, i, pack) {
+			if ((error = git_sortedcache_upsert((void **)&ref, backend->refcache, pack->name)) < 0)
+				break;
+
+			/* the loose file is removed once the packed one is written */
+			git_oid_cpy(&ref->oid, &pack->oid);
+			ref->flags = PACKREF_WAS_LOOSE;
+		}
+
+		git_sortedcache_wunlock(backend->refcache);
+
+		if (error < 0 || (error = packed_write(backend)) < 0)
+			return error;
+	}
+
+	git_vector_foreach(&batch->deleted, i, name) {
+		if (git_buf_joinpath(&loose_path, backend->path, name) < 0) {
+			error = -1;
+			break;
+		}
+
+		if (git_path_isfile(loose_path.ptr) && p_unlink(loose_path.ptr) < 0 && !error) {
+			giterr_set(GITERR_OS, "Failed to remove loose reference '%s'", loose_path.ptr);
+			error = -1;
+		}
+	}
+
+	git_buf_free(&loose_path);
+	return error;
+}
+
+/* Release the locks of a batch and drop its updates */
+static void batch_clear(refdb_fs_batch *batch)
+{
+	batch_reflog *log;
+	struct packref *pack;
+	refdb_fs_lock *lock;
+	char *name;
+	size_t i;
+
+	git_vector_foreach(&batch->reflogs, i, log) {
+		git_buf_free(&log->log);
+		git__free(log);
+	}
+
+	git_vector_foreach(&batch->loose, i, lock)
+		batch_release_lock(lock);
+
+	git_vector_foreach(&batch->held, i, lock)
+		batch_release_lock(lock);
+
+	git_vector_foreach(&batch->updated, i, pack)
+		git__free(pack);
+
+	git_vector_foreach(&batch->deleted, i, name)
+		git__free(name);
+
+	git_vector_clear(&batch->held);
+	git_vector_clear(&batch->loose);
+	git_vector_clear(&batch->updated);
+	git_vector_clear(&batch->deleted);
+	git_vector_clear(&batch->reflogs);
+	git_strmap_clear(batch->reflog_paths);
+	batch->head_resolved = false;
+}
+
+static int refdb_fs_backend__transaction_begin(void **out, git_refdb_backend *_backend)
+{
+	refdb_fs_batch *batch;
+
+	GIT_UNUSED(_backend);
+
+	batch = git__calloc(1, sizeof(refdb_fs_batch));
+	GITERR_CHECK_ALLOC(batch);
+
+	git_buf_init(&batch->head_branch, 0);
+
+	if (git_strmap_alloc(&batch->reflog_paths) < 0) {
+		git__free(batch);
+		return -1;
+	}
+
+	*out = batch;
+	return 0;
+}
 
-	if (error != 0)
-		goto cleanup;
+/*
+ * Apply the updates collected while references were locked, and release
+ * their locks. The reflogs are written first, as they are for a single
+ * update.
+ */
+static int refdb_fs_backend__transaction_commit(git_refdb_backend *_backend, void *payload)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *) _backend;
+	refdb_fs_batch *batch = (refdb_fs_batch *) payload;
+	batch_reflog *log;
+	refdb_fs_lock *lock;
+	size_t i;
+	int error = 0;
 
-	if ((error = packed_reload(backend)) < 0)
-		goto cleanup;
+	git_vector_foreach(&batch->reflogs, i, log) {
+		if ((error = reflog_write_entries(log->path, &log->log)) < 0)
+			goto done;
+	}
 
-	/* If a packed reference exists, remove it from the packfile and repack */
-	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
-		goto cleanup;
+	git_vector_foreach(&batch->loose, i, lock) {
+		if ((error = git_filebuf_commit(&lock->file)) < 0)
+			goto done;
+	}
 
-	if (!(error = git_sortedcache_lookup_index(
-			&pack_pos, backend->refcache, ref_name)))
-		error = git_sortedcache_remove(backend->refcache, pack_pos);
+	if (batch->updated.length || batch->deleted.length)
+		error = batch_write_packed(backend, batch);
 
-	git_sortedcache_wunlock(backend->refcache);
+done:
+	batch_clear(batch);
+	return error;
+}
 
-	if (error == GIT_ENOTFOUND) {
-		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
-		goto cleanup;
-	}
+static void refdb_fs_backend__transaction_free(git_refdb_backend *_backend, void *payload)
+{
+	refdb_fs_batch *batch = (refdb_fs_batch *) payload;
+
+	GIT_UNUSED(_backend);
+
+	batch_clear(batch);
+	git_vector_free(&batch->held);
+	git_vector_free(&batch->loose);
+	git_vector_free(&batch->updated);
+	git_vector_free(&batch->deleted);
+	git_vector_free(&batch->reflogs);
+	git_strmap_free(batch->reflog_paths);
+	git_buf_free(&batch->head_branch);
+	git__free(batch);
+}
 
-	error = packed_write(backend);
+/*
+ * `success` is 2 for a deletion and 3 to write a direct reference
+ * into `packed-refs` instead of as a loose file. The update goes into
+ * the batch of the transaction.
+ */
+static int refdb_fs_backend__unlock(git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+				    const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *) _backend;
+	refdb_fs_lock *lock = (refdb_fs_lock *) payload;
 
-cleanup:
-	git_filebuf_cleanup(file);
+	if (success == 2)
+		return batch_delete(backend, lock->batch, lock, ref->name);
+	else if (success)
+		return batch_write(backend, lock->batch, lock, ref, success == 3, update_reflog, sig, message);
 
-	return error;
+	batch_release_lock(lock);
+	return 0;
 }
 
 static int refdb_reflog_fs__rename(git_refdb_backend *_backend, const char *old_name, const char *new_name);
@@ -1324,7 +2340,7 @@ static int refdb_fs_backend__rename(
 	/* Try to rename the refog; it's ok if the old doesn't exist */
 	error = refdb_reflog_fs__rename(_backend, old_name, new_name);
 	if (((error == 0) || (error == GIT_ENOTFOUND)) &&
-	    ((error = reflog_append(backend, new, git_reference_target(new), NULL, who, message)) < 0)) {
+	    ((error = reflog_append(backend, NULL, new, git_reference_target(new), NULL, who, message)) < 0)) {
 		git_reference_free(new);
 		git_filebuf_cleanup(&file);
 		return error;
@@ -1367,6 +2383,8 @@ static void refdb_fs_backend__free(git_refdb_backend *_backend)
 	assert(backend);
 
 	git_sortedcache_free(backend->refcache);
+	packed_snapshot_release(backend->snapshot);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->path);
 	git__free(backend);
 }
@@ -1435,73 +2453,79 @@ static int reflog_alloc(git_reflog **reflog, const char *name)
 	return 0;
 }
 
-static int reflog_parse(git_reflog *log, const char *buf, size_t buf_size)
+/* Parse the entry on the line which ends with the newline at `eol` */
+static int reflog_entry_parse(git_reflog_entry **out, const char *line, const char *eol)
 {
-	const char *ptr;
 	git_reflog_entry *entry;
+	const char *ptr, *sig_end;
 
-#define seek_forward(_increase) do { \
-	if (_increase >= buf_size) { \
-		giterr_set(GITERR_INVALID, "Ran out of data while parsing reflog"); \
-		goto fail; \
-	} \
-	buf += _increase; \
-	buf_size -= _increase; \
-	} while (0)
+	if (eol - line < 2 * (GIT_OID_HEXSZ + 1)) {
+		giterr_set(GITERR_INVALID, "Ran out of data while parsing reflog");
+		return -1;
+	}
 
-	while (buf_size > GIT_REFLOG_SIZE_MIN) {
-		entry = git__calloc(1, sizeof(git_reflog_entry));
-		GITERR_CHECK_ALLOC(entry);
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GITERR_CHECK_ALLOC(entry);
 
-		entry->committer = git__malloc(sizeof(git_signature));
-		GITERR_CHECK_ALLOC(entry->committer);
+	if ((entry->committer = git__calloc(1, sizeof(git_signature))) == NULL)
+		goto fail;
 
-		if (git_oid_fromstrn(&entry->oid_old, buf, GIT_OID_HEXSZ) < 0)
-			goto fail;
-		seek_forward(GIT_OID_HEXSZ + 1);
+	if (git_oid_fromstrn(&entry->oid_old, line, GIT_OID_HEXSZ) < 0 ||
+		git_oid_fromstrn(&entry->oid_cur, line + GIT_OID_HEXSZ + 1, GIT_OID_HEXSZ) < 0)
+		goto fail;
 
-		if (git_oid_fromstrn(&entry->oid_cur, buf, GIT_OID_HEXSZ) < 0)
-			goto fail;
-		seek_forward(GIT_OID_HEXSZ + 1);
+	ptr = line + 2 * (GIT_OID_HEXSZ + 1);
 
-		ptr = buf;
+	/* The signature ends with the line, or with the tab before the message */
+	if ((sig_end = memchr(ptr, '\t', eol - ptr)) == NULL)
+		sig_end = eol;
 
-		/* Seek forward to the end of the signature. */
-		while (*buf && *buf != '\t' && *buf != '\n')
-			seek_forward(1);
+	if (git_signature__parse(entry->committer, &ptr, sig_end + 1, NULL, *sig_end) < 0)
+		goto fail;
 
-		if (git_signature__parse(entry->committer, &ptr, buf + 1, NULL, *buf) < 0)
+	if (sig_end < eol) {
+		entry->msg = git__strndup(sig_end + 1, eol - sig_end - 1);
+		if (!entry->msg)
 			goto fail;
+	}
 
-		if (*buf == '\t') {
-			/* We got a message. Read everything till we reach LF. */
-			seek_forward(1);
-			ptr = buf;
+	*out = entry;
+	return 0;
 
-			while (*buf && *buf != '\n')
-				seek_forward(1);
+fail:
+	git_reflog_entry__free(entry);
+	return -1;
+}
 
-			entry->msg = git__strndup(ptr, buf - ptr);
-			GITERR_CHECK_ALLOC(entry->msg);
-		} else
-			entry->msg = NULL;
+static int reflog_parse(git_reflog *log, const char *buf, size_t buf_size)
+{
+	const char *eol;
+	git_reflog_entry *entry;
 
-		while (*buf && *buf == '\n' && buf_size > 1)
-			seek_forward(1);
+	while (buf_size > GIT_REFLOG_SIZE_MIN) {
+		if ((eol = memchr(buf, '\n', buf_size)) == NULL) {
+			giterr_set(GITERR_INVALID, "Ran out of data while parsing reflog");
+			return -1;
+		}
 
-		if (git_vector_insert(&log->entries, entry) < 0)
-			goto fail;
-	}
+		if (reflog_entry_parse(&entry, buf, eol) < 0)
+			return -1;
 
-	return 0;
+		if (git_vector_insert(&log->entries, entry) < 0) {
+			git_reflog_entry__free(entry);
+			return -1;
+		}
 
-#undef seek_forward
+		buf_size -= eol + 1 - buf;
+		buf = eol + 1;
 
-fail:
-	if (entry)
-		git_reflog_entry__free(entry);
+		while (buf_size > 1 && *buf == '\n') {
+			buf++;
+			buf_size--;
+		}
+	}
 
-	return -1;
+	return 0;
 }
 
 static int create_new_reflog_file(const char *filepath)
@@ -1717,8 +2741,346 @@ success:
 	return error;
 }
 
+/*
+ * A reflog file which is read from its end. It is mapped as it is, and
+ * an incomplete last line, which is still being appended, is left out.
+ */
+typedef struct {
+	git_map map;
+	git_buf buf;
+	const char *start;
+	const char *end;
+} reflog_file;
+
+static void reflog_file_close(reflog_file *file)
+{
+	if (file->map.data)
+		git_futils_mmap_free(&file->map);
+	git_buf_free(&file->buf);
+}
+
+static int reflog_file_open(reflog_file *file, const char *path)
+{
+	struct stat st;
+	const char *last;
+	git_file fd;
+	int error = 0;
+
+	memset(file, 0, sizeof(reflog_file));
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || !git__is_sizet(st.st_size)) {
+		giterr_set(GITERR_OS, "Failed to stat '%s'", path);
+		p_close(fd);
+		return -1;
+	}
+
+	if (st.st_size) {
+#ifdef GIT_WIN32
+		/* a mapped file could not be replaced by the next writer */
+		if (!(error = git_futils_readbuffer_fd(&file->buf, fd, (size_t)st.st_size)))
+			file->start = file->buf.ptr;
+#else
+		if (!(error = git_futils_mmap_ro(&file->map, fd, 0, (size_t)st.st_size)))
+			file->start = file->map.data;
+#endif
+	}
+
+	p_close(fd);
+
+	if (error < 0 || !file->start)
+		return error;
+
+	last = git__memrchr(file->start, '\n', (size_t)st.st_size);
+	file->end = last ? last + 1 : file->start;
+	return 0;
+}
+
+/*
+ * Step back over the line which ends at `*pos`, skipping empty lines.
+ * `eol` is set to the newline which ends it.
+ */
+static bool reflog_file_prev(
+	const char **line, const char **eol, const reflog_file *file, const char **pos)
+{
+	const char *p = *pos;
+
+	while (p > file->start && p[-1] == '\n')
+		p--;
+
+	if (p == file->start)
+		return false;
+
+	*eol = p;
+	p = git__memrchr(file->start, '\n', p - file->start);
+	*pos = *line = p ? p + 1 : file->start;
+	return true;
+}
+
+/* Count the entries before `pos`, whose lines are all complete */
+static size_t reflog_file_count(const reflog_file *file, const char *pos)
+{
+	const char *p = file->start, *eol;
+	size_t count = 0;
+
+	while (p < pos && (eol = memchr(p, '\n', pos - p)) != NULL) {
+		if (eol > p)
+			count++;
+
+		p = eol + 1;
+	}
+
+	return count;
+}
+
+typedef struct {
+	git_reflog_iterator parent;
+	reflog_file file;
+	const char *pos; /* the end of the entries not returned yet */
+	size_t idx; /* the index of the entry which ends at `pos` */
+	git_reflog_entry *entry;
+} refdb_fs_reflog_iter;
+
+static int refdb_reflog_fs__iterator_byindex(
+	const git_reflog_entry **out, git_reflog_iterator *_iter, size_t idx)
+{
+	refdb_fs_reflog_iter *iter = (refdb_fs_reflog_iter *)_iter;
+	git_reflog_entry *entry;
+	const char *line = NULL, *eol = NULL;
+
+	if (idx < iter->idx) {
+		iter->pos = iter->file.end;
+		iter->idx = 0;
+	}
+
+	/* the entries before it do not need to be parsed */
+	for (; iter->idx <= idx; iter->idx++) {
+		if (!reflog_file_prev(&line, &eol, &iter->file, &iter->pos)) {
+			giterr_set(GITERR_REFERENCE, "No reflog entry at index %"PRIuZ, idx);
+			return GIT_ENOTFOUND;
+		}
+	}
+
+	if (reflog_entry_parse(&entry, line, eol) < 0)
+		return -1;
+
+	if (iter->entry)
+		git_reflog_entry__free(iter->entry);
+
+	*out = iter->entry = entry;
+	return 0;
+}
+
+static int refdb_reflog_fs__iterator_next(
+	const git_reflog_entry **out, git_reflog_iterator *_iter)
+{
+	refdb_fs_reflog_iter *iter = (refdb_fs_reflog_iter *)_iter;
+	int error;
+
+	if ((error = refdb_reflog_fs__iterator_byindex(out, _iter, iter->idx)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return GIT_ITEROVER;
+	}
+
+	return error;
+}
+
+static void refdb_reflog_fs__iterator_free(git_reflog_iterator *_iter)
+{
+	refdb_fs_reflog_iter *iter = (refdb_fs_reflog_iter *)_iter;
+
+	if (iter->entry)
+		git_reflog_entry__free(iter->entry);
+
+	reflog_file_close(&iter->file);
+	git__free(iter);
+}
+
+static int refdb_reflog_fs__iterator(
+	git_reflog_iterator **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	refdb_fs_reflog_iter *iter;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	assert(out && backend && name);
+
+	iter = git__calloc(1, sizeof(refdb_fs_reflog_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	if ((error = retrieve_reflog_path(&path, backend->repo, name)) < 0 ||
+		(error = reflog_file_open(&iter->file, path.ptr)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			/* without a reflog, there are no entries */
+			giterr_clear();
+			error = 0;
+		} else {
+			refdb_reflog_fs__iterator_free(&iter->parent);
+			git_buf_free(&path);
+			return error;
+		}
+	}
+
+	git_buf_free(&path);
+
+	iter->pos = iter->file.end;
+	iter->parent.next = refdb_reflog_fs__iterator_next;
+	iter->parent.entry_byindex = refdb_reflog_fs__iterator_byindex;
+	iter->parent.free = refdb_reflog_fs__iterator_free;
+
+	*out = &iter->parent;
+	return 0;
+}
+
+/* Only read the time of the entry on a line, to know if it expired */
+static int reflog_entry_time(git_time_t *out, const char *line, const char *eol)
+{
+	const char *sig_end, *email_end;
+	int64_t time;
+
+	if ((sig_end = memchr(line, '\t', eol - line)) == NULL)
+		sig_end = eol;
+
+	email_end = git__memrchr(line, '>', sig_end - line);
+
+	if (!email_end || email_end + 2 >= sig_end ||
+		git__strtol64(&time, email_end + 2, NULL, 10) < 0) {
+		giterr_set(GITERR_INVALID, "Invalid time in reflog entry");
+		return -1;
+	}
+
+	*out = (git_time_t)time;
+	return 0;
+}
+
+static int refdb_reflog_fs__expire(
+	size_t *removed,
+	git_refdb_backend *_backend,
+	const char *name,
+	const git_reflog_expire_options *opts)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	git_filebuf fbuf = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_vector kept = GIT_VECTOR_INIT;
+	reflog_file file;
+	const char *line, *eol, *pos;
+	git_time_t time;
+	size_t i, count = 0;
+	int error;
+
+	assert(backend && name && opts);
+
+	if (!has_reflog(backend->repo, name))
+		return 0;
+
+	if ((error = lock_reflog(&fbuf, backend, name)) < 0)
+		return error;
+
+	if ((error = retrieve_reflog_path(&path, backend->repo, name)) < 0 ||
+		(error = reflog_file_open(&file, path.ptr)) < 0)
+		goto cleanup;
+
+	/* the lines which are kept, newest first */
+	for (pos = file.end; reflog_file_prev(&line, &eol, &file, &pos); ) {
+		/* everything older goes; only count it */
+		if (opts->max_entries && kept.length == opts->max_entries) {
+			count += 1 + reflog_file_count(&file, line);
+			break;
+		}
+
+		if (opts->expire_time) {
+			if ((error = reflog_entry_time(&time, line, eol)) < 0)
+				break;
+
+			if (time < opts->expire_time) {
+				count++;
+				continue;
+			}
+		}
+
+		if ((error = git_vector_insert(&kept, (void *)line)) < 0)
+			break;
+	}
+
+	for (i = kept.length; !error && count && i > 0; i--) {
+		line = git_vector_get(&kept, i - 1);
+		eol = memchr(line, '\n', file.end - line);
+
+		error = git_filebuf_write(&fbuf, line, eol - line + 1);
+	}
+
+	if (!error && count)
+		error = git_filebuf_commit(&fbuf);
+
+	reflog_file_close(&file);
+
+	if (!error && removed)
+		*removed = count;
+
+cleanup:
+	git_filebuf_cleanup(&fbuf);
+	git_vector_free(&kept);
+	git_buf_free(&path);
+
+	return error;
+}
+
+static int reflog_write_entries(const char *path, const git_buf *entries)
+{
+	int error;
+
+	if (((error = git_futils_mkpath2file(path, 0777)) < 0) &&
+	    (error != GIT_EEXISTS))
+		return error;
+
+	/* If the new branch matches part of the namespace of a previously deleted branch,
+	 * there maybe an obsolete/unused directory (or directory hierarchy) in the way.
+	 */
+	if (git_path_isdir(path) &&
+		(git_futils_rmdir_r(path, NULL, GIT_RMDIR_SKIP_NONEMPTY) < 0))
+		return -1;
+
+	return git_futils_writebuffer(entries, path, O_WRONLY|O_CREAT|O_APPEND, GIT_REFLOG_FILE_MODE);
+}
+
+/* Keep the entries for a reflog until the batch is applied */
+static int batch_queue_reflog(refdb_fs_batch *batch, const char *path, const git_buf *entry)
+{
+	batch_reflog *log;
+	khiter_t pos;
+	size_t alloclen;
+	int error;
+
+	pos = git_strmap_lookup_index(batch->reflog_paths, path);
+	if (git_strmap_valid_index(batch->reflog_paths, pos)) {
+		log = git_strmap_value_at(batch->reflog_paths, pos);
+		return git_buf_put(&log->log, entry->ptr, entry->size);
+	}
+
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(batch_reflog), strlen(path));
+	GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+	log = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(log);
+
+	memcpy(log->path, path, strlen(path));
+
+	if (git_buf_put(&log->log, entry->ptr, entry->size) < 0 ||
+		git_vector_insert(&batch->reflogs, log) < 0) {
+		git_buf_free(&log->log);
+		git__free(log);
+		return -1;
+	}
+
+	git_strmap_insert(batch->reflog_paths, log->path, log, error);
+	return (error < 0) ? -1 : 0;
+}
+
 /* Append to the reflog, must be called under reference lock */
-static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *who, const char *message)
+static int reflog_append(refdb_fs_backend *backend, refdb_fs_batch *batch, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *who, const char *message)
 {
 	int error, is_symbolic;
 	git_oid old_id = {{0}}, new_id = {{0}};
@@ -1766,21 +3128,10 @@ static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, co
 	if ((error = retrieve_reflog_path(&path, repo, ref->name)) < 0)
 		goto cleanup;
 
-	if (((error = git_futils_mkpath2file(git_buf_cstr(&path), 0777)) < 0) &&
-	    (error != GIT_EEXISTS)) {
-		goto cleanup;
-	}
-
-	/* If the new branch matches part of the namespace of a previously deleted branch,
-	 * there maybe an obsolete/unused directory (or directory hierarchy) in the way.
-	 */
-	if (git_path_isdir(git_buf_cstr(&path)) &&
-		(git_futils_rmdir_r(git_buf_cstr(&path), NULL, GIT_RMDIR_SKIP_NONEMPTY) < 0)) {
-		error = -1;
-		goto cleanup;
-	}
-
-	error = git_futils_writebuffer(&buf, git_buf_cstr(&path), O_WRONLY|O_CREAT|O_APPEND, GIT_REFLOG_FILE_MODE);
+	if (batch)
+		error = batch_queue_reflog(batch, path.ptr, &buf);
+	else
+		error = reflog_write_entries(path.ptr, &buf);
 
 cleanup:
 	git_buf_free(&buf);
@@ -1907,6 +3258,12 @@ int git_refdb_backend_fs(
 
 	backend->repo = repository;
 
+	if (git_mutex_init(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize packed-refs lock");
+		git__free(backend);
+		return -1;
+	}
+
 	if (setup_namespace(&path, repository) < 0)
 		goto fail;
 
@@ -1945,11 +3302,17 @@ int git_refdb_backend_fs(
 	backend->parent.reflog_write = &refdb_reflog_fs__write;
 	backend->parent.reflog_rename = &refdb_reflog_fs__rename;
 	backend->parent.reflog_delete = &refdb_reflog_fs__delete;
+	backend->parent.reflog_iterator = &refdb_reflog_fs__iterator;
+	backend->parent.reflog_expire = &refdb_reflog_fs__expire;
+	backend->parent.transaction_begin = &refdb_fs_backend__transaction_begin;
+	backend->parent.transaction_commit = &refdb_fs_backend__transaction_commit;
+	backend->parent.transaction_free = &refdb_fs_backend__transaction_free;
 
 	*backend_out = (git_refdb_backend *)backend;
 	return 0;
 
 fail:
+	git_mutex_free(&backend->snapshot_lock);
 	git_buf_free(&path);
 	git__free(backend->path);
 	git__free(backend);
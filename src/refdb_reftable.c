@@ -0,0 +1,2005 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "refs.h"
+#include "reflog.h"
+#include "refdb.h"
+#include "reftable.h"
+#include "repository.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "fnmatch.h"
+#include "pool.h"
+#include "signature.h"
+
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+/*
+ * A refdb backend which keeps the references and their logs in a stack
+ * of reftables in `$GIT_DIR/reftable`. The file `tables.list` lists the
+ * tables from the oldest to the newest; it is replaced for every update,
+ * which adds a table with only the records which changed. When the stack
+ * is no longer geometric, the newest tables are merged into one, so that
+ * there are only a logarithmic number of tables to look at.
+ *
+ * Every update is done under the lock of `tables.list`. The updates of a
+ * transaction are collected while the references are locked and written
+ * as a single table when the last one is unlocked, so that they are all
+ * applied or none of them.
+ */
+
+#define MAX_NESTING_LEVEL		10
+#define COMPACTION_FACTOR		2
+
+typedef struct {
+	git_refcount rc;
+	char *name;
+	git_reftable *table;
+} stack_table;
+
+/* The tables of the stack at one point in time, the oldest first */
+typedef struct {
+	git_refcount rc;
+	git_vector tables;
+} reftable_stack;
+
+/*
+ * The updates which go into the next table, while `tables.list` is
+ * locked: those of a single write, or of a whole transaction
+ */
+typedef struct {
+	git_filebuf list_lock;
+	reftable_stack *stack; /* the stack when the lock was taken */
+	git_pool pool;
+	git_vector refs;
+	git_vector logs;
+	uint64_t min_update_index;
+	uint64_t next_update_index;
+	size_t seq;
+} reftable_batch;
+
+typedef struct {
+	git_reftable_ref ref;
+	size_t seq;
+} batch_ref;
+
+typedef struct {
+	git_reftable_log log;
+	size_t seq;
+} batch_log;
+
+typedef struct {
+	git_refdb_backend parent;
+
+	git_repository *repo;
+	char *path;
+	char *list_path;
+
+	git_mutex lock;
+	reftable_stack *stack;
+	git_futils_filestamp stamp;
+} refdb_reftable;
+
+static void stack_table_free(stack_table *t)
+{
+	git_reftable_free(t->table);
+	git__free(t->name);
+	git__free(t);
+}
+
+static void stack_free(reftable_stack *stack)
+{
+	stack_table *t;
+	size_t i;
+
+	git_vector_foreach(&stack->tables, i, t)
+		GIT_REFCOUNT_DEC(t, stack_table_free);
+
+	git_vector_free(&stack->tables);
+	git__free(stack);
+}
+
+static void stack_release(reftable_stack *stack)
+{
+	if (stack)
+		GIT_REFCOUNT_DEC(stack, stack_free);
+}
+
+static int stack_new(reftable_stack **out)
+{
+	reftable_stack *stack = git__calloc(1, sizeof(reftable_stack));
+	GITERR_CHECK_ALLOC(stack);
+
+	if (git_vector_init(&stack->tables, 8, NULL) < 0) {
+		git__free(stack);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(stack);
+	*out = stack;
+	return 0;
+}
+
+static int stack_push(reftable_stack *stack, stack_table *t)
+{
+	if (git_vector_insert(&stack->tables, t) < 0)
+		return -1;
+
+	GIT_REFCOUNT_INC(t);
+	return 0;
+}
+
+static int stack_table_open(stack_table **out, refdb_reftable *backend, const char *name)
+{
+	git_buf path = GIT_BUF_INIT;
+	stack_table *t;
+	int error;
+
+	t = git__calloc(1, sizeof(stack_table));
+	GITERR_CHECK_ALLOC(t);
+
+	if ((t->name = git__strdup(name)) == NULL)
+		error = -1;
+	else if ((error = git_buf_joinpath(&path, backend->path, name)) == 0)
+		error = git_reftable_open(&t->table, path.ptr);
+
+	git_buf_free(&path);
+
+	if (error < 0) {
+		git__free(t->name);
+		git__free(t);
+		return error;
+	}
+
+	GIT_REFCOUNT_INC(t);
+	*out = t;
+	return 0;
+}
+
+/*
+ * Load the stack listed in `tables.list`, keeping the tables which are
+ * already open in `current`. Returns GIT_EMODIFIED if a table went away
+ * because another writer compacted the stack in the meantime.
+ */
+static int stack_load(reftable_stack **out, refdb_reftable *backend, reftable_stack *current)
+{
+	git_buf list = GIT_BUF_INIT;
+	reftable_stack *stack = NULL;
+	stack_table *t;
+	char *line, *next;
+	size_t i;
+	int error;
+
+	if ((error = git_futils_readbuffer(&list, backend->list_path)) < 0 &&
+		error != GIT_ENOTFOUND)
+		return error;
+
+	giterr_clear();
+
+	if ((error = stack_new(&stack)) < 0)
+		goto done;
+
+	for (line = list.ptr; line && *line; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+
+		if (!*line)
+			continue;
+
+		t = NULL;
+		if (current) {
+			git_vector_foreach(&current->tables, i, t) {
+				if (!strcmp(t->name, line))
+					break;
+			}
+
+			if (i == current->tables.length)
+				t = NULL;
+		}
+
+		if (t) {
+			error = stack_push(stack, t);
+		} else if ((error = stack_table_open(&t, backend, line)) == 0) {
+			error = stack_push(stack, t);
+			GIT_REFCOUNT_DEC(t, stack_table_free);
+		} else if (error == GIT_ENOTFOUND) {
+			error = GIT_EMODIFIED;
+		}
+
+		if (error < 0)
+			goto done;
+	}
+
+	*out = stack;
+	stack = NULL;
+
+done:
+	stack_release(stack);
+	git_buf_free(&list);
+	return error;
+}
+
+/* Get the current stack, reloading `tables.list` if it changed */
+static int stack_get(reftable_stack **out, refdb_reftable *backend)
+{
+	reftable_stack *stack;
+	int error, tries = 0;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock reftable stack");
+		return -1;
+	}
+
+	error = git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		git_futils_filestamp_set(&backend->stamp, NULL);
+		error = backend->stack ? 1 : 0;
+	}
+
+	if (error == 0 && !backend->stack)
+		error = 1;
+
+	while (error > 0) {
+		if ((error = stack_load(&stack, backend, backend->stack)) == GIT_EMODIFIED &&
+			++tries < 10) {
+			/* a writer replaced the list since we read it */
+			git_futils_filestamp_check(&backend->stamp, backend->list_path);
+			giterr_clear();
+			error = 1;
+			continue;
+		}
+
+		if (error < 0)
+			break;
+
+		stack_release(backend->stack);
+		backend->stack = stack;
+
+		/* it may be rewritten again within this second */
+		if (backend->stamp.mtime >= time(NULL))
+			backend->stamp.mtime = -1;
+	}
+
+	if (error == GIT_EMODIFIED)
+		giterr_set(GITERR_REFERENCE, "The reftable stack keeps changing");
+
+	if (error < 0) {
+		git_futils_filestamp_set(&backend->stamp, NULL);
+	} else {
+		*out = backend->stack;
+		GIT_REFCOUNT_INC(*out);
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+/*
+ * Merging the tables of a stack: the records come out in order, and of
+ * the records with the same key, only the one of the newest table.
+ */
+typedef struct {
+	git_reftable_iter iter;
+	git_reftable_ref ref;
+	git_reftable_log log;
+	bool valid;
+} merged_sub;
+
+typedef struct {
+	merged_sub *subs;
+	size_t count;
+	bool logs;
+	size_t current; /* the sub which has to move on */
+	bool has_current;
+} merged_iter;
+
+static int merged_sub_next(merged_iter *mi, merged_sub *sub)
+{
+	int error;
+
+	if (mi->logs)
+		error = git_reftable_iter_next_log(&sub->log, &sub->iter);
+	else
+		error = git_reftable_iter_next_ref(&sub->ref, &sub->iter);
+
+	sub->valid = !error;
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+static int merged_sub_cmp(merged_iter *mi, merged_sub *a, merged_sub *b)
+{
+	if (mi->logs)
+		return git_reftable_log_cmp(
+			a->log.name, a->log.update_index, b->log.name, b->log.update_index);
+
+	return strcmp(a->ref.name, b->ref.name);
+}
+
+/* Iterate over the tables `start` to `end` of the stack from `name` on */
+static int merged_init(
+	merged_iter *mi, reftable_stack *stack, size_t start, size_t end,
+	bool logs, const char *name)
+{
+	stack_table *t;
+	size_t i;
+	int error;
+
+	memset(mi, 0, sizeof(*mi));
+	mi->logs = logs;
+
+	if (end > start) {
+		mi->subs = git__calloc(end - start, sizeof(merged_sub));
+		GITERR_CHECK_ALLOC(mi->subs);
+	}
+
+	for (i = start; i < end; i++) {
+		merged_sub *sub = &mi->subs[mi->count++];
+		git_reftable_iter init = GIT_REFTABLE_ITER_INIT;
+
+		memcpy(&sub->iter, &init, sizeof(init));
+		t = git_vector_get(&stack->tables, i);
+
+		if (logs)
+			error = git_reftable_iter_seek_log(&sub->iter, t->table, name);
+		else
+			error = git_reftable_iter_seek_ref(&sub->iter, t->table, name);
+
+		if (error < 0 || (error = merged_sub_next(mi, sub)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/* The sub with the next record, or NULL at the end */
+static int merged_next(merged_sub **out, merged_iter *mi)
+{
+	merged_sub *best = NULL, *sub;
+	size_t i;
+	int error;
+
+	*out = NULL;
+
+	if (mi->has_current &&
+		(error = merged_sub_next(mi, &mi->subs[mi->current])) < 0)
+		return error;
+
+	mi->has_current = false;
+
+	/* the newer tables come later and win ties */
+	for (i = 0; i < mi->count; i++) {
+		sub = &mi->subs[i];
+
+		if (sub->valid && (!best || merged_sub_cmp(mi, sub, best) <= 0)) {
+			best = sub;
+			mi->current = i;
+		}
+	}
+
+	if (!best)
+		return GIT_ITEROVER;
+
+	/* skip the older records with the same key */
+	for (i = 0; i < mi->count; i++) {
+		sub = &mi->subs[i];
+
+		while (sub != best && sub->valid && !merged_sub_cmp(mi, sub, best)) {
+			if ((error = merged_sub_next(mi, sub)) < 0)
+				return error;
+		}
+	}
+
+	mi->has_current = true;
+	*out = best;
+	return 0;
+}
+
+static void merged_dispose(merged_iter *mi)
+{
+	size_t i;
+
+	for (i = 0; i < mi->count; i++)
+		git_reftable_iter_dispose(&mi->subs[i].iter);
+
+	git__free(mi->subs);
+	memset(mi, 0, sizeof(*mi));
+}
+
+/* Find the newest record of the reference `name` */
+static int stack_find_ref(
+	git_reftable_ref *out, git_reftable_iter *iter,
+	reftable_stack *stack, const char *name)
+{
+	stack_table *t;
+	size_t i = stack->tables.length;
+	int error;
+
+	while (i--) {
+		t = git_vector_get(&stack->tables, i);
+
+		if ((error = git_reftable_iter_seek_ref(iter, t->table, name)) < 0)
+			return error;
+
+		error = git_reftable_iter_next_ref(out, iter);
+
+		if (error == GIT_ITEROVER)
+			continue;
+		if (error < 0)
+			return error;
+
+		if (!strcmp(out->name, name))
+			return (out->type == GIT_REFTABLE_REF_DELETION) ? GIT_ENOTFOUND : 0;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+static int ref_error_notfound(const char *name)
+{
+	giterr_set(GITERR_REFERENCE, "Reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static git_reference *ref_from_record(const git_reftable_ref *rec)
+{
+	switch (rec->type) {
+	case GIT_REFTABLE_REF_SYMREF:
+		return git_reference__alloc_symbolic(rec->name, rec->target);
+	case GIT_REFTABLE_REF_VAL2:
+		return git_reference__alloc(rec->name, &rec->id, &rec->peel);
+	default:
+		return git_reference__alloc(rec->name, &rec->id, NULL);
+	}
+}
+
+static int stack_lookup(git_reference **out, reftable_stack *stack, const char *name)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_ref rec;
+	int error;
+
+	if ((error = stack_find_ref(&rec, &iter, stack, name)) == 0) {
+		*out = ref_from_record(&rec);
+		GITERR_CHECK_ALLOC(*out);
+	} else if (error == GIT_ENOTFOUND) {
+		error = ref_error_notfound(name);
+	}
+
+	git_reftable_iter_dispose(&iter);
+	return error;
+}
+
+static int refdb_reftable__exists(
+	int *exists, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_ref rec;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_find_ref(&rec, &iter, stack, ref_name);
+	*exists = !error;
+
+	if (error == GIT_ENOTFOUND)
+		error = 0;
+
+	git_reftable_iter_dispose(&iter);
+	stack_release(stack);
+	return error;
+}
+
+static int refdb_reftable__lookup(
+	git_reference **out, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_lookup(out, stack, ref_name);
+	stack_release(stack);
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+
+	reftable_stack *stack;
+	merged_iter merged;
+	char *glob;
+	git_buf prefix;
+	git_pool pool;
+} refdb_reftable_iter;
+
+static void refdb_reftable__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+
+	merged_dispose(&iter->merged);
+	stack_release(iter->stack);
+	git_buf_free(&iter->prefix);
+	git_pool_clear(&iter->pool);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int iter_next_record(git_reftable_ref **out, refdb_reftable_iter *iter)
+{
+	merged_sub *sub;
+	int error;
+
+	while ((error = merged_next(&sub, &iter->merged)) == 0) {
+		const char *name = sub->ref.name;
+
+		/* the names with the prefix of the glob are all together */
+		if (git__prefixcmp(name, iter->prefix.ptr))
+			return GIT_ITEROVER;
+
+		if (sub->ref.type == GIT_REFTABLE_REF_DELETION ||
+			git__prefixcmp(name, GIT_REFS_DIR) ||
+			(iter->glob && p_fnmatch(iter->glob, name, 0) != 0))
+			continue;
+
+		*out = &sub->ref;
+		return 0;
+	}
+
+	return error;
+}
+
+static int refdb_reftable__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	git_reftable_ref *rec;
+	int error;
+
+	if ((error = iter_next_record(&rec, (refdb_reftable_iter *)_iter)) < 0)
+		return error;
+
+	*out = ref_from_record(rec);
+	GITERR_CHECK_ALLOC(*out);
+	return 0;
+}
+
+static int refdb_reftable__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	git_reftable_ref *rec;
+	int error;
+
+	if ((error = iter_next_record(&rec, iter)) < 0)
+		return error;
+
+	*out = git_pool_strdup(&iter->pool, rec->name);
+	GITERR_CHECK_ALLOC(*out);
+	return 0;
+}
+
+static int refdb_reftable__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	refdb_reftable_iter *iter;
+	size_t len = 0;
+	int error;
+
+	assert(backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	if ((error = git_pool_init(&iter->pool, 1, 0)) < 0)
+		goto fail;
+
+	if (glob) {
+		if ((iter->glob = git__strdup(glob)) == NULL) {
+			error = -1;
+			goto fail;
+		}
+
+		len = strcspn(glob, "*?[\\");
+	}
+
+	/* all the references are below refs/ */
+	if (len < strlen(GIT_REFS_DIR))
+		error = git_buf_sets(&iter->prefix, GIT_REFS_DIR);
+	else
+		error = git_buf_set(&iter->prefix, glob, len);
+
+	if (error < 0 ||
+		(error = stack_get(&iter->stack, backend)) < 0 ||
+		(error = merged_init(&iter->merged, iter->stack, 0,
+			iter->stack->tables.length, false, iter->prefix.ptr)) < 0)
+		goto fail;
+
+	iter->parent.next = refdb_reftable__iterator_next;
+	iter->parent.next_name = refdb_reftable__iterator_next_name;
+	iter->parent.free = refdb_reftable__iterator_free;
+
+	*out = &iter->parent;
+	return 0;
+
+fail:
+	refdb_reftable__iterator_free(&iter->parent);
+	return error;
+}
+
+/*
+ * Writing
+ */
+
+static void batch_free(reftable_batch *batch)
+{
+	if (!batch)
+		return;
+
+	git_filebuf_cleanup(&batch->list_lock);
+	git_vector_free(&batch->refs);
+	git_vector_free(&batch->logs);
+	git_pool_clear(&batch->pool);
+	stack_release(batch->stack);
+	git__free(batch);
+}
+
+static uint64_t stack_max_update_index(reftable_stack *stack)
+{
+	stack_table *t = git_vector_last(&stack->tables);
+	return t ? git_reftable_max_update_index(t->table) : 0;
+}
+
+/*
+ * Take the lock of the stack for an update. Only one batch can hold it,
+ * so this fails with GIT_ELOCKED while a transaction is open.
+ */
+static int batch_open(reftable_batch **out, refdb_reftable *backend)
+{
+	reftable_batch *batch;
+	int error;
+
+	batch = git__calloc(1, sizeof(reftable_batch));
+	GITERR_CHECK_ALLOC(batch);
+
+	if ((error = git_futils_mkdir(backend->path, NULL, GIT_REFS_DIR_MODE, GIT_MKDIR_PATH)) < 0 ||
+		(error = git_filebuf_open(&batch->list_lock, backend->list_path, 0, GIT_REFTABLE_FILE_MODE)) < 0) {
+		git__free(batch);
+		return error;
+	}
+
+	/* what others wrote before we got the lock */
+	git_futils_filestamp_set(&backend->stamp, NULL);
+
+	if ((error = stack_get(&batch->stack, backend)) < 0 ||
+		(error = git_pool_init(&batch->pool, 1, 0)) < 0 ||
+		(error = git_vector_init(&batch->refs, 8, NULL)) < 0 ||
+		(error = git_vector_init(&batch->logs, 8, NULL)) < 0) {
+		batch_free(batch);
+		return error;
+	}
+
+	batch->min_update_index = stack_max_update_index(batch->stack) + 1;
+	batch->next_update_index = batch->min_update_index;
+
+	*out = batch;
+	return 0;
+}
+
+static int batch_ref_cmp(const void *a_, const void *b_)
+{
+	const batch_ref *a = a_, *b = b_;
+	int cmp = strcmp(a->ref.name, b->ref.name);
+
+	if (cmp)
+		return cmp;
+
+	return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+static int batch_log_cmp(const void *a_, const void *b_)
+{
+	const batch_log *a = a_, *b = b_;
+	int cmp = git_reftable_log_cmp(
+		a->log.name, a->log.update_index, b->log.name, b->log.update_index);
+
+	if (cmp)
+		return cmp;
+
+	return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+static int stack_table_name(git_buf *out, uint64_t min, uint64_t max)
+{
+	static uint32_t counter;
+	uint32_t suffix = (uint32_t)(git__timer() * 1000000) ^ (++counter << 20);
+
+	git_buf_clear(out);
+	return git_buf_printf(out, "0x%012llx-0x%012llx-%08x.ref",
+		(unsigned long long)min, (unsigned long long)max, suffix);
+}
+
+/* Write a table of `stack` with the refs and logs of the batch */
+static int write_batch_table(
+	stack_table **out, refdb_reftable *backend, reftable_batch *batch)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_reftable_writer *w = NULL;
+	git_buf name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	uint64_t min = batch->min_update_index;
+	uint64_t max = batch->next_update_index > batch->min_update_index ?
+		batch->next_update_index - 1 : batch->min_update_index;
+	batch_ref *ref, *next;
+	batch_log *log, *next_log;
+	size_t i;
+	int error;
+
+	git_vector_set_cmp(&batch->refs, batch_ref_cmp);
+	git_vector_set_cmp(&batch->logs, batch_log_cmp);
+	git_vector_sort(&batch->refs);
+	git_vector_sort(&batch->logs);
+
+	/* the logs which are deleted or moved keep their older indices */
+	git_vector_foreach(&batch->logs, i, log) {
+		if (log->log.update_index < min)
+			min = log->log.update_index;
+	}
+
+	if ((error = stack_table_name(&name, min, max)) < 0 ||
+		(error = git_buf_joinpath(&path, backend->path, name.ptr)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr, 0, GIT_REFTABLE_FILE_MODE)) < 0 ||
+		(error = git_reftable_writer_new(&w, &file, min, max)) < 0)
+		goto done;
+
+	/* of the updates of one reference, the last one wins */
+	git_vector_foreach(&batch->refs, i, ref) {
+		next = git_vector_get(&batch->refs, i + 1);
+		if (next && !strcmp(next->ref.name, ref->ref.name))
+			continue;
+
+		ref->ref.update_index = max;
+		if ((error = git_reftable_writer_add_ref(w, &ref->ref)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&batch->logs, i, log) {
+		next_log = git_vector_get(&batch->logs, i + 1);
+		if (next_log && !git_reftable_log_cmp(
+				next_log->log.name, next_log->log.update_index,
+				log->log.name, log->log.update_index))
+			continue;
+
+		if ((error = git_reftable_writer_add_log(w, &log->log)) < 0)
+			goto done;
+	}
+
+	if ((error = git_reftable_writer_finish(w)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+	error = stack_table_open(out, backend, name.ptr);
+
+done:
+	git_reftable_writer_free(w);
+	git_filebuf_cleanup(&file);
+	git_buf_free(&name);
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Merge the tables `start` to the end of `stack` into one table. The
+ * deletions are only kept if there are older tables left.
+ */
+static int write_merged_table(
+	stack_table **out, refdb_reftable *backend, reftable_stack *stack, size_t start)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_reftable_writer *w = NULL;
+	git_buf name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	merged_iter mi;
+	merged_sub *sub;
+	stack_table *t;
+	uint64_t min = UINT64_MAX, max = stack_max_update_index(stack);
+	bool keep_deletions = start > 0;
+	size_t i;
+	int error;
+
+	memset(&mi, 0, sizeof(mi));
+
+	for (i = start; i < stack->tables.length; i++) {
+		t = git_vector_get(&stack->tables, i);
+		min = min(min, git_reftable_min_update_index(t->table));
+	}
+
+	if ((error = stack_table_name(&name, min, max)) < 0 ||
+		(error = git_buf_joinpath(&path, backend->path, name.ptr)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr, 0, GIT_REFTABLE_FILE_MODE)) < 0 ||
+		(error = git_reftable_writer_new(&w, &file, min, max)) < 0 ||
+		(error = merged_init(&mi, stack, start, stack->tables.length, false, "")) < 0)
+		goto done;
+
+	while ((error = merged_next(&sub, &mi)) == 0) {
+		if (!keep_deletions && sub->ref.type == GIT_REFTABLE_REF_DELETION)
+			continue;
+
+		if ((error = git_reftable_writer_add_ref(w, &sub->ref)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	merged_dispose(&mi);
+
+	if ((error = merged_init(&mi, stack, start, stack->tables.length, true, "")) < 0)
+		goto done;
+
+	while ((error = merged_next(&sub, &mi)) == 0) {
+		if (!keep_deletions && sub->log.type == GIT_REFTABLE_LOG_DELETION)
+			continue;
+
+		if ((error = git_reftable_writer_add_log(w, &sub->log)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER ||
+		(error = git_reftable_writer_finish(w)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+	error = stack_table_open(out, backend, name.ptr);
+
+done:
+	merged_dispose(&mi);
+	git_reftable_writer_free(w);
+	git_filebuf_cleanup(&file);
+	git_buf_free(&name);
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * The first of the newest tables which have to be merged for the size
+ * of every table to be at least twice the size of the next one.
+ */
+static size_t compaction_start(reftable_stack *stack)
+{
+	stack_table *t;
+	size_t start = stack->tables.length, total = 0;
+
+	while (start > 0) {
+		t = git_vector_get(&stack->tables, start - 1);
+
+		if (total && git_reftable_size(t->table) >= COMPACTION_FACTOR * total)
+			break;
+
+		total += git_reftable_size(t->table);
+		start--;
+	}
+
+	return start;
+}
+
+static int remove_table(refdb_reftable *backend, const char *name)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_buf_joinpath(&path, backend->path, name)) == 0 &&
+		p_unlink(path.ptr) < 0 && errno != ENOENT) {
+		/* readers which still have it open may keep it on some systems */
+		error = 0;
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+/*
+ * Replace the tables `start` and after of the locked stack with
+ * `merged`, write `tables.list` and release its lock.
+ */
+static int stack_commit(
+	refdb_reftable *backend, reftable_batch *batch,
+	reftable_stack *stack, size_t start, stack_table *merged)
+{
+	reftable_stack *result = NULL;
+	stack_table *t;
+	size_t i;
+	int error;
+
+	if ((error = stack_new(&result)) < 0)
+		return error;
+
+	for (i = 0; i < start && !error; i++)
+		error = stack_push(result, git_vector_get(&stack->tables, i));
+
+	if (!error && merged)
+		error = stack_push(result, merged);
+
+	git_vector_foreach(&result->tables, i, t) {
+		if (error < 0)
+			break;
+
+		error = git_filebuf_printf(&batch->list_lock, "%s\n", t->name);
+	}
+
+	if (error < 0 || (error = git_filebuf_commit(&batch->list_lock)) < 0) {
+		stack_release(result);
+		return error;
+	}
+
+	for (i = start; i < stack->tables.length; i++) {
+		t = git_vector_get(&stack->tables, i);
+		if (t != merged)
+			remove_table(backend, t->name);
+	}
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		stack_release(result);
+		giterr_set(GITERR_OS, "Failed to lock reftable stack");
+		return -1;
+	}
+
+	stack_release(backend->stack);
+	backend->stack = result;
+	git_futils_filestamp_set(&backend->stamp, NULL);
+
+	git_mutex_unlock(&backend->lock);
+	return 0;
+}
+
+/* Write the batch as a new table and compact the stack if needed */
+static int batch_commit(refdb_reftable *backend, reftable_batch *batch)
+{
+	reftable_stack *stack = NULL;
+	stack_table *added = NULL, *merged = NULL;
+	size_t i, start;
+	int error;
+
+	if (!batch->refs.length && !batch->logs.length) {
+		git_filebuf_cleanup(&batch->list_lock);
+		return 0;
+	}
+
+	if ((error = write_batch_table(&added, backend, batch)) < 0)
+		goto done;
+
+	/* the stack with the new table on top */
+	if ((error = stack_new(&stack)) < 0)
+		goto done;
+
+	for (i = 0; i < batch->stack->tables.length && !error; i++)
+		error = stack_push(stack, git_vector_get(&batch->stack->tables, i));
+
+	if (error < 0 || (error = stack_push(stack, added)) < 0)
+		goto done;
+
+	start = compaction_start(stack);
+
+	if (start + 1 < stack->tables.length) {
+		if ((error = write_merged_table(&merged, backend, stack, start)) < 0)
+			goto done;
+	} else {
+		merged = added;
+		GIT_REFCOUNT_INC(merged);
+	}
+
+	error = stack_commit(backend, batch, stack, start, merged);
+
+done:
+	/* `tables.list` was not written, nobody knows the new tables */
+	if (error < 0) {
+		git_filebuf_cleanup(&batch->list_lock);
+
+		if (added)
+			remove_table(backend, added->name);
+		if (merged && merged != added)
+			remove_table(backend, merged->name);
+	}
+
+	if (merged)
+		GIT_REFCOUNT_DEC(merged, stack_table_free);
+	if (added)
+		GIT_REFCOUNT_DEC(added, stack_table_free);
+
+	stack_release(stack);
+	return error;
+}
+
+/* Write the batch of a single update unless it failed, and free it */
+static int batch_close(refdb_reftable *backend, reftable_batch *batch, int error)
+{
+	if (error >= 0)
+		error = batch_commit(backend, batch);
+
+	batch_free(batch);
+	return error;
+}
+
+static int batch_add_ref(
+	reftable_batch *batch, const char *name, unsigned int type,
+	const git_oid *id, const git_oid *peel, const char *target)
+{
+	batch_ref *ref = git_pool_mallocz(&batch->pool, sizeof(batch_ref));
+
+	GITERR_CHECK_ALLOC(ref);
+
+	ref->seq = batch->seq++;
+	ref->ref.type = type;
+	ref->ref.name = git_pool_strdup(&batch->pool, name);
+	GITERR_CHECK_ALLOC(ref->ref.name);
+
+	if (id)
+		git_oid_cpy(&ref->ref.id, id);
+	if (peel)
+		git_oid_cpy(&ref->ref.peel, peel);
+	if (target) {
+		ref->ref.target = git_pool_strdup(&batch->pool, target);
+		GITERR_CHECK_ALLOC(ref->ref.target);
+	}
+
+	return git_vector_insert(&batch->refs, ref);
+}
+
+static int batch_add_log(
+	reftable_batch *batch, const git_reftable_log *log, bool fresh_index)
+{
+	batch_log *entry = git_pool_mallocz(&batch->pool, sizeof(batch_log));
+
+	GITERR_CHECK_ALLOC(entry);
+	memcpy(&entry->log, log, sizeof(*log));
+
+	entry->seq = batch->seq++;
+	entry->log.name = git_pool_strdup(&batch->pool, log->name);
+	GITERR_CHECK_ALLOC(entry->log.name);
+
+	if (fresh_index)
+		entry->log.update_index = batch->next_update_index++;
+
+	if (log->type == GIT_REFTABLE_LOG_UPDATE) {
+		entry->log.who_name = git_pool_strdup(&batch->pool, log->who_name);
+		entry->log.email = git_pool_strdup(&batch->pool, log->email);
+		entry->log.message = git_pool_strdup(&batch->pool, log->message ? log->message : "");
+
+		if (!entry->log.who_name || !entry->log.email || !entry->log.message)
+			return -1;
+	}
+
+	return git_vector_insert(&batch->logs, entry);
+}
+
+static int batch_add_log_entry(
+	reftable_batch *batch, const char *name,
+	const git_oid *old_id, const git_oid *new_id,
+	const git_signature *who, const char *message)
+{
+	git_reftable_log log;
+
+	memset(&log, 0, sizeof(log));
+	log.name = name;
+	log.type = GIT_REFTABLE_LOG_UPDATE;
+	git_oid_cpy(&log.old_id, old_id);
+	git_oid_cpy(&log.new_id, new_id);
+	log.who_name = who->name;
+	log.email = who->email;
+	log.time = who->when.time;
+	log.tz_offset = who->when.offset;
+	log.message = message;
+
+	return batch_add_log(batch, &log, true);
+}
+
+/* The logs of a reference have a marker which says it has a log */
+static int batch_add_log_marker(reftable_batch *batch, const char *name)
+{
+	static const git_oid zero = {{0}};
+	git_signature who;
+
+	memset(&who, 0, sizeof(who));
+	who.name = who.email = "";
+
+	return batch_add_log_entry(batch, name, &zero, &zero, &who, NULL);
+}
+
+static bool is_log_marker(const git_reftable_log *log)
+{
+	return git_oid_iszero(&log->old_id) && git_oid_iszero(&log->new_id);
+}
+
+/* Call `cb` for every log record of `name`, the newest first */
+static int stack_foreach_log(
+	reftable_stack *stack, const char *name,
+	int (*cb)(const git_reftable_log *log, void *payload), void *payload)
+{
+	merged_iter mi;
+	merged_sub *sub;
+	int error;
+
+	if ((error = merged_init(&mi, stack, 0, stack->tables.length, true, name)) < 0)
+		goto done;
+
+	while ((error = merged_next(&sub, &mi)) == 0) {
+		if (strcmp(sub->log.name, name))
+			break;
+
+		if (sub->log.type == GIT_REFTABLE_LOG_DELETION)
+			continue;
+
+		if ((error = cb(&sub->log, payload)) != 0)
+			break;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	merged_dispose(&mi);
+	return error;
+}
+
+static int has_log_cb(const git_reftable_log *log, void *payload)
+{
+	GIT_UNUSED(log);
+	*(int *)payload = 1;
+	return 1;
+}
+
+static int stack_has_log(int *out, reftable_stack *stack, const char *name)
+{
+	int error;
+
+	*out = 0;
+	error = stack_foreach_log(stack, name, has_log_cb, out);
+
+	return (error == 1) ? 0 : error;
+}
+
+static int should_write_reflog(
+	int *write, refdb_reftable *backend, reftable_batch *batch, const char *name)
+{
+	int error, logall;
+
+	if ((error = git_repository__cvar(&logall, backend->repo, GIT_CVAR_LOGALLREFUPDATES)) < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(backend->repo);
+
+	*write = 0;
+
+	if (!logall)
+		return 0;
+
+	if (!git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+		!git__strcmp(name, GIT_HEAD_FILE) ||
+		!git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+		!git__prefixcmp(name, GIT_REFS_NOTES_DIR)) {
+		*write = 1;
+		return 0;
+	}
+
+	return stack_has_log(write, batch->stack, name);
+}
+
+/* The id a reference resolves to in the locked stack, or zero */
+static int resolve_id(git_oid *out, reftable_batch *batch, const char *name)
+{
+	git_reference *ref = NULL;
+	int error, nesting;
+
+	memset(out, 0, sizeof(*out));
+
+	for (nesting = 0; nesting < MAX_NESTING_LEVEL; nesting++) {
+		git_reference *next = NULL;
+
+		error = stack_lookup(&next, batch->stack, ref ? ref->target.symbolic : name);
+		git_reference_free(ref);
+		ref = next;
+
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			return 0;
+		}
+
+		if (error < 0)
+			return error;
+
+		if (ref->type == GIT_REF_OID) {
+			git_oid_cpy(out, &ref->target.oid);
+			break;
+		}
+	}
+
+	git_reference_free(ref);
+	return 0;
+}
+
+/* The same rules as for the reflogs of the filesystem backend */
+static int reflog_append(
+	reftable_batch *batch, const git_reference *ref,
+	const git_oid *old, const git_oid *new,
+	const git_signature *who, const char *message)
+{
+	git_oid old_id, new_id;
+	int error, is_symbolic = (ref->type == GIT_REF_SYMBOLIC);
+
+	/* "normal" symbolic updates do not write */
+	if (is_symbolic && strcmp(ref->name, GIT_HEAD_FILE) && !(old && new))
+		return 0;
+
+	if (old)
+		git_oid_cpy(&old_id, old);
+	else if ((error = resolve_id(&old_id, batch, ref->name)) < 0)
+		return error;
+
+	if (new) {
+		git_oid_cpy(&new_id, new);
+	} else if (!is_symbolic) {
+		git_oid_cpy(&new_id, &ref->target.oid);
+	} else {
+		if ((error = resolve_id(&new_id, batch, ref->target.symbolic)) < 0)
+			return error;
+
+		/* detaching HEAD does not create an entry */
+		if (git_oid_iszero(&new_id))
+			return 0;
+	}
+
+	return batch_add_log_entry(batch, ref->name, &old_id, &new_id, who, message);
+}
+
+/* See the filesystem backend: HEAD's log follows the branch it is on */
+static int maybe_append_head(
+	reftable_batch *batch, const git_reference *ref,
+	const git_signature *who, const char *message)
+{
+	git_reference *head = NULL, *tmp = NULL;
+	git_oid old_id;
+	int error, nesting;
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		return 0;
+
+	if ((error = resolve_id(&old_id, batch, ref->name)) < 0)
+		return error;
+
+	if ((error = stack_lookup(&head, batch->stack, GIT_HEAD_FILE)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		return error;
+	}
+
+	/* go down the symref chain until we find the branch */
+	for (nesting = 0; nesting < MAX_NESTING_LEVEL; nesting++) {
+		const git_reference *cur = tmp ? tmp : head;
+		git_reference *next;
+
+		if (cur->type != GIT_REF_SYMBOLIC)
+			break;
+
+		if (!strcmp(cur->target.symbolic, ref->name)) {
+			error = reflog_append(batch, head, &old_id, &ref->target.oid, who, message);
+			break;
+		}
+
+		if ((error = stack_lookup(&next, batch->stack, cur->target.symbolic)) < 0) {
+			if (error == GIT_ENOTFOUND) {
+				giterr_clear();
+				error = 0;
+			}
+			break;
+		}
+
+		git_reference_free(tmp);
+		tmp = next;
+	}
+
+	git_reference_free(tmp);
+	git_reference_free(head);
+	return error;
+}
+
+static int cmp_old_ref(
+	int *cmp, reftable_batch *batch, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	git_reference *old_ref = NULL;
+	int error;
+
+	*cmp = 0;
+
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if ((error = stack_lookup(&old_ref, batch->stack, name)) < 0)
+		return error;
+
+	if (old_id && old_ref->type != GIT_REF_OID)
+		*cmp = -1;
+	else if (old_target && old_ref->type != GIT_REF_SYMBOLIC)
+		*cmp = 1;
+	else if (old_id)
+		*cmp = git_oid_cmp(old_id, &old_ref->target.oid);
+	else
+		*cmp = git__strcmp(old_target, old_ref->target.symbolic);
+
+	git_reference_free(old_ref);
+	return 0;
+}
+
+/* Whether a reference is in the way of a directory for `new_ref`, or below it */
+static int reference_path_available(
+	reftable_batch *batch, const char *new_ref, const char *old_ref, int force)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_ref rec;
+	git_buf name = GIT_BUF_INIT;
+	const char *slash;
+	merged_iter mi;
+	merged_sub *sub;
+	int error = 0;
+
+	memset(&mi, 0, sizeof(mi));
+
+	if (!force) {
+		if ((error = stack_find_ref(&rec, &iter, batch->stack, new_ref)) == 0) {
+			giterr_set(GITERR_REFERENCE,
+				"Failed to write reference '%s': a reference with "
+				"that name already exists.", new_ref);
+			error = GIT_EEXISTS;
+			goto done;
+		}
+		if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	for (slash = strchr(new_ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		git_buf_clear(&name);
+		if ((error = git_buf_put(&name, new_ref, slash - new_ref)) < 0)
+			goto done;
+
+		if (old_ref && !strcmp(old_ref, name.ptr))
+			continue;
+
+		if ((error = stack_find_ref(&rec, &iter, batch->stack, name.ptr)) == 0)
+			goto collides;
+		if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	git_buf_clear(&name);
+	if ((error = git_buf_printf(&name, "%s/", new_ref)) < 0 ||
+		(error = merged_init(&mi, batch->stack, 0,
+			batch->stack->tables.length, false, name.ptr)) < 0)
+		goto done;
+
+	while ((error = merged_next(&sub, &mi)) == 0) {
+		if (git__prefixcmp(sub->ref.name, name.ptr))
+			break;
+
+		if (sub->ref.type != GIT_REFTABLE_REF_DELETION &&
+			(!old_ref || strcmp(old_ref, sub->ref.name)))
+			goto collides;
+	}
+
+	error = 0;
+	goto done;
+
+collides:
+	giterr_set(GITERR_REFERENCE,
+		"Path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	merged_dispose(&mi);
+	git_reftable_iter_dispose(&iter);
+	git_buf_free(&name);
+	return error;
+}
+
+static int write_ref(
+	refdb_reftable *backend, reftable_batch *batch,
+	const git_reference *ref, int update_reflog,
+	const git_signature *who, const char *message,
+	const git_oid *old_id, const char *old_target)
+{
+	const char *new_target = NULL;
+	const git_oid *new_id = NULL;
+	int error, cmp, should_write;
+
+	if ((error = cmp_old_ref(&cmp, batch, ref->name, old_id, old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		new_target = ref->target.symbolic;
+	else
+		new_id = &ref->target.oid;
+
+	error = cmp_old_ref(&cmp, batch, ref->name, new_id, new_target);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp)
+		return 0;
+
+	giterr_clear();
+
+	if (update_reflog) {
+		if ((error = should_write_reflog(&should_write, backend, batch, ref->name)) < 0)
+			return error;
+
+		if (should_write &&
+			((error = reflog_append(batch, ref, NULL, NULL, who, message)) < 0 ||
+			 (error = maybe_append_head(batch, ref, who, message)) < 0))
+			return error;
+	}
+
+	if (ref->type == GIT_REF_SYMBOLIC)
+		return batch_add_ref(batch, ref->name,
+			GIT_REFTABLE_REF_SYMREF, NULL, NULL, ref->target.symbolic);
+
+	if (!git_oid_iszero(&ref->peel))
+		return batch_add_ref(batch, ref->name,
+			GIT_REFTABLE_REF_VAL2, &ref->target.oid, &ref->peel, NULL);
+
+	return batch_add_ref(batch, ref->name,
+		GIT_REFTABLE_REF_VAL1, &ref->target.oid, NULL, NULL);
+}
+
+static int delete_ref(
+	reftable_batch *batch, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_ref rec;
+	int error, cmp;
+
+	if ((error = cmp_old_ref(&cmp, batch, name, old_id, old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	error = stack_find_ref(&rec, &iter, batch->stack, name);
+	git_reftable_iter_dispose(&iter);
+
+	if (error == GIT_ENOTFOUND)
+		return ref_error_notfound(name);
+	if (error < 0)
+		return error;
+
+	return batch_add_ref(batch, name, GIT_REFTABLE_REF_DELETION, NULL, NULL, NULL);
+}
+
+static int refdb_reftable__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error;
+
+	assert(backend);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	if ((error = reference_path_available(batch, ref->name, NULL, force)) == 0)
+		error = write_ref(backend, batch, ref, true, who, message, old_id, old_target);
+
+	return batch_close(backend, batch, error);
+}
+
+static int refdb_reftable__del(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id, const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error;
+
+	assert(backend && ref_name);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	error = delete_ref(batch, ref_name, old_id, old_target);
+	return batch_close(backend, batch, error);
+}
+
+static int log_copy_cb(const git_reftable_log *log, void *payload)
+{
+	reftable_batch *batch = payload;
+	git_reftable_log deletion;
+
+	memset(&deletion, 0, sizeof(deletion));
+	deletion.name = log->name;
+	deletion.update_index = log->update_index;
+	deletion.type = GIT_REFTABLE_LOG_DELETION;
+
+	return batch_add_log(batch, &deletion, false);
+}
+
+/* Drop the logs of `name`, the stored ones and the ones of the batch */
+static int delete_logs(reftable_batch *batch, const char *name)
+{
+	batch_log *log;
+	size_t i;
+
+	git_vector_rforeach(&batch->logs, i, log) {
+		if (!strcmp(log->log.name, name))
+			git_vector_remove(&batch->logs, i);
+	}
+
+	return stack_foreach_log(batch->stack, name, log_copy_cb, batch);
+}
+
+typedef struct {
+	reftable_batch *batch;
+	const char *new_name;
+} rename_payload;
+
+static int log_rename_cb(const git_reftable_log *log, void *payload)
+{
+	rename_payload *rename = payload;
+	git_reftable_log copy;
+
+	memcpy(&copy, log, sizeof(copy));
+	copy.name = rename->new_name;
+
+	return batch_add_log(rename->batch, &copy, false);
+}
+
+static int rename_logs(reftable_batch *batch, const char *old_name, const char *new_name)
+{
+	rename_payload payload = { batch, new_name };
+	int error;
+
+	if ((error = delete_logs(batch, new_name)) < 0 ||
+		(error = stack_foreach_log(batch->stack, old_name, log_rename_cb, &payload)) < 0)
+		return error;
+
+	return delete_logs(batch, old_name);
+}
+
+static int refdb_reftable__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	git_reference *old = NULL, *new = NULL;
+	int error;
+
+	assert(backend);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	if ((error = reference_path_available(batch, new_name, old_name, force)) < 0 ||
+		(error = stack_lookup(&old, batch->stack, old_name)) < 0 ||
+		(error = batch_add_ref(batch, old_name, GIT_REFTABLE_REF_DELETION, NULL, NULL, NULL)) < 0)
+		goto done;
+
+	if ((new = git_reference__set_name(old, new_name)) == NULL) {
+		error = -1;
+		goto done;
+	}
+	old = NULL;
+
+	/* the log is moved along, and tells about the rename */
+	if ((error = rename_logs(batch, old_name, new_name)) < 0 ||
+		(error = reflog_append(batch, new,
+			new->type == GIT_REF_OID ? &new->target.oid : NULL, NULL, who, message)) < 0)
+		goto done;
+
+	if (new->type == GIT_REF_SYMBOLIC)
+		error = batch_add_ref(batch, new_name,
+			GIT_REFTABLE_REF_SYMREF, NULL, NULL, new->target.symbolic);
+	else
+		error = batch_add_ref(batch, new_name,
+			git_oid_iszero(&new->peel) ? GIT_REFTABLE_REF_VAL1 : GIT_REFTABLE_REF_VAL2,
+			&new->target.oid, &new->peel, NULL);
+
+done:
+	error = batch_close(backend, batch, error);
+
+	if (!error && out)
+		*out = new;
+	else
+		git_reference_free(new);
+
+	git_reference_free(old);
+	return error;
+}
+
+/* Merge the whole stack into a single table */
+static int refdb_reftable__compress(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	reftable_stack *stack;
+	stack_table *merged = NULL;
+	int error;
+
+	assert(backend);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	stack = batch->stack;
+
+	if (stack->tables.length > 1 &&
+		(error = write_merged_table(&merged, backend, stack, 0)) == 0) {
+		error = stack_commit(backend, batch, stack, 0, merged);
+		GIT_REFCOUNT_DEC(merged, stack_table_free);
+	}
+
+	/* there is nothing left to write */
+	batch_free(batch);
+	return error;
+}
+
+static int refdb_reftable__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error, has_log;
+
+	assert(backend && name);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_has_log(&has_log, stack, name);
+	stack_release(stack);
+
+	return error < 0 ? error : has_log;
+}
+
+static int refdb_reftable__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error, has_log;
+
+	assert(backend && name);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	if ((error = stack_has_log(&has_log, batch->stack, name)) == 0 && !has_log)
+		error = batch_add_log_marker(batch, name);
+
+	return batch_close(backend, batch, error);
+}
+
+static int reflog_alloc(git_reflog **out, const char *name)
+{
+	git_reflog *log = git__calloc(1, sizeof(git_reflog));
+	GITERR_CHECK_ALLOC(log);
+
+	if ((log->ref_name = git__strdup(name)) == NULL ||
+		git_vector_init(&log->entries, 0, NULL) < 0) {
+		git__free(log->ref_name);
+		git__free(log);
+		return -1;
+	}
+
+	*out = log;
+	return 0;
+}
+
+static int reflog_read_cb(const git_reftable_log *log, void *payload)
+{
+	git_reflog *reflog = payload;
+	git_reflog_entry *entry;
+
+	if (is_log_marker(log))
+		return 0;
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid_old, &log->old_id);
+	git_oid_cpy(&entry->oid_cur, &log->new_id);
+
+	if ((entry->committer = git__calloc(1, sizeof(git_signature))) == NULL ||
+		(entry->committer->name = git__strdup(log->who_name)) == NULL ||
+		(entry->committer->email = git__strdup(log->email)) == NULL ||
+		(*log->message && (entry->msg = git__strdup(log->message)) == NULL) ||
+		git_vector_insert(&reflog->entries, entry) < 0) {
+		git_reflog_entry__free(entry);
+		return -1;
+	}
+
+	entry->committer->when.time = log->time;
+	entry->committer->when.offset = log->tz_offset;
+	return 0;
+}
+
+static int refdb_reftable__reflog_read(
+	git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack = NULL;
+	git_reflog *log = NULL;
+	size_t i, n;
+	int error;
+
+	assert(out && backend && name);
+
+	if ((error = reflog_alloc(&log, name)) < 0 ||
+		(error = stack_get(&stack, backend)) < 0 ||
+		(error = stack_foreach_log(stack, name, reflog_read_cb, log)) < 0)
+		goto done;
+
+	/* the entries of a reflog go from the oldest to the newest */
+	for (i = 0, n = log->entries.length; i < n / 2; i++) {
+		void *tmp = log->entries.contents[i];
+		log->entries.contents[i] = log->entries.contents[n - i - 1];
+		log->entries.contents[n - i - 1] = tmp;
+	}
+
+	*out = log;
+	log = NULL;
+
+done:
+	git_reflog_free(log);
+	stack_release(stack);
+	return error;
+}
+
+static int batch_reflog_write(reftable_batch *batch, git_reflog *reflog)
+{
+	git_reflog_entry *entry;
+	size_t i;
+	int error;
+
+	/* the new entries get new update indices, so the old ones are dropped */
+	if ((error = delete_logs(batch, reflog->ref_name)) < 0)
+		return error;
+
+	if (!reflog->entries.length)
+		error = batch_add_log_marker(batch, reflog->ref_name);
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		if (error < 0)
+			break;
+
+		error = batch_add_log_entry(batch, reflog->ref_name,
+			&entry->oid_old, &entry->oid_cur, entry->committer, entry->msg);
+	}
+
+	return error;
+}
+
+static int refdb_reftable__reflog_write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error;
+
+	assert(backend && reflog);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	error = batch_reflog_write(batch, reflog);
+	return batch_close(backend, batch, error);
+}
+
+static int refdb_reftable__reflog_rename(
+	git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	error = rename_logs(batch, old_name, new_name);
+	return batch_close(backend, batch, error);
+}
+
+static int refdb_reftable__reflog_delete(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = batch_open(&batch, backend)) < 0)
+		return error;
+
+	error = delete_logs(batch, name);
+	return batch_close(backend, batch, error);
+}
+
+/*
+ * A transaction holds the lock of the whole stack from its first
+ * reference on, so the writes made outside of it fail until it ends.
+ */
+static int refdb_reftable__transaction_begin(void **out, git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+
+	assert(backend);
+
+	return batch_open((reftable_batch **)out, backend);
+}
+
+static int refdb_reftable__transaction_reflog_write(
+	git_refdb_backend *_backend, void *payload, git_reflog *reflog)
+{
+	GIT_UNUSED(_backend);
+
+	return batch_reflog_write(payload, reflog);
+}
+
+static int refdb_reftable__transaction_commit(git_refdb_backend *_backend, void *payload)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+
+	return batch_commit(backend, payload);
+}
+
+static void refdb_reftable__transaction_free(git_refdb_backend *_backend, void *payload)
+{
+	GIT_UNUSED(_backend);
+
+	batch_free(payload);
+}
+
+static int refdb_reftable__lock(void **out, git_refdb_backend *_backend, const char *refname)
+{
+	GIT_UNUSED(_backend);
+	GIT_UNUSED(refname);
+
+	/* the batch holds the lock of the whole stack, and is the payload */
+	assert(*out);
+
+	return 0;
+}
+
+static int refdb_reftable__unlock(
+	git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+	const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_batch *batch = payload;
+
+	if (success == 2)
+		return delete_ref(batch, ref->name, NULL, NULL);
+	else if (success)
+		return write_ref(backend, batch, ref, update_reflog, sig, message, NULL, NULL);
+
+	return 0;
+}
+
+static void refdb_reftable__free(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+
+	assert(backend);
+
+	stack_release(backend->stack);
+	git_mutex_free(&backend->lock);
+	git__free(backend->path);
+	git__free(backend->list_path);
+	git__free(backend);
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repository)
+{
+	git_buf path = GIT_BUF_INIT;
+	refdb_reftable *backend;
+
+	assert(backend_out && repository);
+
+	if (!repository->path_repository) {
+		giterr_set(GITERR_REFERENCE, "The reftable backend needs a repository on disk");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->repo = repository;
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize reftable lock");
+		git__free(backend);
+		return -1;
+	}
+
+	if (git_buf_joinpath(&path, repository->path_repository, GIT_REFTABLE_DIR) < 0)
+		goto fail;
+
+	backend->path = git_buf_detach(&path);
+
+	if (git_buf_joinpath(&path, backend->path, GIT_REFTABLE_LIST_FILE) < 0)
+		goto fail;
+
+	backend->list_path = git_buf_detach(&path);
+
+	backend->parent.version = GIT_REFDB_BACKEND_VERSION;
+	backend->parent.exists = &refdb_reftable__exists;
+	backend->parent.lookup = &refdb_reftable__lookup;
+	backend->parent.iterator = &refdb_reftable__iterator;
+	backend->parent.write = &refdb_reftable__write;
+	backend->parent.del = &refdb_reftable__del;
+	backend->parent.rename = &refdb_reftable__rename;
+	backend->parent.compress = &refdb_reftable__compress;
+	backend->parent.lock = &refdb_reftable__lock;
+	backend->parent.unlock = &refdb_reftable__unlock;
+	backend->parent.has_log = &refdb_reftable__has_log;
+	backend->parent.ensure_log = &refdb_reftable__ensure_log;
+	backend->parent.free = &refdb_reftable__free;
+	backend->parent.reflog_read = &refdb_reftable__reflog_read;
+	backend->parent.reflog_write = &refdb_reftable__reflog_write;
+	backend->parent.reflog_rename = &refdb_reftable__reflog_rename;
+	backend->parent.reflog_delete = &refdb_reftable__reflog_delete;
+	backend->parent.transaction_begin = &refdb_reftable__transaction_begin;
+	backend->parent.transaction_reflog_write = &refdb_reftable__transaction_reflog_write;
+	backend->parent.transaction_commit = &refdb_reftable__transaction_commit;
+	backend->parent.transaction_free = &refdb_reftable__transaction_free;
+
+	*backend_out = (git_refdb_backend *)backend;
+	return 0;
+
+fail:
+	git_buf_free(&path);
+	git_mutex_free(&backend->lock);
+	git__free(backend->path);
+	git__free(backend);
+	return -1;
+}
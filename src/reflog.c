@@ -142,6 +142,61 @@ int git_reflog_delete(git_repository *repo, const char *name)
 	return refdb->backend->reflog_delete(refdb->backend, name);
 }
 
+int git_reflog_iterator_new(git_reflog_iterator **out, git_repository *repo, const char *name)
+{
+	git_refdb *refdb;
+	int error;
+
+	assert(out && repo && name);
+
+	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0)
+		return error;
+
+	return git_refdb_reflog_iterator(out, refdb, name);
+}
+
+int git_reflog_iterator_next(const git_reflog_entry **out, git_reflog_iterator *iter)
+{
+	assert(out && iter);
+	return iter->next(out, iter);
+}
+
+int git_reflog_iterator_entry_byindex(const git_reflog_entry **out, git_reflog_iterator *iter, size_t idx)
+{
+	assert(out && iter);
+	return iter->entry_byindex(out, iter, idx);
+}
+
+void git_reflog_iterator_free(git_reflog_iterator *iter)
+{
+	if (iter == NULL)
+		return;
+
+	iter->free(iter);
+}
+
+int git_reflog_expire_init_options(git_reflog_expire_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_reflog_expire_options, GIT_REFLOG_EXPIRE_OPTIONS_INIT);
+	return 0;
+}
+
+int git_reflog_expire(size_t *removed, git_repository *repo, const char *name, const git_reflog_expire_options *opts)
+{
+	git_refdb *refdb;
+	int error;
+
+	assert(repo && name && opts);
+
+	GITERR_CHECK_VERSION(opts, GIT_REFLOG_EXPIRE_OPTIONS_VERSION, "git_reflog_expire_options");
+
+	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0)
+		return error;
+
+	return git_refdb_reflog_expire(removed, refdb, name, opts);
+}
+
 size_t git_reflog_entrycount(git_reflog *reflog)
 {
 	assert(reflog);
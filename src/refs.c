@@ -732,6 +732,37 @@ int git_reference_iterator_glob_new(
 	return git_refdb_iterator(out, refdb, glob);
 }
 
+int git_reference_iterator_prefix_new(
+	git_reference_iterator **out, git_repository *repo, const char *prefix)
+{
+	git_refdb *refdb;
+	git_buf glob = GIT_BUF_INIT;
+	const char *p;
+	int error;
+
+	assert(out && repo && prefix);
+
+	if (git_repository_refdb__weakptr(&refdb, repo) < 0)
+		return -1;
+
+	/* backends only take globs; a trailing star matches across slashes */
+	for (p = prefix; *p; p++) {
+		if (strchr("*?[\\", *p))
+			git_buf_putc(&glob, '\\');
+		git_buf_putc(&glob, *p);
+	}
+
+	git_buf_putc(&glob, '*');
+
+	if (git_buf_oom(&glob))
+		return -1;
+
+	error = git_refdb_iterator(out, refdb, glob.ptr);
+
+	git_buf_free(&glob);
+	return error;
+}
+
 int git_reference_next(git_reference **out, git_reference_iterator *iter)
 {
 	return git_refdb_iterator_next(out, iter);
@@ -0,0 +1,1219 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+#include "fileops.h"
+
+#include <zlib.h>
+
+#define REFTABLE_VERSION 1
+#define HEADER_SIZE 24
+#define FOOTER_SIZE 68
+#define BLOCK_HEADER_SIZE 4
+#define RESTART_INTERVAL 16
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+struct git_reftable {
+	git_map map;
+	const unsigned char *data;
+	size_t size;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	/* where the sections start and end; they are empty if start == end */
+	size_t ref_start, ref_end;
+	size_t ref_index_pos;
+	size_t log_start, log_end;
+	size_t log_index_pos;
+};
+
+static int reftable_error(const char *message)
+{
+	giterr_set(GITERR_REFERENCE, "Corrupted reftable - %s", message);
+	return -1;
+}
+
+static uint64_t get_be(const unsigned char *p, size_t n)
+{
+	uint64_t value = 0;
+
+	while (n--)
+		value = (value << 8) | *p++;
+
+	return value;
+}
+
+static void put_be(unsigned char *p, uint64_t value, size_t n)
+{
+	while (n--) {
+		p[n] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+/* The same variable-length integers as the offsets of ofs-deltas */
+static int put_varint(git_buf *buf, uint64_t value)
+{
+	unsigned char varint[16];
+	size_t pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 127;
+	while (value >>= 7)
+		varint[--pos] = 128 | (--value & 127);
+
+	return git_buf_put(buf, (const char *)varint + pos, sizeof(varint) - pos);
+}
+
+static int get_varint(uint64_t *out, const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *s = *p;
+	uint64_t value;
+	unsigned char c;
+
+	if (s >= end)
+		return -1;
+
+	c = *s++;
+	value = c & 127;
+
+	while (c & 128) {
+		if (s >= end || value >= (UINT64_MAX >> 7))
+			return -1;
+
+		c = *s++;
+		value = ((value + 1) << 7) + (c & 127);
+	}
+
+	*p = s;
+	*out = value;
+	return 0;
+}
+
+static int get_string(
+	git_buf *out, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t len;
+
+	if (get_varint(&len, p, end) < 0 || len > (uint64_t)(end - *p))
+		return -1;
+
+	git_buf_clear(out);
+	if (git_buf_put(out, (const char *)*p, (size_t)len) < 0)
+		return -1;
+
+	*p += len;
+	return 0;
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (cmp)
+		return cmp;
+
+	return (a_len < b_len) ? -1 : (a_len > b_len);
+}
+
+/* The key of a log record: the name, a NUL and the reversed update index */
+static int log_key(git_buf *out, const char *name, uint64_t update_index)
+{
+	unsigned char index[8];
+
+	put_be(index, UINT64_MAX - update_index, 8);
+
+	git_buf_clear(out);
+	git_buf_puts(out, name);
+	git_buf_putc(out, '\0');
+	return git_buf_put(out, (const char *)index, sizeof(index));
+}
+
+/*
+ * Reading tables
+ */
+
+int git_reftable_open(git_reftable **out, const char *path)
+{
+	git_reftable *table;
+	const unsigned char *footer;
+	struct stat st;
+	size_t footer_pos, starts[4], i;
+	uint64_t ref_index_pos, obj_pos, obj_index_pos, log_pos, log_index_pos;
+	git_file fd;
+	int error;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_OS, "Failed to stat '%s'", path);
+		return -1;
+	}
+
+	if (!git__is_sizet(st.st_size) || (size_t)st.st_size < HEADER_SIZE + FOOTER_SIZE) {
+		p_close(fd);
+		return reftable_error("the file is too small");
+	}
+
+	table = git__calloc(1, sizeof(git_reftable));
+	if (!table) {
+		p_close(fd);
+		return -1;
+	}
+
+	error = git_futils_mmap_ro(&table->map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0) {
+		git__free(table);
+		return error;
+	}
+
+	table->data = table->map.data;
+	table->size = (size_t)st.st_size;
+
+	footer_pos = table->size - FOOTER_SIZE;
+	footer = table->data + footer_pos;
+
+	/* the footer starts with a copy of the header */
+	if (memcmp(footer, "REFT", 4) != 0 || footer[4] != REFTABLE_VERSION ||
+		memcmp(table->data, footer, HEADER_SIZE) != 0) {
+		error = reftable_error("invalid header");
+		goto fail;
+	}
+
+	if (crc32(0, footer, FOOTER_SIZE - 4) != get_be(footer + FOOTER_SIZE - 4, 4)) {
+		error = reftable_error("footer checksum mismatch");
+		goto fail;
+	}
+
+	table->block_size = (uint32_t)get_be(footer + 5, 3);
+	table->min_update_index = get_be(footer + 8, 8);
+	table->max_update_index = get_be(footer + 16, 8);
+
+	ref_index_pos = get_be(footer + 24, 8);
+	obj_pos = get_be(footer + 32, 8) >> 5;
+	obj_index_pos = get_be(footer + 40, 8);
+	log_pos = get_be(footer + 48, 8);
+	log_index_pos = get_be(footer + 56, 8);
+
+	if (ref_index_pos > footer_pos || obj_pos > footer_pos ||
+		obj_index_pos > footer_pos || log_pos > footer_pos ||
+		log_index_pos > footer_pos) {
+		error = reftable_error("invalid section offsets");
+		goto fail;
+	}
+
+	table->ref_index_pos = (size_t)ref_index_pos;
+	table->log_index_pos = (size_t)log_index_pos;
+
+	/* a section ends where the next one starts */
+	starts[0] = (size_t)ref_index_pos;
+	starts[1] = (size_t)obj_pos;
+	starts[2] = (size_t)obj_index_pos;
+	starts[3] = (size_t)log_pos;
+
+	table->ref_end = footer_pos;
+	for (i = 0; i < ARRAY_SIZE(starts); i++)
+		if (starts[i] && starts[i] < table->ref_end)
+			table->ref_end = starts[i];
+
+	/* the first block tells whether there are refs or only logs */
+	if (footer_pos > HEADER_SIZE && table->data[HEADER_SIZE] == BLOCK_TYPE_LOG)
+		table->ref_end = 0;
+	else if (footer_pos == HEADER_SIZE)
+		table->ref_end = 0;
+
+	if (log_pos || (footer_pos > HEADER_SIZE && table->data[HEADER_SIZE] == BLOCK_TYPE_LOG)) {
+		table->log_start = (size_t)log_pos;
+		table->log_end = log_index_pos ? (size_t)log_index_pos : footer_pos;
+	}
+
+	*out = table;
+	return 0;
+
+fail:
+	git_reftable_free(table);
+	return error;
+}
+
+void git_reftable_free(git_reftable *table)
+{
+	if (!table)
+		return;
+
+	git_futils_mmap_free(&table->map);
+	git__free(table);
+}
+
+uint64_t git_reftable_min_update_index(const git_reftable *table)
+{
+	return table->min_update_index;
+}
+
+uint64_t git_reftable_max_update_index(const git_reftable *table)
+{
+	return table->max_update_index;
+}
+
+size_t git_reftable_size(const git_reftable *table)
+{
+	return table->size;
+}
+
+static int inflate_block(
+	git_reftable_iter *iter, const unsigned char *block, size_t header_len,
+	size_t block_len, size_t available, size_t *compressed_len)
+{
+	z_stream zs;
+	int status;
+
+	git_buf_clear(&iter->inflated);
+	if (git_buf_grow(&iter->inflated, block_len + 1) < 0)
+		return -1;
+
+	memcpy(iter->inflated.ptr, block, header_len);
+
+	memset(&zs, 0, sizeof(zs));
+	zs.next_in = (Bytef *)block + header_len;
+	zs.avail_in = (uInt)min(available - header_len, (size_t)UINT_MAX);
+	zs.next_out = (Bytef *)iter->inflated.ptr + header_len;
+	zs.avail_out = (uInt)(block_len - header_len);
+
+	if (inflateInit(&zs) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate log block");
+		return -1;
+	}
+
+	status = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (status != Z_STREAM_END || zs.avail_out != 0)
+		return reftable_error("invalid log block");
+
+	iter->inflated.size = block_len;
+	iter->inflated.ptr[block_len] = '\0';
+
+	*compressed_len = header_len + zs.total_in;
+	return 0;
+}
+
+/* Load the block at `off`, which has to be of type `type` */
+static int iter_load_block(git_reftable_iter *iter, size_t off, char type, size_t end)
+{
+	git_reftable *table = iter->table;
+	const unsigned char *block = table->data + off;
+	size_t header_off = off ? 0 : HEADER_SIZE, block_len, full_len;
+
+	if (off + header_off + BLOCK_HEADER_SIZE > end)
+		return reftable_error("truncated block");
+
+	if (block[header_off] != type)
+		return reftable_error("unexpected block type");
+
+	block_len = (size_t)get_be(block + header_off + 1, 3);
+
+	if (block_len < header_off + BLOCK_HEADER_SIZE + 2)
+		return reftable_error("invalid block length");
+
+	if (type == BLOCK_TYPE_LOG) {
+		if (inflate_block(iter, block, header_off + BLOCK_HEADER_SIZE,
+				block_len, end - off, &full_len) < 0)
+			return -1;
+
+		block = (const unsigned char *)iter->inflated.ptr;
+	} else {
+		if (block_len > end - off)
+			return reftable_error("truncated block");
+
+		full_len = block_len;
+
+		/* blocks may be padded up to the block size */
+		if (table->block_size && block_len < table->block_size &&
+			table->block_size <= end - off && block[block_len] == 0)
+			full_len = table->block_size;
+	}
+
+	iter->block = block;
+	iter->block_off = off;
+	iter->block_len = block_len;
+	iter->header_off = header_off;
+	iter->next_block_off = off + full_len;
+	iter->restart_count = (size_t)get_be(block + block_len - 2, 2);
+
+	if (iter->restart_count * 3 + 2 > block_len - header_off - BLOCK_HEADER_SIZE)
+		return reftable_error("invalid restart points");
+
+	iter->restart_off = block_len - 2 - iter->restart_count * 3;
+	iter->pos = header_off + BLOCK_HEADER_SIZE;
+	git_buf_clear(&iter->key);
+
+	return 0;
+}
+
+/* Decode the key of the record at `*p`, after the one in `key` */
+static int decode_key(
+	git_buf *key, unsigned int *extra,
+	const unsigned char **p, const unsigned char *end)
+{
+	uint64_t prefix_len, suffix;
+
+	if (get_varint(&prefix_len, p, end) < 0 ||
+		get_varint(&suffix, p, end) < 0 ||
+		prefix_len > key->size || (suffix >> 3) > (uint64_t)(end - *p))
+		return reftable_error("invalid record key");
+
+	*extra = (unsigned int)(suffix & 7);
+
+	git_buf_truncate(key, (size_t)prefix_len);
+	if (git_buf_put(key, (const char *)*p, (size_t)(suffix >> 3)) < 0)
+		return -1;
+
+	*p += suffix >> 3;
+	return 0;
+}
+
+static int decode_ref(
+	git_reftable_ref *out, git_reftable_iter *iter,
+	unsigned int type, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t delta;
+
+	memset(out, 0, sizeof(*out));
+	out->name = iter->key.ptr;
+	out->type = type;
+
+	if (get_varint(&delta, p, end) < 0)
+		goto corrupted;
+
+	out->update_index = iter->table->min_update_index + delta;
+
+	switch (type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+	case GIT_REFTABLE_REF_VAL2:
+		if ((size_t)(end - *p) < GIT_OID_RAWSZ * (type == GIT_REFTABLE_REF_VAL2 ? 2 : 1))
+			goto corrupted;
+
+		git_oid_fromraw(&out->id, *p);
+		*p += GIT_OID_RAWSZ;
+
+		if (type == GIT_REFTABLE_REF_VAL2) {
+			git_oid_fromraw(&out->peel, *p);
+			*p += GIT_OID_RAWSZ;
+		}
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		if (get_string(&iter->strings[0], p, end) < 0)
+			goto corrupted;
+
+		out->target = iter->strings[0].ptr;
+		break;
+	default:
+		goto corrupted;
+	}
+
+	return 0;
+
+corrupted:
+	return reftable_error("invalid ref record");
+}
+
+static int decode_log(
+	git_reftable_log *out, git_reftable_iter *iter,
+	unsigned int type, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t time;
+	size_t name_len;
+
+	memset(out, 0, sizeof(*out));
+
+	/* the key is the name, a NUL and the reversed update index */
+	if (iter->key.size < 9 || iter->key.ptr[iter->key.size - 9] != '\0')
+		goto corrupted;
+
+	name_len = iter->key.size - 9;
+	if (memchr(iter->key.ptr, '\0', name_len) != NULL)
+		goto corrupted;
+
+	out->name = iter->key.ptr;
+	out->update_index = UINT64_MAX -
+		get_be((const unsigned char *)iter->key.ptr + name_len + 1, 8);
+	out->type = type;
+
+	if (type == GIT_REFTABLE_LOG_DELETION)
+		return 0;
+
+	if (type != GIT_REFTABLE_LOG_UPDATE ||
+		(size_t)(end - *p) < 2 * GIT_OID_RAWSZ)
+		goto corrupted;
+
+	git_oid_fromraw(&out->old_id, *p);
+	git_oid_fromraw(&out->new_id, *p + GIT_OID_RAWSZ);
+	*p += 2 * GIT_OID_RAWSZ;
+
+	if (get_string(&iter->strings[0], p, end) < 0 ||
+		get_string(&iter->strings[1], p, end) < 0 ||
+		get_varint(&time, p, end) < 0 ||
+		end - *p < 2)
+		goto corrupted;
+
+	out->time = (git_time_t)time;
+	out->tz_offset = (int16_t)get_be(*p, 2);
+	*p += 2;
+
+	if (get_string(&iter->strings[2], p, end) < 0)
+		goto corrupted;
+
+	out->who_name = iter->strings[0].ptr;
+	out->email = iter->strings[1].ptr;
+	out->message = iter->strings[2].ptr;
+
+	return 0;
+
+corrupted:
+	return reftable_error("invalid log record");
+}
+
+static int decode_index(
+	uint64_t *out, const unsigned char **p, const unsigned char *end)
+{
+	if (get_varint(out, p, end) < 0)
+		return reftable_error("invalid index record");
+
+	return 0;
+}
+
+/*
+ * Decode the record at the position of the iterator and move on. For
+ * an index block, the position of the block is put in `index_pos`.
+ */
+static int iter_decode(
+	git_reftable_iter *iter, void *out, uint64_t *index_pos)
+{
+	const unsigned char *p = iter->block + iter->pos;
+	const unsigned char *end = iter->block + iter->restart_off;
+	unsigned int extra;
+	int error;
+
+	if ((error = decode_key(&iter->key, &extra, &p, end)) < 0)
+		return error;
+
+	if (index_pos)
+		error = decode_index(index_pos, &p, end);
+	else if (iter->section == BLOCK_TYPE_REF)
+		error = decode_ref(out, iter, extra, &p, end);
+	else
+		error = decode_log(out, iter, extra, &p, end);
+
+	iter->pos = p - iter->block;
+	return error;
+}
+
+/*
+ * Position the iterator on the first record of the block whose key is
+ * `key` or after it. Returns GIT_ITEROVER if all are before.
+ */
+static int iter_block_seek(git_reftable_iter *iter, const char *key, size_t key_len)
+{
+	git_buf prev = GIT_BUF_INIT;
+	git_reftable_ref ref;
+	git_reftable_log log;
+	uint64_t index_pos;
+	size_t lo = 0, hi = iter->restart_count, pos;
+	bool is_index = (iter->block[iter->header_off] == BLOCK_TYPE_INDEX);
+	int error = 0;
+
+	/* find the first restart point after the key */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const unsigned char *p;
+		unsigned int extra;
+
+		pos = (size_t)get_be(iter->block + iter->restart_off + mid * 3, 3);
+		if (pos >= iter->restart_off)
+			return reftable_error("invalid restart point");
+
+		p = iter->block + pos;
+		git_buf_clear(&iter->key);
+
+		if ((error = decode_key(&iter->key, &extra, &p, iter->block + iter->restart_off)) < 0)
+			return error;
+
+		if (key_cmp(iter->key.ptr, iter->key.size, key, key_len) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	iter->pos = lo ?
+		(size_t)get_be(iter->block + iter->restart_off + (lo - 1) * 3, 3) :
+		iter->header_off + BLOCK_HEADER_SIZE;
+	git_buf_clear(&iter->key);
+
+	/* and then the first record from there */
+	while (iter->pos < iter->restart_off) {
+		pos = iter->pos;
+
+		git_buf_clear(&prev);
+		if ((error = git_buf_set(&prev, iter->key.ptr, iter->key.size)) < 0)
+			break;
+
+		if (is_index)
+			error = iter_decode(iter, NULL, &index_pos);
+		else
+			error = iter_decode(iter, iter->section == BLOCK_TYPE_REF ?
+				(void *)&ref : (void *)&log, NULL);
+
+		if (error < 0)
+			break;
+
+		if (key_cmp(iter->key.ptr, iter->key.size, key, key_len) >= 0) {
+			iter->pos = pos;
+			git_buf_swap(&iter->key, &prev);
+			break;
+		}
+	}
+
+	git_buf_free(&prev);
+
+	if (!error && iter->pos >= iter->restart_off)
+		error = GIT_ITEROVER;
+
+	return error;
+}
+
+static int iter_seek(
+	git_reftable_iter *iter, git_reftable *table, char section,
+	const char *key, size_t key_len)
+{
+	size_t index_pos;
+	uint64_t pos;
+	int error;
+
+	iter->table = table;
+	iter->section = section;
+
+	if (section == BLOCK_TYPE_REF) {
+		iter->section_end = table->ref_end;
+		index_pos = table->ref_index_pos;
+		iter->next_block_off = table->ref_start;
+	} else {
+		iter->section_end = table->log_end;
+		index_pos = table->log_index_pos;
+		iter->next_block_off = table->log_start;
+	}
+
+	iter->block = NULL;
+
+	if (iter->next_block_off >= iter->section_end)
+		return 0;
+
+	/* without an index, look at the blocks one after the other */
+	if (!index_pos) {
+		while (iter->next_block_off < iter->section_end) {
+			if ((error = iter_load_block(iter, iter->next_block_off,
+					section, iter->section_end)) < 0)
+				return error;
+
+			if ((error = iter_block_seek(iter, key, key_len)) != GIT_ITEROVER)
+				return error;
+		}
+
+		return 0;
+	}
+
+	pos = index_pos;
+
+	for (;;) {
+		/* the index may have several levels */
+		bool is_index = pos && table->data[pos] == BLOCK_TYPE_INDEX;
+
+		if ((error = iter_load_block(iter, (size_t)pos,
+				is_index ? BLOCK_TYPE_INDEX : section,
+				is_index ? table->size - FOOTER_SIZE : iter->section_end)) < 0)
+			return error;
+
+		error = iter_block_seek(iter, key, key_len);
+
+		if (!is_index)
+			return (error == GIT_ITEROVER) ? 0 : error;
+
+		/* everything is before the key */
+		if (error == GIT_ITEROVER) {
+			iter->block = NULL;
+			iter->next_block_off = iter->section_end;
+			return 0;
+		}
+
+		if (error < 0 || (error = iter_decode(iter, NULL, &pos)) < 0)
+			return error;
+
+		if (pos >= table->size - FOOTER_SIZE)
+			return reftable_error("invalid index record");
+	}
+}
+
+int git_reftable_iter_seek_ref(
+	git_reftable_iter *iter, git_reftable *table, const char *name)
+{
+	return iter_seek(iter, table, BLOCK_TYPE_REF, name, strlen(name));
+}
+
+int git_reftable_iter_seek_log(
+	git_reftable_iter *iter, git_reftable *table, const char *name)
+{
+	/* the NUL which follows the name comes before any update index */
+	return iter_seek(iter, table, BLOCK_TYPE_LOG, name, strlen(name) + 1);
+}
+
+static int iter_next(git_reftable_iter *iter, void *out)
+{
+	int error;
+
+	while (!iter->block || iter->pos >= iter->restart_off) {
+		if (iter->next_block_off >= iter->section_end)
+			return GIT_ITEROVER;
+
+		if ((error = iter_load_block(iter, iter->next_block_off,
+				iter->section, iter->section_end)) < 0)
+			return error;
+	}
+
+	return iter_decode(iter, out, NULL);
+}
+
+int git_reftable_iter_next_ref(git_reftable_ref *out, git_reftable_iter *iter)
+{
+	assert(iter->section == BLOCK_TYPE_REF);
+	return iter_next(iter, out);
+}
+
+int git_reftable_iter_next_log(git_reftable_log *out, git_reftable_iter *iter)
+{
+	assert(iter->section == BLOCK_TYPE_LOG);
+	return iter_next(iter, out);
+}
+
+void git_reftable_iter_dispose(git_reftable_iter *iter)
+{
+	size_t i;
+
+	git_buf_free(&iter->inflated);
+	git_buf_free(&iter->key);
+
+	for (i = 0; i < ARRAY_SIZE(iter->strings); i++)
+		git_buf_free(&iter->strings[i]);
+
+	iter->block = NULL;
+}
+
+/*
+ * Writing tables
+ */
+
+typedef struct {
+	char *key;
+	size_t key_len;
+	uint64_t pos;
+} index_entry;
+
+typedef git_array_t(index_entry) index_array;
+
+/* A block being filled with records */
+typedef struct {
+	char type;
+	size_t header_off;
+	git_buf data;
+	git_buf last_key;
+	git_array_t(uint32_t) restarts;
+	size_t entries;
+} block_writer;
+
+struct git_reftable_writer {
+	git_filebuf *file;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint32_t block_size;
+
+	/* the number of bytes written so far */
+	size_t offset;
+
+	block_writer block;
+	bool has_block;
+	index_array index;
+	git_buf record;
+
+	char section;
+	uint64_t ref_index_pos;
+	uint64_t log_pos;
+	uint64_t log_index_pos;
+	bool has_refs;
+};
+
+static void index_clear(index_array *index)
+{
+	index_entry *entry;
+	size_t i;
+
+	for (i = 0; i < git_array_size(*index); i++) {
+		entry = git_array_get(*index, i);
+		git__free(entry->key);
+	}
+
+	git_array_clear(*index);
+}
+
+static void write_header(unsigned char *out, git_reftable_writer *w)
+{
+	memcpy(out, "REFT", 4);
+	out[4] = REFTABLE_VERSION;
+	put_be(out + 5, w->block_size, 3);
+	put_be(out + 8, w->min_update_index, 8);
+	put_be(out + 16, w->max_update_index, 8);
+}
+
+int git_reftable_writer_new(
+	git_reftable_writer **out,
+	git_filebuf *file,
+	uint64_t min_update_index,
+	uint64_t max_update_index)
+{
+	git_reftable_writer *w = git__calloc(1, sizeof(git_reftable_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	w->file = file;
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->block_size = GIT_REFTABLE_BLOCK_SIZE;
+
+	*out = w;
+	return 0;
+}
+
+static int write_data(git_reftable_writer *w, const void *data, size_t len)
+{
+	if (git_filebuf_write(w->file, data, len) < 0)
+		return -1;
+
+	w->offset += len;
+	return 0;
+}
+
+static void block_start(git_reftable_writer *w, char type)
+{
+	block_writer *b = &w->block;
+
+	git_buf_clear(&b->data);
+	git_array_clear(b->restarts);
+
+	b->type = type;
+	b->entries = 0;
+	b->header_off = w->offset ? 0 : HEADER_SIZE;
+
+	/* the first block holds the file header */
+	if (b->header_off) {
+		git_buf_grow(&b->data, HEADER_SIZE);
+		write_header((unsigned char *)b->data.ptr, w);
+		b->data.size = HEADER_SIZE;
+	}
+
+	git_buf_putc(&b->data, type);
+	git_buf_put(&b->data, "\0\0\0", 3);
+
+	w->has_block = true;
+}
+
+/*
+ * Encode a record for the current block into `w->record`, with its key
+ * stored in full when it is a restart point.
+ */
+static int encode_key(
+	git_reftable_writer *w, const char *key, size_t key_len, unsigned int extra)
+{
+	block_writer *b = &w->block;
+	size_t prefix = 0;
+
+	git_buf_clear(&w->record);
+
+	if (b->entries % RESTART_INTERVAL) {
+		size_t max = min(key_len, b->last_key.size);
+
+		while (prefix < max && b->last_key.ptr[prefix] == key[prefix])
+			prefix++;
+	}
+
+	put_varint(&w->record, prefix);
+	put_varint(&w->record, ((uint64_t)(key_len - prefix) << 3) | extra);
+	return git_buf_put(&w->record, key + prefix, key_len - prefix);
+}
+
+static bool block_fits(git_reftable_writer *w, bool restart)
+{
+	block_writer *b = &w->block;
+	size_t restarts = git_array_size(b->restarts) + (restart ? 1 : 0);
+
+	return b->data.size + w->record.size + restarts * 3 + 2 <= w->block_size;
+}
+
+static int block_add(git_reftable_writer *w, const char *key, size_t key_len)
+{
+	block_writer *b = &w->block;
+
+	if (!(b->entries % RESTART_INTERVAL)) {
+		uint32_t *restart = git_array_alloc(b->restarts);
+		GITERR_CHECK_ALLOC(restart);
+
+		*restart = (uint32_t)b->data.size;
+	}
+
+	b->entries++;
+
+	git_buf_clear(&b->last_key);
+	if (git_buf_put(&b->last_key, key, key_len) < 0 ||
+		git_buf_put(&b->data, w->record.ptr, w->record.size) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int deflate_block(git_buf *out, const char *data, size_t len)
+{
+	z_stream zs;
+	int status;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to compress log block");
+		return -1;
+	}
+
+	if (git_buf_grow(out, out->size + deflateBound(&zs, (uLong)len)) < 0) {
+		deflateEnd(&zs);
+		return -1;
+	}
+
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+	zs.next_out = (Bytef *)out->ptr + out->size;
+	zs.avail_out = (uInt)(out->asize - out->size);
+
+	status = deflate(&zs, Z_FINISH);
+	out->size += zs.total_out;
+	deflateEnd(&zs);
+
+	if (status != Z_STREAM_END) {
+		giterr_set(GITERR_ZLIB, "Failed to compress log block");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write out the current block and remember it in `index` */
+static int block_flush(git_reftable_writer *w, index_array *index)
+{
+	block_writer *b = &w->block;
+	index_entry *entry;
+	unsigned char *restart;
+	uint32_t *pos;
+	size_t i, block_len, header_len = b->header_off + BLOCK_HEADER_SIZE;
+	git_buf compressed = GIT_BUF_INIT;
+	int error;
+
+	if (!w->has_block || !b->entries)
+		return 0;
+
+	for (i = 0; i < git_array_size(b->restarts); i++) {
+		unsigned char offset[3];
+
+		pos = git_array_get(b->restarts, i);
+		put_be(offset, *pos, 3);
+		git_buf_put(&b->data, (const char *)offset, 3);
+	}
+
+	if (git_buf_grow(&b->data, b->data.size + 2) < 0)
+		return -1;
+
+	restart = (unsigned char *)b->data.ptr + b->data.size;
+	put_be(restart, git_array_size(b->restarts), 2);
+	b->data.size += 2;
+
+	block_len = b->data.size;
+	put_be((unsigned char *)b->data.ptr + b->header_off + 1, block_len, 3);
+
+	entry = git_array_alloc(*index);
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->pos = w->offset;
+	entry->key_len = b->last_key.size;
+	entry->key = git__malloc(b->last_key.size + 1);
+	GITERR_CHECK_ALLOC(entry->key);
+	memcpy(entry->key, b->last_key.ptr, b->last_key.size + 1);
+
+	if (b->type == BLOCK_TYPE_LOG) {
+		if ((error = git_buf_put(&compressed, b->data.ptr, header_len)) == 0 &&
+			(error = deflate_block(&compressed,
+				b->data.ptr + header_len, block_len - header_len)) == 0)
+			error = write_data(w, compressed.ptr, compressed.size);
+
+		git_buf_free(&compressed);
+	} else {
+		error = write_data(w, b->data.ptr, block_len);
+
+		/* ref blocks are aligned to the block size */
+		while (!error && b->type == BLOCK_TYPE_REF && block_len < w->block_size) {
+			static const char zeroes[256];
+			size_t n = min(sizeof(zeroes), w->block_size - block_len);
+
+			error = write_data(w, zeroes, n);
+			block_len += n;
+		}
+	}
+
+	w->has_block = false;
+	return error;
+}
+
+static int writer_add(
+	git_reftable_writer *w, char type,
+	const char *key, size_t key_len, unsigned int extra, const git_buf *value)
+{
+	block_writer *b = &w->block;
+	int error;
+
+	if (b->last_key.size &&
+		key_cmp(key, key_len, b->last_key.ptr, b->last_key.size) <= 0) {
+		giterr_set(GITERR_INVALID, "reftable records must be added in order");
+		return -1;
+	}
+
+	if (!w->has_block)
+		block_start(w, type);
+
+	if ((error = encode_key(w, key, key_len, extra)) < 0 ||
+		(error = git_buf_put(&w->record, value->ptr, value->size)) < 0)
+		return error;
+
+	if (b->entries && !block_fits(w, !(b->entries % RESTART_INTERVAL))) {
+		if ((error = block_flush(w, &w->index)) < 0)
+			return error;
+
+		block_start(w, type);
+
+		/* the first record of a block is a restart point */
+		if ((error = encode_key(w, key, key_len, extra)) < 0 ||
+			(error = git_buf_put(&w->record, value->ptr, value->size)) < 0)
+			return error;
+	}
+
+	return block_add(w, key, key_len);
+}
+
+/*
+ * Write the index of the blocks of the section which was just written,
+ * with as many levels as it takes for the top one to fit in a block.
+ */
+static int write_index(uint64_t *out, git_reftable_writer *w)
+{
+	index_array level = GIT_ARRAY_INIT;
+	git_buf value = GIT_BUF_INIT;
+	index_entry *entry;
+	size_t i;
+	int error = 0;
+
+	*out = 0;
+
+	while (git_array_size(w->index) > 1) {
+		/* the entries of this level, which get indexed in turn */
+		memcpy(&level, &w->index, sizeof(level));
+		memset(&w->index, 0, sizeof(w->index));
+		git_buf_clear(&w->block.last_key);
+
+		for (i = 0; i < git_array_size(level); i++) {
+			entry = git_array_get(level, i);
+
+			git_buf_clear(&value);
+			if ((error = put_varint(&value, entry->pos)) < 0 ||
+				(error = writer_add(w, BLOCK_TYPE_INDEX,
+					entry->key, entry->key_len, 0, &value)) < 0)
+				goto done;
+		}
+
+		*out = w->offset;
+		if ((error = block_flush(w, &w->index)) < 0)
+			goto done;
+
+		index_clear(&level);
+	}
+
+done:
+	index_clear(&level);
+	index_clear(&w->index);
+	git_buf_clear(&w->block.last_key);
+	git_buf_free(&value);
+	return error;
+}
+
+static int finish_refs(git_reftable_writer *w)
+{
+	int error;
+
+	if (w->section != BLOCK_TYPE_REF)
+		return 0;
+
+	if ((error = block_flush(w, &w->index)) < 0 ||
+		(error = write_index(&w->ref_index_pos, w)) < 0)
+		return error;
+
+	w->section = 0;
+	return 0;
+}
+
+int git_reftable_writer_add_ref(git_reftable_writer *w, const git_reftable_ref *ref)
+{
+	git_buf value = GIT_BUF_INIT;
+	int error;
+
+	if (w->section && w->section != BLOCK_TYPE_REF) {
+		giterr_set(GITERR_INVALID, "reftable refs must come before the logs");
+		return -1;
+	}
+
+	if (ref->update_index < w->min_update_index ||
+		ref->update_index > w->max_update_index) {
+		giterr_set(GITERR_INVALID, "update index out of the reftable's range");
+		return -1;
+	}
+
+	w->section = BLOCK_TYPE_REF;
+	w->has_refs = true;
+
+	put_varint(&value, ref->update_index - w->min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		git_buf_put(&value, (const char *)ref->id.id, GIT_OID_RAWSZ);
+		git_buf_put(&value, (const char *)ref->peel.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+		git_buf_put(&value, (const char *)ref->id.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		put_varint(&value, strlen(ref->target));
+		git_buf_puts(&value, ref->target);
+		break;
+	default:
+		giterr_set(GITERR_INVALID, "invalid reftable record type");
+		git_buf_free(&value);
+		return -1;
+	}
+
+	if ((error = git_buf_oom(&value) ? -1 : 0) == 0)
+		error = writer_add(w, BLOCK_TYPE_REF,
+			ref->name, strlen(ref->name), ref->type, &value);
+
+	git_buf_free(&value);
+	return error;
+}
+
+int git_reftable_writer_add_log(git_reftable_writer *w, const git_reftable_log *log)
+{
+	git_buf key = GIT_BUF_INIT, value = GIT_BUF_INIT;
+	unsigned char tz[2];
+	int error;
+
+	if (log->update_index < w->min_update_index ||
+		log->update_index > w->max_update_index) {
+		giterr_set(GITERR_INVALID, "update index out of the reftable's range");
+		return -1;
+	}
+
+	if ((error = finish_refs(w)) < 0)
+		return error;
+
+	/* the log section may begin right after the header */
+	if (w->section != BLOCK_TYPE_LOG) {
+		w->section = BLOCK_TYPE_LOG;
+		w->log_pos = w->offset;
+	}
+
+	if (log->type == GIT_REFTABLE_LOG_UPDATE) {
+		git_buf_put(&value, (const char *)log->old_id.id, GIT_OID_RAWSZ);
+		git_buf_put(&value, (const char *)log->new_id.id, GIT_OID_RAWSZ);
+		put_varint(&value, strlen(log->who_name));
+		git_buf_puts(&value, log->who_name);
+		put_varint(&value, strlen(log->email));
+		git_buf_puts(&value, log->email);
+		put_varint(&value, (uint64_t)log->time);
+		put_be(tz, (uint16_t)(int16_t)log->tz_offset, 2);
+		git_buf_put(&value, (const char *)tz, 2);
+		put_varint(&value, log->message ? strlen(log->message) : 0);
+		git_buf_puts(&value, log->message ? log->message : "");
+	}
+
+	if ((error = log_key(&key, log->name, log->update_index)) == 0 &&
+		(error = git_buf_oom(&value) ? -1 : 0) == 0)
+		error = writer_add(w, BLOCK_TYPE_LOG, key.ptr, key.size, log->type, &value);
+
+	git_buf_free(&key);
+	git_buf_free(&value);
+	return error;
+}
+
+int git_reftable_writer_finish(git_reftable_writer *w)
+{
+	unsigned char footer[FOOTER_SIZE];
+	int error;
+
+	if ((error = finish_refs(w)) < 0)
+		return error;
+
+	if (w->section == BLOCK_TYPE_LOG &&
+		((error = block_flush(w, &w->index)) < 0 ||
+		 (error = write_index(&w->log_index_pos, w)) < 0))
+		return error;
+
+	/* an empty table still has its header */
+	if (!w->offset) {
+		write_header(footer, w);
+		if ((error = write_data(w, footer, HEADER_SIZE)) < 0)
+			return error;
+	}
+
+	write_header(footer, w);
+	put_be(footer + 24, w->ref_index_pos, 8);
+	put_be(footer + 32, 0, 8);
+	put_be(footer + 40, 0, 8);
+	put_be(footer + 48, w->log_pos, 8);
+	put_be(footer + 56, w->log_index_pos, 8);
+	put_be(footer + 64, crc32(0, footer, FOOTER_SIZE - 4), 4);
+
+	return write_data(w, footer, FOOTER_SIZE);
+}
+
+void git_reftable_writer_free(git_reftable_writer *w)
+{
+	if (!w)
+		return;
+
+	index_clear(&w->index);
+	git_buf_free(&w->block.data);
+	git_buf_free(&w->block.last_key);
+	git_array_clear(w->block.restarts);
+	git_buf_free(&w->record);
+	git__free(w);
+}
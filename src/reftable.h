@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+#include "git2/oid.h"
+#include "git2/types.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "map.h"
+
+/*
+ * A reftable is an immutable file holding references and their logs.
+ *
+ * The references are sorted by name and stored in blocks of a fixed
+ * size. Within a block, each name only stores the suffix which differs
+ * from the previous name, and every few records a "restart point" stores
+ * the full name so that the block can be binary-searched. When there is
+ * more than one block, an index of the last name of every block points
+ * to the block which may hold a name. The logs come after the refs, in
+ * compressed blocks of their own, keyed by the reference name and the
+ * reverse of the update index so that the newest entry comes first.
+ *
+ * Every table covers a range of "update indices", which increase with
+ * every transaction; a stack of tables is read from the newest to the
+ * oldest, the newest record for a name winning.
+ */
+
+#define GIT_REFTABLE_DIR "reftable"
+#define GIT_REFTABLE_LIST_FILE "tables.list"
+#define GIT_REFTABLE_FILE_MODE 0644
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+
+enum {
+	GIT_REFTABLE_REF_DELETION = 0,
+	GIT_REFTABLE_REF_VAL1 = 1, /* one object id */
+	GIT_REFTABLE_REF_VAL2 = 2, /* an object id and its peeled value */
+	GIT_REFTABLE_REF_SYMREF = 3,
+};
+
+enum {
+	GIT_REFTABLE_LOG_DELETION = 0,
+	GIT_REFTABLE_LOG_UPDATE = 1,
+};
+
+/*
+ * A reference record. When it is returned by an iterator, the strings
+ * belong to the iterator and are valid until it is moved again.
+ */
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	unsigned int type;
+	git_oid id;
+	git_oid peel;
+	const char *target;
+} git_reftable_ref;
+
+/* A log record, with the same rules as for a reference record */
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	unsigned int type;
+	git_oid old_id;
+	git_oid new_id;
+	const char *who_name;
+	const char *email;
+	git_time_t time;
+	int tz_offset; /* in minutes */
+	const char *message;
+} git_reftable_log;
+
+typedef struct git_reftable git_reftable;
+
+/* Open the table at `path` */
+extern int git_reftable_open(git_reftable **out, const char *path);
+
+extern void git_reftable_free(git_reftable *table);
+
+extern uint64_t git_reftable_min_update_index(const git_reftable *table);
+extern uint64_t git_reftable_max_update_index(const git_reftable *table);
+
+/* The size of the table file, to keep the stack geometric */
+extern size_t git_reftable_size(const git_reftable *table);
+
+/*
+ * An iterator over the refs or the logs of one table. It can only be
+ * used after seeking.
+ */
+typedef struct {
+	git_reftable *table;
+	char section; /* 'r' or 'g' */
+	size_t block_off;
+	size_t next_block_off;
+	size_t section_end;
+
+	/* the current block, inflated for log blocks */
+	const unsigned char *block;
+	size_t block_len;
+	size_t header_off;
+	size_t restart_off; /* the start of the restart offsets */
+	size_t restart_count;
+	git_buf inflated;
+
+	size_t pos; /* the next record in the block */
+	git_buf key;
+	git_buf strings[4];
+} git_reftable_iter;
+
+#define GIT_REFTABLE_ITER_INIT { NULL, 0, 0, 0, 0, NULL, 0, 0, 0, 0, GIT_BUF_INIT, 0, GIT_BUF_INIT, \
+	{ GIT_BUF_INIT, GIT_BUF_INIT, GIT_BUF_INIT, GIT_BUF_INIT } }
+
+/* Position the iterator on the first reference named `name` or after */
+extern int git_reftable_iter_seek_ref(
+	git_reftable_iter *iter, git_reftable *table, const char *name);
+
+/*
+ * Return the next reference, or GIT_ITEROVER. Deletion records are
+ * returned too, they hide the references in the older tables.
+ */
+extern int git_reftable_iter_next_ref(git_reftable_ref *out, git_reftable_iter *iter);
+
+/* Position the iterator on the newest log of reference `name` or after */
+extern int git_reftable_iter_seek_log(
+	git_reftable_iter *iter, git_reftable *table, const char *name);
+
+extern int git_reftable_iter_next_log(git_reftable_log *out, git_reftable_iter *iter);
+
+extern void git_reftable_iter_dispose(git_reftable_iter *iter);
+
+/*
+ * Writing a table: the references have to be added in order of their
+ * names, then the logs in order of their names and newest first.
+ */
+typedef struct git_reftable_writer git_reftable_writer;
+
+extern int git_reftable_writer_new(
+	git_reftable_writer **out,
+	git_filebuf *file,
+	uint64_t min_update_index,
+	uint64_t max_update_index);
+
+extern int git_reftable_writer_add_ref(git_reftable_writer *w, const git_reftable_ref *ref);
+extern int git_reftable_writer_add_log(git_reftable_writer *w, const git_reftable_log *log);
+
+/* Write the remaining blocks, the indices and the footer */
+extern int git_reftable_writer_finish(git_reftable_writer *w);
+
+extern void git_reftable_writer_free(git_reftable_writer *w);
+
+/* Compare two log keys: by name, then newest first */
+GIT_INLINE(int) git_reftable_log_cmp(
+	const char *a_name, uint64_t a_index, const char *b_name, uint64_t b_index)
+{
+	int cmp = strcmp(a_name, b_name);
+
+	if (cmp)
+		return cmp;
+
+	return (a_index > b_index) ? -1 : (a_index < b_index);
+}
+
+#endif
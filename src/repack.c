@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "git2/repository.h"
+#include "git2/pack.h"
+#include "git2/odb_backend.h"
+#include "git2/sys/odb_backend.h"
+
+#include "repository.h"
+#include "odb.h"
+#include "pack.h"
+#include "midx.h"
+#include "fileops.h"
+#include "array.h"
+#include "vector.h"
+
+/*
+ * A geometric repack only rewrites the small packs: the packs are sorted
+ * by the number of objects they hold, and the smallest ones are merged
+ * (with the loose objects) into a new pack until every remaining pack is
+ * at least `geometric_factor` times as large as the next smaller one. A
+ * repository which is repacked after every push or fetch thus only ever
+ * rewrites about as much data as was added since the last repack, and
+ * the large base pack is left alone.
+ */
+
+typedef struct {
+	struct git_pack_file *pack;
+	uint32_t count;
+} repack_pack;
+
+typedef struct {
+	git_vector packs;
+	git_array_t(git_oid) loose;
+	git_buf objects_dir;
+	git_buf path;
+} repack_state;
+
+static int repack_pack_cmp(const void *a_, const void *b_)
+{
+	const repack_pack *a = a_, *b = b_;
+
+	if (a->count != b->count)
+		return (a->count < b->count) ? -1 : 1;
+
+	return strcmp(a->pack->pack_name, b->pack->pack_name);
+}
+
+/* Replace the extension of the pack path in `state->path` */
+static int pack_path_ext(
+	repack_state *state, const struct git_pack_file *p, const char *ext)
+{
+	size_t root_len = strlen(p->pack_name) - strlen(".pack");
+
+	git_buf_clear(&state->path);
+	return git_buf_put(&state->path, p->pack_name, root_len) < 0 ?
+		-1 : git_buf_puts(&state->path, ext);
+}
+
+static int load_pack_cb(void *payload, git_buf *path)
+{
+	repack_state *state = payload;
+	struct git_pack_file *p;
+	repack_pack *entry;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	/* an index without its pack is not a pack yet, or anymore */
+	if ((error = git_mwindow_get_pack(&p, path->ptr)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+	if (error < 0)
+		return error;
+
+	/* check for the .keep file anew, it may have been added since */
+	if ((error = pack_path_ext(state, p, ".keep")) < 0 ||
+		git_path_exists(state->path.ptr)) {
+		git_mwindow_put_pack(p);
+		return error;
+	}
+
+	entry = git__calloc(1, sizeof(repack_pack));
+	GITERR_CHECK_ALLOC(entry);
+	entry->pack = p;
+
+	if ((error = git_pack_object_count(&entry->count, p)) < 0 ||
+		(error = git_vector_insert(&state->packs, entry)) < 0) {
+		git_mwindow_put_pack(p);
+		git__free(entry);
+	}
+
+	return error;
+}
+
+static int load_loose_cb(const git_oid *id, void *payload)
+{
+	repack_state *state = payload;
+	git_oid *out = git_array_alloc(state->loose);
+
+	GITERR_CHECK_ALLOC(out);
+	git_oid_cpy(out, id);
+
+	return 0;
+}
+
+static int load_loose(repack_state *state)
+{
+	git_odb *loose = NULL;
+	git_odb_backend *backend;
+	int error;
+
+	if (!git_path_isdir(state->objects_dir.ptr))
+		return 0;
+
+	if ((error = git_odb_new(&loose)) < 0 ||
+		(error = git_odb_backend_loose(
+			&backend, state->objects_dir.ptr, -1, 0, 0, 0)) < 0)
+		goto done;
+
+	if ((error = git_odb_add_backend(loose, backend, 1)) < 0) {
+		backend->free(backend);
+		goto done;
+	}
+
+	error = git_odb_foreach(loose, load_loose_cb, state);
+
+done:
+	git_odb_free(loose);
+	return error;
+}
+
+/*
+ * The number of packs, starting from the smallest, which have to be
+ * merged for the sizes of the packs to form a geometric progression.
+ */
+static size_t geometric_split(
+	repack_state *state, size_t loose_count, unsigned int factor)
+{
+	repack_pack *ours, *prev;
+	uint64_t total;
+	size_t i, split;
+
+	if (!state->packs.length)
+		return 0;
+
+	/* find the largest packs which already form a progression */
+	for (i = state->packs.length - 1; i > 0; i--) {
+		ours = git_vector_get(&state->packs, i);
+		prev = git_vector_get(&state->packs, i - 1);
+
+		if ((uint64_t)ours->count < (uint64_t)factor * prev->count)
+			break;
+	}
+
+	/* the larger pack of the pair we stopped at is not part of it */
+	split = i ? i + 1 : 0;
+
+	total = loose_count;
+	for (i = 0; i < split; i++) {
+		ours = git_vector_get(&state->packs, i);
+		total += ours->count;
+	}
+
+	/* the new pack may be too large to be followed by the next packs */
+	for (i = split; i < state->packs.length; i++) {
+		ours = git_vector_get(&state->packs, i);
+
+		if ((uint64_t)ours->count >= (uint64_t)factor * total)
+			break;
+
+		total += ours->count;
+		split++;
+	}
+
+	return split;
+}
+
+static int insert_pack_entry_cb(const git_oid *id, git_off_t offset, void *payload)
+{
+	GIT_UNUSED(offset);
+	return git_packbuilder_insert(payload, id, NULL);
+}
+
+/* Whether one of the packs which are left alone has the object */
+static bool in_remaining_packs(repack_state *state, size_t split, const git_oid *id)
+{
+	struct git_pack_entry e;
+	repack_pack *entry;
+	size_t i;
+
+	for (i = split; i < state->packs.length; i++) {
+		entry = git_vector_get(&state->packs, i);
+
+		if (git_pack_entry_find(&e, entry->pack, id, GIT_OID_HEXSZ) == 0)
+			return true;
+	}
+
+	giterr_clear();
+	return false;
+}
+
+static int remove_file(const char *path)
+{
+	if (p_unlink(path) < 0 && errno != ENOENT) {
+		giterr_set(GITERR_OS, "failed to remove '%s'", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int remove_pack(repack_state *state, struct git_pack_file *p)
+{
+	static const char *exts[] = { ".pack", ".idx", ".bitmap" };
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < ARRAY_SIZE(exts) && !error; i++) {
+		if ((error = pack_path_ext(state, p, exts[i])) == 0)
+			error = remove_file(state->path.ptr);
+	}
+
+	return error;
+}
+
+static int remove_loose(repack_state *state)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < git_array_size(state->loose) && !error; i++) {
+		git_oid_tostr(hex, sizeof(hex), git_array_get(state->loose, i));
+
+		git_buf_clear(&state->path);
+		if ((error = git_buf_printf(&state->path, "%s%.2s/%s",
+				state->objects_dir.ptr, hex, hex + 2)) == 0)
+			error = remove_file(state->path.ptr);
+	}
+
+	return error;
+}
+
+int git_repository_repack(
+	git_repository *repo, const git_repository_repack_options *given_opts)
+{
+	git_repository_repack_options opts = GIT_REPOSITORY_REPACK_OPTIONS_INIT;
+	repack_state state = { GIT_VECTOR_INIT, GIT_ARRAY_INIT, GIT_BUF_INIT, GIT_BUF_INIT };
+	git_packbuilder *pb = NULL;
+	git_odb *odb;
+	const char *pack_dir;
+	char new_name[GIT_OID_HEXSZ + 1];
+	repack_pack *entry;
+	size_t i, split;
+	int error;
+
+	assert(repo);
+
+	GITERR_CHECK_VERSION(given_opts,
+		GIT_REPOSITORY_REPACK_OPTIONS_VERSION, "git_repository_repack_options");
+
+	if (given_opts)
+		memcpy(&opts, given_opts, sizeof(opts));
+
+	if (opts.geometric_factor < 2) {
+		giterr_set(GITERR_INVALID, "the geometric factor of a repack must be at least 2");
+		return -1;
+	}
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+		(error = git_odb__pack_folder(&pack_dir, odb)) < 0)
+		return error;
+
+	if ((error = git_vector_init(&state.packs, 0, repack_pack_cmp)) < 0 ||
+		(error = git_path_dirname_r(&state.objects_dir, pack_dir)) < 0 ||
+		(error = git_path_to_dir(&state.objects_dir)) < 0)
+		goto done;
+
+	if (git_path_isdir(pack_dir)) {
+		git_buf_sets(&state.path, pack_dir);
+		if ((error = git_path_direach(&state.path, 0, load_pack_cb, &state)) < 0)
+			goto done;
+	}
+
+	if (!(opts.flags & GIT_REPOSITORY_REPACK_SKIP_LOOSE) && (error = load_loose(&state)) < 0)
+		goto done;
+
+	git_vector_sort(&state.packs);
+	split = geometric_split(&state, git_array_size(state.loose), opts.geometric_factor);
+
+	/* rewriting a single pack on its own would not gain anything */
+	if (!git_array_size(state.loose) && split < 2)
+		goto done;
+
+	if ((error = git_packbuilder_new(&pb, repo)) < 0)
+		goto done;
+
+	for (i = 0; i < split; i++) {
+		entry = git_vector_get(&state.packs, i);
+
+		if ((error = git_pack_foreach_entry_offset(
+				entry->pack, insert_pack_entry_cb, pb)) < 0)
+			goto done;
+	}
+
+	/* loose objects which are packed already only need to be removed */
+	for (i = 0; i < git_array_size(state.loose); i++) {
+		const git_oid *id = git_array_get(state.loose, i);
+
+		if (!in_remaining_packs(&state, split, id) &&
+			(error = git_packbuilder_insert(pb, id, NULL)) < 0)
+			goto done;
+	}
+
+	if (!git_packbuilder_object_count(pb))
+		goto remove_loose;
+
+	/* the new pack and its index are in place before anything is removed */
+	if ((error = git_packbuilder_write(
+			pb, pack_dir, 0, opts.progress_cb, opts.progress_payload)) < 0)
+		goto done;
+
+	git_oid_tostr(new_name, sizeof(new_name), git_packbuilder_hash(pb));
+
+	for (i = 0; i < split; i++) {
+		entry = git_vector_get(&state.packs, i);
+
+		/* the same objects make for the same pack */
+		if (strstr(entry->pack->pack_name, new_name) != NULL)
+			continue;
+
+		if ((error = remove_pack(&state, entry->pack)) < 0)
+			goto done;
+	}
+
+remove_loose:
+	if ((error = remove_loose(&state)) < 0 ||
+		(error = git_odb_refresh(odb)) < 0)
+		goto done;
+
+	/* an existing multi-pack-index would no longer cover the packs */
+	git_buf_clear(&state.path);
+	if ((error = git_buf_joinpath(&state.path, pack_dir, GIT_MIDX_FILE)) == 0 &&
+		git_path_exists(state.path.ptr))
+		error = git_odb_write_multi_pack_index(odb);
+
+done:
+	git_vector_foreach(&state.packs, i, entry) {
+		git_mwindow_put_pack(entry->pack);
+		git__free(entry);
+	}
+
+	git_packbuilder_free(pb);
+	git_vector_free(&state.packs);
+	git_array_clear(state.loose);
+	git_buf_free(&state.objects_dir);
+	git_buf_free(&state.path);
+	return error;
+}
+
+int git_repository_repack_init_options(
+	git_repository_repack_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_repository_repack_options,
+		GIT_REPOSITORY_REPACK_OPTIONS_INIT);
+	return 0;
+}
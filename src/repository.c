@@ -131,6 +131,9 @@ void git_repository_free(git_repository *repo)
 	git_diff_driver_registry_free(repo->diff_drivers);
 	repo->diff_drivers = NULL;
 
+	git_graph_cache_free(repo->graph_cache);
+	repo->graph_cache = NULL;
+
 	for (i = 0; i < repo->reserved_names.size; i++)
 		git_buf_free(git_array_get(repo->reserved_names, i));
 	git_array_clear(repo->reserved_names);
@@ -22,6 +22,7 @@
 #include "attrcache.h"
 #include "submodule.h"
 #include "diff_driver.h"
+#include "graph_cache.h"
 
 #define DOT_GIT ".git"
 #define GIT_DIR DOT_GIT "/"
@@ -126,6 +127,7 @@ struct git_repository {
 	git_cache objects;
 	git_attr_cache *attrcache;
 	git_diff_driver_registry *diff_drivers;
+	git_graph_cache *graph_cache;
 
 	char *path_repository;
 	char *path_gitlink;
@@ -140,10 +140,10 @@ static int try_parse_numeric(int *n, const char *curly_braces_content)
 static int retrieve_previously_checked_out_branch_or_revision(git_object **out, git_reference **base_ref, git_repository *repo, const char *identifier, size_t position)
 {
 	git_reference *ref = NULL;
-	git_reflog *reflog = NULL;
+	git_reflog_iterator *iter = NULL;
 	regex_t preg;
 	int error = -1;
-	size_t i, numentries, cur;
+	size_t cur;
 	const git_reflog_entry *entry;
 	const char *msg;
 	regmatch_t regexmatches[2];
@@ -160,13 +160,10 @@ static int retrieve_previously_checked_out_branch_or_revision(git_object **out,
 	if (git_reference_lookup(&ref, repo, GIT_HEAD_FILE) < 0)
 		goto cleanup;
 
-	if (git_reflog_read(&reflog, repo, GIT_HEAD_FILE) < 0)
+	if (git_reflog_iterator_new(&iter, repo, GIT_HEAD_FILE) < 0)
 		goto cleanup;
 
-	numentries  = git_reflog_entrycount(reflog);
-
-	for (i = 0; i < numentries; i++) {
-		entry = git_reflog_entry_byindex(reflog, i);
+	while ((error = git_reflog_iterator_next(&entry, iter)) == 0) {
 		msg = git_reflog_entry_message(entry);
 		if (!msg)
 			continue;
@@ -192,64 +189,50 @@ static int retrieve_previously_checked_out_branch_or_revision(git_object **out,
 		goto cleanup;
 	}
 
-	error = GIT_ENOTFOUND;
+	if (error == GIT_ITEROVER)
+		error = GIT_ENOTFOUND;
 
 cleanup:
 	git_reference_free(ref);
 	git_buf_free(&buf);
 	regfree(&preg);
-	git_reflog_free(reflog);
+	git_reflog_iterator_free(iter);
 	return error;
 }
 
+/* Only the entries up to the one asked for are read */
 static int retrieve_oid_from_reflog(git_oid *oid, git_reference *ref, size_t identifier)
 {
-	git_reflog *reflog;
-	size_t numentries;
+	git_reflog_iterator *iter;
 	const git_reflog_entry *entry;
 	bool search_by_pos = (identifier <= 100000000);
+	int error;
 
-	if (git_reflog_read(&reflog, git_reference_owner(ref), git_reference_name(ref)) < 0)
+	if (git_reflog_iterator_new(&iter, git_reference_owner(ref), git_reference_name(ref)) < 0)
 		return -1;
 
-	numentries = git_reflog_entrycount(reflog);
-
 	if (search_by_pos) {
-		if (numentries < identifier + 1)
-			goto notfound;
-
-		entry = git_reflog_entry_byindex(reflog, identifier);
-		git_oid_cpy(oid, git_reflog_entry_id_new(entry));
+		error = git_reflog_iterator_entry_byindex(&entry, iter, identifier);
 	} else {
-		size_t i;
-		git_time commit_time;
-
-		for (i = 0; i < numentries; i++) {
-			entry = git_reflog_entry_byindex(reflog, i);
-			commit_time = git_reflog_entry_committer(entry)->when;
-
-			if (commit_time.time > (git_time_t)identifier)
-				continue;
-
-			git_oid_cpy(oid, git_reflog_entry_id_new(entry));
-			break;
+		while ((error = git_reflog_iterator_next(&entry, iter)) == 0) {
+			if (git_reflog_entry_committer(entry)->when.time <= (git_time_t)identifier)
+				break;
 		}
-
-		if (i == numentries)
-			goto notfound;
 	}
 
-	git_reflog_free(reflog);
-	return 0;
+	if (!error)
+		git_oid_cpy(oid, git_reflog_entry_id_new(entry));
 
-notfound:
-	giterr_set(
-		GITERR_REFERENCE,
-		"Reflog for '%s' has only %"PRIuZ" entries, asked for %"PRIuZ,
-		git_reference_name(ref), numentries, identifier);
+	if (error == GIT_ENOTFOUND || error == GIT_ITEROVER) {
+		giterr_set(
+			GITERR_REFERENCE,
+			"Reflog for '%s' has no entry for %"PRIuZ,
+			git_reference_name(ref), identifier);
+		error = GIT_ENOTFOUND;
+	}
 
-	git_reflog_free(reflog);
-	return GIT_ENOTFOUND;
+	git_reflog_iterator_free(iter);
+	return error;
 }
 
 static int retrieve_revobject_from_reflog(git_object **out, git_reference **base_ref, git_repository *repo, const char *identifier, size_t position)
@@ -13,6 +13,9 @@
 #include "common.h"
 #include "sysdir.h"
 #include "cache.h"
+#include "pack-cache.h"
+#include "odb.h"
+#include "graph_cache.h"
 #include "global.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
@@ -40,6 +43,8 @@ int git_libgit2_features()
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern size_t git_mwindow__file_limit;
+extern bool git_smart__pipelined_download;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -81,6 +86,14 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, size_t *)) = git_mwindow__mapped_limit;
 		break;
 
+	case GIT_OPT_SET_MWINDOW_FILE_LIMIT:
+		git_mwindow__file_limit = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_MWINDOW_FILE_LIMIT:
+		*(va_arg(ap, size_t *)) = git_mwindow__file_limit;
+		break;
+
 	case GIT_OPT_GET_SEARCH_PATH:
 		if ((error = config_level_to_sysdir(va_arg(ap, int))) >= 0) {
 			git_buf *out = va_arg(ap, git_buf *);
@@ -115,11 +128,67 @@ int git_libgit2_opts(int key, ...)
 		git_cache__enabled = (va_arg(ap, int) != 0);
 		break;
 
+	case GIT_OPT_ENABLE_PIPELINED_FETCH:
+		git_smart__pipelined_download = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE:
+		git_pack_cache__max_storage = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_SET_DELTA_BASE_CACHE_OBJECT_LIMIT:
+		{
+			git_otype type = (git_otype)va_arg(ap, int);
+			size_t size = va_arg(ap, size_t);
+			error = git_pack_cache_set_max_object_size(type, size);
+			break;
+		}
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *used = va_arg(ap, size_t *);
+			git_pack_cache_stats(hits, misses, used);
+			break;
+		}
+
 	case GIT_OPT_GET_CACHED_MEMORY:
 		*(va_arg(ap, ssize_t *)) = git_cache__current_storage.val;
 		*(va_arg(ap, ssize_t *)) = git_cache__max_storage;
 		break;
 
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+
+			if (hits)
+				*hits = (size_t)git_cache__hits.val;
+			if (misses)
+				*misses = (size_t)git_cache__misses.val;
+			if (evictions)
+				*evictions = (size_t)git_cache__evictions.val;
+			break;
+		}
+
+	case GIT_OPT_ENABLE_ODB_EXISTS_FILTER:
+		git_odb__exists_filter = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_GRAPH_CACHE_SIZE:
+		git_graph_cache__max_entries = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_GRAPH_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			git_graph_cache_stats(hits, misses);
+			break;
+		}
+
 	case GIT_OPT_GET_TEMPLATE_PATH:
 		{
 			git_buf *out = va_arg(ap, git_buf *);
@@ -247,3 +247,48 @@ int sha1_position(const void *table,
 
 	return -((int)lo)-1;
 }
+
+static size_t common_prefix_len(const unsigned char *a, const unsigned char *b)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_OID_RAWSZ; i++) {
+		if (a[i] != b[i])
+			return i * 2 + ((a[i] ^ b[i]) < 0x10);
+	}
+
+	return GIT_OID_HEXSZ;
+}
+
+size_t sha1_unique_prefix_len(const void *table,
+			size_t stride,
+			unsigned lo, unsigned hi, unsigned nr,
+			const unsigned char *key)
+{
+	const unsigned char *base = table;
+	size_t len = 0, common;
+	int pos, prev, next;
+
+	pos = (lo < hi) ? sha1_position(table, stride, lo, hi, key) : -1 - (int)lo;
+
+	if (pos >= 0) {
+		prev = pos - 1;
+		next = pos + 1;
+	} else {
+		prev = -pos - 2;
+		next = -pos - 1;
+	}
+
+	if (prev >= 0) {
+		common = common_prefix_len(base + prev * stride, key);
+		len = common + 1;
+	}
+
+	if (next < (int)nr) {
+		common = common_prefix_len(base + next * stride, key);
+		if (common + 1 > len)
+			len = common + 1;
+	}
+
+	return (len > GIT_OID_HEXSZ) ? GIT_OID_HEXSZ : len;
+}
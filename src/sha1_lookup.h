@@ -20,4 +20,15 @@ int sha1_position(const void *table,
 			unsigned lo, unsigned hi,
 			const unsigned char *key);
 
+/*
+ * The number of hex digits of `key` needed to tell it apart from every
+ * other entry of a sorted table of `nr` ids, `stride` bytes apart, i.e.
+ * from its neighbours in the table. `lo` and `hi` bound where `key`
+ * sorts, as for `sha1_position`. Returns 0 when there is no other entry.
+ */
+size_t sha1_unique_prefix_len(const void *table,
+			size_t stride,
+			unsigned lo, unsigned hi, unsigned nr,
+			const unsigned char *key);
+
 #endif
@@ -378,3 +378,43 @@ int git_sortedcache_remove(git_sortedcache *sc, size_t pos)
 	return 0;
 }
 
+/* remove all the matching entries from cache */
+typedef struct {
+	git_sortedcache *sc;
+	int (*match)(void *item, void *payload);
+	void *payload;
+} sortedcache_match_data;
+
+static int sortedcache_remove_match(const git_vector *v, size_t idx, void *payload)
+{
+	sortedcache_match_data *data = payload;
+	git_sortedcache *sc = data->sc;
+	char *item = git_vector_get(v, idx);
+	khiter_t mappos;
+
+	if (!data->match(item, data->payload))
+		return 0;
+
+	mappos = git_strmap_lookup_index(sc->map, item + sc->item_path_offset);
+	git_strmap_delete_at(sc->map, mappos);
+
+	if (sc->free_item)
+		sc->free_item(sc->free_item_payload, item);
+
+	return 1;
+}
+
+void git_sortedcache_remove_matching(
+	git_sortedcache *sc,
+	int (*match)(void *item, void *payload),
+	void *payload)
+{
+	sortedcache_match_data data;
+
+	data.sc = sc;
+	data.match = match;
+	data.payload = payload;
+
+	git_vector_remove_matching(&sc->items, sortedcache_remove_match, &data);
+}
+
@@ -143,6 +143,15 @@ int git_sortedcache_upsert(
  */
 int git_sortedcache_remove(git_sortedcache *sc, size_t pos);
 
+/* Removes all the entries for which `match` returns non-zero, in a
+ * single pass over the cache.
+ * You should already be holding the write lock when you call this.
+ */
+void git_sortedcache_remove_matching(
+	git_sortedcache *sc,
+	int (*match)(void *item, void *payload),
+	void *payload);
+
 /*
  * CACHE READ FUNCTIONS
  *
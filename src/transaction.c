@@ -43,6 +43,10 @@ struct git_transaction {
 
 	git_strmap *locks;
 	git_pool pool;
+
+	void *batch; /* the backend's batch for the updates, if it has one */
+
+	int packed;
 };
 
 int git_transaction_new(git_transaction **out, git_repository *repo)
@@ -93,6 +97,12 @@ int git_transaction_lock_ref(git_transaction *tx, const char *refname)
 	node->name = git_pool_strdup(&tx->pool, refname);
 	GITERR_CHECK_ALLOC(node->name);
 
+	if (!tx->batch && tx->db->backend->transaction_begin &&
+		(error = tx->db->backend->transaction_begin(&tx->batch, tx->db->backend)) < 0)
+		return error;
+
+	node->payload = tx->batch;
+
 	if ((error = git_refdb_lock(&node->payload, tx->db, refname)) < 0)
 		return error;
 
@@ -205,6 +215,14 @@ int git_transaction_remove(git_transaction *tx, const char *refname)
 	return 0;
 }
 
+int git_transaction_set_packed(git_transaction *tx, int packed)
+{
+	assert(tx);
+
+	tx->packed = packed;
+	return 0;
+}
+
 static int dup_reflog(git_reflog **out, const git_reflog *in, git_pool *pool)
 {
 	git_reflog *reflog;
@@ -264,7 +282,7 @@ int git_transaction_set_reflog(git_transaction *tx, const char *refname, const g
 	return 0;
 }
 
-static int update_target(git_refdb *db, transaction_node *node)
+static int update_target(git_refdb *db, transaction_node *node, int packed)
 {
 	git_reference *ref;
 	int error, update_reflog;
@@ -283,7 +301,7 @@ static int update_target(git_refdb *db, transaction_node *node)
 	if (node->remove) {
 		error =  git_refdb_unlock(db, node->payload, 2, false, ref, NULL, NULL);
 	} else if (node->ref_type == GIT_REF_OID) {
-		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
+		error = git_refdb_unlock(db, node->payload, packed ? 3 : true, update_reflog, ref, node->sig, node->message);
 	} else if (node->ref_type == GIT_REF_SYMBOLIC) {
 		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
 	} else {
@@ -310,16 +328,31 @@ int git_transaction_commit(git_transaction *tx)
 
 		node = git_strmap_value_at(tx->locks, pos);
 		if (node->reflog) {
-			if ((error = tx->db->backend->reflog_write(tx->db->backend, node->reflog)) < 0)
+			if (tx->batch && tx->db->backend->transaction_reflog_write)
+				error = tx->db->backend->transaction_reflog_write(tx->db->backend, tx->batch, node->reflog);
+			else
+				error = tx->db->backend->reflog_write(tx->db->backend, node->reflog);
+
+			if (error < 0)
 				return error;
 		}
 
 		if (node->ref_type != GIT_REF_INVALID) {
-			if ((error = update_target(tx->db, node)) < 0)
+			if ((error = update_target(tx->db, node, tx->packed)) < 0)
+				return error;
+		} else {
+			/* the batch is only applied once all are unlocked */
+			error = git_refdb_unlock(tx->db, node->payload, false, false, NULL, NULL, NULL);
+			node->committed = true;
+
+			if (error < 0)
 				return error;
 		}
 	}
 
+	if (tx->batch)
+		return tx->db->backend->transaction_commit(tx->db->backend, tx->batch);
+
 	return 0;
 }
 
@@ -343,6 +376,10 @@ void git_transaction_free(git_transaction *tx)
 		git_refdb_unlock(tx->db, node->payload, false, false, NULL, NULL, NULL);
 	}
 
+	/* what was not committed is dropped */
+	if (tx->batch)
+		tx->db->backend->transaction_free(tx->db->backend, tx->batch);
+
 	git_refdb_free(tx->db);
 	git_strmap_free(tx->locks);
 
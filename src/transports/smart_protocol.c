@@ -14,11 +14,17 @@
 #include "pack-objects.h"
 #include "remote.h"
 #include "util.h"
+#include "thread-utils.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
 /* The minimal interval between progress updates (in seconds). */
 #define MIN_PROGRESS_UPDATE_INTERVAL 0.5
 
+/* The number of packets the receiving thread may get ahead by */
+#define PIPELINE_SLOTS 32
+
+bool git_smart__pipelined_download = false;
+
 int git_smart__store_refs(transport_smart *t, int flushes)
 {
 	gitno_buffer *buf = &t->buffer;
@@ -511,6 +517,19 @@ struct network_packetsize_payload
 	size_t last_fired_bytes;
 };
 
+static int network_progress(struct network_packetsize_payload *npp)
+{
+	/* Fire notification if the threshold is reached */
+	if ((npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
+		npp->last_fired_bytes = npp->stats->received_bytes;
+
+		if (npp->callback(npp->stats, npp->payload))
+			return GIT_EUSER;
+	}
+
+	return 0;
+}
+
 static int network_packetsize(size_t received, void *payload)
 {
 	struct network_packetsize_payload *npp = (struct network_packetsize_payload*)payload;
@@ -518,17 +537,219 @@ static int network_packetsize(size_t received, void *payload)
 	/* Accumulate bytes */
 	npp->stats->received_bytes += received;
 
-	/* Fire notification if the threshold is reached */
-	if ((npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
-		npp->last_fired_bytes = npp->stats->received_bytes;
+	return network_progress(npp);
+}
 
-		if (npp->callback(npp->stats, npp->payload))
-			return GIT_EUSER;
+/* Pass a side-band packet on to where it belongs */
+static int download_pkt(
+	transport_smart *t,
+	struct git_odb_writepack *writepack,
+	git_pkt *pkt,
+	git_transfer_progress *stats)
+{
+	if (pkt->type == GIT_PKT_PROGRESS) {
+		if (t->progress_cb) {
+			git_pkt_progress *p = (git_pkt_progress *) pkt;
+			return t->progress_cb(p->data, p->len, t->message_cb_payload);
+		}
+	} else if (pkt->type == GIT_PKT_DATA) {
+		git_pkt_data *p = (git_pkt_data *) pkt;
+
+		if (p->len)
+			return writepack->append(writepack, p->data, p->len, stats);
 	}
 
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * In a pipelined download, a thread receives the packets and queues them
+ * in a ring, while the calling thread takes them out and passes them to
+ * the indexer. The receiving thread waits when the ring is full. Every
+ * callback is still called from the calling thread.
+ */
+struct download_pipeline {
+	transport_smart *t;
+	git_thread thread;
+
+	git_mutex lock;
+	git_cond cond;
+	git_pkt *slots[PIPELINE_SLOTS];
+	size_t head, count;
+
+	/* the receiving thread is done, or is asked to stop */
+	int done, stop;
+
+	int error;
+	int error_class;
+	char *error_msg;
+
+	git_atomic_ssize received_bytes;
+};
+
+static int pipeline_packetsize(size_t received, void *payload)
+{
+	struct download_pipeline *pl = payload;
+
+	git_atomic_ssize_add(&pl->received_bytes, (ssize_t)received);
+	return 0;
+}
+
+static void *pipeline_receive(void *payload)
+{
+	struct download_pipeline *pl = payload;
+	transport_smart *t = pl->t;
+	const git_error *err;
+	git_pkt *pkt;
+	int error = 0, stop = 0;
+
+	while (!stop) {
+		if (t->cancelled.val) {
+			giterr_clear();
+			error = GIT_EUSER;
+			break;
+		}
+
+		if ((error = recv_pkt(&pkt, &t->buffer)) < 0)
+			break;
+
+		git_mutex_lock(&pl->lock);
+
+		while (pl->count == PIPELINE_SLOTS && !pl->stop)
+			git_cond_wait(&pl->cond, &pl->lock);
+
+		if (pl->stop) {
+			git__free(pkt);
+			stop = 1;
+		} else {
+			pl->slots[(pl->head + pl->count) % PIPELINE_SLOTS] = pkt;
+			pl->count++;
+
+			/* A flush indicates the end of the packfile */
+			stop = (pkt->type == GIT_PKT_FLUSH);
+			git_cond_broadcast(&pl->cond);
+		}
+
+		git_mutex_unlock(&pl->lock);
+	}
+
+	git_mutex_lock(&pl->lock);
+
+	if (error < 0) {
+		pl->error = error;
+		if ((err = giterr_last()) != NULL) {
+			pl->error_class = err->klass;
+			pl->error_msg = git__strdup(err->message);
+		}
+	}
+
+	pl->done = 1;
+	git_cond_broadcast(&pl->cond);
+	git_mutex_unlock(&pl->lock);
+
+	return NULL;
+}
+
+static int pipelined_download(
+	transport_smart *t,
+	struct git_odb_writepack *writepack,
+	git_transfer_progress *stats,
+	struct network_packetsize_payload *npp)
+{
+	struct download_pipeline pl;
+	git_pkt *pkt;
+	int error = 0;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.t = t;
+
+	/* the receiving thread only counts the bytes */
+	git_atomic_ssize_add(&pl.received_bytes, (ssize_t)stats->received_bytes);
+	t->packetsize_cb = &pipeline_packetsize;
+	t->packetsize_payload = &pl;
+
+	git_mutex_init(&pl.lock);
+	git_cond_init(&pl.cond);
+
+	if (git_thread_create(&pl.thread, NULL, pipeline_receive, &pl)) {
+		giterr_set(GITERR_THREAD, "unable to create thread");
+		error = -1;
+		goto cleanup;
+	}
+
+	while (1) {
+		git_mutex_lock(&pl.lock);
+
+		while (!pl.count && !pl.done)
+			git_cond_wait(&pl.cond, &pl.lock);
+
+		if (!pl.count) {
+			git_mutex_unlock(&pl.lock);
+
+			if ((error = pl.error) < 0 && pl.error_msg)
+				giterr_set_str(pl.error_class, pl.error_msg);
+			break;
+		}
+
+		pkt = pl.slots[pl.head];
+		pl.head = (pl.head + 1) % PIPELINE_SLOTS;
+		pl.count--;
+		git_cond_broadcast(&pl.cond);
+
+		git_mutex_unlock(&pl.lock);
+
+		/* A flush indicates the end of the packfile */
+		if (pkt->type == GIT_PKT_FLUSH) {
+			git__free(pkt);
+			break;
+		}
+
+		stats->received_bytes = (size_t)pl.received_bytes.val;
+
+		if (npp->callback && network_progress(npp) != 0) {
+			giterr_clear();
+			error = GIT_EUSER;
+		} else if (t->cancelled.val) {
+			giterr_clear();
+			error = GIT_EUSER;
+		} else {
+			error = download_pkt(t, writepack, pkt, stats);
+		}
+
+		git__free(pkt);
+		if (error < 0)
+			break;
+	}
+
+	git_mutex_lock(&pl.lock);
+	pl.stop = 1;
+	git_cond_broadcast(&pl.cond);
+	git_mutex_unlock(&pl.lock);
+
+	git_thread_join(&pl.thread, NULL);
+
+	while (pl.count) {
+		git__free(pl.slots[pl.head]);
+		pl.head = (pl.head + 1) % PIPELINE_SLOTS;
+		pl.count--;
+	}
+
+	stats->received_bytes = (size_t)pl.received_bytes.val;
+
+cleanup:
+	t->packetsize_cb = npp->callback ? &network_packetsize : NULL;
+	t->packetsize_payload = npp->callback ? npp : NULL;
+
+	git__free(pl.error_msg);
+	git_cond_free(&pl.cond);
+	git_mutex_free(&pl.lock);
+	return error;
+}
+
+#endif
+
 int git_smart__download_pack(
 	git_transport *transport,
 	git_repository *repo,
@@ -572,6 +793,17 @@ int git_smart__download_pack(
 		goto done;
 	}
 
+#ifdef GIT_THREADS
+	if (git_smart__pipelined_download) {
+		npp.stats = stats;
+
+		if ((error = pipelined_download(t, writepack, stats, &npp)) < 0)
+			goto done;
+
+		goto received;
+	}
+#endif
+
 	do {
 		git_pkt *pkt = NULL;
 
@@ -587,20 +819,12 @@ int git_smart__download_pack(
 			if (t->cancelled.val) {
 				giterr_clear();
 				error = GIT_EUSER;
-			} else if (pkt->type == GIT_PKT_PROGRESS) {
-				if (t->progress_cb) {
-					git_pkt_progress *p = (git_pkt_progress *) pkt;
-					error = t->progress_cb(p->data, p->len, t->message_cb_payload);
-				}
-			} else if (pkt->type == GIT_PKT_DATA) {
-				git_pkt_data *p = (git_pkt_data *) pkt;
-
-				if (p->len)
-					error = writepack->append(writepack, p->data, p->len, stats);
 			} else if (pkt->type == GIT_PKT_FLUSH) {
 				/* A flush indicates the end of the packfile */
 				git__free(pkt);
 				break;
+			} else {
+				error = download_pkt(t, writepack, pkt, stats);
 			}
 		}
 
@@ -610,6 +834,9 @@ int git_smart__download_pack(
 
 	} while (1);
 
+#ifdef GIT_THREADS
+received:
+#endif
 	/*
 	 * Trailing execution of transfer_progress_cb, if necessary...
 	 * Only the callback through the npp datastructure currently
@@ -0,0 +1,157 @@
+#include "clar_libgit2.h"
+#include "array.h"
+
+static git_repository *_repo;
+
+void test_graph_cache__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, (size_t)64));
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+}
+
+void test_graph_cache__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, (size_t)0));
+}
+
+static size_t cache_hits(void)
+{
+	size_t hits;
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_GRAPH_CACHE_STATS, &hits, NULL));
+	return hits;
+}
+
+void test_graph_cache__merge_base(void)
+{
+	git_oid result, one, two, expected;
+	size_t hits;
+
+	cl_git_pass(git_oid_fromstr(&one, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_oid_fromstr(&two, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_oid_fromstr(&expected, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+
+	hits = cache_hits();
+	cl_git_pass(git_merge_base(&result, _repo, &one, &two));
+	cl_assert_equal_oid(&expected, &result);
+	cl_assert_equal_sz(hits, cache_hits());
+
+	cl_git_pass(git_merge_base(&result, _repo, &one, &two));
+	cl_assert_equal_oid(&expected, &result);
+	cl_assert_equal_sz(hits + 1, cache_hits());
+
+	/* the pair is the same one in the other order */
+	cl_git_pass(git_merge_base(&result, _repo, &two, &one));
+	cl_assert_equal_oid(&expected, &result);
+	cl_assert_equal_sz(hits + 2, cache_hits());
+}
+
+void test_graph_cache__no_merge_base(void)
+{
+	git_oid result, one, two;
+	size_t hits;
+
+	cl_git_pass(git_oid_fromstr(&one, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_oid_fromstr(&two, "e90810b8df3e80c413d903f631643c716887138d"));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_merge_base(&result, _repo, &one, &two));
+
+	hits = cache_hits();
+	cl_git_fail_with(GIT_ENOTFOUND, git_merge_base(&result, _repo, &two, &one));
+	cl_assert_equal_sz(hits + 1, cache_hits());
+
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &one, &two));
+	cl_assert_equal_sz(hits + 2, cache_hits());
+}
+
+void test_graph_cache__descendant_of(void)
+{
+	git_oid one, two;
+	size_t hits;
+
+	cl_git_pass(git_oid_fromstr(&one, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&two, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+
+	cl_assert_equal_i(1, git_graph_descendant_of(_repo, &one, &two));
+
+	hits = cache_hits();
+	cl_assert_equal_i(1, git_graph_descendant_of(_repo, &one, &two));
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &two, &one));
+	cl_assert_equal_sz(hits + 2, cache_hits());
+}
+
+void test_graph_cache__ahead_behind(void)
+{
+	git_oid one, two;
+	size_t ahead, behind, hits;
+
+	cl_git_pass(git_oid_fromstr(&one, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_oid_fromstr(&two, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &one, &two));
+	cl_assert_equal_sz(1, ahead);
+	cl_assert_equal_sz(4, behind);
+
+	hits = cache_hits();
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &one, &two));
+	cl_assert_equal_sz(1, ahead);
+	cl_assert_equal_sz(4, behind);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, _repo, &two, &one));
+	cl_assert_equal_sz(4, ahead);
+	cl_assert_equal_sz(1, behind);
+	cl_assert_equal_sz(hits + 2, cache_hits());
+}
+
+typedef git_array_t(git_oid) oid_array;
+
+static int collect_commits(const char *name, void *payload)
+{
+	oid_array *commits = payload;
+	git_oid *id;
+
+	if (git__prefixcmp(name, "refs/heads/"))
+		return 0;
+
+	id = git_array_alloc(*commits);
+	cl_assert(id);
+
+	return git_reference_name_to_id(id, _repo, name);
+}
+
+void test_graph_cache__is_bounded(void)
+{
+	oid_array commits = GIT_ARRAY_INIT;
+	git_oid cached, walked;
+	size_t i, j, count;
+	int cached_error, walked_error;
+
+	cl_git_pass(git_reference_foreach_name(_repo, collect_commits, &commits));
+	count = git_array_size(commits);
+	cl_assert(count > 4);
+
+	git_repository_free(_repo);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, (size_t)4));
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+
+	/* more pairs than entries: some are evicted, none are wrong */
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < count; j++) {
+			cached_error = git_merge_base(&cached,
+				_repo, git_array_get(commits, i), git_array_get(commits, j));
+
+			cl_git_pass(git_libgit2_opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, (size_t)0));
+			walked_error = git_merge_base(&walked,
+				_repo, git_array_get(commits, i), git_array_get(commits, j));
+			cl_git_pass(git_libgit2_opts(GIT_OPT_SET_GRAPH_CACHE_SIZE, (size_t)4));
+
+			cl_assert_equal_i(walked_error, cached_error);
+			if (!walked_error)
+				cl_assert_equal_oid(&walked, &cached);
+		}
+	}
+
+	git_array_clear(commits);
+}
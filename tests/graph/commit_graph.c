@@ -0,0 +1,214 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/commit_graph.h>
+
+#include "commit_graph.h"
+#include "fileops.h"
+#include "odb.h"
+
+static void dump_commit_graph(git_buf *out, git_repository *repo)
+{
+	git_commit_graph_writer *w = NULL;
+	git_revwalk *walk;
+
+	cl_git_pass(git_commit_graph_writer_new(&w, "unused"));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_dump(out, w));
+
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+}
+
+static void assert_graph_matches_odb(git_repository *repo)
+{
+	git_commit_graph_file file = {{0}};
+	git_commit_graph_entry e, parent;
+	git_buf cgraph = GIT_BUF_INIT;
+	git_commit *commit;
+	size_t i, j;
+
+	dump_commit_graph(&cgraph, repo);
+	cl_git_pass(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size));
+
+	for (i = 0; i < file.num_commits; ++i) {
+		cl_git_pass(git_commit_graph_entry_find(&e, &file, &file.oid_lookup[i], GIT_OID_HEXSZ));
+		cl_git_pass(git_commit_lookup(&commit, repo, &e.sha1));
+
+		cl_assert_equal_oid(git_commit_tree_id(commit), &e.tree_oid);
+		cl_assert_equal_i(git_commit_time(commit), e.commit_time);
+		cl_assert_equal_sz(git_commit_parentcount(commit), e.parent_count);
+		cl_assert(e.generation > 0);
+
+		for (j = 0; j < e.parent_count; ++j) {
+			cl_git_pass(git_commit_graph_entry_parent(&parent, &file, &e, j));
+			cl_assert_equal_oid(git_commit_parent_id(commit, (unsigned int)j), &parent.sha1);
+			cl_assert(parent.generation < e.generation);
+		}
+		cl_git_fail_with(GIT_ENOTFOUND,
+			git_commit_graph_entry_parent(&parent, &file, &e, e.parent_count));
+
+		git_commit_free(commit);
+	}
+
+	git_buf_free(&cgraph);
+}
+
+void test_graph_commit_graph__parse(void)
+{
+	git_repository *repo;
+	git_commit_graph_file file = {{0}};
+	git_commit_graph_entry e, parent;
+	git_buf cgraph = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	dump_commit_graph(&cgraph, repo);
+
+	cl_git_pass(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size));
+	cl_assert_equal_i(file.num_commits, 15);
+
+	cl_git_pass(git_oid_fromstr(&id, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_i(e.parent_count, 1);
+	cl_git_pass(git_oid_fromstr(&id, "f60079018b664e4e79329a7ef9559c8d9e0378d1"));
+	cl_assert_equal_oid(&e.tree_oid, &id);
+
+	cl_git_pass(git_commit_graph_entry_parent(&parent, &file, &e, 0));
+	cl_git_pass(git_oid_fromstr(&id, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	cl_assert_equal_i(parent.parent_count, 0);
+	cl_assert_equal_i(parent.generation, 1);
+
+	cl_git_pass(git_oid_fromstrn(&id, "5b5b025a", 8));
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &id, 8));
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_commit_graph_entry_find(&e, &file, &id, GIT_OID_HEXSZ));
+
+	git_buf_free(&cgraph);
+	git_repository_free(repo);
+}
+
+void test_graph_commit_graph__matches_commits(void)
+{
+	git_repository *repo;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	assert_graph_matches_odb(repo);
+	git_repository_free(repo);
+}
+
+void test_graph_commit_graph__octopus_merges(void)
+{
+	git_repository *repo;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("push_src/.gitted")));
+	assert_graph_matches_odb(repo);
+	git_repository_free(repo);
+}
+
+void test_graph_commit_graph__truncated(void)
+{
+	git_repository *repo;
+	git_commit_graph_file file = {{0}};
+	git_buf cgraph = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	dump_commit_graph(&cgraph, repo);
+
+	cl_git_fail(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, cgraph.size - 100));
+	cl_git_fail(git_commit_graph_file_parse(&file,
+		(const unsigned char *)cgraph.ptr, 10));
+
+	git_buf_free(&cgraph);
+	git_repository_free(repo);
+}
+
+void test_graph_commit_graph__used_by_merge_base(void)
+{
+	git_repository *repo;
+	git_commit_graph_writer *w;
+	git_commit_graph_file *file;
+	git_revwalk *walk;
+	git_odb *odb;
+	git_oid one, two, result, expected;
+	size_t ahead, behind;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_commit_graph_writer_new(&w, "testrepo.git/objects/info"));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+
+	cl_assert(git_path_exists("testrepo.git/objects/info/commit-graph"));
+
+	/* the commit-graph is picked up when the repository is opened */
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+	git_commit_graph_file_free(file);
+	git_odb_free(odb);
+
+	cl_git_pass(git_oid_fromstr(&one, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_oid_fromstr(&two, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_oid_fromstr(&expected, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+
+	cl_git_pass(git_merge_base(&result, repo, &one, &two));
+	cl_assert_equal_oid(&expected, &result);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, repo, &one, &two));
+	cl_assert_equal_sz(ahead, 1);
+	cl_assert_equal_sz(behind, 2);
+
+	git_repository_free(repo);
+	cl_git_sandbox_cleanup();
+}
+
+void test_graph_commit_graph__rechecked_on_refresh(void)
+{
+	git_repository *repo;
+	git_commit_graph_writer *w;
+	git_commit_graph_file *file, *old;
+	git_revwalk *walk;
+	git_odb *odb;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb__get_commit_graph_file(&file, odb));
+
+	cl_git_pass(git_commit_graph_writer_new(&w, "testrepo.git/objects/info"));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+
+	/* the new file is only noticed by a refresh */
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb__get_commit_graph_file(&file, odb));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&old, odb));
+
+	/* an unchanged file is kept */
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+	cl_assert(file == old);
+	git_commit_graph_file_free(file);
+	git_commit_graph_file_free(old);
+
+	git_odb_free(odb);
+	cl_git_sandbox_cleanup();
+}
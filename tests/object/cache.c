@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "repository.h"
+#include "odb.h"
 
 static git_repository *g_repo;
 
@@ -285,3 +286,127 @@ void test_object_cache__fast_thread_rush(void)
 		g_repo = NULL;
 	}
 }
+
+void test_object_cache__stats(void)
+{
+	size_t hits, misses, hits_after, misses_after;
+	git_oid oid;
+	git_object *obj;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, NULL));
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, NULL, &misses_after, NULL));
+	cl_assert(misses_after > misses);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits_after, NULL, NULL));
+	cl_assert_equal_sz(hits + 1, hits_after);
+}
+
+static git_odb_object *fake_object(unsigned char prefix, unsigned char n, size_t size)
+{
+	git_odb_object *obj = git__calloc(1, sizeof(git_odb_object));
+
+	cl_assert(obj);
+	obj->cached.oid.id[0] = prefix;
+	obj->cached.oid.id[1] = n;
+	obj->cached.type = GIT_OBJ_BLOB;
+	obj->cached.size = size;
+
+	return obj;
+}
+
+void test_object_cache__scan_does_not_evict_hot_objects(void)
+{
+	git_cache cache;
+	git_odb_object *hot, *obj;
+	git_oid hot_id, first_id;
+	ssize_t current, max_storage;
+	size_t evictions, evictions_after;
+	int i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &max_storage));
+	/* each shard may hold about 1000 bytes */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, current + (ssize_t)(GIT_CACHE_SHARDS * 1000)));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)32767);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, NULL, NULL, &evictions));
+
+	cl_git_pass(git_cache_init(&cache));
+
+	/* an object which is looked up again is protected... */
+	hot = git_cache_store_raw(&cache, fake_object(0x10, 0xff, 100));
+	git_oid_cpy(&hot_id, &hot->cached.oid);
+	git_odb_object_free(hot);
+
+	hot = git_cache_get_raw(&cache, &hot_id);
+	cl_assert(hot);
+	git_odb_object_free(hot);
+
+	/* ...from a scan over many objects of the same shard */
+	for (i = 0; i < 50; i++) {
+		obj = git_cache_store_raw(&cache, fake_object(0x10, (unsigned char)i, 100));
+		if (i == 0)
+			git_oid_cpy(&first_id, &obj->cached.oid);
+		git_odb_object_free(obj);
+	}
+
+	cl_assert(git_cache_get_raw(&cache, &first_id) == NULL);
+
+	hot = git_cache_get_raw(&cache, &hot_id);
+	cl_assert(hot);
+	git_odb_object_free(hot);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, NULL, NULL, &evictions_after));
+	cl_assert(evictions_after > evictions);
+
+	git_cache_free(&cache);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, max_storage));
+}
+
+void test_object_cache__busy_shard_does_not_evict_others(void)
+{
+	git_cache cache;
+	git_odb_object *hot, *obj;
+	git_oid hot_id;
+	ssize_t current, max_storage;
+	int i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &max_storage));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, current + (ssize_t)(GIT_CACHE_SHARDS * 1000)));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)32767);
+
+	cl_git_pass(git_cache_init(&cache));
+
+	hot = git_cache_store_raw(&cache, fake_object(0x10, 0xff, 100));
+	git_oid_cpy(&hot_id, &hot->cached.oid);
+	git_odb_object_free(hot);
+
+	hot = git_cache_get_raw(&cache, &hot_id);
+	cl_assert(hot);
+	git_odb_object_free(hot);
+
+	/* another shard takes in far more than its part of the limit */
+	for (i = 0; i < 250; i++) {
+		obj = git_cache_store_raw(&cache, fake_object(0x11, (unsigned char)i, 100));
+		git_odb_object_free(obj);
+	}
+
+	/* which doesn't cost the first shard its protected entries */
+	obj = git_cache_store_raw(&cache, fake_object(0x10, 0, 100));
+	git_odb_object_free(obj);
+
+	hot = git_cache_get_raw(&cache, &hot_id);
+	cl_assert(hot);
+	git_odb_object_free(hot);
+
+	git_cache_free(&cache);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, max_storage));
+}
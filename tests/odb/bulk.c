@@ -0,0 +1,235 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "fileops.h"
+
+static git_repository *repo;
+static git_odb *odb;
+
+void test_odb_bulk__initialize(void)
+{
+	cl_git_pass(git_repository_init(&repo, "bulk.git", 1));
+	cl_git_pass(git_repository_odb(&odb, repo));
+}
+
+void test_odb_bulk__cleanup(void)
+{
+	git_odb_free(odb);
+	git_repository_free(repo);
+	cl_fixture_cleanup("bulk.git");
+}
+
+static int count_files_cb(void *payload, git_buf *path)
+{
+	size_t *count = payload;
+
+	if (git__suffixcmp(path->ptr, ".idx") == 0 ||
+		git__suffixcmp(path->ptr, ".pack") == 0 ||
+		strstr(path->ptr, "pack_bulk") != NULL)
+		(*count)++;
+
+	return 0;
+}
+
+static size_t pack_files(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t count = 0;
+
+	cl_git_pass(git_buf_sets(&path, "bulk.git/objects/pack"));
+	cl_git_pass(git_path_direach(&path, 0, count_files_cb, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void assert_object(git_odb *db, const git_oid *id, const char *data, size_t len)
+{
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, db, id));
+	cl_assert_equal_i(GIT_OBJ_BLOB, git_odb_object_type(obj));
+	cl_assert_equal_sz(len, git_odb_object_size(obj));
+	cl_assert(memcmp(data, git_odb_object_data(obj), len) == 0);
+	git_odb_object_free(obj);
+}
+
+static bool is_loose(const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	bool loose;
+
+	git_oid_tostr(hex, sizeof(hex), id);
+	cl_git_pass(git_buf_printf(&path, "bulk.git/objects/%.2s/%s", hex, hex + 2));
+	loose = git_path_exists(path.ptr);
+	git_buf_free(&path);
+
+	return loose;
+}
+
+static int count_objects_cb(const git_oid *id, void *payload)
+{
+	GIT_UNUSED(id);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static void write_stream(git_oid *out, const char *data, size_t len)
+{
+	git_odb_stream *stream;
+
+	cl_git_pass(git_odb_open_wstream(&stream, odb, len, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_stream_write(stream, data, len / 2));
+	cl_git_pass(git_odb_stream_write(stream, data + len / 2, len - len / 2));
+	cl_git_pass(git_odb_stream_finalize_write(out, stream));
+	git_odb_stream_free(stream);
+}
+
+void test_odb_bulk__objects_are_readable_before_commit(void)
+{
+	git_odb_bulk *bulk;
+	git_odb_object *obj;
+	git_oid one, two, short_id;
+	size_t len;
+	git_otype type;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+
+	cl_git_pass(git_odb_write(&one, odb, "one\n", 4, GIT_OBJ_BLOB));
+	write_stream(&two, "two\n", 4);
+
+	assert_object(odb, &one, "one\n", 4);
+	assert_object(odb, &two, "two\n", 4);
+
+	cl_git_pass(git_odb_read_header(&len, &type, odb, &two));
+	cl_assert_equal_sz(4, len);
+	cl_assert_equal_i(GIT_OBJ_BLOB, type);
+
+	git_oid_cpy(&short_id, &one);
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &short_id, 7));
+	cl_assert_equal_oid(&one, git_odb_object_id(obj));
+	git_odb_object_free(obj);
+
+	/* nothing was written as a loose object */
+	cl_assert(!is_loose(&one));
+	cl_assert(!is_loose(&two));
+
+	git_odb_bulk_free(bulk);
+}
+
+void test_odb_bulk__commit_writes_a_pack(void)
+{
+	git_odb_bulk *bulk;
+	git_odb *other;
+	git_oid one, two, big;
+	char *data;
+	size_t i, count = 0, big_len = 512 * 1024;
+
+	/* large enough to need several rounds of deflate */
+	data = git__malloc(big_len);
+	cl_assert(data);
+	for (i = 0; i < big_len; i++)
+		data[i] = (char)((i * 7919) ^ (i >> 11));
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+
+	cl_git_pass(git_odb_write(&one, odb, "one\n", 4, GIT_OBJ_BLOB));
+	write_stream(&big, data, big_len);
+	cl_git_pass(git_odb_write(&two, odb, "two\n", 4, GIT_OBJ_BLOB));
+
+	cl_git_pass(git_odb_bulk_commit(bulk));
+	git_odb_bulk_free(bulk);
+
+	cl_assert_equal_sz(2, pack_files());
+
+	assert_object(odb, &one, "one\n", 4);
+	assert_object(odb, &big, data, big_len);
+
+	cl_git_pass(git_odb_open(&other, "bulk.git/objects"));
+	assert_object(other, &one, "one\n", 4);
+	assert_object(other, &two, "two\n", 4);
+	assert_object(other, &big, data, big_len);
+
+	cl_git_pass(git_odb_foreach(other, count_objects_cb, &count));
+	cl_assert_equal_sz(3, count);
+
+	git_odb_free(other);
+	git__free(data);
+}
+
+void test_odb_bulk__free_aborts(void)
+{
+	git_odb_bulk *bulk;
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	cl_git_pass(git_odb_write(&id, odb, "one\n", 4, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	git_odb_bulk_free(bulk);
+
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_assert_equal_sz(0, pack_files());
+
+	/* objects are written as loose objects again */
+	cl_git_pass(git_odb_write(&id, odb, "one\n", 4, GIT_OBJ_BLOB));
+	cl_assert(is_loose(&id));
+}
+
+void test_odb_bulk__empty_commit_writes_nothing(void)
+{
+	git_odb_bulk *bulk;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	cl_git_pass(git_odb_bulk_commit(bulk));
+	git_odb_bulk_free(bulk);
+
+	cl_assert_equal_sz(0, pack_files());
+}
+
+void test_odb_bulk__only_one_at_a_time(void)
+{
+	git_odb_bulk *bulk, *other;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	cl_git_fail(git_odb_bulk_begin(&other, odb));
+	git_odb_bulk_free(bulk);
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	git_odb_bulk_free(bulk);
+}
+
+void test_odb_bulk__dropped_streams_leave_no_trace(void)
+{
+	git_odb_bulk *bulk;
+	git_odb_stream *stream;
+	git_odb *other;
+	git_oid one, dup, two;
+	size_t count = 0;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	cl_git_pass(git_odb_write(&one, odb, "one\n", 4, GIT_OBJ_BLOB));
+
+	/* an object which is already there is not written again */
+	write_stream(&dup, "one\n", 4);
+	cl_assert_equal_oid(&one, &dup);
+
+	/* neither is one whose stream is never finished */
+	cl_git_pass(git_odb_open_wstream(&stream, odb, 8, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_stream_write(stream, "unfin", 5));
+	git_odb_stream_free(stream);
+
+	cl_git_pass(git_odb_write(&two, odb, "two\n", 4, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_bulk_commit(bulk));
+	git_odb_bulk_free(bulk);
+
+	cl_git_pass(git_odb_open(&other, "bulk.git/objects"));
+	assert_object(other, &one, "one\n", 4);
+	assert_object(other, &two, "two\n", 4);
+
+	cl_git_pass(git_odb_foreach(other, count_objects_cb, &count));
+	cl_assert_equal_sz(2, count);
+	git_odb_free(other);
+}
@@ -0,0 +1,92 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "fileops.h"
+
+static git_repository *repo;
+static git_odb *odb;
+
+void test_odb_existsfilter__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_EXISTS_FILTER, 1));
+
+	cl_git_pass(git_repository_init(&repo, "existsfilter.git", 1));
+	cl_git_pass(git_repository_odb(&odb, repo));
+}
+
+void test_odb_existsfilter__cleanup(void)
+{
+	git_odb_free(odb);
+	git_repository_free(repo);
+	cl_fixture_cleanup("existsfilter.git");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_ODB_EXISTS_FILTER, 0));
+}
+
+void test_odb_existsfilter__missing_objects(void)
+{
+	git_oid id;
+	size_t len;
+	git_otype type;
+
+	cl_git_pass(git_oid_fromstr(&id, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"));
+
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_assert(!git_odb_exists(odb, &id));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_read_header(&len, &type, odb, &id));
+}
+
+void test_odb_existsfilter__sees_own_writes(void)
+{
+	git_oid id, other;
+
+	cl_git_pass(git_odb_hash(&other, "other\n", 6, GIT_OBJ_BLOB));
+	cl_assert(!git_odb_exists(odb, &other));
+
+	cl_git_pass(git_odb_write(&id, odb, "hello\n", 6, GIT_OBJ_BLOB));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_assert(!git_odb_exists(odb, &other));
+
+	cl_git_pass(git_odb_write(&other, odb, "other\n", 6, GIT_OBJ_BLOB));
+	cl_assert(git_odb_exists(odb, &other));
+}
+
+void test_odb_existsfilter__sees_loose_objects_written_elsewhere(void)
+{
+	git_odb *other;
+	git_oid id, written;
+
+	cl_git_pass(git_odb_hash(&id, "hello\n", 6, GIT_OBJ_BLOB));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_git_pass(git_odb_open(&other, "existsfilter.git/objects"));
+	cl_git_pass(git_odb_write(&written, other, "hello\n", 6, GIT_OBJ_BLOB));
+	cl_assert(git_oid_equal(&id, &written));
+	git_odb_free(other);
+
+	cl_assert(git_odb_exists(odb, &id));
+}
+
+void test_odb_existsfilter__sees_new_packs(void)
+{
+	const char *pack = "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5";
+	git_buf from = GIT_BUF_INIT, to = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	cl_git_pass(git_buf_printf(&from, "%s/objects/pack/%s.pack", cl_fixture("testrepo.git"), pack));
+	cl_git_pass(git_buf_printf(&to, "existsfilter.git/objects/pack/%s.pack", pack));
+	cl_git_pass(git_futils_cp(from.ptr, to.ptr, 0444));
+
+	git_buf_clear(&from);
+	git_buf_clear(&to);
+	cl_git_pass(git_buf_printf(&from, "%s/objects/pack/%s.idx", cl_fixture("testrepo.git"), pack));
+	cl_git_pass(git_buf_printf(&to, "existsfilter.git/objects/pack/%s.idx", pack));
+	cl_git_pass(git_futils_cp(from.ptr, to.ptr, 0444));
+
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_buf_free(&from);
+	git_buf_free(&to);
+}
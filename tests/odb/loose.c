@@ -89,6 +89,38 @@ void test_odb_loose__exists(void)
 	git_odb_free(odb);
 }
 
+void test_odb_loose__prefix_lookups_notice_changes(void)
+{
+	const char *other = "test-objects/8b/1378ffffffffffffffffffffffffffffffffff";
+	git_oid id, id2;
+	git_odb *odb;
+
+	write_object_files(&one);
+	cl_git_pass(git_odb_open(&odb, "test-objects"));
+
+	cl_git_pass(git_oid_fromstrp(&id, "8b1378"));
+	cl_git_pass(git_odb_exists_prefix(&id2, odb, &id, 6));
+	cl_assert_equal_i(0, git_oid_streq(&id2, one.id));
+
+	/* the listing of the directory is read again once it changes */
+	cl_git_mkfile(other, "");
+	cl_assert_equal_i(GIT_EAMBIGUOUS, git_odb_exists_prefix(&id2, odb, &id, 6));
+
+	cl_git_pass(git_oid_fromstrp(&id, "8b1378f"));
+	cl_git_pass(git_odb_exists_prefix(&id2, odb, &id, 7));
+	cl_assert_equal_i(0, git_oid_streq(&id2, "8b1378ffffffffffffffffffffffffffffffffff"));
+
+	cl_must_pass(p_unlink(other));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_exists_prefix(&id2, odb, &id, 7));
+
+	cl_git_pass(git_oid_fromstrp(&id, "8b1378"));
+	cl_git_pass(git_odb_exists_prefix(&id2, odb, &id, 6));
+	cl_assert_equal_i(0, git_oid_streq(&id2, one.id));
+
+	git_odb_free(odb);
+}
+
 void test_odb_loose__simple_reads(void)
 {
 	test_read_object(&commit);
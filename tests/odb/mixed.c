@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
 #include "odb.h"
+#include "array.h"
+#include "git2/sys/odb_backend.h"
 
 static git_odb *_odb;
 
@@ -108,3 +110,111 @@ void test_odb_mixed__dup_oid_prefix_0(void) {
 	cl_git_pass(git_odb_read_prefix(&obj, _odb, &oid, strlen(hex)));
 	git_odb_object_free(obj);
 }
+
+/* the shortest prefix of `id` which git_odb_exists_prefix finds uniquely */
+static size_t unique_prefix_len_by_lookup(git_odb *odb, const git_oid *id)
+{
+	git_oid found;
+	size_t len;
+	int error;
+
+	for (len = GIT_OID_MINPREFIXLEN; len < GIT_OID_HEXSZ; len++) {
+		error = git_odb_exists_prefix(&found, odb, id, len);
+		if (error != GIT_EAMBIGUOUS)
+			break;
+	}
+
+	giterr_clear();
+	return len;
+}
+
+static int collect_ids_cb(const git_oid *id, void *payload)
+{
+	git_array_t(git_oid) *ids = payload;
+	git_oid *out = git_array_alloc(*ids);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+static void assert_unique_prefix_lens(git_odb *odb)
+{
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	size_t *lens, i, len;
+
+	cl_git_pass(git_odb_foreach(odb, collect_ids_cb, &ids));
+	cl_assert(git_array_size(ids) > 0);
+
+	lens = git__calloc(git_array_size(ids), sizeof(size_t));
+	cl_assert(lens);
+
+	cl_git_pass(git_odb_unique_prefix_len_many(
+		lens, odb, ids.ptr, git_array_size(ids), 0));
+
+	for (i = 0; i < git_array_size(ids); i++) {
+		const git_oid *id = git_array_get(ids, i);
+
+		cl_assert_equal_sz(unique_prefix_len_by_lookup(odb, id), lens[i]);
+
+		cl_git_pass(git_odb_unique_prefix_len(&len, odb, id, 0));
+		cl_assert_equal_sz(lens[i], len);
+	}
+
+	git__free(lens);
+	git_array_clear(ids);
+}
+
+void test_odb_mixed__unique_prefix_len(void)
+{
+	git_oid oid;
+	size_t len;
+
+	assert_unique_prefix_lens(_odb);
+
+	/* ambiguous in pack file and loose */
+	cl_git_pass(git_oid_fromstr(&oid, "0ddeaded9502971eefe1e41e34d0e536853ae20f"));
+	cl_git_pass(git_odb_unique_prefix_len(&len, _odb, &oid, 0));
+	cl_assert_equal_sz(9, len);
+
+	/* never shorter than asked for */
+	cl_git_pass(git_odb_unique_prefix_len(&len, _odb, &oid, 12));
+	cl_assert_equal_sz(12, len);
+}
+
+void test_odb_mixed__unique_prefix_len_without_backend_support(void)
+{
+	git_odb *odb;
+	git_odb_backend *backend;
+
+	cl_git_pass(git_odb_new(&odb));
+
+	cl_git_pass(git_odb_backend_pack(&backend, cl_fixture("duplicate.git/objects")));
+	backend->unique_prefix_len = NULL;
+	cl_git_pass(git_odb_add_backend(odb, backend, 2));
+
+	cl_git_pass(git_odb_backend_loose(&backend, cl_fixture("duplicate.git/objects"), -1, 0, 0, 0));
+	backend->unique_prefix_len = NULL;
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	assert_unique_prefix_lens(odb);
+
+	git_odb_free(odb);
+}
+
+void test_odb_mixed__unique_prefix_len_of_missing_objects(void)
+{
+	git_oid ids[2];
+	size_t lens[2], len;
+
+	cl_git_pass(git_oid_fromstr(&ids[0], "ce013625030ba8dba906f756967f9e9ca394464a"));
+	cl_git_pass(git_oid_fromstr(&ids[1], "ce013625030ba8dba906f756967f9e9ca394464b"));
+
+	cl_git_pass(git_odb_unique_prefix_len(&len, _odb, &ids[0], 0));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_unique_prefix_len(&lens[0], _odb, &ids[1], 0));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_unique_prefix_len_many(lens, _odb, ids, 2, 0));
+	cl_assert_equal_sz(len, lens[0]);
+	cl_assert_equal_sz(0, lens[1]);
+}
@@ -77,3 +77,105 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+static git_oid *parse_ids(const char **hex, size_t count)
+{
+	git_oid *ids = git__calloc(count, sizeof(git_oid));
+	size_t i;
+
+	cl_assert(ids);
+
+	for (i = 0; i < count; ++i)
+		cl_git_pass(git_oid_fromstr(&ids[i], hex[i]));
+
+	return ids;
+}
+
+void test_odb_packed__read_many(void)
+{
+	size_t i, count = ARRAY_SIZE(packed_objects);
+	git_oid *ids = parse_ids(packed_objects, count);
+	git_odb_object **objs = git__calloc(count, sizeof(git_odb_object *));
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read_many(objs, _odb, ids, count));
+
+	for (i = 0; i < count; ++i) {
+		cl_assert(objs[i]);
+		cl_assert(git_oid_equal(&ids[i], git_odb_object_id(objs[i])));
+
+		cl_git_pass(git_odb_read(&obj, _odb, &ids[i]));
+		cl_assert_equal_i(git_odb_object_type(obj), git_odb_object_type(objs[i]));
+		cl_assert_equal_sz(git_odb_object_size(obj), git_odb_object_size(objs[i]));
+		cl_assert(!memcmp(git_odb_object_data(obj),
+			git_odb_object_data(objs[i]), git_odb_object_size(obj)));
+
+		git_odb_object_free(obj);
+		git_odb_object_free(objs[i]);
+	}
+
+	git__free(objs);
+	git__free(ids);
+}
+
+void test_odb_packed__read_header_many(void)
+{
+	size_t i, count = ARRAY_SIZE(loose_objects), len;
+	git_oid *ids = parse_ids(loose_objects, count);
+	size_t *lens = git__calloc(count, sizeof(size_t));
+	git_otype *types = git__calloc(count, sizeof(git_otype)), type;
+	int *exists = git__calloc(count, sizeof(int));
+
+	cl_git_pass(git_odb_read_header_many(lens, types, _odb, ids, count));
+	cl_git_pass(git_odb_exists_many(exists, _odb, ids, count));
+
+	for (i = 0; i < count; ++i) {
+		cl_git_pass(git_odb_read_header(&len, &type, _odb, &ids[i]));
+		cl_assert_equal_sz(len, lens[i]);
+		cl_assert_equal_i(type, types[i]);
+		cl_assert_equal_i(1, exists[i]);
+	}
+
+	git__free(exists);
+	git__free(types);
+	git__free(lens);
+	git__free(ids);
+}
+
+void test_odb_packed__read_many_with_missing_objects(void)
+{
+	const char *hex[] = {
+		"e90810b8df3e80c413d903f631643c716887138d",
+		"deadbeefdeadbeefdeadbeefdeadbeefdeadbeef",
+		"0266163a49e280c4f5ed1e08facd36a2bd716bcf",
+		"e90810b8df3e80c413d903f631643c716887138d",
+	};
+	git_oid *ids = parse_ids(hex, ARRAY_SIZE(hex));
+	git_odb_object *objs[ARRAY_SIZE(hex)];
+	size_t lens[ARRAY_SIZE(hex)];
+	git_otype types[ARRAY_SIZE(hex)];
+	int exists[ARRAY_SIZE(hex)];
+	size_t i;
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_read_many(objs, _odb, ids, ARRAY_SIZE(hex)));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_read_header_many(lens, types, _odb, ids, ARRAY_SIZE(hex)));
+	cl_git_pass(git_odb_exists_many(exists, _odb, ids, ARRAY_SIZE(hex)));
+
+	for (i = 0; i < ARRAY_SIZE(hex); ++i) {
+		if (i == 1) {
+			cl_assert(objs[i] == NULL);
+			cl_assert_equal_i(GIT_OBJ_BAD, types[i]);
+			cl_assert_equal_i(0, exists[i]);
+			continue;
+		}
+
+		cl_assert(git_oid_equal(&ids[i], git_odb_object_id(objs[i])));
+		cl_assert_equal_i(git_odb_object_type(objs[i]), types[i]);
+		cl_assert_equal_i(1, exists[i]);
+		git_odb_object_free(objs[i]);
+	}
+
+	git__free(ids);
+}
@@ -38,6 +38,8 @@ void test_online_clone__cleanup(void)
 		g_repo = NULL;
 	}
 	cl_fixture_cleanup("./foo");
+
+	git_libgit2_opts(GIT_OPT_ENABLE_PIPELINED_FETCH, 0);
 }
 
 void test_online_clone__network_full(void)
@@ -126,6 +128,32 @@ void test_online_clone__can_checkout_a_cloned_repo(void)
 	git_buf_free(&path);
 }
 
+static int pipelined_fetch_progress(const git_transfer_progress *stats, void *payload)
+{
+	size_t *received_bytes = (size_t *)payload;
+
+	/* the bytes come in on another thread, but never go backwards */
+	cl_assert(stats->received_bytes >= *received_bytes);
+	*received_bytes = stats->received_bytes;
+	return 0;
+}
+
+void test_online_clone__pipelined_fetch(void)
+{
+	git_oid oid;
+	size_t received_bytes = 0;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PIPELINED_FETCH, 1));
+
+	g_options.fetch_opts.callbacks.transfer_progress = &pipelined_fetch_progress;
+	g_options.fetch_opts.callbacks.payload = &received_bytes;
+
+	cl_git_pass(git_clone(&g_repo, LIVE_REPO_URL, "./foo", &g_options));
+
+	cl_assert(received_bytes > 0);
+	cl_git_pass(git_reference_name_to_id(&oid, g_repo, "refs/remotes/origin/master"));
+}
+
 static int remote_mirror_cb(git_remote **out, git_repository *repo,
 			    const char *name, const char *url, void *payload)
 {
@@ -0,0 +1,285 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+
+#include "ewah.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+
+static git_repository *_repo;
+
+void test_pack_bitmap__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("bitmaps.git")));
+}
+
+void test_pack_bitmap__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+}
+
+void test_pack_bitmap__open(void)
+{
+	git_bitmap_index *index;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_oid id;
+	size_t pos;
+
+	cl_git_pass(git_bitmap_index_open_dir(&index,
+		cl_fixture("bitmaps.git/objects/pack")));
+	cl_assert_equal_i(index->num_objects, 50);
+	cl_assert(index->entry_count > 0);
+
+	cl_assert_equal_sz(50,
+		git_bitmap_popcount(&index->commits) +
+		git_bitmap_popcount(&index->trees) +
+		git_bitmap_popcount(&index->blobs) +
+		git_bitmap_popcount(&index->tags));
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_bitmap_index_position(&pos, index, &id));
+	cl_assert_equal_oid(&id, &git_bitmap_index_object(index, pos)->id);
+	cl_assert(git_bitmap_get(&index->commits, pos));
+
+	/* the tip of master has its own bitmap, with everything reachable */
+	cl_git_pass(git_bitmap_index_lookup(&bitmap, index, &id));
+	cl_assert_equal_sz(20, git_bitmap_popcount(&bitmap));
+	git_bitmap_free(&bitmap);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_bitmap_index_position(&pos, index, &id));
+
+	git_bitmap_index_free(index);
+}
+
+void test_pack_bitmap__no_bitmap(void)
+{
+	git_bitmap_index *index;
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_bitmap_index_open_dir(&index,
+		cl_fixture("testrepo.git/objects/pack")));
+}
+
+static void check_reachable(git_bitmap_index *index, const char *commit)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_revwalk *walk;
+	git_packbuilder *pb;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, commit));
+	cl_git_pass(git_bitmap_index_add_reachable(&bitmap, index, _repo, &id));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	pb->use_bitmaps = 0;
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push(walk, &id));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_assert_equal_sz(git_packbuilder_object_count(pb),
+		git_bitmap_popcount(&bitmap));
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_bitmap_free(&bitmap);
+}
+
+void test_pack_bitmap__add_reachable(void)
+{
+	git_bitmap_index *index;
+
+	cl_git_pass(git_bitmap_index_open_dir(&index,
+		cl_fixture("bitmaps.git/objects/pack")));
+
+	check_reachable(index, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+	check_reachable(index, "9fd738e8f7967c078dceed8190330fc8648ee56a");
+	check_reachable(index, "763d71aadf09a7951596c9746c024e7eece7c7af");
+	/* not a tip, so some of its history has to be walked */
+	check_reachable(index, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644");
+
+	git_bitmap_index_free(index);
+}
+
+static size_t count_walk(int use_bitmaps, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_oid id;
+	size_t count;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	pb->use_bitmaps = use_bitmaps;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "heads/*"));
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&id, hide));
+		cl_git_pass(git_revwalk_hide(walk, &id));
+	}
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_assert_equal_b(use_bitmaps, pb->bitmaps != NULL);
+	count = git_packbuilder_object_count(pb);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+
+	return count;
+}
+
+void test_pack_bitmap__insert_walk(void)
+{
+	cl_assert_equal_sz(count_walk(0, NULL), count_walk(1, NULL));
+
+	/*
+	 * The tree walk only leaves out the trees of the hidden edges, so it
+	 * may send more than the bitmaps do, but never less.
+	 */
+	cl_assert(count_walk(1, "5b5b025afb0b4c913b4c338a42934a3863bf3644") <=
+		count_walk(0, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+}
+
+void test_pack_bitmap__ewah(void)
+{
+	static const unsigned char ewah[] = {
+		0x00, 0x00, 0x00, 0x82, /* 130 bits */
+		0x00, 0x00, 0x00, 0x03, /* 3 words */
+		/* a run of one word of ones, followed by one literal */
+		0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05,
+		/* a run of one word of zeroes */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+		0x00, 0x00, 0x00, 0x02, /* the last RLW */
+	};
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	size_t consumed;
+
+	cl_git_pass(git_ewah_read(&bitmap, &consumed, ewah, sizeof(ewah)));
+	cl_assert_equal_sz(sizeof(ewah), consumed);
+	cl_assert_equal_sz(66, git_bitmap_popcount(&bitmap));
+	cl_assert(git_bitmap_get(&bitmap, 63));
+	cl_assert(git_bitmap_get(&bitmap, 64));
+	cl_assert(!git_bitmap_get(&bitmap, 65));
+	cl_assert(git_bitmap_get(&bitmap, 66));
+	cl_assert(!git_bitmap_get(&bitmap, 128));
+	git_bitmap_free(&bitmap);
+
+	cl_git_fail(git_ewah_read(&bitmap, &consumed, ewah, sizeof(ewah) - 8));
+	git_bitmap_free(&bitmap);
+	cl_git_fail(git_ewah_read(&bitmap, &consumed, ewah, 6));
+	git_bitmap_free(&bitmap);
+}
+
+void test_pack_bitmap__ewah_roundtrip(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT, decoded = GIT_BITMAP_INIT;
+	git_buf ewah = GIT_BUF_INIT;
+	size_t i, consumed;
+
+	/* a mix of clean words of both kinds and literals */
+	for (i = 0; i < 1000; i++) {
+		if (i < 200 || (i > 450 && i % 7 == 0) || i == 999)
+			cl_git_pass(git_bitmap_set(&bitmap, i));
+	}
+
+	cl_git_pass(git_ewah_write(&ewah, &bitmap, 1000));
+	cl_git_pass(git_ewah_read(&decoded, &consumed,
+		(const unsigned char *)ewah.ptr, ewah.size));
+	cl_assert_equal_sz(ewah.size, consumed);
+
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), git_bitmap_popcount(&decoded));
+	for (i = 0; i < 1000; i++)
+		cl_assert_equal_b(git_bitmap_get(&bitmap, i), git_bitmap_get(&decoded, i));
+
+	git_bitmap_free(&bitmap);
+	git_bitmap_free(&decoded);
+	git_buf_free(&ewah);
+}
+
+static git_bitmap_index *write_bitmapped_pack(
+	const git_packbuilder_bitmap_options *opts)
+{
+	git_bitmap_index *index;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	/* testrepo.git has no bitmaps, so the new pack has the only one */
+	cl_git_sandbox_init("testrepo.git");
+	git_repository_free(_repo);
+	cl_git_pass(git_repository_open(&_repo, "testrepo.git"));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_git_pass(git_packbuilder_set_bitmap_options(pb, opts));
+	cl_git_pass(git_packbuilder_write(pb, "testrepo.git/objects/pack", 0, NULL, NULL));
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+
+	cl_git_pass(git_bitmap_index_open_dir(&index, "testrepo.git/objects/pack"));
+	return index;
+}
+
+void test_pack_bitmap__write(void)
+{
+	git_packbuilder_bitmap_options opts = GIT_PACKBUILDER_BITMAP_OPTIONS_INIT;
+	git_bitmap_index *index;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_revwalk *walk;
+	git_oid id;
+	size_t count = 0;
+
+	/* bitmap every single commit */
+	opts.history_span = 1;
+	opts.max_history_span = 1;
+	index = write_bitmapped_pack(&opts);
+
+	cl_assert(index->options & GIT_BITMAP_OPT_HASH_CACHE);
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_bitmap_index_lookup(&bitmap, index, &id));
+		git_bitmap_free(&bitmap);
+
+		/* what the bitmap says is reachable is what a walk finds */
+		check_reachable(index, git_oid_tostr_s(&id));
+		count++;
+	}
+	cl_assert_equal_sz(index->entry_count, count);
+
+	git_revwalk_free(walk);
+	git_bitmap_index_free(index);
+	cl_git_sandbox_cleanup();
+}
+
+void test_pack_bitmap__write_ref_tips_only(void)
+{
+	git_packbuilder_bitmap_options opts = GIT_PACKBUILDER_BITMAP_OPTIONS_INIT;
+	git_bitmap_index *index;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_oid id;
+
+	opts.ref_tips = 3;
+	opts.history_span = 0;
+	index = write_bitmapped_pack(&opts);
+
+	cl_assert_equal_i(3, index->entry_count);
+
+	/* the third most recent tip gets one, older ones and history do not */
+	cl_git_pass(git_oid_fromstr(&id, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_bitmap_index_lookup(&bitmap, index, &id));
+	git_bitmap_free(&bitmap);
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_bitmap_index_lookup(&bitmap, index, &id));
+
+	cl_git_pass(git_oid_fromstr(&id, "5b5b025afb0b4c913b4c338a42934a3863bf3644"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_bitmap_index_lookup(&bitmap, index, &id));
+
+	git_bitmap_index_free(index);
+	cl_git_sandbox_cleanup();
+}
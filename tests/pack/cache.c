@@ -0,0 +1,87 @@
+#include "clar_libgit2.h"
+#include <git2.h>
+#include "pack-cache.h"
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+/* This tree sits at the end of a delta chain 40 deep */
+#define DEEP_DELTA "c341bd71e5bc97d012fe7d788f5d95ad61f421c9"
+
+void test_pack_cache__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_pack_cache__cleanup(void)
+{
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)GIT_PACK_CACHE_MEMORY_LIMIT));
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_DELTA_BASE_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, (size_t)GIT_PACK_CACHE_SIZE_LIMIT));
+}
+
+static void read_deep_delta(void)
+{
+	git_oid id;
+	git_odb_object *obj;
+
+	cl_git_pass(git_oid_fromstr(&id, DEEP_DELTA));
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+	cl_assert_equal_i(GIT_OBJ_TREE, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+}
+
+void test_pack_cache__bases_are_reused(void)
+{
+	size_t hits, misses, used, hits_after;
+
+	read_deep_delta();
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_GET_DELTA_BASE_CACHE_STATS, &hits, &misses, &used));
+	cl_assert(used > 0);
+
+	read_deep_delta();
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_GET_DELTA_BASE_CACHE_STATS, &hits_after, NULL, NULL));
+	cl_assert(hits_after > hits);
+}
+
+void test_pack_cache__object_limit(void)
+{
+	size_t used_before, used_after;
+
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_DELTA_BASE_CACHE_OBJECT_LIMIT, GIT_OBJ_TREE, (size_t)0));
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_GET_DELTA_BASE_CACHE_STATS, NULL, NULL, &used_before));
+
+	read_deep_delta();
+
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_GET_DELTA_BASE_CACHE_STATS, NULL, NULL, &used_after));
+	cl_assert_equal_sz(used_before, used_after);
+}
+
+void test_pack_cache__freeing_the_pack_purges_it(void)
+{
+	size_t used;
+
+	read_deep_delta();
+
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	_odb = NULL;
+	_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_GET_DELTA_BASE_CACHE_STATS, NULL, NULL, &used));
+	cl_assert_equal_sz(0, used);
+}
@@ -0,0 +1,150 @@
+#include "clar_libgit2.h"
+#include "mwindow.h"
+#include "pack.h"
+#include "pack-objects.h"
+
+static git_repository *_repo;
+static git_odb *_odb;
+static size_t _file_limit;
+
+/* one object from each of the two small packs of testrepo */
+#define IN_PACK_D7C6 "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"
+#define IN_PACK_D85F "e90810b8df3e80c413d903f631643c716887138d"
+
+#define PACK_D7C6 "testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"
+#define PACK_D85F "testrepo.git/objects/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"
+
+void test_pack_filelimit__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_FILE_LIMIT, &_file_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, (size_t)1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_pack_filelimit__cleanup(void)
+{
+	git_odb_free(_odb);
+	cl_git_sandbox_cleanup();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_FILE_LIMIT, _file_limit));
+}
+
+static int read_object(const char *sha)
+{
+	git_oid id;
+	git_odb_object *obj;
+	int error;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+
+	if ((error = git_odb_read(&obj, _odb, &id)) == 0) {
+		cl_assert(git_oid_equal(&id, git_odb_object_id(obj)));
+		git_odb_object_free(obj);
+	}
+
+	return error;
+}
+
+void test_pack_filelimit__packs_are_closed_and_reopened(void)
+{
+	cl_git_pass(read_object(IN_PACK_D7C6));
+	cl_assert_equal_sz(1, git_mwindow__mem_ctl.windowfiles.length);
+
+	cl_git_pass(read_object(IN_PACK_D85F));
+	cl_assert_equal_sz(1, git_mwindow__mem_ctl.windowfiles.length);
+
+	cl_git_pass(read_object(IN_PACK_D7C6));
+	cl_assert_equal_sz(1, git_mwindow__mem_ctl.windowfiles.length);
+}
+
+void test_pack_filelimit__a_changed_pack_is_not_reopened(void)
+{
+	cl_git_pass(read_object(IN_PACK_D7C6));
+	cl_git_pass(read_object(IN_PACK_D85F));
+
+	/* the pack has been closed; pretend it was rewritten meanwhile */
+	cl_git_append2file(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.pack",
+		"garbage");
+
+	cl_git_fail(read_object(IN_PACK_D7C6));
+}
+
+static void find_entry(struct git_pack_entry *e, struct git_pack_file *p, const char *sha)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_pack_entry_find(e, p, &id, GIT_OID_HEXSZ));
+}
+
+/* Open `other`, which closes `p` to stay within the limit */
+static void close_pack(struct git_pack_file *p, struct git_pack_file *other)
+{
+	struct git_pack_entry e;
+
+	find_entry(&e, other, IN_PACK_D85F);
+	cl_assert_equal_i(-1, p->mwf.fd);
+}
+
+void test_pack_filelimit__closed_packs_are_reopened_on_read(void)
+{
+	struct git_pack_file *p, *other;
+	struct git_pack_entry e;
+	git_packfile_object_stream *stream;
+	git_rawobj raw;
+	git_off_t offset;
+	git_otype type;
+	size_t size;
+	char buf[64];
+
+	cl_git_pass(git_mwindow_get_pack(&p, PACK_D7C6));
+	cl_git_pass(git_mwindow_get_pack(&other, PACK_D85F));
+
+	find_entry(&e, p, IN_PACK_D7C6);
+
+	close_pack(p, other);
+	cl_git_pass(git_packfile_resolve_header(&size, &type, p, e.offset));
+	cl_assert_equal_i(GIT_OBJ_COMMIT, type);
+
+	close_pack(p, other);
+	offset = e.offset;
+	cl_git_pass(git_packfile_unpack(&raw, p, &offset));
+	cl_assert_equal_sz(size, raw.len);
+	git__free(raw.data);
+
+	close_pack(p, other);
+	cl_git_pass(git_packfile_object_stream_open(&stream, p, e.offset, NULL));
+	cl_assert_equal_sz(size, git_packfile_object_stream_size(stream));
+	cl_assert(git_packfile_object_stream_read(stream, buf, sizeof(buf)) > 0);
+	git_packfile_object_stream_free(stream);
+
+	git_mwindow_put_pack(other);
+	git_mwindow_put_pack(p);
+}
+
+void test_pack_filelimit__packbuilder_reuses_closed_packs(void)
+{
+	git_packbuilder *pb;
+	git_oid id;
+	unsigned int i;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+
+	/* finding the second object closes the pack of the first */
+	cl_git_pass(git_oid_fromstr(&id, IN_PACK_D7C6));
+	cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+	cl_git_pass(git_oid_fromstr(&id, IN_PACK_D85F));
+	cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+
+	cl_git_pass(git_packbuilder_write(pb, "testrepo.git/objects/pack", 0, NULL, NULL));
+
+	for (i = 0; i < pb->nr_objects; i++)
+		cl_assert(pb->object_list[i].reuse_pack != NULL);
+
+	git_packbuilder_free(pb);
+}
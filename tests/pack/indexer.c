@@ -6,6 +6,18 @@
 #include "vector.h"
 #include "posix.h"
 
+extern size_t git_indexer__max_resolve_memory;
+static size_t _max_resolve_memory;
+
+void test_pack_indexer__initialize(void)
+{
+	_max_resolve_memory = git_indexer__max_resolve_memory;
+}
+
+void test_pack_indexer__cleanup(void)
+{
+	git_indexer__max_resolve_memory = _max_resolve_memory;
+}
 
 /*
  * This is a packfile with three objects. The second is a delta which
@@ -125,3 +137,91 @@ void test_pack_indexer__fix_thin(void)
 		git_indexer_free(idx);
 	}
 }
+
+static void assert_indexes_like_git(unsigned int threads)
+{
+	git_indexer *idx = NULL;
+	git_transfer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT, written = GIT_BUF_INIT, expected = GIT_BUF_INIT;
+	const char *name = "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695";
+	git_buf path = GIT_BUF_INIT;
+
+	/* this pack has long delta chains to share out among the threads */
+	cl_git_pass(git_buf_printf(&path, "testrepo.git/objects/pack/%s.pack", name));
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(path.ptr)));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	git_indexer_set_threads(idx, threads);
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+	cl_assert(stats.indexed_deltas > 0);
+	cl_assert_equal_i(stats.total_deltas, stats.indexed_deltas);
+
+	/* it comes up with the same index as git does */
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "testrepo.git/objects/pack/%s.idx", name));
+	cl_git_pass(git_futils_readbuffer(&expected, cl_fixture(path.ptr)));
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "%s.idx", name));
+	cl_git_pass(git_futils_readbuffer(&written, path.ptr));
+
+	cl_assert_equal_sz(expected.size, written.size);
+	cl_assert(memcmp(expected.ptr, written.ptr, written.size) == 0);
+
+	git_indexer_free(idx);
+	git_buf_free(&pack);
+	git_buf_free(&written);
+	git_buf_free(&expected);
+	git_buf_free(&path);
+}
+
+void test_pack_indexer__threads(void)
+{
+	assert_indexes_like_git(4);
+}
+
+void test_pack_indexer__bases_are_inflated_again_past_the_limit(void)
+{
+	/* keep nothing but the base in use */
+	git_indexer__max_resolve_memory = 0;
+
+	assert_indexes_like_git(1);
+	assert_indexes_like_git(4);
+}
+
+static int cancel_resolving_cb(const git_transfer_progress *stats, void *payload)
+{
+	int *calls = payload;
+
+	if (!stats->indexed_deltas)
+		return 0;
+
+	(*calls)++;
+	return -1111;
+}
+
+void test_pack_indexer__threads_can_cancel_from_progress(void)
+{
+	git_indexer *idx = NULL;
+	git_transfer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT;
+	int calls = 0;
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack")));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, cancel_resolving_cb, &calls));
+	git_indexer_set_threads(idx, 4);
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_fail_with(-1111, git_indexer_commit(idx, &stats));
+
+	/* the threads stopped once the callback asked them to */
+	cl_assert_equal_i(1, calls);
+	cl_assert(stats.indexed_deltas < stats.total_deltas);
+
+	git_indexer_free(idx);
+	git_buf_free(&pack);
+}
@@ -0,0 +1,136 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/midx.h>
+
+#include "midx.h"
+#include "path.h"
+
+void test_pack_midx__parse(void)
+{
+	git_midx_writer *w = NULL;
+	git_midx_file idx = {{0}};
+	git_midx_entry e;
+	git_oid id;
+	git_buf midx = GIT_BUF_INIT;
+	const char *pack_dir = cl_fixture("testrepo.git/objects/pack");
+
+	cl_git_pass(git_midx_writer_new(&w, pack_dir));
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+
+	cl_git_pass(git_midx_parse(&idx, (const unsigned char *)midx.ptr, midx.size));
+	cl_assert_equal_i(git_vector_length(&idx.packfile_names), 3);
+	cl_assert_equal_s(git_vector_get(&idx.packfile_names, 0),
+		"pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx");
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, &idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_s(git_vector_get(&idx.packfile_names, e.pack_index),
+		"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx");
+
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_midx_entry_find(&e, &idx, &id, 8));
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert_equal_oid(&e.sha1, &id);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_midx_entry_find(&e, &idx, &id, GIT_OID_HEXSZ));
+
+	git_vector_free(&idx.packfile_names);
+	git_midx_writer_free(w);
+	git_buf_free(&midx);
+}
+
+void test_pack_midx__corrupt(void)
+{
+	git_midx_writer *w = NULL;
+	git_midx_file idx = {{0}};
+	git_buf midx = GIT_BUF_INIT;
+
+	cl_git_pass(git_midx_writer_new(&w, cl_fixture("testrepo.git/objects/pack")));
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+
+	/* flipping any byte must be caught by the trailing checksum */
+	midx.ptr[midx.size / 2] ^= 0xff;
+	cl_git_fail(git_midx_parse(&idx, (const unsigned char *)midx.ptr, midx.size));
+	git_vector_free(&idx.packfile_names);
+
+	memset(&idx, 0, sizeof(idx));
+	cl_git_fail(git_midx_parse(&idx, (const unsigned char *)midx.ptr, 10));
+	git_vector_free(&idx.packfile_names);
+
+	git_midx_writer_free(w);
+	git_buf_free(&midx);
+}
+
+static int check_object_cb(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_odb_object *obj;
+	git_oid found;
+	size_t len;
+	git_otype type;
+
+	cl_assert(git_odb_exists(odb, id) == 1);
+	cl_git_pass(git_odb_read_header(&len, &type, odb, id));
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(len, git_odb_object_size(obj));
+	cl_assert_equal_i(type, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_odb_exists_prefix(&found, odb, id, 10));
+	cl_assert_equal_oid(id, &found);
+
+	return 0;
+}
+
+void test_pack_midx__lookup_through_odb(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+	cl_assert(git_path_exists("testrepo.git/objects/pack/multi-pack-index"));
+
+	cl_git_pass(git_odb_foreach(odb, check_object_cb, odb));
+
+	git_odb_free(odb);
+	cl_git_sandbox_cleanup();
+}
+
+void test_pack_midx__stale_index_is_ignored(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+	git_odb_object *obj;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+	git_odb_free(odb);
+
+	/* an index referring to a pack that no longer exists is skipped */
+	cl_git_pass(p_rename(
+		"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx",
+		"testrepo.git/objects/pack/removed.idx.bak"));
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+	cl_git_sandbox_cleanup();
+}
@@ -1,10 +1,12 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
 #include "posix.h"
+#include "mwindow.h"
 
 static git_repository *_repo;
 static git_revwalk *_revwalker;
@@ -145,6 +147,174 @@ void test_pack_packbuilder__get_hash(void)
 	cl_assert_equal_s(hex, "80e61eb315239ef3c53033e37fee43b744d57122");
 }
 
+static int write_progress_cb(const git_transfer_progress *stats, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	cl_assert(stats->indexed_objects <= stats->total_objects);
+	memcpy(&_stats, stats, sizeof(_stats));
+	return 0;
+}
+
+void test_pack_packbuilder__index_matches_indexer(void)
+{
+	git_buf pack = GIT_BUF_INIT, written = GIT_BUF_INIT, indexed = GIT_BUF_INIT;
+
+	seed_packbuilder();
+
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, write_progress_cb, NULL));
+	cl_assert_equal_i(_stats.total_objects, git_packbuilder_object_count(_packbuilder));
+	cl_assert_equal_i(_stats.indexed_objects, _stats.total_objects);
+
+	/* the indexer must come up with the very same index for the pack */
+	cl_git_pass(p_mkdir("indexed", 0777));
+	cl_git_pass(git_futils_readbuffer(&pack, "pack-80e61eb315239ef3c53033e37fee43b744d57122.pack"));
+	cl_assert_equal_sz(_stats.received_bytes, pack.size);
+
+	cl_git_pass(git_indexer_new(&_indexer, "indexed", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, pack.ptr, pack.size, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+
+	cl_git_pass(git_futils_readbuffer(&written, "pack-80e61eb315239ef3c53033e37fee43b744d57122.idx"));
+	cl_git_pass(git_futils_readbuffer(&indexed, "indexed/pack-80e61eb315239ef3c53033e37fee43b744d57122.idx"));
+	cl_assert_equal_sz(written.size, indexed.size);
+	cl_assert(memcmp(written.ptr, indexed.ptr, written.size) == 0);
+
+	git_buf_free(&pack);
+	git_buf_free(&written);
+	git_buf_free(&indexed);
+}
+
+void test_pack_packbuilder__reuse_packed_objects(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_buf path = GIT_BUF_INIT, pack = GIT_BUF_INIT,
+		written = GIT_BUF_INIT, indexed = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ+1];
+	unsigned int i, deltas = 0;
+	struct git_pack_file *reused;
+	struct git_pack_entry e;
+	git_mwindow *w = NULL;
+	git_otype type;
+	size_t size;
+
+	hex[GIT_OID_HEXSZ] = '\0';
+
+	/* every object of bitmaps.git is in a single pack, some as deltas */
+	cl_git_pass(git_repository_open(&repo, cl_fixture("bitmaps.git")));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(p_mkdir("reused", 0777));
+	cl_git_pass(git_packbuilder_write(pb, "reused", 0, NULL, NULL));
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		cl_assert(pb->object_list[i].reuse_pack != NULL);
+		if (pb->object_list[i].reuse_delta)
+			deltas++;
+	}
+	cl_assert(deltas > 0);
+
+	/* the indexer resolves the rewritten deltas to the same objects */
+	git_oid_fmt(hex, git_packbuilder_hash(pb));
+	cl_git_pass(git_buf_printf(&path, "reused/pack-%s.pack", hex));
+	cl_git_pass(git_futils_readbuffer(&pack, path.ptr));
+
+	cl_git_pass(p_mkdir("indexed", 0777));
+	cl_git_pass(git_indexer_new(&_indexer, "indexed", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, pack.ptr, pack.size, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+	cl_assert_equal_i(git_packbuilder_object_count(pb), _stats.indexed_objects);
+	cl_assert_equal_oid(git_packbuilder_hash(pb), git_indexer_hash(_indexer));
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "reused/pack-%s.idx", hex));
+	cl_git_pass(git_futils_readbuffer(&written, path.ptr));
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "indexed/pack-%s.idx", hex));
+	cl_git_pass(git_futils_readbuffer(&indexed, path.ptr));
+	cl_assert_equal_sz(written.size, indexed.size);
+	cl_assert(memcmp(written.ptr, indexed.ptr, written.size) == 0);
+
+	/* the reused deltas name their base, like the ones we compute */
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_printf(&path, "reused/pack-%s.idx", hex));
+	cl_git_pass(git_mwindow_get_pack(&reused, path.ptr));
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		if (!pb->object_list[i].reuse_delta)
+			continue;
+
+		cl_git_pass(git_pack_entry_find(&e, reused, &pb->object_list[i].id, GIT_OID_HEXSZ));
+		cl_git_pass(git_packfile_unpack_header(&size, &type, &reused->mwf, &w, &e.offset));
+		cl_assert_equal_i(GIT_OBJ_REF_DELTA, type);
+	}
+
+	git_mwindow_put_pack(reused);
+
+	git_buf_free(&path);
+	git_buf_free(&pack);
+	git_buf_free(&written);
+	git_buf_free(&indexed);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+}
+
+static int drop_packs_cb(void *buf, size_t len, void *payload)
+{
+	git_odb *odb = payload;
+	static int dropped;
+
+	/* once writing has started, a refresh forgets the pack */
+	if (!dropped) {
+		dropped = 1;
+		cl_git_pass(p_unlink("objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+		cl_git_pass(git_odb_refresh(odb));
+	}
+
+	return git_indexer_append(_indexer, buf, len, &_stats);
+}
+
+void test_pack_packbuilder__reused_packs_outlive_a_refresh(void)
+{
+#ifdef GIT_WIN32
+	/* the index of the pack is mapped, so it can't be removed */
+	cl_skip();
+#else
+	/* blobs stored whole in that pack */
+	const char *blobs[] = {
+		"215da649e1c68079fb03f4f9bc0f196cca9855c8",
+		"627513e78ae0c8dbcdb62e371ea674495c841aca",
+		"c36f4cf1e38ec1bb9d9ad146ed572b89ecfc9f18",
+	};
+	git_odb *odb;
+	git_oid id;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(blobs); i++) {
+		cl_git_pass(git_oid_fromstr(&id, blobs[i]));
+		cl_git_pass(git_packbuilder_insert(_packbuilder, &id, NULL));
+	}
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL, NULL));
+
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, drop_packs_cb, odb));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+	cl_assert_equal_i(git_packbuilder_object_count(_packbuilder), _stats.indexed_objects);
+
+	for (i = 0; i < _packbuilder->nr_objects; i++)
+		cl_assert(_packbuilder->object_list[i].reuse_pack != NULL);
+
+	git_odb_free(odb);
+#endif
+}
+
 static void test_write_pack_permission(mode_t given, mode_t expected)
 {
 	struct stat statbuf;
@@ -0,0 +1,166 @@
+#include "clar_libgit2.h"
+#include <git2.h>
+#include "git2/sys/odb_backend.h"
+#include "pack.h"
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+/* This tree sits at the end of a delta chain 40 deep */
+#define DEEP_DELTA "c341bd71e5bc97d012fe7d788f5d95ad61f421c9"
+
+/* A blob which is stored whole, and is inflated as it is read */
+#define WHOLE_BLOB "215da649e1c68079fb03f4f9bc0f196cca9855c8"
+
+void test_pack_readstream__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_pack_readstream__cleanup(void)
+{
+	git_packfile__spill_threshold = GIT_PACK_SPILL_THRESHOLD;
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+
+	git_odb_free(_odb);
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_streams_like_read(const git_oid *id)
+{
+	git_odb_object *obj;
+	git_odb_stream *stream;
+	git_buf contents = GIT_BUF_INIT;
+	char buffer[7]; /* small, so that reads cross delta instructions */
+	int read;
+
+	cl_git_pass(git_odb_read(&obj, _odb, id));
+	cl_git_pass(git_odb_open_rstream(&stream, _odb, id));
+	cl_assert_equal_i(git_odb_object_size(obj), stream->declared_size);
+
+	while ((read = git_odb_stream_read(stream, buffer, sizeof(buffer))) > 0)
+		cl_git_pass(git_buf_put(&contents, buffer, read));
+
+	cl_assert_equal_i(0, read);
+	cl_assert_equal_i(git_odb_object_size(obj), contents.size);
+	cl_assert(memcmp(git_odb_object_data(obj), contents.ptr, contents.size) == 0);
+
+	git_buf_free(&contents);
+	git_odb_stream_free(stream);
+	git_odb_object_free(obj);
+}
+
+static int stream_object_cb(const git_oid *id, void *payload)
+{
+	int *count = payload;
+	git_odb_stream *stream;
+
+	/* only packed objects can be streamed */
+	if (git_odb_open_rstream(&stream, _odb, id) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	git_odb_stream_free(stream);
+	assert_streams_like_read(id);
+
+	(*count)++;
+	return 0;
+}
+
+void test_pack_readstream__packed_objects(void)
+{
+	int count = 0;
+
+	cl_git_pass(git_odb_foreach(_odb, stream_object_cb, &count));
+	cl_assert(count > 0);
+}
+
+void test_pack_readstream__deep_delta(void)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, DEEP_DELTA));
+	assert_streams_like_read(&id);
+}
+
+static int no_spill_cb(void *payload, git_buf *path)
+{
+	GIT_UNUSED(payload);
+	cl_assert(strstr(path->ptr, "tmp_stream") == NULL);
+	return 0;
+}
+
+void test_pack_readstream__spilled_bases(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+	int count = 0;
+
+	/* write every delta base out to a temporary file */
+	git_packfile__spill_threshold = 0;
+
+	cl_git_pass(git_oid_fromstr(&id, DEEP_DELTA));
+	assert_streams_like_read(&id);
+
+	cl_git_pass(git_odb_foreach(_odb, stream_object_cb, &count));
+	cl_assert(count > 0);
+
+	/* and they're all gone */
+	cl_git_pass(git_buf_sets(&path, "testrepo.git/objects"));
+	cl_git_pass(git_path_direach(&path, 0, no_spill_cb, NULL));
+	git_buf_free(&path);
+}
+
+void test_pack_readstream__loose_objects_are_not_streamed(void)
+{
+	git_odb_stream *stream;
+	git_oid id;
+
+	/* a loose object of the repository */
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_assert(git_odb_exists(_odb, &id));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_open_rstream(&stream, _odb, &id));
+}
+
+void test_pack_readstream__outlives_its_pack_in_the_odb(void)
+{
+#ifdef GIT_WIN32
+	/* the index of the pack is mapped, so it can't be removed */
+	cl_skip();
+#else
+	git_odb_object *obj;
+	git_odb_stream *stream;
+	git_buf contents = GIT_BUF_INIT;
+	char buffer[7];
+	git_oid id;
+	int read;
+
+	/* so that looking the object up goes to the packs */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	cl_git_pass(git_oid_fromstr(&id, WHOLE_BLOB));
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+	cl_git_pass(git_odb_open_rstream(&stream, _odb, &id));
+
+	cl_assert((read = git_odb_stream_read(stream, buffer, sizeof(buffer))) > 0);
+	cl_git_pass(git_buf_put(&contents, buffer, read));
+
+	/* the refresh drops the pack, but the stream still holds it */
+	cl_git_pass(p_unlink("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(git_odb_refresh(_odb));
+	cl_assert(!git_odb_exists(_odb, &id));
+
+	while ((read = git_odb_stream_read(stream, buffer, sizeof(buffer))) > 0)
+		cl_git_pass(git_buf_put(&contents, buffer, read));
+
+	cl_assert_equal_i(0, read);
+	cl_assert_equal_i(git_odb_object_size(obj), contents.size);
+	cl_assert(memcmp(git_odb_object_data(obj), contents.ptr, contents.size) == 0);
+
+	git_buf_free(&contents);
+	git_odb_stream_free(stream);
+	git_odb_object_free(obj);
+#endif
+}
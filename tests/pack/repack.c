@@ -0,0 +1,280 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "vector.h"
+
+static git_repository *repo;
+static git_odb *odb;
+static int blob_counter;
+
+void test_pack_repack__initialize(void)
+{
+	cl_git_pass(git_repository_init(&repo, "repack.git", 1));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	blob_counter = 0;
+}
+
+void test_pack_repack__cleanup(void)
+{
+	git_odb_free(odb);
+	git_repository_free(repo);
+	cl_fixture_cleanup("repack.git");
+}
+
+static void write_blobs(git_oid *ids, size_t count)
+{
+	char data[64];
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		p_snprintf(data, sizeof(data), "blob number %d\n", blob_counter++);
+		cl_git_pass(git_odb_write(&ids[i], odb, data, strlen(data), GIT_OBJ_BLOB));
+	}
+}
+
+/* write `count` new blobs into a pack of their own */
+static void write_pack(git_oid *ids, size_t count)
+{
+	git_odb_bulk *bulk;
+
+	cl_git_pass(git_odb_bulk_begin(&bulk, odb));
+	write_blobs(ids, count);
+	cl_git_pass(git_odb_bulk_commit(bulk));
+	git_odb_bulk_free(bulk);
+}
+
+static int collect_packs_cb(void *payload, git_buf *path)
+{
+	if (git__suffixcmp(path->ptr, ".pack") == 0)
+		cl_git_pass(git_vector_insert(payload, git__strdup(path->ptr)));
+
+	return 0;
+}
+
+static void pack_names(git_vector *out)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_vector_init(out, 0, git__strcmp_cb));
+	cl_git_pass(git_buf_sets(&path, "repack.git/objects/pack"));
+	cl_git_pass(git_path_direach(&path, 0, collect_packs_cb, out));
+	git_vector_sort(out);
+	git_buf_free(&path);
+}
+
+static void free_pack_names(git_vector *names)
+{
+	git_vector_free_deep(names);
+}
+
+static size_t pack_count(void)
+{
+	git_vector names;
+	size_t count;
+
+	pack_names(&names);
+	count = names.length;
+	free_pack_names(&names);
+
+	return count;
+}
+
+static bool is_loose(const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	bool loose;
+
+	git_oid_tostr(hex, sizeof(hex), id);
+	cl_git_pass(git_buf_printf(&path, "repack.git/objects/%.2s/%s", hex, hex + 2));
+	loose = git_path_exists(path.ptr);
+	git_buf_free(&path);
+
+	return loose;
+}
+
+static void assert_readable(git_odb *db, const git_oid *ids, size_t count)
+{
+	git_odb_object *obj;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		cl_git_pass(git_odb_read(&obj, db, &ids[i]));
+		git_odb_object_free(obj);
+	}
+}
+
+static void assert_readable_from_disk(const git_oid *ids, size_t count)
+{
+	git_odb *other;
+
+	cl_git_pass(git_odb_open(&other, "repack.git/objects"));
+	assert_readable(other, ids, count);
+	git_odb_free(other);
+}
+
+void test_pack_repack__packs_loose_objects(void)
+{
+	git_oid ids[10];
+	size_t i;
+
+	write_blobs(ids, 10);
+	cl_assert(is_loose(&ids[0]));
+
+	cl_git_pass(git_repository_repack(repo, NULL));
+
+	cl_assert_equal_sz(1, pack_count());
+	for (i = 0; i < 10; i++)
+		cl_assert(!is_loose(&ids[i]));
+
+	assert_readable(odb, ids, 10);
+	assert_readable_from_disk(ids, 10);
+}
+
+void test_pack_repack__merges_small_packs_only(void)
+{
+	git_oid base[64], one[1], two[2], three[3];
+	git_vector before, after;
+	size_t i, found = 0;
+
+	write_pack(base, 64);
+	write_pack(one, 1);
+	write_pack(two, 2);
+	write_pack(three, 3);
+
+	pack_names(&before);
+	cl_assert_equal_sz(4, before.length);
+
+	cl_git_pass(git_repository_repack(repo, NULL));
+
+	/* 1, 2 and 3 objects are merged, the 64 objects are not rewritten */
+	pack_names(&after);
+	cl_assert_equal_sz(2, after.length);
+
+	for (i = 0; i < after.length; i++) {
+		size_t pos;
+		if (!git_vector_search(&pos, &before, git_vector_get(&after, i)))
+			found++;
+	}
+	cl_assert_equal_sz(1, found);
+
+	assert_readable(odb, one, 1);
+	assert_readable(odb, two, 2);
+	assert_readable(odb, three, 3);
+	assert_readable(odb, base, 64);
+	assert_readable_from_disk(one, 1);
+	assert_readable_from_disk(three, 3);
+	assert_readable_from_disk(base, 64);
+
+	free_pack_names(&before);
+	free_pack_names(&after);
+}
+
+void test_pack_repack__geometric_packs_are_left_alone(void)
+{
+	git_oid ids[16];
+	git_vector before, after;
+	size_t i;
+
+	write_pack(ids, 8);
+	write_pack(ids + 8, 2);
+
+	pack_names(&before);
+	cl_git_pass(git_repository_repack(repo, NULL));
+	pack_names(&after);
+
+	cl_assert_equal_sz(2, after.length);
+	for (i = 0; i < after.length; i++)
+		cl_assert_equal_s(git_vector_get(&before, i), git_vector_get(&after, i));
+
+	free_pack_names(&before);
+	free_pack_names(&after);
+}
+
+void test_pack_repack__large_merges_swallow_larger_packs(void)
+{
+	git_oid ids[24];
+
+	/* 8 and 4 form a progression, but 1 + 4 loose ones need the 8 */
+	write_pack(ids, 8);
+	write_pack(ids + 8, 1);
+	write_pack(ids + 9, 1);
+	write_blobs(ids + 10, 4);
+
+	cl_git_pass(git_repository_repack(repo, NULL));
+
+	cl_assert_equal_sz(1, pack_count());
+	assert_readable(odb, ids, 14);
+	assert_readable_from_disk(ids, 14);
+}
+
+void test_pack_repack__honours_keep_files(void)
+{
+	git_oid ids[4];
+	git_vector before;
+	git_buf keep = GIT_BUF_INIT;
+
+	write_pack(ids, 1);
+
+	pack_names(&before);
+	cl_git_pass(git_buf_sets(&keep, git_vector_get(&before, 0)));
+	git_buf_shorten(&keep, strlen("pack"));
+	cl_git_pass(git_buf_puts(&keep, "keep"));
+	cl_git_mkfile(keep.ptr, "");
+
+	write_pack(ids + 1, 1);
+	write_pack(ids + 2, 1);
+
+	cl_git_pass(git_repository_repack(repo, NULL));
+
+	cl_assert_equal_sz(2, pack_count());
+	cl_assert(git_path_exists(git_vector_get(&before, 0)));
+	assert_readable_from_disk(ids, 3);
+
+	git_buf_free(&keep);
+	free_pack_names(&before);
+}
+
+void test_pack_repack__can_skip_loose_objects(void)
+{
+	git_repository_repack_options opts = GIT_REPOSITORY_REPACK_OPTIONS_INIT;
+	git_oid ids[3];
+
+	write_pack(ids, 1);
+	write_pack(ids + 1, 1);
+	write_blobs(ids + 2, 1);
+
+	opts.flags = GIT_REPOSITORY_REPACK_SKIP_LOOSE;
+	cl_git_pass(git_repository_repack(repo, &opts));
+
+	cl_assert_equal_sz(1, pack_count());
+	cl_assert(is_loose(&ids[2]));
+	assert_readable_from_disk(ids, 3);
+}
+
+void test_pack_repack__rewrites_multi_pack_index(void)
+{
+	git_oid ids[3];
+	git_odb *other;
+
+	write_pack(ids, 1);
+	write_pack(ids + 1, 1);
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+
+	write_blobs(ids + 2, 1);
+	cl_git_pass(git_repository_repack(repo, NULL));
+
+	cl_assert_equal_sz(1, pack_count());
+	cl_assert(git_path_exists("repack.git/objects/pack/multi-pack-index"));
+
+	cl_git_pass(git_odb_open(&other, "repack.git/objects"));
+	assert_readable(other, ids, 3);
+	git_odb_free(other);
+}
+
+void test_pack_repack__rejects_small_factors(void)
+{
+	git_repository_repack_options opts = GIT_REPOSITORY_REPACK_OPTIONS_INIT;
+
+	opts.geometric_factor = 1;
+	cl_git_fail(git_repository_repack(repo, &opts));
+}
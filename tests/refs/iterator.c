@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "refs.h"
+#include "fileops.h"
 #include "vector.h"
 
 static git_repository *repo;
@@ -219,3 +220,92 @@ void test_refs_iterator__concurrent_delete(void)
 	cl_git_sandbox_cleanup();
 	repo = NULL;
 }
+
+static void assert_prefix_lists(const char *prefix, size_t start, size_t count)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_vector output;
+	size_t i;
+	int error;
+
+	cl_git_pass(git_vector_init(&output, 32, &refcmp_cb));
+	cl_git_pass(git_reference_iterator_prefix_new(&iter, repo, prefix));
+
+	while ((error = git_reference_next(&ref, iter)) == 0)
+		cl_git_pass(git_vector_insert(&output, ref));
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	cl_assert_equal_sz(count, output.length);
+	git_vector_sort(&output);
+
+	git_vector_foreach(&output, i, ref) {
+		cl_assert_equal_s(refnames[start + i], ref->name);
+		git_reference_free(ref);
+	}
+
+	git_vector_free(&output);
+}
+
+void test_refs_iterator__prefix(void)
+{
+	assert_prefix_lists("", 0, ARRAY_SIZE(refnames));
+	assert_prefix_lists("refs/", 0, ARRAY_SIZE(refnames));
+	assert_prefix_lists("refs/heads/", 0, 12);
+	assert_prefix_lists("refs/heads/packed", 6, 2);
+	assert_prefix_lists("refs/heads/t", 9, 3);
+	assert_prefix_lists("refs/notes", 12, 1);
+	assert_prefix_lists("refs/tags/", 14, 7);
+	assert_prefix_lists("refs/heads/nope", 0, 0);
+	assert_prefix_lists("nope/", 0, 0);
+}
+
+void test_refs_iterator__prefix_names(void)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_prefix_new(&iter, repo, "refs/remotes/"));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert_equal_s("refs/remotes/test/master", name);
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_sz(1, count);
+
+	git_reference_iterator_free(iter);
+}
+
+void test_refs_iterator__prefix_without_loose_directory(void)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	git_repository_free(repo);
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_futils_rmdir_r("testrepo.git/refs/heads", NULL, GIT_RMDIR_REMOVE_FILES));
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, repo, "refs/heads/*"));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert(!git__prefixcmp(name, "refs/heads/packed"));
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_sz(2, count);
+
+	git_reference_iterator_free(iter);
+
+	cl_git_sandbox_cleanup();
+	repo = NULL;
+}
@@ -0,0 +1,225 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "fnmatch.h"
+#include "git2/refdb.h"
+#include "refs.h"
+
+static git_repository *g_repo;
+static git_oid g_id, g_peel;
+
+#define SORTED_HEADER "# pack-refs with: peeled fully-peeled sorted \n"
+
+void test_refs_packed__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_oid_fromstr(&g_id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&g_peel, "e90810b8df3e80c413d903f631643c716887138d"));
+}
+
+void test_refs_packed__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/*
+ * Write a `packed-refs` file with the references refs/tags/t0000 to
+ * refs/tags/t<count - 1>, the odd ones peeled; the loose ones are
+ * removed so they don't get in the way.
+ */
+static void write_packed_refs(const char *header, size_t count, bool reverse)
+{
+	git_buf contents = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	char id[GIT_OID_HEXSZ + 1], peel[GIT_OID_HEXSZ + 1];
+	size_t i, n;
+
+	git_oid_tostr(id, sizeof(id), &g_id);
+	git_oid_tostr(peel, sizeof(peel), &g_peel);
+
+	cl_git_pass(git_buf_puts(&contents, header));
+
+	for (i = 0; i < count; i++) {
+		n = reverse ? count - i - 1 : i;
+
+		cl_git_pass(git_buf_printf(&contents, "%s refs/tags/t%04d\n", id, (int)n));
+		if (n % 2)
+			cl_git_pass(git_buf_printf(&contents, "^%s\n", peel));
+	}
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), "refs/tags"));
+	cl_git_pass(git_futils_rmdir_r(path.ptr, NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(git_futils_mkdir_r(path.ptr, NULL, GIT_REFS_DIR_MODE));
+
+	git_buf_clear(&path);
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_git_rewritefile(path.ptr, contents.ptr);
+
+	git_buf_free(&contents);
+	git_buf_free(&path);
+}
+
+static void assert_tag(const char *name, bool peeled)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_s(name, git_reference_name(ref));
+	cl_assert_equal_oid(&g_id, git_reference_target(ref));
+
+	if (peeled)
+		cl_assert_equal_oid(&g_peel, git_reference_target_peel(ref));
+	else
+		cl_assert(git_reference_target_peel(ref) == NULL);
+
+	git_reference_free(ref);
+}
+
+static size_t count_glob(const char *glob)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		cl_assert(!p_fnmatch(glob, git_reference_name(ref), 0));
+		git_reference_free(ref);
+		count++;
+	}
+	cl_assert_equal_i(GIT_ITEROVER, error);
+
+	git_reference_iterator_free(iter);
+	return count;
+}
+
+void test_refs_packed__lookup_in_sorted_file(void)
+{
+	git_reference *ref;
+	char name[32];
+	int i;
+
+	write_packed_refs(SORTED_HEADER, 1000, false);
+
+	for (i = 0; i < 1000; i++) {
+		p_snprintf(name, sizeof(name), "refs/tags/t%04d", i);
+		assert_tag(name, i % 2);
+	}
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/t1000"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/t00"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/a"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/u"));
+}
+
+void test_refs_packed__unsorted_file_is_parsed_in_full(void)
+{
+	write_packed_refs("# pack-refs with: peeled fully-peeled \n", 100, true);
+
+	assert_tag("refs/tags/t0000", false);
+	assert_tag("refs/tags/t0051", true);
+	assert_tag("refs/tags/t0099", true);
+	cl_assert_equal_sz(100, count_glob("refs/tags/*"));
+}
+
+void test_refs_packed__glob_iteration(void)
+{
+	write_packed_refs(SORTED_HEADER, 1000, false);
+
+	cl_assert_equal_sz(1000, count_glob("refs/tags/*"));
+	cl_assert_equal_sz(100, count_glob("refs/tags/t05*"));
+	cl_assert_equal_sz(10, count_glob("refs/tags/t099?"));
+	cl_assert_equal_sz(1, count_glob("refs/tags/t0123"));
+	cl_assert_equal_sz(0, count_glob("refs/tags/u*"));
+	cl_assert_equal_sz(100, count_glob("refs/*/t0[4]*"));
+}
+
+void test_refs_packed__loose_refs_shadow_packed_ones(void)
+{
+	git_reference *ref;
+
+	write_packed_refs(SORTED_HEADER, 10, false);
+
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/tags/t0003", &g_peel, 1, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/tags/t0003a", &g_peel, 0, NULL));
+	git_reference_free(ref);
+
+	cl_assert_equal_sz(11, count_glob("refs/tags/*"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/t0003"));
+	cl_assert_equal_oid(&g_peel, git_reference_target(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_packed__paths_collide_with_packed_refs(void)
+{
+	git_reference *ref;
+
+	write_packed_refs(SORTED_HEADER, 10, false);
+
+	cl_git_fail(git_reference_create(&ref, g_repo,
+		"refs/tags/t0004/sub", &g_id, 0, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo,
+		"refs/tags", &g_id, 0, NULL));
+	cl_git_fail_with(GIT_EEXISTS, git_reference_create(&ref, g_repo,
+		"refs/tags/t0004", &g_id, 0, NULL));
+
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/tags/t0004-sub", &g_id, 0, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_packed__delete(void)
+{
+	git_reference *ref;
+
+	write_packed_refs(SORTED_HEADER, 10, false);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/t0005"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/t0005"));
+	cl_assert_equal_sz(9, count_glob("refs/tags/*"));
+	assert_tag("refs/tags/t0007", true);
+
+	/* the file is still sorted after it was rewritten */
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/tags/t0005", &g_id, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/t0005"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_packed__compress_writes_sorted_file(void)
+{
+	git_refdb *refdb;
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	size_t before;
+
+	before = count_glob("refs/*");
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), GIT_PACKEDREFS_FILE));
+	cl_git_pass(git_futils_readbuffer(&contents, path.ptr));
+	cl_assert(git__prefixcmp(contents.ptr, SORTED_HEADER) == 0);
+
+	cl_assert_equal_sz(before, count_glob("refs/*"));
+
+	git_buf_free(&path);
+	git_buf_free(&contents);
+}
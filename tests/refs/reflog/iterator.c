@@ -0,0 +1,150 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "reflog.h"
+
+static git_repository *g_repo;
+static git_reflog *g_reflog;
+
+void test_refs_reflog_iterator__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_reflog_read(&g_reflog, g_repo, "HEAD"));
+}
+
+void test_refs_reflog_iterator__cleanup(void)
+{
+	git_reflog_free(g_reflog);
+	g_reflog = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_entries_equal(const git_reflog_entry *expected, const git_reflog_entry *actual)
+{
+	cl_assert_equal_oid(git_reflog_entry_id_old(expected), git_reflog_entry_id_old(actual));
+	cl_assert_equal_oid(git_reflog_entry_id_new(expected), git_reflog_entry_id_new(actual));
+	cl_assert_equal_s(git_reflog_entry_message(expected), git_reflog_entry_message(actual));
+	cl_assert_equal_s(git_reflog_entry_committer(expected)->email, git_reflog_entry_committer(actual)->email);
+	cl_assert(git_reflog_entry_committer(expected)->when.time == git_reflog_entry_committer(actual)->when.time);
+}
+
+void test_refs_reflog_iterator__returns_the_newest_entries_first(void)
+{
+	git_reflog_iterator *iter;
+	const git_reflog_entry *entry;
+	size_t i = 0;
+	int error;
+
+	cl_git_pass(git_reflog_iterator_new(&iter, g_repo, "HEAD"));
+
+	while ((error = git_reflog_iterator_next(&entry, iter)) == 0)
+		assert_entries_equal(git_reflog_entry_byindex(g_reflog, i++), entry);
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_sz(git_reflog_entrycount(g_reflog), i);
+
+	git_reflog_iterator_free(iter);
+}
+
+void test_refs_reflog_iterator__entry_byindex(void)
+{
+	git_reflog_iterator *iter;
+	const git_reflog_entry *entry;
+	size_t count = git_reflog_entrycount(g_reflog);
+
+	cl_git_pass(git_reflog_iterator_new(&iter, g_repo, "HEAD"));
+
+	cl_git_pass(git_reflog_iterator_entry_byindex(&entry, iter, 3));
+	assert_entries_equal(git_reflog_entry_byindex(g_reflog, 3), entry);
+
+	/* it continues after the entry */
+	cl_git_pass(git_reflog_iterator_next(&entry, iter));
+	assert_entries_equal(git_reflog_entry_byindex(g_reflog, 4), entry);
+
+	cl_git_pass(git_reflog_iterator_entry_byindex(&entry, iter, 0));
+	assert_entries_equal(git_reflog_entry_byindex(g_reflog, 0), entry);
+
+	cl_git_pass(git_reflog_iterator_entry_byindex(&entry, iter, count - 1));
+	assert_entries_equal(git_reflog_entry_byindex(g_reflog, count - 1), entry);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reflog_iterator_entry_byindex(&entry, iter, count));
+
+	git_reflog_iterator_free(iter);
+}
+
+void test_refs_reflog_iterator__no_reflog(void)
+{
+	git_reflog_iterator *iter;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reflog_iterator_new(&iter, g_repo, "refs/heads/does-not-exist"));
+	cl_git_fail_with(GIT_ITEROVER, git_reflog_iterator_next(&entry, iter));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reflog_iterator_entry_byindex(&entry, iter, 0));
+	git_reflog_iterator_free(iter);
+}
+
+void test_refs_reflog_iterator__skips_an_incomplete_last_line(void)
+{
+	git_reflog_iterator *iter;
+	const git_reflog_entry *entry;
+
+	cl_git_append2file("testrepo.git/logs/HEAD",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 be3563ae3f795b2b4353bcce3a527ad0a4f7f644 Someone");
+
+	cl_git_pass(git_reflog_iterator_new(&iter, g_repo, "HEAD"));
+	cl_git_pass(git_reflog_iterator_next(&entry, iter));
+	assert_entries_equal(git_reflog_entry_byindex(g_reflog, 0), entry);
+	git_reflog_iterator_free(iter);
+}
+
+void test_refs_reflog_iterator__expire_by_count(void)
+{
+	git_reflog_expire_options opts = GIT_REFLOG_EXPIRE_OPTIONS_INIT;
+	git_reflog *reflog;
+	size_t i, removed, count = git_reflog_entrycount(g_reflog);
+
+	opts.max_entries = 3;
+	cl_git_pass(git_reflog_expire(&removed, g_repo, "HEAD", &opts));
+	cl_assert_equal_sz(count - 3, removed);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_sz(3, git_reflog_entrycount(reflog));
+
+	for (i = 0; i < 3; i++)
+		assert_entries_equal(git_reflog_entry_byindex(g_reflog, i),
+			git_reflog_entry_byindex(reflog, i));
+
+	git_reflog_free(reflog);
+
+	/* nothing left to remove */
+	cl_git_pass(git_reflog_expire(&removed, g_repo, "HEAD", &opts));
+	cl_assert_equal_sz(0, removed);
+}
+
+void test_refs_reflog_iterator__expire_by_time(void)
+{
+	git_reflog_expire_options opts = GIT_REFLOG_EXPIRE_OPTIONS_INIT;
+	git_reflog *reflog;
+	size_t removed;
+
+	/* the entries from 1335806563 to 1335806605 */
+	opts.expire_time = 1335806608;
+	cl_git_pass(git_reflog_expire(&removed, g_repo, "HEAD", &opts));
+	cl_assert_equal_sz(4, removed);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_sz(3, git_reflog_entrycount(reflog));
+	cl_assert(git_reflog_entry_committer(git_reflog_entry_byindex(reflog, 2))->when.time == 1335806608);
+	git_reflog_free(reflog);
+}
+
+void test_refs_reflog_iterator__expire_without_reflog(void)
+{
+	git_reflog_expire_options opts = GIT_REFLOG_EXPIRE_OPTIONS_INIT;
+	size_t removed = 42;
+
+	opts.max_entries = 1;
+	cl_git_pass(git_reflog_expire(&removed, g_repo, "refs/heads/does-not-exist", &opts));
+	cl_assert_equal_sz(0, removed);
+}
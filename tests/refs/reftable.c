@@ -0,0 +1,395 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "git2/refdb.h"
+#include "git2/sys/refdb_backend.h"
+#include "git2/sys/repository.h"
+#include "git2/transaction.h"
+#include "reftable.h"
+
+static git_repository *g_repo;
+static git_oid g_id, g_other;
+
+static void use_reftable(void)
+{
+	git_refdb *refdb;
+	git_refdb_backend *backend;
+
+	cl_git_pass(git_refdb_new(&refdb, g_repo));
+	cl_git_pass(git_refdb_backend_reftable(&backend, g_repo));
+	cl_git_pass(git_refdb_set_backend(refdb, backend));
+	git_repository_set_refdb(g_repo, refdb);
+	git_refdb_free(refdb);
+}
+
+void test_refs_reftable__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	use_reftable();
+
+	cl_git_pass(git_oid_fromstr(&g_id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&g_other, "e90810b8df3e80c413d903f631643c716887138d"));
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static size_t table_count(void)
+{
+	git_buf path = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	size_t i, count = 0;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(g_repo), "reftable/tables.list"));
+	cl_git_pass(git_futils_readbuffer(&list, path.ptr));
+
+	for (i = 0; i < list.size; i++)
+		count += (list.ptr[i] == '\n');
+
+	git_buf_free(&path);
+	git_buf_free(&list);
+	return count;
+}
+
+static size_t count_glob(const char *glob)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		git_reference_free(ref);
+		count++;
+	}
+	cl_assert_equal_i(GIT_ITEROVER, error);
+
+	git_reference_iterator_free(iter);
+	return count;
+}
+
+static void assert_target(const char *name, const git_oid *id)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_oid(id, git_reference_target(ref));
+	git_reference_free(ref);
+}
+
+static void create_tags(size_t count)
+{
+	git_transaction *tx;
+	char name[32];
+	size_t i;
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+
+	for (i = 0; i < count; i++) {
+		p_snprintf(name, sizeof(name), "refs/tags/t%05d", (int)i);
+		cl_git_pass(git_transaction_lock_ref(tx, name));
+		cl_git_pass(git_transaction_set_target(tx, name, &g_id, NULL, NULL));
+	}
+
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+}
+
+void test_refs_reftable__write_lookup_and_delete(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/one", &g_id, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_symbolic_create(&ref, g_repo, "refs/heads/sym", "refs/heads/one", 0, NULL));
+	git_reference_free(ref);
+
+	assert_target("refs/heads/one", &g_id);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/sym"));
+	cl_assert_equal_i(GIT_REF_SYMBOLIC, git_reference_type(ref));
+	cl_assert_equal_s("refs/heads/one", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/one", &g_other, 0, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/one/two", &g_id, 0, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &g_id, 0, NULL));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/one", &g_other, 1, NULL));
+	git_reference_free(ref);
+	assert_target("refs/heads/one", &g_other);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/one"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/one"));
+	cl_assert_equal_sz(1, count_glob("refs/*"));
+}
+
+void test_refs_reftable__rename(void)
+{
+	git_reference *ref, *renamed;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/old", &g_id, 0, NULL));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/new", 0, NULL));
+	git_reference_free(ref);
+	git_reference_free(renamed);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/old"));
+	assert_target("refs/heads/new", &g_id);
+}
+
+void test_refs_reftable__many_references(void)
+{
+	git_refdb *refdb;
+	git_reference *ref;
+	char name[32];
+	int i;
+
+	create_tags(3000);
+
+	/* all the references went into a single table with an index */
+	cl_assert_equal_sz(1, table_count());
+
+	for (i = 0; i < 3000; i += 7) {
+		p_snprintf(name, sizeof(name), "refs/tags/t%05d", i);
+		assert_target(name, &g_id);
+	}
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/tags/t03000"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/tags/a"));
+
+	cl_assert_equal_sz(3000, count_glob("refs/tags/*"));
+	cl_assert_equal_sz(100, count_glob("refs/tags/t012*"));
+	cl_assert_equal_sz(10, count_glob("refs/*/t0299?"));
+
+	/* another backend reads the same tables */
+	use_reftable();
+	assert_target("refs/tags/t02999", &g_id);
+	cl_assert_equal_sz(3000, count_glob("refs/*"));
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+	cl_assert_equal_sz(3000, count_glob("refs/*"));
+}
+
+void test_refs_reftable__stack_stays_small(void)
+{
+	git_refdb *refdb;
+	git_reference *ref;
+	char name[32];
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/b%03d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &g_id, 0, NULL));
+		git_reference_free(ref);
+
+		cl_assert(table_count() <= 8);
+	}
+
+	for (i = 0; i < 100; i += 2) {
+		p_snprintf(name, sizeof(name), "refs/heads/b%03d", i);
+		cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+		cl_git_pass(git_reference_delete(ref));
+		git_reference_free(ref);
+	}
+
+	cl_assert_equal_sz(50, count_glob("refs/heads/*"));
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	cl_assert_equal_sz(1, table_count());
+	cl_assert_equal_sz(50, count_glob("refs/heads/*"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/b000"));
+	assert_target("refs/heads/b001", &g_id);
+}
+
+void test_refs_reftable__transactions_are_atomic(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	size_t before;
+
+	create_tags(1);
+	before = table_count();
+
+	/* removing a reference which does not exist fails the whole commit */
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/a"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/b"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/a", &g_id, NULL, NULL));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/b"));
+	cl_git_fail(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/a"));
+	cl_assert_equal_sz(before, table_count());
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/a"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/tags/t00000"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/a", &g_id, NULL, NULL));
+	cl_git_pass(git_transaction_remove(tx, "refs/tags/t00000"));
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_target("refs/heads/a", &g_id);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/tags/t00000"));
+}
+
+void test_refs_reftable__writes_outside_a_transaction_do_not_join_it(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	size_t before;
+
+	create_tags(1);
+	before = table_count();
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/a"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/b"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/a", &g_id, NULL, NULL));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/b"));
+
+	/* the transaction holds the stack, so nothing is written behind it */
+	cl_git_fail_with(GIT_ELOCKED, git_reference_create(&ref, g_repo, "refs/heads/direct", &g_other, 0, NULL));
+	cl_git_fail_with(GIT_ELOCKED, git_reference_remove(g_repo, "refs/tags/t00000"));
+
+	cl_git_fail(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/a"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/direct"));
+	assert_target("refs/tags/t00000", &g_id);
+	cl_assert_equal_sz(before, table_count());
+
+	/* and once it is over, they are committed right away */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/direct", &g_other, 0, NULL));
+	git_reference_free(ref);
+
+	assert_target("refs/heads/direct", &g_other);
+}
+
+void test_refs_reftable__reflogs(void)
+{
+	git_reference *ref, *renamed;
+	git_reflog *reflog;
+	git_signature *sig;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &g_id, 0, "first"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &g_other, 1, "second"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(2, git_reflog_entrycount(reflog));
+
+	entry = git_reflog_entry_byindex(reflog, 0);
+	cl_assert_equal_s("second", git_reflog_entry_message(entry));
+	cl_assert_equal_oid(&g_id, git_reflog_entry_id_old(entry));
+	cl_assert_equal_oid(&g_other, git_reflog_entry_id_new(entry));
+
+	entry = git_reflog_entry_byindex(reflog, 1);
+	cl_assert_equal_s("first", git_reflog_entry_message(entry));
+	cl_assert(git_oid_iszero(git_reflog_entry_id_old(entry)));
+
+	/* appending and writing it back keeps the order */
+	cl_git_pass(git_signature_new(&sig, "Some One", "one@example.com", 1234567890, 60));
+	cl_git_pass(git_reflog_append(reflog, &g_id, sig, "third"));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(3, git_reflog_entrycount(reflog));
+	entry = git_reflog_entry_byindex(reflog, 0);
+	cl_assert_equal_s("third", git_reflog_entry_message(entry));
+	cl_assert_equal_s("Some One", git_reflog_entry_committer(entry)->name);
+	cl_assert_equal_i(60, git_reflog_entry_committer(entry)->when.offset);
+	cl_assert_equal_s("first", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 2)));
+
+	/* dropping entries removes them from the tables too */
+	cl_git_pass(git_reflog_drop(reflog, 0, 1));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(2, git_reflog_entrycount(reflog));
+	git_reflog_free(reflog);
+
+	/* the log moves along with the reference */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/logged"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/moved", 0, "moving"));
+	git_reference_free(ref);
+	git_reference_free(renamed);
+
+	cl_assert(!git_reference_has_log(g_repo, "refs/heads/logged"));
+	cl_assert(git_reference_has_log(g_repo, "refs/heads/moved"));
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/moved"));
+	cl_assert_equal_sz(3, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("moving", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_delete(g_repo, "refs/heads/moved"));
+	cl_assert(!git_reference_has_log(g_repo, "refs/heads/moved"));
+
+	git_signature_free(sig);
+}
+
+void test_refs_reftable__ensure_log(void)
+{
+	git_reflog *reflog;
+
+	cl_assert(!git_reference_has_log(g_repo, "refs/tags/logged"));
+	cl_git_pass(git_reference_ensure_log(g_repo, "refs/tags/logged"));
+	cl_assert(git_reference_has_log(g_repo, "refs/tags/logged"));
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/tags/logged"));
+	cl_assert_equal_sz(0, git_reflog_entrycount(reflog));
+	git_reflog_free(reflog);
+}
+
+void test_refs_reftable__reflog_iterator_and_expire(void)
+{
+	git_reference *ref;
+	git_reflog_iterator *iter;
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+	git_reflog_expire_options opts = GIT_REFLOG_EXPIRE_OPTIONS_INIT;
+	size_t removed;
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &g_id, 0, "first"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &g_other, 1, "second"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &g_id, 1, "third"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reflog_iterator_new(&iter, g_repo, "refs/heads/logged"));
+	cl_git_pass(git_reflog_iterator_next(&entry, iter));
+	cl_assert_equal_s("third", git_reflog_entry_message(entry));
+	cl_git_pass(git_reflog_iterator_entry_byindex(&entry, iter, 2));
+	cl_assert_equal_s("first", git_reflog_entry_message(entry));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reflog_iterator_entry_byindex(&entry, iter, 3));
+	git_reflog_iterator_free(iter);
+
+	opts.max_entries = 1;
+	cl_git_pass(git_reflog_expire(&removed, g_repo, "refs/heads/logged", &opts));
+	cl_assert_equal_sz(2, removed);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(1, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("third", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+}
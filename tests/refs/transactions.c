@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "git2/transaction.h"
+#include "fileops.h"
 
 static git_repository *g_repo;
 static git_transaction *g_tx;
@@ -108,3 +109,176 @@ void test_refs_transactions__unlocked_set(void)
 	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_set_target(g_tx, "refs/heads/foo", &id, NULL, NULL));
 	cl_git_pass(git_transaction_commit(g_tx));
 }
+
+void test_refs_transactions__delete_many_packed(void)
+{
+	git_reference *ref;
+	git_buf packed = GIT_BUF_INIT;
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed-test"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed-test"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/br2"));
+
+	/* nothing is removed until the last reference is unlocked */
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed-test"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/packed-test"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/br2"));
+
+	cl_git_pass(git_futils_readbuffer(&packed, "testrepo/.git/packed-refs"));
+	cl_assert(strstr(packed.ptr, "refs/heads/packed\n") == NULL);
+	cl_assert(strstr(packed.ptr, "refs/tags/packed-tag") != NULL);
+	git_buf_free(&packed);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/packed-tag"));
+	git_reference_free(ref);
+}
+
+void test_refs_transactions__delete_loose_keeps_unsorted_packed(void)
+{
+	git_reference *ref;
+	git_buf before = GIT_BUF_INIT, after = GIT_BUF_INIT;
+
+	/* the fixture's packed-refs is not sorted, so it has to be loaded */
+	cl_git_pass(git_futils_readbuffer(&before, "testrepo/.git/packed-refs"));
+	cl_assert(strstr(before.ptr, " sorted") == NULL);
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+
+	/* br2 was only loose; packed-refs is not rewritten */
+	cl_git_pass(git_futils_readbuffer(&after, "testrepo/.git/packed-refs"));
+	cl_assert_equal_s(before.ptr, after.ptr);
+
+	git_buf_free(&before);
+	git_buf_free(&after);
+}
+
+void test_refs_transactions__write_packed(void)
+{
+	git_reference *ref;
+	git_reflog *reflog;
+	git_buf packed = GIT_BUF_INIT;
+	git_oid id;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	cl_git_pass(git_transaction_set_packed(g_tx, true));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/new-branch"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, "master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/new-branch", &id, NULL, "new"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/master"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/new-branch"));
+
+	cl_git_pass(git_futils_readbuffer(&packed, "testrepo/.git/packed-refs"));
+	cl_assert(strstr(packed.ptr, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/master\n") != NULL);
+	cl_assert(strstr(packed.ptr, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/new-branch\n") != NULL);
+	cl_assert(strstr(packed.ptr, "refs/heads/packed\n") == NULL);
+	git_buf_free(&packed);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	/* the reflogs were appended once the references were unlocked */
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/new-branch"));
+	cl_assert_equal_i(1, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("new", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_i(1, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("master", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+}
+
+void test_refs_transactions__write_packed_keeps_symbolic_loose(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_transaction_set_packed(g_tx, true));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/sym"));
+	cl_git_pass(git_transaction_set_symbolic_target(g_tx, "refs/heads/sym", "refs/heads/master", NULL, NULL));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_assert(git_path_isfile("testrepo/.git/refs/heads/sym"));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/sym"));
+	cl_assert_equal_s("refs/heads/master", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_transactions__commit_applies_while_another_is_open(void)
+{
+	git_transaction *other;
+	git_buf contents = GIT_BUF_INIT;
+	git_oid id;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	cl_git_pass(git_transaction_new(&other, g_repo));
+	cl_git_pass(git_transaction_lock_ref(other, "refs/heads/test"));
+	cl_git_pass(git_transaction_set_target(other, "refs/heads/test", &id, NULL, NULL));
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, NULL));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	/* on disk and unlocked, while the other one still holds its lock */
+	cl_git_pass(git_futils_readbuffer(&contents, "testrepo/.git/refs/heads/master"));
+	cl_assert_equal_s("a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n", contents.ptr);
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/master.lock"));
+	cl_assert(git_path_exists("testrepo/.git/refs/heads/test.lock"));
+
+	cl_git_pass(git_transaction_commit(other));
+	git_transaction_free(other);
+
+	git_buf_clear(&contents);
+	cl_git_pass(git_futils_readbuffer(&contents, "testrepo/.git/refs/heads/test"));
+	cl_assert_equal_s("a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n", contents.ptr);
+	git_buf_free(&contents);
+}
+
+void test_refs_transactions__failed_commit_drops_the_updates(void)
+{
+	static const char *names[] = {
+		"refs/heads/master", "refs/heads/br2", "refs/heads/test", "refs/heads/subtrees"
+	};
+	git_reference *ref;
+	git_oid id;
+	size_t i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		cl_git_pass(git_transaction_lock_ref(g_tx, names[i]));
+		cl_git_pass(git_transaction_set_target(g_tx, names[i], &id, NULL, NULL));
+	}
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/missing"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/missing"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_commit(g_tx));
+
+	/* nothing queued before the failure is written when it is freed */
+	git_transaction_free(g_tx);
+	cl_git_pass(git_transaction_new(&g_tx, g_repo));
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		cl_git_pass(git_reference_lookup(&ref, g_repo, names[i]));
+		cl_assert(git_oid_cmp(&id, git_reference_target(ref)));
+		git_reference_free(ref);
+	}
+}
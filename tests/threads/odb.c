@@ -0,0 +1,72 @@
+#include "clar_libgit2.h"
+
+#include "thread_helpers.h"
+#include "array.h"
+
+static git_repository *g_repo;
+static git_odb *g_odb;
+static git_array_t(git_oid) g_ids;
+static size_t g_window_size, g_mapped_limit;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out;
+
+	GIT_UNUSED(payload);
+
+	out = git_array_alloc(g_ids);
+	GITERR_CHECK_ALLOC(out);
+
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_threads_odb__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &g_mapped_limit));
+
+	/* tiny windows, so the threads keep mapping and closing them */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)16384));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)65536));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0));
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&g_odb, g_repo));
+	cl_git_pass(git_odb_foreach(g_odb, collect_id, NULL));
+}
+
+void test_threads_odb__cleanup(void)
+{
+	git_array_clear(g_ids);
+	git_odb_free(g_odb);
+	git_repository_free(g_repo);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, g_mapped_limit));
+}
+
+static void *read_objects(void *arg)
+{
+	size_t i, n = git_array_size(g_ids), start = *(int *)arg;
+	git_odb_object *obj;
+
+	/* every thread starts somewhere else and goes through all objects */
+	for (i = 0; i < n; i++) {
+		git_oid *id = git_array_get(g_ids, (start * 7 + i) % n);
+
+		cl_git_pass(git_odb_read(&obj, g_odb, id));
+		cl_assert(git_oid_equal(id, git_odb_object_id(obj)));
+		git_odb_object_free(obj);
+	}
+
+	return arg;
+}
+
+void test_threads_odb__concurrent_reads(void)
+{
+	cl_assert(git_array_size(g_ids) > 0);
+
+	run_in_parallel(5, 16, read_objects, NULL, NULL);
+}